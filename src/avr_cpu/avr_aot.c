@@ -0,0 +1,880 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_aot.c
+
+  \brief Ahead-of-time translation of firmware images into C.
+
+  AVR_AOT_Emit() walks the program loaded into ROM by recursive descent,
+  starting from the reset/interrupt vectors, the targets of every call found
+  along the way, and any function symbols loaded from an ELF file.  Code is
+  divided into functions (call targets) and basic blocks (branch targets,
+  and the instructions following branches, calls and skips).  Each function
+  is written out as a C function, with each basic block as a label that can
+  be entered directly.
+
+  Register-only arithmetic, logic, moves and branches are translated into
+  straight-line C operating on the AVR register file.  Everything else (I/O,
+  memory, stack, skips, etc.) calls back into the interpreter for a single
+  instruction.  Indirect jumps, calls and returns always leave translated
+  code, and execution resumes in the interpreter until the PC lands on the
+  start of a known basic block again.
+
+  As with the JIT, each instruction is retired individually, so that
+  peripheral clocking and interrupt timing is identical to the interpreter.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <dlfcn.h>
+
+#include "emu_config.h"
+
+#include "avr_cpu.h"
+#include "avr_io.h"
+#include "avr_interrupt.h"
+#include "avr_opcodes.h"
+#include "avr_op_decode.h"
+#include "avr_op_size.h"
+#include "avr_op_cycles.h"
+#include "avr_disasm.h"
+#include "avr_aot.h"
+#include "avr_idle_loop.h"
+#include "avr_hle.h"
+#include "avr_aot_if.h"
+#include "debug_sym.h"
+
+#if FEATURE_USE_AOT
+
+_Static_assert( offsetof(AVRRegisterFile, SREG) == AVR_AOT_SREG,
+                "AVR_AOT_SREG doesn't match the register file layout" );
+
+//---------------------------------------------------------------------------
+/*!
+    Analysis results for a single ROM word.
+*/
+typedef struct
+{
+    uint16_t    u16OP;          //!< First opcode word
+    uint8_t     u8Index;        //!< Opcode function index (see AVR_Opcode_Index())
+    uint8_t     u8Size;         //!< Size of the instruction, in words
+    uint8_t     u8Cycles;       //!< Minimum number of cycles to execute the instruction
+    uint8_t     u8Rd;           //!< Register file offset of Rd (or Rd16)
+    uint8_t     u8Rr;           //!< Register file offset of Rr (or Rr16)
+    uint8_t     u8b;            //!< Bit index operand
+    uint16_t    u16K;           //!< Immediate operand
+    uint32_t    u32Target;      //!< Branch/jump/call target address
+    uint32_t    u32Function;    //!< Index + 1 of the function owning this word (0 = unreached)
+    bool        bLeader;        //!< Word starts a basic block
+} AOT_Insn_t;
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE AOT_Insn_t  *pstInsns = NULL;        //!< Analysis results, indexed by ROM word
+static EMU_INSTANCE uint32_t     u32Words = 0;           //!< Number of ROM words analyzed
+
+static EMU_INSTANCE uint32_t    *pu32Functions = NULL;   //!< Function entry addresses
+static EMU_INSTANCE uint32_t     u32FunctionCount = 0;
+static EMU_INSTANCE uint32_t     u32FunctionSize = 0;
+
+static EMU_INSTANCE uint32_t    *pu32Work = NULL;        //!< Addresses waiting to be walked
+static EMU_INSTANCE uint32_t     u32WorkCount = 0;
+static EMU_INSTANCE uint32_t     u32WorkSize = 0;
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE AVR_AOT_Function    *apfEntries = NULL;      //!< Translated entry points, indexed by ROM word
+static EMU_INSTANCE uint32_t             u32EntryWords = 0;
+static EMU_INSTANCE uint32_t             u32Budget;              //!< Instructions remaining in the current run
+static EMU_INSTANCE AVR_AOT_Interface_t  stInterface;
+
+//---------------------------------------------------------------------------
+static uint32_t AOT_ROMHash( void )
+{
+    // 32-bit FNV-1a over the contents of ROM
+    uint32_t u32Hash = 2166136261u;
+    uint32_t i;
+    const uint8_t *pu8ROM = (const uint8_t*)stCPU.pu16ROM;
+
+    for (i = 0; i < stCPU.u32ROMSize; i++)
+    {
+        u32Hash ^= pu8ROM[i];
+        u32Hash *= 16777619u;
+    }
+    return u32Hash;
+}
+
+//---------------------------------------------------------------------------
+static void AOT_Push( uint32_t **ppu32List_, uint32_t *pu32Count_, uint32_t *pu32Size_,
+                      uint32_t u32Val_ )
+{
+    if (*pu32Count_ == *pu32Size_)
+    {
+        *pu32Size_ = *pu32Size_ ? (*pu32Size_ * 2) : 256;
+        *ppu32List_ = (uint32_t*)realloc( *ppu32List_, *pu32Size_ * sizeof(uint32_t) );
+        if (!*ppu32List_)
+        {
+            fprintf( stderr, "Unable to allocate AOT analysis data\n" );
+            exit(-1);
+        }
+    }
+    (*ppu32List_)[ (*pu32Count_)++ ] = u32Val_;
+}
+
+//---------------------------------------------------------------------------
+static void AOT_AddFunction( uint32_t u32Addr_ )
+{
+    uint32_t i;
+    if (u32Addr_ >= u32Words)
+    {
+        return;
+    }
+    for (i = 0; i < u32FunctionCount; i++)
+    {
+        if (pu32Functions[i] == u32Addr_)
+        {
+            return;
+        }
+    }
+    pstInsns[ u32Addr_ ].bLeader = true;
+    AOT_Push( &pu32Functions, &u32FunctionCount, &u32FunctionSize, u32Addr_ );
+}
+
+//---------------------------------------------------------------------------
+static void AOT_AddBlock( uint32_t u32Addr_ )
+{
+    if (u32Addr_ >= u32Words)
+    {
+        return;
+    }
+    pstInsns[ u32Addr_ ].bLeader = true;
+    AOT_Push( &pu32Work, &u32WorkCount, &u32WorkSize, u32Addr_ );
+}
+
+//---------------------------------------------------------------------------
+static void AOT_Decode( uint32_t u32Addr_ )
+{
+    AOT_Insn_t *pstInsn = &pstInsns[ u32Addr_ ];
+    uintptr_t uRAM = (uintptr_t)stCPU.pstRAM->au8RAM;
+    uint16_t OP;
+
+    // Fetch exactly what the interpreter would see at this address
+    stCPU.u32PC = u32Addr_;
+    OP = CPU_Fetch();
+
+    pstInsn->u16OP      = OP;
+    pstInsn->u8Size     = AVR_Opcode_Size( OP );
+    pstInsn->u8Cycles   = AVR_Opcode_Cycles( OP );
+    pstInsn->u8Index    = AVR_Opcode_Index( AVR_Opcode_Function( OP ) );
+
+    if ((u32Addr_ + pstInsn->u8Size) > u32Words)
+    {
+        pstInsn->u8Index = AVR_OPCODE_INDEX_INVALID;
+        return;
+    }
+
+    AVR_Decode( OP );
+
+    switch (pstInsn->u8Index)
+    {
+        case AVR_OPCODE_INDEX_MOVW:
+            pstInsn->u8Rd = (uint8_t)((uintptr_t)stCPU.Rd16 - uRAM);
+            pstInsn->u8Rr = (uint8_t)((uintptr_t)stCPU.Rr16 - uRAM);
+            break;
+        case AVR_OPCODE_INDEX_ADIW:
+        case AVR_OPCODE_INDEX_SBIW:
+            pstInsn->u8Rd = (uint8_t)((uintptr_t)stCPU.Rd16 - uRAM);
+            break;
+        default:
+            pstInsn->u8Rd = (uint8_t)((uintptr_t)stCPU.Rd - uRAM);
+            pstInsn->u8Rr = (uint8_t)((uintptr_t)stCPU.Rr - uRAM);
+            break;
+    }
+    pstInsn->u8b  = stCPU.b;
+    pstInsn->u16K = stCPU.K;
+
+    switch (pstInsn->u8Index)
+    {
+        case AVR_OPCODE_INDEX_JMP:
+        case AVR_OPCODE_INDEX_CALL:
+            pstInsn->u32Target = stCPU.k & stCPU.u32PCMask;
+            break;
+        default:
+            pstInsn->u32Target = (uint32_t)((int32_t)u32Addr_ + stCPU.k_s + 1) & stCPU.u32PCMask;
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Return the SREG bit tested by a conditional branch, and whether the branch
+    is taken when that bit is set.  Returns 0 if the opcode isn't a
+    conditional branch.
+*/
+static uint8_t AOT_BranchFlag( uint8_t u8Index_, bool *pbTakenIfSet_ )
+{
+    switch (u8Index_)
+    {
+        case AVR_OPCODE_INDEX_BREQ: *pbTakenIfSet_ = true;  return 0x02;
+        case AVR_OPCODE_INDEX_BRNE: *pbTakenIfSet_ = false; return 0x02;
+        case AVR_OPCODE_INDEX_BRCS: *pbTakenIfSet_ = true;  return 0x01;
+        case AVR_OPCODE_INDEX_BRLO: *pbTakenIfSet_ = true;  return 0x01;
+        case AVR_OPCODE_INDEX_BRCC: *pbTakenIfSet_ = false; return 0x01;
+        case AVR_OPCODE_INDEX_BRSH: *pbTakenIfSet_ = false; return 0x01;
+        case AVR_OPCODE_INDEX_BRMI: *pbTakenIfSet_ = true;  return 0x04;
+        case AVR_OPCODE_INDEX_BRPL: *pbTakenIfSet_ = false; return 0x04;
+        case AVR_OPCODE_INDEX_BRLT: *pbTakenIfSet_ = true;  return 0x10;
+        case AVR_OPCODE_INDEX_BRGE: *pbTakenIfSet_ = false; return 0x10;
+        case AVR_OPCODE_INDEX_BRHC: *pbTakenIfSet_ = false; return 0x20;
+        case AVR_OPCODE_INDEX_BRTS: *pbTakenIfSet_ = true;  return 0x40;
+        case AVR_OPCODE_INDEX_BRTC: *pbTakenIfSet_ = false; return 0x40;
+        case AVR_OPCODE_INDEX_BRVS: *pbTakenIfSet_ = true;  return 0x08;
+        case AVR_OPCODE_INDEX_BRVC: *pbTakenIfSet_ = false; return 0x08;
+        case AVR_OPCODE_INDEX_BRIE: *pbTakenIfSet_ = true;  return 0x80;
+        case AVR_OPCODE_INDEX_BRID: *pbTakenIfSet_ = false; return 0x80;
+        default:
+            break;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+static bool AOT_IsSkip( uint8_t u8Index_ )
+{
+    return ((u8Index_ == AVR_OPCODE_INDEX_CPSE) ||
+            (u8Index_ == AVR_OPCODE_INDEX_SBRC) ||
+            (u8Index_ == AVR_OPCODE_INDEX_SBRS) ||
+            (u8Index_ == AVR_OPCODE_INDEX_SBIC) ||
+            (u8Index_ == AVR_OPCODE_INDEX_SBIS));
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Walk all code reachable from a function's entry point without following
+    calls (which become functions of their own).
+*/
+static void AOT_WalkFunction( uint32_t u32Function_ )
+{
+    AOT_AddBlock( pu32Functions[ u32Function_ ] );
+
+    while (u32WorkCount)
+    {
+        uint32_t u32Addr = pu32Work[ --u32WorkCount ];
+
+        while (u32Addr < u32Words)
+        {
+            AOT_Insn_t *pstInsn = &pstInsns[ u32Addr ];
+            uint32_t u32Next;
+            bool bTakenIfSet;
+
+            if (pstInsn->u32Function)
+            {
+                // Already walked - falling or jumping into it starts a block
+                pstInsn->bLeader = true;
+                break;
+            }
+
+            AOT_Decode( u32Addr );
+            pstInsn->u32Function = u32Function_ + 1;
+            if (pstInsn->u8Index == AVR_OPCODE_INDEX_INVALID)
+            {
+                break;
+            }
+
+            u32Next = u32Addr + pstInsn->u8Size;
+
+            if (AOT_BranchFlag( pstInsn->u8Index, &bTakenIfSet ))
+            {
+                AOT_AddBlock( pstInsn->u32Target );
+                AOT_AddBlock( u32Next );
+                break;
+            }
+
+            switch (pstInsn->u8Index)
+            {
+                case AVR_OPCODE_INDEX_RJMP:
+                case AVR_OPCODE_INDEX_JMP:
+                    AOT_AddBlock( pstInsn->u32Target );
+                    u32Next = u32Words;
+                    break;
+
+                case AVR_OPCODE_INDEX_RCALL:
+                case AVR_OPCODE_INDEX_CALL:
+                    AOT_AddFunction( pstInsn->u32Target );
+                    AOT_AddBlock( u32Next );
+                    u32Next = u32Words;
+                    break;
+
+                case AVR_OPCODE_INDEX_ICALL:
+                case AVR_OPCODE_INDEX_EICALL:
+                case AVR_OPCODE_INDEX_SLEEP:
+                case AVR_OPCODE_INDEX_BREAK:
+                    AOT_AddBlock( u32Next );
+                    u32Next = u32Words;
+                    break;
+
+                case AVR_OPCODE_INDEX_IJMP:
+                case AVR_OPCODE_INDEX_EIJMP:
+                case AVR_OPCODE_INDEX_RET:
+                case AVR_OPCODE_INDEX_RETI:
+                    // Indirect - targets are resolved at runtime
+                    u32Next = u32Words;
+                    break;
+
+                default:
+                    if (AOT_IsSkip( pstInsn->u8Index ) && (u32Next < u32Words))
+                    {
+                        // Both the next instruction and the one after are reachable
+                        stCPU.u32PC = u32Next;
+                        AOT_AddBlock( u32Next + AVR_Opcode_Size( CPU_Fetch() ) );
+                        AOT_AddBlock( u32Next );
+                        u32Next = u32Words;
+                    }
+                    break;
+            }
+            u32Addr = u32Next;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void AOT_Analyze( void )
+{
+    uint32_t i;
+    uint32_t u32Addr = 0;
+
+    u32Words = stCPU.u32ROMSize / sizeof(uint16_t);
+    free( pstInsns );
+    pstInsns = (AOT_Insn_t*)calloc( u32Words, sizeof(AOT_Insn_t) );
+    if (!pstInsns)
+    {
+        fprintf( stderr, "Unable to allocate AOT analysis data\n" );
+        exit(-1);
+    }
+
+    // The vector table is a run of jumps starting at the reset vector
+    while (u32Addr < u32Words)
+    {
+        AOT_Decode( u32Addr );
+        if ((pstInsns[ u32Addr ].u8Index != AVR_OPCODE_INDEX_JMP) &&
+            (pstInsns[ u32Addr ].u8Index != AVR_OPCODE_INDEX_RJMP))
+        {
+            break;
+        }
+        AOT_AddFunction( u32Addr );
+        u32Addr += pstInsns[ u32Addr ].u8Size;
+    }
+    AOT_AddFunction( 0 );
+
+    // Functions from the ELF symbol table, if available
+    for (i = 0; i < Symbol_Get_Func_Count(); i++)
+    {
+        AOT_AddFunction( Symbol_Func_At_Index( i )->u32StartAddr );
+    }
+
+    // Walk each function in turn - new functions are discovered as we go.
+    for (i = 0; i < u32FunctionCount; i++)
+    {
+        AOT_WalkFunction( i );
+    }
+}
+
+//---------------------------------------------------------------------------
+static void AOT_EmitComment( FILE *fp_, uint32_t u32Addr_ )
+{
+    char szBuf[256];
+    char *pcEnd;
+
+    stCPU.u32PC = u32Addr_;
+    AVR_Decode( pstInsns[ u32Addr_ ].u16OP );
+    AVR_Disasm_Function( pstInsns[ u32Addr_ ].u16OP )( szBuf );
+
+    // Keep only the instruction text, not the trailing description
+    pcEnd = strpbrk( szBuf, "\t\n" );
+    if (pcEnd)
+    {
+        *pcEnd = '\0';
+    }
+    pcEnd = szBuf + strlen( szBuf );
+    while ((pcEnd > szBuf) && (pcEnd[-1] == ' '))
+    {
+        *--pcEnd = '\0';
+    }
+    fprintf( fp_, "    // 0x%05X: %s\n", u32Addr_, szBuf );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Write the C statement(s) for a register-only instruction.  Returns false
+    if the instruction has no native translation.
+*/
+static bool AOT_EmitNative( FILE *fp_, const AOT_Insn_t *pstInsn_ )
+{
+    uint8_t d = pstInsn_->u8Rd;
+    uint8_t s = pstInsn_->u8Rr;
+    uint8_t K = (uint8_t)pstInsn_->u16K;
+
+    switch (pstInsn_->u8Index)
+    {
+        case AVR_OPCODE_INDEX_NOP:
+            break;
+        case AVR_OPCODE_INDEX_MOV:
+            fprintf( fp_, "    r[%u] = r[%u];\n", d, s );
+            break;
+        case AVR_OPCODE_INDEX_MOVW:
+            fprintf( fp_, "    r[%u] = r[%u]; r[%u] = r[%u];\n", d, s, d + 1, s + 1 );
+            break;
+        case AVR_OPCODE_INDEX_LDI:
+            fprintf( fp_, "    r[%u] = 0x%02X;\n", d, K );
+            break;
+        case AVR_OPCODE_INDEX_SER:
+            fprintf( fp_, "    r[%u] = 0xFF;\n", d );
+            break;
+        case AVR_OPCODE_INDEX_SWAP:
+            fprintf( fp_, "    r[%u] = (uint8_t)((r[%u] >> 4) | (r[%u] << 4));\n", d, d, d );
+            break;
+        case AVR_OPCODE_INDEX_ADD:
+            fprintf( fp_, "    r[%u] = AOT_Add( r, r[%u], r[%u], 0 );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_ADC:
+            fprintf( fp_, "    r[%u] = AOT_Add( r, r[%u], r[%u], r[AVR_AOT_SREG] & 1 );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_SUB:
+            fprintf( fp_, "    r[%u] = AOT_Sub( r, r[%u], r[%u], 0, false );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_SUBI:
+            fprintf( fp_, "    r[%u] = AOT_Sub( r, r[%u], 0x%02X, 0, false );\n", d, d, K );
+            break;
+        case AVR_OPCODE_INDEX_SBC:
+            fprintf( fp_, "    r[%u] = AOT_Sub( r, r[%u], r[%u], r[AVR_AOT_SREG] & 1, true );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_SBCI:
+            fprintf( fp_, "    r[%u] = AOT_Sub( r, r[%u], 0x%02X, r[AVR_AOT_SREG] & 1, true );\n", d, d, K );
+            break;
+        case AVR_OPCODE_INDEX_CP:
+            fprintf( fp_, "    AOT_Sub( r, r[%u], r[%u], 0, false );\n", d, s );
+            break;
+        case AVR_OPCODE_INDEX_CPC:
+            fprintf( fp_, "    AOT_Sub( r, r[%u], r[%u], r[AVR_AOT_SREG] & 1, true );\n", d, s );
+            break;
+        case AVR_OPCODE_INDEX_CPI:
+            fprintf( fp_, "    AOT_Sub( r, r[%u], 0x%02X, 0, false );\n", d, K );
+            break;
+        case AVR_OPCODE_INDEX_ADIW:
+            fprintf( fp_, "    AOT_Word( r, %u, %u, false );\n", d, pstInsn_->u16K );
+            break;
+        case AVR_OPCODE_INDEX_SBIW:
+            fprintf( fp_, "    AOT_Word( r, %u, %u, true );\n", d, pstInsn_->u16K );
+            break;
+        case AVR_OPCODE_INDEX_AND:
+            fprintf( fp_, "    r[%u] = AOT_Logic( r, r[%u] & r[%u] );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_ANDI:
+            fprintf( fp_, "    r[%u] = AOT_Logic( r, r[%u] & 0x%02X );\n", d, d, K );
+            break;
+        case AVR_OPCODE_INDEX_OR:
+            fprintf( fp_, "    r[%u] = AOT_Logic( r, r[%u] | r[%u] );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_ORI:
+        case AVR_OPCODE_INDEX_SBR:
+            fprintf( fp_, "    r[%u] = AOT_Logic( r, r[%u] | 0x%02X );\n", d, d, K );
+            break;
+        case AVR_OPCODE_INDEX_EOR:
+            fprintf( fp_, "    r[%u] = AOT_Logic( r, r[%u] ^ r[%u] );\n", d, d, s );
+            break;
+        case AVR_OPCODE_INDEX_COM:
+            fprintf( fp_, "    r[%u] = AOT_Com( r, r[%u] );\n", d, d );
+            break;
+        case AVR_OPCODE_INDEX_NEG:
+            fprintf( fp_, "    r[%u] = AOT_Neg( r, r[%u] );\n", d, d );
+            break;
+        case AVR_OPCODE_INDEX_INC:
+            fprintf( fp_, "    r[%u] = AOT_Inc( r, r[%u] );\n", d, d );
+            break;
+        case AVR_OPCODE_INDEX_DEC:
+            fprintf( fp_, "    r[%u] = AOT_Dec( r, r[%u] );\n", d, d );
+            break;
+        case AVR_OPCODE_INDEX_LSR:
+            fprintf( fp_, "    r[%u] = AOT_Shift( r, r[%u] >> 1, r[%u] & 1 );\n", d, d, d );
+            break;
+        case AVR_OPCODE_INDEX_ROR:
+            fprintf( fp_, "    r[%u] = AOT_Shift( r, (r[%u] >> 1) | ((r[AVR_AOT_SREG] & 1) << 7), r[%u] & 1 );\n", d, d, d );
+            break;
+        case AVR_OPCODE_INDEX_ASR:
+            fprintf( fp_, "    r[%u] = AOT_Shift( r, (r[%u] & 0x80) | (r[%u] >> 1), r[%u] & 1 );\n", d, d, d, d );
+            break;
+        case AVR_OPCODE_INDEX_BSET:
+            fprintf( fp_, "    r[AVR_AOT_SREG] |= 0x%02X;\n", (uint8_t)(1 << pstInsn_->u8b) );
+            break;
+        case AVR_OPCODE_INDEX_BCLR:
+            fprintf( fp_, "    r[AVR_AOT_SREG] &= 0x%02X;\n", (uint8_t)~(1 << pstInsn_->u8b) );
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Return whether or not a ROM word is the start of a translated basic block
+    within the given function.
+*/
+static bool AOT_IsEntry( uint32_t u32Addr_, uint32_t u32Function_ )
+{
+    return ((u32Addr_ < u32Words)
+            && (pstInsns[ u32Addr_ ].u32Function == u32Function_ + 1)
+            && pstInsns[ u32Addr_ ].bLeader
+            && (pstInsns[ u32Addr_ ].u8Index != AVR_OPCODE_INDEX_INVALID));
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Write the code to transfer control to a branch/jump target, which has
+    already been retired.
+*/
+static void AOT_EmitJump( FILE *fp_, uint32_t u32Function_, uint32_t u32Target_ )
+{
+    if (AOT_IsEntry( u32Target_, u32Function_ ))
+    {
+        fprintf( fp_, "    goto L_%05X;\n", u32Target_ );
+    }
+    else
+    {
+        fprintf( fp_, "    return;\n" );
+    }
+}
+
+//---------------------------------------------------------------------------
+static void AOT_EmitFunction( FILE *fp_, uint32_t u32Function_, uint32_t *pu32Native_ )
+{
+    uint32_t u32Entry = pu32Functions[ u32Function_ ];
+    uint32_t u32Owner = u32Function_ + 1;
+    uint32_t i;
+
+    fprintf( fp_, "//---------------------------------------------------------------------------\n" );
+    fprintf( fp_, "static void AOT_Func_%05X( uint32_t u32PC_ )\n{\n", u32Entry );
+    fprintf( fp_, "    uint8_t *r = pstAOT->pu8RAM;\n\n" );
+    fprintf( fp_, "    switch (u32PC_)\n    {\n" );
+    for (i = 0; i < u32Words; i++)
+    {
+        if (AOT_IsEntry( i, u32Function_ ))
+        {
+            fprintf( fp_, "        case 0x%05X: goto L_%05X;\n", i, i );
+        }
+    }
+    fprintf( fp_, "        default: return;\n    }\n" );
+
+    for (i = 0; i < u32Words; i++)
+    {
+        const AOT_Insn_t *pstInsn = &pstInsns[i];
+        uint32_t u32Next;
+        uint8_t u8Flag;
+        bool bTakenIfSet;
+
+        if (pstInsn->u32Function != u32Owner)
+        {
+            continue;
+        }
+        if (AOT_IsEntry( i, u32Function_ ))
+        {
+            fprintf( fp_, "L_%05X:\n", i );
+        }
+        if (pstInsn->u8Index == AVR_OPCODE_INDEX_INVALID)
+        {
+            fprintf( fp_, "    return;\n" );
+            continue;
+        }
+
+        AOT_EmitComment( fp_, i );
+        u32Next = i + pstInsn->u8Size;
+        u8Flag = AOT_BranchFlag( pstInsn->u8Index, &bTakenIfSet );
+
+        if (u8Flag)
+        {
+            fprintf( fp_, "    if (%s(r[AVR_AOT_SREG] & 0x%02X))\n    {\n",
+                     bTakenIfSet ? "" : "!", u8Flag );
+            fprintf( fp_, "        if (pstAOT->pfRetire( 0x%05X, %u )) { return; }\n",
+                     pstInsn->u32Target, pstInsn->u8Cycles + 1 );
+            fprintf( fp_, "    " );
+            AOT_EmitJump( fp_, u32Function_, pstInsn->u32Target );
+            fprintf( fp_, "    }\n" );
+            fprintf( fp_, "    if (pstAOT->pfRetire( 0x%05X, %u )) { return; }\n",
+                     u32Next, pstInsn->u8Cycles );
+            (*pu32Native_)++;
+        }
+        else if ((pstInsn->u8Index == AVR_OPCODE_INDEX_RJMP) && (pstInsn->u32Target != 0))
+        {
+            // Jumps to reset are left to the interpreter, for --exitreset
+            fprintf( fp_, "    if (pstAOT->pfRetire( 0x%05X, %u )) { return; }\n",
+                     pstInsn->u32Target, pstInsn->u8Cycles );
+            AOT_EmitJump( fp_, u32Function_, pstInsn->u32Target );
+            (*pu32Native_)++;
+            continue;
+        }
+        else if (AOT_EmitNative( fp_, pstInsn ))
+        {
+            fprintf( fp_, "    if (pstAOT->pfRetire( 0x%05X, %u )) { return; }\n",
+                     u32Next, pstInsn->u8Cycles );
+            (*pu32Native_)++;
+        }
+        else
+        {
+            fprintf( fp_, "    if (pstAOT->pfStep( 0x%05X )) { return; }\n", u32Next );
+        }
+
+        // Fall through into the next instruction only if it belongs to this
+        // function; otherwise, let the runtime find the next block.
+        if ((u32Next >= u32Words) || (pstInsns[ u32Next ].u32Function != u32Owner))
+        {
+            fprintf( fp_, "    return;\n" );
+        }
+    }
+    fprintf( fp_, "}\n\n" );
+}
+
+//---------------------------------------------------------------------------
+bool AVR_AOT_Emit( const char *szPath_ )
+{
+    FILE *fp;
+    uint32_t i;
+    uint32_t u32Blocks = 0;
+    uint32_t u32Insns = 0;
+    uint32_t u32Native = 0;
+    uint32_t u32SavedPC = stCPU.u32PC;
+
+    AOT_Analyze();
+
+    fp = fopen( szPath_, "w" );
+    if (!fp)
+    {
+        fprintf( stderr, "Unable to open %s for writing\n", szPath_ );
+        return false;
+    }
+
+    fprintf( fp, "/* Generated by flavr --aot-emit - do not edit.\n\n" );
+    fprintf( fp, "   Build with:\n" );
+    fprintf( fp, "       gcc -O2 -shared -fPIC -I<flavr>/src/avr_cpu -o <module>.so <this file>\n" );
+    fprintf( fp, "   Run with:\n" );
+    fprintf( fp, "       flavr <program options> --aot-load <module>.so\n" );
+    fprintf( fp, "*/\n\n" );
+    fprintf( fp, "#include \"avr_aot_if.h\"\n\n" );
+    fprintf( fp, "static __thread const AVR_AOT_Interface_t *pstAOT;\n\n" );
+
+    for (i = 0; i < u32FunctionCount; i++)
+    {
+        AOT_EmitFunction( fp, i, &u32Native );
+    }
+
+    fprintf( fp, "//---------------------------------------------------------------------------\n" );
+    fprintf( fp, "static const AVR_AOT_Entry_t astEntries[] =\n{\n" );
+    for (i = 0; i < u32Words; i++)
+    {
+        if (pstInsns[i].u32Function)
+        {
+            u32Insns++;
+            if (AOT_IsEntry( i, pstInsns[i].u32Function - 1 ))
+            {
+                fprintf( fp, "    { 0x%05X, AOT_Func_%05X },\n", i,
+                         pu32Functions[ pstInsns[i].u32Function - 1 ] );
+                u32Blocks++;
+            }
+        }
+    }
+    fprintf( fp, "};\n\n" );
+
+    fprintf( fp, "//---------------------------------------------------------------------------\n" );
+    fprintf( fp, "static void AOT_Bind( const AVR_AOT_Interface_t *pstInterface_ )\n{\n" );
+    fprintf( fp, "    pstAOT = pstInterface_;\n}\n\n" );
+
+    fprintf( fp, "//---------------------------------------------------------------------------\n" );
+    fprintf( fp, "const AVR_AOT_Module_t AVR_AOT_Module =\n{\n" );
+    fprintf( fp, "    AVR_AOT_VERSION,\n" );
+    fprintf( fp, "    %u,\n", u32Words );
+    fprintf( fp, "    0x%08X,\n", AOT_ROMHash() );
+    fprintf( fp, "    %u,\n", u32Blocks );
+    fprintf( fp, "    astEntries,\n" );
+    fprintf( fp, "    AOT_Bind\n" );
+    fprintf( fp, "};\n" );
+
+    fclose( fp );
+
+    stCPU.u32PC = u32SavedPC;
+
+    printf( "AOT: %u functions, %u blocks, %u instructions (%u native) written to %s\n",
+            u32FunctionCount, u32Blocks, u32Insns, u32Native, szPath_ );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Called from translated code after each natively-executed instruction.
+    Mirrors the retire logic in CPU_RunCycle().
+*/
+static bool AOT_Retire( uint32_t u32NextPC_, uint32_t u32Cycles_ )
+{
+#if FEATURE_USE_IDLE_LOOPS
+    uint32_t u32PC = stCPU.u32PC;
+    uint32_t u32Skipped;
+#endif
+
+    stCPU.u32PC = u32NextPC_;
+    stCPU.u64CycleCount += u32Cycles_;
+    IO_Advance( u32Cycles_ );
+    stCPU.u64InstructionCount++;
+    AVR_Interrupt();
+
+    u32Budget--;
+
+#if FEATURE_USE_IDLE_LOOPS
+    // After skipping loop iterations, return to AVR_AOT_Run(), which picks the
+    // loop back up from wherever the skip left off.
+    if ((u32NextPC_ < u32PC) && (stCPU.u32PC == u32NextPC_))
+    {
+        u32Skipped = AVR_IdleLoop_Skip( u32PC, u32Budget );
+        if (u32Skipped)
+        {
+            u32Budget -= u32Skipped;
+            return true;
+        }
+    }
+#endif
+    return ((stCPU.u32PC != u32NextPC_) || !u32Budget);
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Called from translated code for instructions executed by the interpreter.
+*/
+static bool AOT_Step( uint32_t u32NextPC_ )
+{
+    // Translated code works on SREG directly
+    CPU_RunCycle();
+    AVR_Opcode_SyncFlags();
+
+    u32Budget--;
+    return ((stCPU.u32PC != u32NextPC_) || !u32Budget || stCPU.bAsleep || !apfEntries);
+}
+
+//---------------------------------------------------------------------------
+bool AVR_AOT_Load( const char *szPath_ )
+{
+    const AVR_AOT_Module_t *pstModule;
+    void *pvHandle;
+    uint32_t i;
+
+    pvHandle = dlopen( szPath_, RTLD_NOW | RTLD_LOCAL );
+    if (!pvHandle)
+    {
+        fprintf( stderr, "Unable to load AOT module: %s\n", dlerror() );
+        return false;
+    }
+
+    pstModule = (const AVR_AOT_Module_t*)dlsym( pvHandle, AVR_AOT_MODULE_SYMBOL );
+    if (!pstModule || (pstModule->u32Version != AVR_AOT_VERSION))
+    {
+        fprintf( stderr, "%s is not a compatible AOT module\n", szPath_ );
+        dlclose( pvHandle );
+        return false;
+    }
+
+    if ((pstModule->u32ROMWords != (stCPU.u32ROMSize / sizeof(uint16_t))) ||
+        (pstModule->u32ROMHash != AOT_ROMHash()))
+    {
+        fprintf( stderr, "%s was not translated from the loaded program\n", szPath_ );
+        dlclose( pvHandle );
+        return false;
+    }
+
+    free( apfEntries );
+    u32EntryWords = pstModule->u32ROMWords;
+    apfEntries = (AVR_AOT_Function*)calloc( u32EntryWords, sizeof(AVR_AOT_Function) );
+    if (!apfEntries)
+    {
+        fprintf( stderr, "Unable to allocate AOT entry table\n" );
+        exit(-1);
+    }
+
+    for (i = 0; i < pstModule->u32EntryCount; i++)
+    {
+        if (pstModule->pstEntries[i].u32Addr < u32EntryWords)
+        {
+            apfEntries[ pstModule->pstEntries[i].u32Addr ] = pstModule->pstEntries[i].pfFunction;
+        }
+    }
+
+    stInterface.pu8RAM   = stCPU.pstRAM->au8RAM;
+    stInterface.pfRetire = AOT_Retire;
+    stInterface.pfStep   = AOT_Step;
+    pstModule->pfBind( &stInterface );
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void AVR_AOT_Run( uint32_t u32Count_ )
+{
+    u32Budget = u32Count_;
+
+    while (u32Budget)
+    {
+        uint32_t u32PC = stCPU.u32PC;
+
+#if FEATURE_USE_HLE
+        if (stCPU.bHLE)
+        {
+            uint32_t u32Native = AVR_HLE_Call( u32Budget );
+            if (u32Native)
+            {
+                // Translated code works on SREG directly
+                AVR_Opcode_SyncFlags();
+                u32Budget -= u32Native;
+                continue;
+            }
+        }
+#endif
+
+        if (!stCPU.bAsleep && (u32PC < u32EntryWords) && apfEntries[ u32PC ])
+        {
+            apfEntries[ u32PC ]( u32PC );
+            continue;
+        }
+
+#if FEATURE_USE_SLEEP_SKIP
+        if (stCPU.bAsleep)
+        {
+            u32Budget -= CPU_SkipSleep( u32Budget - 1 );
+        }
+#endif
+        CPU_RunCycle();
+        AVR_Opcode_SyncFlags();
+        u32Budget--;
+    }
+}
+
+//---------------------------------------------------------------------------
+void AVR_AOT_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+    (void)u32Addr_;
+    (void)u32Words_;
+
+    // Translated code no longer matches ROM - interpret everything from here.
+    free( apfEntries );
+    apfEntries = NULL;
+    u32EntryWords = 0;
+}
+
+#endif
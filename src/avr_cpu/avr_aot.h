@@ -0,0 +1,77 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_aot.h
+
+  \brief Ahead-of-time translation of firmware images into C.
+*/
+
+#ifndef __AVR_AOT_H__
+#define __AVR_AOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_AOT_Emit
+ *
+ * Analyze the program currently loaded into the CPU's ROM, dividing it into
+ * functions and basic blocks, and write out a C translation of the program
+ * that can be built into a shared object and loaded with AVR_AOT_Load().
+ *
+ * \param szPath_ Path of the C file to generate
+ * \return true on success, false if the file couldn't be written
+ */
+bool AVR_AOT_Emit( const char *szPath_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_AOT_Load
+ *
+ * Load a shared object built from the output of AVR_AOT_Emit().  The module
+ * must have been translated from the program currently loaded into ROM.
+ *
+ * \param szPath_ Path of the shared object to load
+ * \return true on success, false if the module is missing or doesn't match
+ */
+bool AVR_AOT_Load( const char *szPath_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_AOT_Run
+ *
+ * Run a number of CPU instruction cycles, executing translated code wherever
+ * the PC lands on the start of a translated basic block, and falling back to
+ * the interpreter everywhere else.  The results are identical to calling
+ * CPU_RunCycle() the same number of times.
+ *
+ * \param u32Count_ Number of instruction cycles to run
+ */
+void AVR_AOT_Run( uint32_t u32Count_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_AOT_Invalidate
+ *
+ * Stop using translated code once the ROM it was translated from has been
+ * modified.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of ROM words modified
+ */
+void AVR_AOT_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ );
+
+#endif
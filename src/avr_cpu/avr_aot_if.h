@@ -0,0 +1,206 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_aot_if.h
+
+  \brief Interface between flavr and ahead-of-time translated firmware.
+
+  This header is included by the C source generated with "--aot-emit", and
+  must not depend on any other flavr headers, so that the generated code
+  can be built into a shared object on its own:
+
+      gcc -O2 -shared -fPIC -I<flavr>/src/avr_cpu -o fw.so fw.c
+
+  The inline helpers below compute results and SREG flags exactly as the
+  corresponding opcode functions in avr_opcodes.c do.
+*/
+
+#ifndef __AVR_AOT_IF_H__
+#define __AVR_AOT_IF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//---------------------------------------------------------------------------
+//! Interface version - bump whenever anything in this file changes
+#define AVR_AOT_VERSION             (2)
+
+//! Name of the AVR_AOT_Module_t object exported by a translated module
+#define AVR_AOT_MODULE_SYMBOL       "AVR_AOT_Module"
+
+//! Offset of SREG within the CPU's RAM/register file
+#define AVR_AOT_SREG                (0x5F)
+
+//---------------------------------------------------------------------------
+/*!
+    Services provided by flavr to translated code.
+*/
+typedef struct
+{
+    uint8_t    *pu8RAM;         //!< CPU RAM - register file, I/O, and SRAM
+
+    //! Retire a natively-executed instruction.  Returns true if translated
+    //! code must return control to flavr.
+    bool      (*pfRetire)( uint32_t u32NextPC_, uint32_t u32Cycles_ );
+
+    //! Run the instruction at the current PC through the interpreter.
+    //! Returns true if translated code must return control to flavr.
+    bool      (*pfStep)( uint32_t u32NextPC_ );
+} AVR_AOT_Interface_t;
+
+//---------------------------------------------------------------------------
+//! Translated function, entered at the basic block starting at u32PC_
+typedef void (*AVR_AOT_Function)( uint32_t u32PC_ );
+
+//---------------------------------------------------------------------------
+/*!
+    Entry point into translated code - one for each basic block.
+*/
+typedef struct
+{
+    uint32_t            u32Addr;        //!< ROM word address of the block
+    AVR_AOT_Function    pfFunction;     //!< Function containing the block
+} AVR_AOT_Entry_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Descriptor exported by a translated module (see AVR_AOT_MODULE_SYMBOL).
+*/
+typedef struct
+{
+    uint32_t                u32Version;     //!< AVR_AOT_VERSION
+    uint32_t                u32ROMWords;    //!< Size of the ROM translated
+    uint32_t                u32ROMHash;     //!< Hash of the ROM translated
+    uint32_t                u32EntryCount;  //!< Number of block entry points
+    const AVR_AOT_Entry_t  *pstEntries;     //!< Block entry points
+
+    //! Bind the module to flavr's services before running any translated code
+    //! (the binding is per host thread, as each thread runs its own CPU)
+    void                  (*pfBind)( const AVR_AOT_Interface_t *pstInterface_ );
+} AVR_AOT_Module_t;
+
+//---------------------------------------------------------------------------
+static inline void AOT_SetFlags( uint8_t *r, uint8_t u8Mask_, uint8_t u8Flags_ )
+{
+    r[AVR_AOT_SREG] = (r[AVR_AOT_SREG] & ~u8Mask_) | u8Flags_;
+}
+
+//---------------------------------------------------------------------------
+static inline uint8_t AOT_NZVS( uint8_t u8Result_, uint8_t V_ )
+{
+    uint8_t N = ((u8Result_ & 0x80) != 0);
+    uint8_t Z = (u8Result_ == 0);
+
+    return (Z << 1) | (N << 2) | (V_ << 3) | ((N ^ V_) << 4);
+}
+
+//---------------------------------------------------------------------------
+//! ADD, ADC
+static inline uint8_t AOT_Add( uint8_t *r, uint8_t Rd_, uint8_t Rr_, uint8_t C_ )
+{
+    uint8_t R = Rd_ + Rr_ + C_;
+    uint8_t u8Carry = (Rd_ & Rr_) | (Rr_ & ~R) | (~R & Rd_);
+    uint8_t V = ((((Rd_ & Rr_ & ~R) | (~Rd_ & ~Rr_ & R)) & 0x80) != 0);
+
+    AOT_SetFlags( r, 0x3F, AOT_NZVS( R, V ) | ((u8Carry >> 7) & 1)
+                           | (((u8Carry >> 3) & 1) << 5) );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+//! SUB, SUBI, SBC, SBCI, CP, CPC, CPI.  SBC/SBCI/CPC only ever clear Z.
+static inline uint8_t AOT_Sub( uint8_t *r, uint8_t Rd_, uint8_t Rr_, uint8_t C_, bool bKeepZ_ )
+{
+    uint8_t R = Rd_ - Rr_ - C_;
+    uint8_t u8Borrow = (~Rd_ & Rr_) | (Rr_ & R) | (R & ~Rd_);
+    uint8_t V = ((((Rd_ & ~Rr_ & ~R) | (~Rd_ & Rr_ & R)) & 0x80) != 0);
+    uint8_t u8Flags = AOT_NZVS( R, V ) | ((u8Borrow >> 7) & 1)
+                    | (((u8Borrow >> 3) & 1) << 5);
+
+    if (bKeepZ_)
+    {
+        u8Flags &= (r[AVR_AOT_SREG] | ~0x02);
+    }
+    AOT_SetFlags( r, 0x3F, u8Flags );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+//! AND, ANDI, OR, ORI, SBR, EOR
+static inline uint8_t AOT_Logic( uint8_t *r, uint8_t u8Result_ )
+{
+    AOT_SetFlags( r, 0x1E, AOT_NZVS( u8Result_, 0 ) );
+    return u8Result_;
+}
+
+//---------------------------------------------------------------------------
+static inline uint8_t AOT_Com( uint8_t *r, uint8_t Rd_ )
+{
+    uint8_t R = 0xFF - Rd_;
+    AOT_SetFlags( r, 0x1F, AOT_NZVS( R, 0 ) | 0x01 );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+static inline uint8_t AOT_Neg( uint8_t *r, uint8_t Rd_ )
+{
+    uint8_t R = 0 - Rd_;
+    AOT_SetFlags( r, 0x1F, AOT_NZVS( R, (R == 0x80) ) | (R != 0) );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+static inline uint8_t AOT_Inc( uint8_t *r, uint8_t Rd_ )
+{
+    uint8_t R = Rd_ + 1;
+    AOT_SetFlags( r, 0x1E, AOT_NZVS( R, (R == 0x80) ) );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+static inline uint8_t AOT_Dec( uint8_t *r, uint8_t Rd_ )
+{
+    uint8_t R = Rd_ - 1;
+    AOT_SetFlags( r, 0x1E, AOT_NZVS( R, (R == 0x7F) ) );
+    return R;
+}
+
+//---------------------------------------------------------------------------
+//! LSR, ROR, ASR - R_ is the shifted result, C_ the bit shifted out
+static inline uint8_t AOT_Shift( uint8_t *r, uint8_t R_, uint8_t C_ )
+{
+    uint8_t N = ((R_ & 0x80) != 0);
+    AOT_SetFlags( r, 0x1F, AOT_NZVS( R_, N ^ C_ ) | C_ );
+    return R_;
+}
+
+//---------------------------------------------------------------------------
+//! ADIW, SBIW on the register pair starting at u8Reg_
+static inline void AOT_Word( uint8_t *r, uint8_t u8Reg_, uint16_t K_, bool bSub_ )
+{
+    uint16_t Rd = r[u8Reg_] | ((uint16_t)r[u8Reg_ + 1] << 8);
+    uint16_t R = bSub_ ? (uint16_t)(Rd - K_) : (uint16_t)(Rd + K_);
+    uint8_t u8Rd15 = ((Rd & 0x8000) != 0);
+    uint8_t u8R15 = ((R & 0x8000) != 0);
+    uint8_t C = bSub_ ? (!u8Rd15 && u8R15) : (u8Rd15 && !u8R15);
+    uint8_t V = bSub_ ? (u8Rd15 && !u8R15) : (!u8Rd15 && u8R15);
+    uint8_t Z = (R == 0);
+
+    r[u8Reg_] = (uint8_t)R;
+    r[u8Reg_ + 1] = (uint8_t)(R >> 8);
+    AOT_SetFlags( r, 0x1F, C | (Z << 1) | (u8R15 << 2) | (V << 3) | ((u8R15 ^ V) << 4) );
+}
+
+#endif
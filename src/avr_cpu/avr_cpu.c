@@ -20,13 +20,26 @@
          using either lookup tables or direct-decoding logic.
 */
 
+#if !defined(_WIN32)
+# define _GNU_SOURCE    // REG_ERR, used by the data space fault handler
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "emu_config.h"
 
+#if FEATURE_USE_GUARD_PAGES
+# include <setjmp.h>
+# include <signal.h>
+# include <unistd.h>
+# include <ucontext.h>
+# include <sys/mman.h>
+#endif
+
 #include "avr_cpu.h"
 #include "avr_peripheral.h"
 #include "avr_interrupt.h"
@@ -35,10 +48,28 @@
 #include "avr_op_size.h"
 #include "avr_opcodes.h"
 #include "avr_op_cycles.h"
+#include "avr_op_cache.h"
+#include "avr_jit.h"
+#include "avr_aot.h"
+#include "avr_idle_loop.h"
+#include "avr_hle.h"
+#include "write_callout.h"
+#include "interrupt_callout.h"
 
 #include "trace_buffer.h"
+#include "avr_cpu_print.h"
 
-AVR_CPU stCPU;
+EMU_INSTANCE AVR_CPU stCPU;
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE CPU_ExitHandler pfExitHandler = NULL;
+
+#if FEATURE_USE_SLEEP_SKIP
+//---------------------------------------------------------------------------
+static EMU_INSTANCE uint64_t u64SleepCycles = 0;   // Cycles spent asleep
+static EMU_INSTANCE uint64_t u64SleepSkipped = 0;  // ... of which were skipped over
+static EMU_INSTANCE uint64_t u64SleepSkips = 0;    // Number of times cycles were skipped
+#endif
 
 #if FEATURE_USE_JUMPTABLES
 //---------------------------------------------------------------------------
@@ -51,13 +82,21 @@ AVR_CPU stCPU;
    This greatly reduces opcode function complexity, saves lots of code.
    Second-level is a pure jump-table to opcode function pointers, where the
    CPU register pointers are used w/AVR_CPU struct data to execute the opcode.
+
+   The tables are read-only once built, and shared by every CPU instance in
+   the process.  Call/return opcode functions and cycle counts differ for parts
+   with a 22-bit PC, so there is one opcode table and one cycle table for each
+   PC width, indexed by CPU_Has22BitPC().
 */
 //---------------------------------------------------------------------------
 
 static AVR_Decoder astDecoders[65536] = { 0 };
-static AVR_Opcode  astOpcodes[65536] = { 0 };
+static AVR_Opcode  astOpcodes[2][65536] = { { 0 } };
 static uint8_t     au8OpSizes[65536] = { 0 };
-static uint8_t     au8OpCycles[65536] = { 0 };
+static uint8_t     au8OpCycles[2][65536] = { { 0 } };
+
+static pthread_once_t stTablesOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t astPCTablesOnce[2] = { PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT };
 
 #endif
 
@@ -76,7 +115,7 @@ static void CPU_Decode( uint16_t OP_ )
 static void CPU_Execute( uint16_t OP_ )
 {
 #if FEATURE_USE_JUMPTABLES
-    astOpcodes[OP_]();
+    astOpcodes[ CPU_Has22BitPC() ][OP_]();
 #else
     AVR_Opcode pfOp = AVR_Opcode_Function(OP_);
     pfOP(  OP_ );
@@ -86,8 +125,7 @@ static void CPU_Execute( uint16_t OP_ )
 //---------------------------------------------------------------------------
 uint16_t CPU_Fetch( void )
 {
-    uint16_t PC = stCPU.u32PC;
-    if (PC >= 16384)
+    if (stCPU.u32PC >= (stCPU.u32ROMSize >> 1))
     {
         return 0xFFFF;
     }
@@ -98,7 +136,7 @@ uint16_t CPU_Fetch( void )
 static void CPU_GetOpCycles( uint16_t OP_ )
 {
 #if FEATURE_USE_JUMPTABLES
-    stCPU.u16ExtraCycles = au8OpCycles[ OP_ ];
+    stCPU.u16ExtraCycles = au8OpCycles[ CPU_Has22BitPC() ][ OP_ ];
 #else
     stCPU.u16ExtraCycles = AVR_Opcode_Cycles( OP_ );
 #endif
@@ -124,26 +162,58 @@ static void CPU_PeripheralCycle( void )
 void CPU_RunCycle( void )
 {
     uint16_t OP;
+#if FEATURE_USE_DECODE_CACHE
+    AVR_OpCache_Entry_t *pstEntry;
+#endif
 
     if (!stCPU.bAsleep)
     {
 
-        OP = CPU_Fetch();
-
-        // From the first word fetched, figure out how big this opcode is
-        // (either 16 or 32-bit)
-        CPU_GetOpSize(  OP );
-
-        // Based on the first word fetched, figure out the minimum number of
-        // CPU cycles required to execute the instruction fetched.
-        CPU_GetOpCycles(  OP );
-
-        // Decode the instruction, load internal registers with appropriate
-        // values.
-        CPU_Decode(  OP );
-
-        // Execute the instruction that was just decoded
-        CPU_Execute(  OP );
+#if FEATURE_USE_DECODE_CACHE
+        pstEntry = AVR_OpCache_Lookup( stCPU.u32PC );
+        if (pstEntry && pstEntry->bValid)
+        {
+            // This instruction has already been predecoded - take the size,
+            // cycle count, and operands directly from the cache.
+            stCPU.u16ExtraPC = pstEntry->u8Size;
+            stCPU.u16ExtraCycles = pstEntry->u8Cycles;
+            AVR_OpCache_Restore( pstEntry );
+
+            // Preserve the decoder's peripheral clock for 2-word JMP/CALL
+            if (pstEntry->bDecodeClock)
+            {
+                CPU_PeripheralCycle();
+            }
+
+            pstEntry->pfOpcode();
+        }
+        else
+#endif
+        {
+            OP = CPU_Fetch();
+
+            // From the first word fetched, figure out how big this opcode is
+            // (either 16 or 32-bit)
+            CPU_GetOpSize(  OP );
+
+            // Based on the first word fetched, figure out the minimum number of
+            // CPU cycles required to execute the instruction fetched.
+            CPU_GetOpCycles(  OP );
+
+            // Decode the instruction, load internal registers with appropriate
+            // values.
+            CPU_Decode(  OP );
+
+#if FEATURE_USE_DECODE_CACHE
+            // Remember the decoded instruction for the next time it's run
+            if (pstEntry)
+            {
+                AVR_OpCache_Store( pstEntry, OP );
+            }
+#endif
+            // Execute the instruction that was just decoded
+            CPU_Execute(  OP );
+        }
 
         // Update the PC based on the size of the instruction + whatever
         // modifications occurred during the execution cycle.
@@ -154,14 +224,12 @@ void CPU_RunCycle( void )
         // during execution of the instruction.
         stCPU.u64CycleCount += stCPU.u16ExtraCycles;
 
-        // Cycle-accurate peripheral clocking -- one iteration for each
-        // peripheral for each CPU cycle of the instruction.
+        // Clock the peripherals for each CPU cycle of the instruction - events
+        // due within it run on the cycle they're due (or all at once, in fast
+        // IO mode).
         // Note that CPU Interrupts are generated in the peripheral
         // phase of the instruction cycle.
-        while (stCPU.u16ExtraCycles--)
-        {
-            CPU_PeripheralCycle();
-        }
+        IO_Advance( stCPU.u16ExtraCycles );
 
         // Increment the "total executed instruction counter"
         stCPU.u64InstructionCount++;
@@ -172,6 +240,9 @@ void CPU_RunCycle( void )
         // CPU is asleep, just NOP and wait until we hit an interrupt.
         stCPU.u64CycleCount++;
         CPU_PeripheralCycle();
+#if FEATURE_USE_SLEEP_SKIP
+        u64SleepCycles++;
+#endif
     }
 
     // Check to see if there are any pending interrupts - if so, vector
@@ -195,10 +266,12 @@ static void CPU_BuildDecodeTable(void)
 //---------------------------------------------------------------------------
 static void CPU_BuildOpcodeTable(void)
 {
+    // Built for the PC width of the CPU being initialized
+    AVR_Opcode *pstTable = astOpcodes[ CPU_Has22BitPC() ];
     uint32_t i;
     for (i = 0; i < 65536; i++)
     {
-        astOpcodes[i] = AVR_Opcode_Function(i);
+        pstTable[i] = AVR_Opcode_Function(i);
     }
 }
 
@@ -215,12 +288,158 @@ static void CPU_BuildSizeTable(void)
 //---------------------------------------------------------------------------
 static void CPU_BuildCycleTable(void)
 {
+    // Built for the PC width of the CPU being initialized
+    uint8_t *pu8Table = au8OpCycles[ CPU_Has22BitPC() ];
     uint32_t i;
     for (i = 0; i < 65536; i++)
     {
-        au8OpCycles[i] = AVR_Opcode_Cycles(i);
+        pu8Table[i] = AVR_Opcode_Cycles(i);
     }
 }
+
+//---------------------------------------------------------------------------
+static void CPU_BuildSharedTables(void)
+{
+    CPU_BuildSizeTable();
+    CPU_BuildDecodeTable();
+}
+
+//---------------------------------------------------------------------------
+static void CPU_BuildPCTables(void)
+{
+    CPU_BuildCycleTable();
+    CPU_BuildOpcodeTable();
+}
+#endif
+
+#if FEATURE_USE_GUARD_PAGES
+//---------------------------------------------------------------------------
+static EMU_INSTANCE uint8_t *pu8DataSpaceEnd;    // End of the inaccessible region past RAM
+
+static EMU_INSTANCE sigjmp_buf stFaultJump;          // Where CPU_DataFault() returns to
+static EMU_INSTANCE volatile bool bFaultArmed;       // stFaultJump is set - CPU_Run() is running
+static EMU_INSTANCE volatile uint32_t u32FaultAddr;  // Data address of the last fault
+static EMU_INSTANCE const char * volatile szFaultAccess; // ... and the kind of access
+
+static pthread_once_t stFaultOnce = PTHREAD_ONCE_INIT;
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_DataFault
+ *
+ * SIGSEGV handler - catches loads and stores past the end of RAM (which land
+ * in the inaccessible region that follows it), records the address, and
+ * unwinds back to CPU_Run() to report them.  Faults anywhere else, or outside
+ * of CPU_Run(), crash as normal.
+ *
+ * Runs in signal context, so touches nothing but the fault state.
+ */
+static void CPU_DataFault( int iSignal_, siginfo_t *pstInfo_, void *pvContext_ )
+{
+    uint8_t *pu8Fault = (uint8_t*)pstInfo_->si_addr;
+
+    if (!bFaultArmed || !pu8DataSpaceEnd ||
+        (pu8Fault < stCPU.pstRAM->au8RAM) || (pu8Fault >= pu8DataSpaceEnd))
+    {
+        // Returning re-runs the faulting instruction with the default action
+        signal( iSignal_, SIG_DFL );
+        return;
+    }
+
+    szFaultAccess = "Access";
+#if defined(__x86_64__) && defined(__linux__)
+    // Page fault error code - bit 1 is set on a write
+    szFaultAccess = (((ucontext_t*)pvContext_)->uc_mcontext.gregs[REG_ERR] & 2) ? "Write" : "Read";
+#else
+    (void)pvContext_;
+#endif
+    u32FaultAddr = (uint32_t)(pu8Fault - stCPU.pstRAM->au8RAM);
+
+    bFaultArmed = false;
+    siglongjmp( stFaultJump, 1 );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_DataAbort
+ *
+ * Report a fault caught by CPU_DataFault() the same way as Data_Read() and
+ * Data_Write() would, and abort.
+ */
+static void CPU_DataAbort( void )
+{
+    fprintf( stderr, "[%s Abort] RAM Address 0x%08X is out of range! (PC = 0x%05X)\n",
+             szFaultAccess, u32FaultAddr, stCPU.u32PC );
+
+    AVR_Opcode_SyncFlags();
+    print_core_regs();
+    CPU_Exit( CPU_EXIT_ABORT );
+}
+
+//---------------------------------------------------------------------------
+static void CPU_InstallFaultHandler( void )
+{
+    struct sigaction stAction;
+
+    // SA_NODEFER, as the handler leaves with siglongjmp() rather than
+    // returning, and stFaultJump doesn't save the signal mask (to keep
+    // CPU_Run() free of system calls).
+    memset( &stAction, 0, sizeof(stAction) );
+    stAction.sa_sigaction = CPU_DataFault;
+    stAction.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset( &stAction.sa_mask );
+    sigaction( SIGSEGV, &stAction, NULL );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_AllocRAM
+ *
+ * Map the AVR data space, such that RAM ends exactly on a host page boundary,
+ * followed by enough inaccessible pages to cover any 16-bit address (plus
+ * displacement) past the end of RAM.
+ *
+ * \param u32Size_ Size of RAM, including the register file and IO space
+ * \return Pointer to the start of the data space
+ */
+static AVR_RAM_t *CPU_AllocRAM( uint32_t u32Size_ )
+{
+    size_t szPage = (size_t)sysconf( _SC_PAGESIZE );
+    size_t szRAM = (u32Size_ + szPage - 1) & ~(szPage - 1);
+    size_t szGuard = (65536 + 256 + szPage - 1) & ~(szPage - 1);
+    uint8_t *pu8Map;
+
+    pu8Map = (uint8_t*)mmap( NULL, szRAM + szGuard, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ((pu8Map == MAP_FAILED) || (0 != mprotect( pu8Map, szRAM, PROT_READ | PROT_WRITE )))
+    {
+        fprintf( stderr, "Unable to map RAM\n" );
+        exit(-1);
+    }
+    pu8DataSpaceEnd = pu8Map + szRAM + szGuard;
+
+    // The handler is process-wide, and shared by every instance
+    pthread_once( &stFaultOnce, CPU_InstallFaultHandler );
+
+    return (AVR_RAM_t*)(pu8Map + szRAM - u32Size_);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_FreeRAM
+ *
+ * Unmap a data space mapped by CPU_AllocRAM().
+ *
+ * \param u32Size_ Size of RAM, as passed to CPU_AllocRAM()
+ */
+static void CPU_FreeRAM( uint32_t u32Size_ )
+{
+    size_t szPage = (size_t)sysconf( _SC_PAGESIZE );
+    size_t szRAM = (u32Size_ + szPage - 1) & ~(szPage - 1);
+    size_t szGuard = (65536 + 256 + szPage - 1) & ~(szPage - 1);
+
+    munmap( pu8DataSpaceEnd - (szRAM + szGuard), szRAM + szGuard );
+    pu8DataSpaceEnd = NULL;
+}
 #endif
 
 //---------------------------------------------------------------------------
@@ -230,11 +449,29 @@ void CPU_Init( AVR_CPU_Config_t *pstConfig_ )
     pstConfig_->u32RAMSize += 256;
 
     stCPU.bExitOnReset = pstConfig_->bExitOnReset;
+    stCPU.bIdleSkip = pstConfig_->bIdleSkip;
+    stCPU.bFastIO = pstConfig_->bFastIO;
+    stCPU.eEngine = pstConfig_->eEngine;
+
+    // Parts with more than 64K words of ROM need a 22-bit PC.  This must be set
+    // before any opcode tables are built, as the call/return handlers differ.
+    if (pstConfig_->u32ROMSize > (128 * 1024))
+    {
+        stCPU.u32PCMask = CPU_PC_MASK_22BIT;
+    }
+    else
+    {
+        stCPU.u32PCMask = CPU_PC_MASK_16BIT;
+    }
 
     // Dynamically allocate memory for RAM, ROM, and EEPROM buffers
     stCPU.pu8EEPROM = (uint8_t*)malloc( pstConfig_->u32EESize );
     stCPU.pu16ROM    = (uint16_t*)malloc( pstConfig_->u32ROMSize );
+#if FEATURE_USE_GUARD_PAGES
+    stCPU.pstRAM    = CPU_AllocRAM( pstConfig_->u32RAMSize );
+#else
     stCPU.pstRAM    = (AVR_RAM_t*)malloc( pstConfig_->u32RAMSize );
+#endif
 
     stCPU.u32ROMSize = pstConfig_->u32ROMSize;
     stCPU.u32RAMSize = pstConfig_->u32RAMSize;
@@ -244,8 +481,20 @@ void CPU_Init( AVR_CPU_Config_t *pstConfig_ )
     memset( stCPU.pu16ROM, 0, pstConfig_->u32ROMSize );
     memset( stCPU.pstRAM, 0, pstConfig_->u32RAMSize );
 
+    // Build the data space map - peripherals and callouts flag their own
+    // addresses as they're registered.
+    stCPU.au8DataMap[ offsetof(AVRRegisterFile, SREG) ] = DATA_MAP_SREG;
+#if !FEATURE_USE_GUARD_PAGES
+    // (Otherwise, accesses past the end of RAM are caught by CPU_DataFault())
+    if (pstConfig_->u32RAMSize < CONFIG_DATA_ADDRESS_BYTES)
+    {
+        memset( &stCPU.au8DataMap[ pstConfig_->u32RAMSize ], DATA_MAP_INVALID,
+                CONFIG_DATA_ADDRESS_BYTES - pstConfig_->u32RAMSize );
+    }
+#endif
+
     // Set the base stack pointer to top-of-ram.
-    uint16_t u16InitialStack = 256 + pstConfig_->u32RAMSize - 1;
+    uint16_t u16InitialStack = pstConfig_->u32RAMSize - 1;
     stCPU.pstRAM->stRegisters.SPH.r = (uint8_t)(u16InitialStack >> 8);
     stCPU.pstRAM->stRegisters.SPL.r = (uint8_t)(u16InitialStack & 0xFF);
 
@@ -257,16 +506,259 @@ void CPU_Init( AVR_CPU_Config_t *pstConfig_ )
     stCPU.pstFeatureMap = pstConfig_->pstFeatureMap;
 
 #if FEATURE_USE_JUMPTABLES
-    CPU_BuildCycleTable();
-    CPU_BuildSizeTable();
-    CPU_BuildOpcodeTable();
-    CPU_BuildDecodeTable();
+    // Only the first CPU instance (of each PC width) builds the tables
+    pthread_once( &stTablesOnce, CPU_BuildSharedTables );
+    pthread_once( &astPCTablesOnce[ CPU_Has22BitPC() ], CPU_BuildPCTables );
+#endif
+
+#if FEATURE_USE_DECODE_CACHE
+    AVR_OpCache_Init( pstConfig_->u32ROMSize );
+#endif
+
+#if FEATURE_USE_JIT
+    if (stCPU.eEngine == CPU_ENGINE_JIT)
+    {
+        AVR_JIT_Init( pstConfig_->u32ROMSize );
+    }
+#endif
+
+#if FEATURE_USE_IDLE_LOOPS
+    if (stCPU.bIdleSkip)
+    {
+        AVR_IdleLoop_Init( pstConfig_->u32ROMSize );
+    }
+#endif
+
+#if FEATURE_USE_HLE
+    if (pstConfig_->bHLE)
+    {
+        AVR_HLE_Init( pstConfig_->u32ROMSize );
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+void CPU_Free( void )
+{
+    IO_Free();
+    WriteCallout_Free();
+    InterruptCallout_Free();
+
+    while (stCPU.pstBreakPoints)
+    {
+        BreakPoint_Delete( stCPU.pstBreakPoints->u32Addr );
+    }
+    while (stCPU.pstWatchPoints)
+    {
+        WatchPoint_Delete( stCPU.pstWatchPoints->u16Addr );
+    }
+
+#if FEATURE_USE_IDLE_LOOPS
+    AVR_IdleLoop_Free();
+#endif
+
+    free( stCPU.pu8EEPROM );
+    free( stCPU.pu16ROM );
+#if FEATURE_USE_GUARD_PAGES
+    CPU_FreeRAM( stCPU.u32RAMSize );
+#else
+    free( stCPU.pstRAM );
+#endif
+
+    memset( &stCPU, 0, sizeof(stCPU) );
+}
+
+//---------------------------------------------------------------------------
+static void CPU_RunEngine( uint32_t u32Count_ )
+{
+#if FEATURE_USE_THREADED_ENGINE
+    if (stCPU.eEngine == CPU_ENGINE_THREADED)
+    {
+        AVR_Opcode_RunThreaded( u32Count_ );
+        return;
+    }
+#endif
+#if FEATURE_USE_JIT
+    if (stCPU.eEngine == CPU_ENGINE_JIT)
+    {
+        AVR_JIT_Run( u32Count_ );
+        return;
+    }
+#endif
+#if FEATURE_USE_AOT
+    if (stCPU.eEngine == CPU_ENGINE_AOT)
+    {
+        AVR_AOT_Run( u32Count_ );
+        return;
+    }
+#endif
+    while (u32Count_--)
+    {
+#if FEATURE_USE_IDLE_LOOPS
+        uint32_t u32PC = stCPU.u32PC;
+#endif
+#if FEATURE_USE_HLE
+        if (stCPU.bHLE)
+        {
+            uint32_t u32Native = AVR_HLE_Call( u32Count_ + 1 );
+            if (u32Native)
+            {
+                u32Count_ -= (u32Native - 1);
+                continue;
+            }
+        }
+#endif
+#if FEATURE_USE_SLEEP_SKIP
+        if (stCPU.bAsleep)
+        {
+            u32Count_ -= CPU_SkipSleep( u32Count_ );
+        }
+#endif
+        CPU_RunCycle();
+#if FEATURE_USE_IDLE_LOOPS
+        if (stCPU.u32PC < u32PC)
+        {
+            u32Count_ -= AVR_IdleLoop_Skip( u32PC, u32Count_ );
+        }
+#endif
+    }
+}
+
+//---------------------------------------------------------------------------
+void CPU_Run( uint32_t u32Count_ )
+{
+#if FEATURE_USE_GUARD_PAGES
+    if (sigsetjmp( stFaultJump, 0 ))
+    {
+        CPU_DataAbort();
+    }
+    bFaultArmed = true;
+    CPU_RunEngine( u32Count_ );
+    bFaultArmed = false;
+#else
+    CPU_RunEngine( u32Count_ );
+#endif
+
+    // Leave SREG up-to-date for the debugger, tracebuffer, etc.
+    AVR_Opcode_SyncFlags();
+
+    // Peripherals may have let their registers fall behind while the CPU
+    // sleeps - bring them up to date as well.
+    if (stCPU.bAsleep)
+    {
+        IO_RescheduleAll();
+    }
+}
+
+#if FEATURE_USE_SLEEP_SKIP
+//---------------------------------------------------------------------------
+uint32_t CPU_SkipSleep( uint32_t u32Limit_ )
+{
+    uint64_t u64Idle;
+    uint32_t u32Skip;
+
+    // A pending interrupt wakes the CPU on the very next cycle.
+    if ((stCPU.u8IntPriority != 255) && stCPU.pstRAM->stRegisters.SREG.I)
+    {
+        return 0;
+    }
+
+    // Each sleep cycle advances the peripheral clock by one tick; every cycle
+    // before the next scheduled event is a no-op, so jump straight past them.
+    if (stCPU.u64IONextEvent <= (stCPU.u64IOTicks + 1))
+    {
+        return 0;
+    }
+    u64Idle = stCPU.u64IONextEvent - stCPU.u64IOTicks - 1;
+    u32Skip = (u64Idle < u32Limit_) ? (uint32_t)u64Idle : u32Limit_;
+    if (!u32Skip)
+    {
+        return 0;
+    }
+
+    stCPU.u64CycleCount += u32Skip;
+    stCPU.u64IOTicks += u32Skip;
+
+    u64SleepCycles += u32Skip;
+    u64SleepSkipped += u32Skip;
+    u64SleepSkips++;
+    return u32Skip;
+}
+
+//---------------------------------------------------------------------------
+void CPU_SleepReport( void )
+{
+    printf( "=====================================================================================\n");
+    printf( "%60s: %llu\n", "Cycles asleep", (unsigned long long)u64SleepCycles );
+    printf( "%60s: %llu\n", "Cycles skipped", (unsigned long long)u64SleepSkipped );
+    printf( "%60s: %llu\n", "Skips", (unsigned long long)u64SleepSkips );
+}
+#endif
+
+//---------------------------------------------------------------------------
+void CPU_InvalidateROM( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+#if FEATURE_USE_DECODE_CACHE
+    AVR_OpCache_Invalidate( u32Addr_, u32Words_ );
+#endif
+#if FEATURE_USE_JIT
+    AVR_JIT_Invalidate( u32Addr_, u32Words_ );
+#endif
+#if FEATURE_USE_AOT
+    AVR_AOT_Invalidate( u32Addr_, u32Words_ );
+#endif
+#if FEATURE_USE_IDLE_LOOPS
+    AVR_IdleLoop_Invalidate( u32Addr_, u32Words_ );
+#endif
+#if FEATURE_USE_HLE
+    AVR_HLE_Invalidate( u32Addr_, u32Words_ );
+#endif
+}
+
+//---------------------------------------------------------------------------
+void CPU_UpdateDataMap( uint32_t u32Addr_, uint32_t u32Count_, uint8_t u8Set_, uint8_t u8Clear_ )
+{
+    uint32_t i;
+
+    if (u32Addr_ >= CONFIG_DATA_ADDRESS_BYTES)
+    {
+        return;
+    }
+    if (u32Count_ > (CONFIG_DATA_ADDRESS_BYTES - u32Addr_))
+    {
+        u32Count_ = CONFIG_DATA_ADDRESS_BYTES - u32Addr_;
+    }
+
+    for (i = u32Addr_; i < (u32Addr_ + u32Count_); i++)
+    {
+        stCPU.au8DataMap[i] = (stCPU.au8DataMap[i] & ~u8Clear_) | u8Set_;
+    }
+
+#if FEATURE_USE_IO_BINDING
+    if (u32Addr_ < CONFIG_IO_ADDRESS_BYTES)
+    {
+        AVR_OpCache_Rebind();
+    }
 #endif
 }
 
 //---------------------------------------------------------------------------
 void CPU_AddPeriph( AVRPeripheral *pstPeriph_ )
 {    
+    if (stCPU.u32PeriphCount == CPU_MAX_PERIPHERALS)
+    {
+        fprintf( stderr, "Too many peripherals - can't add any more\n" );
+        return;
+    }
+    stCPU.apstPeriphs[ stCPU.u32PeriphCount++ ] = pstPeriph_;
+
+    // Initialize first, so that the scheduler never sees state left over from
+    // an earlier CPU instance on this thread.
+    if (pstPeriph_->pfInit)
+    {
+        pstPeriph_->pfInit( pstPeriph_->pvContext );
+    }
+
     IO_AddClocker(  pstPeriph_ );
 
     uint8_t i;
@@ -275,20 +767,35 @@ void CPU_AddPeriph( AVRPeripheral *pstPeriph_ )
         IO_AddReader(  pstPeriph_, i );
         IO_AddWriter(  pstPeriph_, i );
     }
-
-    if (pstPeriph_->pfInit)
-    {
-        pstPeriph_->pfInit( pstPeriph_->pvContext );
-    }
 }
 
 //---------------------------------------------------------------------------
 void CPU_RegisterInterruptCallback( InterruptAck pfIntAck_, uint8_t ucVector_ )
 {
-    if (ucVector_ >= 32)
+    if (ucVector_ >= CPU_MAX_INTERRUPTS)
     {
         return;
     }
 
     stCPU.apfInterruptCallbacks[ ucVector_ ] = pfIntAck_;
 }
+
+//---------------------------------------------------------------------------
+void CPU_SetExitHandler( CPU_ExitHandler pfHandler_ )
+{
+    pfExitHandler = pfHandler_;
+}
+
+//---------------------------------------------------------------------------
+void CPU_Exit( CPU_Exit_t eReason_ )
+{
+#if FEATURE_USE_GUARD_PAGES
+    // The exit handler may unwind out of CPU_Run()
+    bFaultArmed = false;
+#endif
+    if (pfExitHandler)
+    {
+        pfExitHandler( eReason_ );
+    }
+    exit( (eReason_ == CPU_EXIT_RESET) ? 0 : -1 );
+}
@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "emu_config.h"
 
@@ -41,9 +42,9 @@
 /*!
     union structure mapping the first 256 bytes of IO address space to an
     aray of bytes used to represent CPU RAM.  Note that based on the runtime
-    configuration, we'll purposefully malloc() a block of memory larger than
+    configuration, we'll purposefully allocate a block of memory larger than
     the size of this struct to extend the au8RAM[] array to the appropriate
-    size for the CPU target.
+    size for the CPU target (see FEATURE_USE_GUARD_PAGES).
 */
 typedef struct
 {
@@ -54,46 +55,131 @@ typedef struct
     };
 } AVR_RAM_t;
 
+//---------------------------------------------------------------------------
+/*!
+    Mask applied to the program counter on parts with up to 128KB of ROM (i.e.
+    a 16-bit word address), and on larger parts, which use a 22-bit program
+    counter and push 3-byte return addresses.
+*/
+#define CPU_PC_MASK_16BIT       (0x0000FFFF)
+#define CPU_PC_MASK_22BIT       (0x003FFFFF)
+
+//---------------------------------------------------------------------------
+/*!
+    Maximum number of interrupt vectors supported by any part.
+*/
+#define CPU_MAX_INTERRUPTS      (64)
+
+//---------------------------------------------------------------------------
+/*!
+    Maximum number of peripherals which can be added to a CPU.
+*/
+#define CPU_MAX_PERIPHERALS     (32)
+
+//---------------------------------------------------------------------------
+/*!
+    Number of 64-bit words in a dirty-page bitmap covering a given number of
+    bytes (see FEATURE_USE_DIRTY_PAGES).
+*/
+#define CPU_DIRTY_PAGES(x)      (((x) + CONFIG_DIRTY_PAGE_BYTES - 1) / CONFIG_DIRTY_PAGE_BYTES)
+#define CPU_DIRTY_WORDS(x)      ((CPU_DIRTY_PAGES(x) + 63) / 64)
+
+//---------------------------------------------------------------------------
+/*!
+    Flags describing how each address in the data space is accessed (see
+    AVR_CPU::au8DataMap).  Addresses with no flags set are plain RAM, and are
+    read and written directly.
+*/
+#define DATA_MAP_PERIPH_READ    (0x01)  //!< Peripheral read handler(s) installed
+#define DATA_MAP_PERIPH_WRITE   (0x02)  //!< Peripheral write handler(s) installed
+#define DATA_MAP_SREG           (0x04)  //!< Outstanding flag updates are synced on access
+#define DATA_MAP_CALLOUT        (0x08)  //!< Write callout(s) registered
+#define DATA_MAP_WATCH          (0x10)  //!< Data watchpoint set
+#define DATA_MAP_INVALID        (0x20)  //!< Past the end of RAM
+
+#define DATA_MAP_READ_MASK      (DATA_MAP_PERIPH_READ | DATA_MAP_SREG | DATA_MAP_INVALID)
+#define DATA_MAP_WRITE_MASK     (DATA_MAP_PERIPH_WRITE | DATA_MAP_SREG | DATA_MAP_CALLOUT | \
+                                 DATA_MAP_WATCH | DATA_MAP_INVALID)
+
+//---------------------------------------------------------------------------
+/*!
+    Execution engines available for running CPU instruction cycles.  All
+    engines produce identical results, and differ only in performance.
+*/
+typedef enum
+{
+    CPU_ENGINE_INTERPRETER,     //!< Fetch/decode/execute via CPU_RunCycle()
+    CPU_ENGINE_THREADED,        //!< Threaded-code dispatch from the instruction cache
+    CPU_ENGINE_JIT,             //!< Native translation of hot code (x86-64 hosts)
+    CPU_ENGINE_AOT,             //!< Ahead-of-time translated code (see avr_aot.h)
+//---
+    CPU_ENGINE_COUNT
+} CPU_Engine_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Reasons for the emulated program to terminate the emulator (see CPU_Exit())
+*/
+typedef enum
+{
+    CPU_EXIT_RESET,             //!< Jump to the reset vector with bExitOnReset set
+    CPU_EXIT_ABORT,             //!< Access outside of the part's memories
+//---
+    CPU_EXIT_COUNT
+} CPU_Exit_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Function called in place of exit() when the emulated program terminates.
+    Handlers must not return (i.e. they siglongjmp() back to the caller of
+    CPU_Run()).
+*/
+typedef void (*CPU_ExitHandler)( CPU_Exit_t eReason_ );
+
 //---------------------------------------------------------------------------
 /*!
     This structure effectively represents an entire simulated AVR CPU - all
     memories, registers (memory-mapped or internal), peripherals and housekeeping
     information.  All new CPU functionality added to the emulator eventually winds
     up tied to this structure.
+
+    The struct is split into "hot" state - touched by every instruction that
+    executes - and "cold" state, which is only used by slow-path code (IO
+    callouts, interrupt acknowledgement, the debugger, initialization).  The
+    hot state is kept together at the start of the struct, aligned to a host
+    cache line, so that the execution loop works out of as few cache lines as
+    possible.  Keep new per-instruction state in the hot block, and everything
+    else after it.
 */
 typedef struct
 {
     //---------------------------------------------------------------------------
-    // Jump tables for peripheral read/write functions.  This implementaton uses
-    // a table with function pointer arrays, enabling multiple peripherals to
-    // monitor reads/writes at particular addresses efficiently.
+    // Hot execution state
     //---------------------------------------------------------------------------
-    IOReaderList *apstPeriphReadTable[CONFIG_IO_ADDRESS_BYTES];
-    IOWriterList *apstPeriphWriteTable[CONFIG_IO_ADDRESS_BYTES];
-    IOClockList  *pstClockList;
+    // Internal CPU Registers (not exposed via IO space)
+    uint32_t     u32PC __attribute__((aligned(CONFIG_HOST_CACHE_LINE_BYTES))); // Program counter is not memory mapped, unlike all others
+    uint32_t     u32PCMask;     // Valid program counter bits (CPU_PC_MASK_16BIT or CPU_PC_MASK_22BIT)
 
-    //---------------------------------------------------------------------------
-    // List of data watchpoints
-    struct _WatchPoint *pstWatchPoints;
+    uint16_t     u16ExtraPC;    // Offset to add to the PC after executing an instruction
+    uint16_t     u16ExtraCycles;// CPU Cycles to add for the current instruction
 
-    //---------------------------------------------------------------------------
-    // List of instruction breakpoints
-    struct _BreakPoint *pstBreakPoints;
+    uint64_t     u64CycleCount; // Cycle Counter
+    uint64_t     u64InstructionCount; // Total Executed instructions
+
+    uint64_t     u64IOTicks;    // Peripheral clock ticks elapsed (see IO_Clock())
+    uint64_t     u64IONextEvent;// Tick at which peripheral clocks next need to run
 
     //---------------------------------------------------------------------------
-    // Internal CPU Registers (not exposed via IO space)
-    uint32_t     u32PC;         // Program counter is not memory mapped, unlike all others
+    // Setting up regions of memory for general-purpose RAM (shared with the
+    // IO space from 0-0xFF), and ROM/FLASH.
+    //---------------------------------------------------------------------------
+    AVR_RAM_t    *pstRAM;
+    uint16_t     *pu16ROM;
 
     //---------------------------------------------------------------------------
-    // Emulator variables
-    uint64_t     u64InstructionCount; // Total Executed instructions
-    uint64_t     u64CycleCount; // Cycle Counter
-    uint32_t     u32CoreFreq;   // CPU Frequency (Hz)
-    uint32_t     u32WDTCount;   // Current watchdog timer count
-    uint16_t     u16ExtraPC;    // Offset to add to the PC after executing an instruction
-    uint16_t     u16ExtraCycles;// CPU Cycles to add for the current instruction
+    // List of peripheral clock functions, run on every CPU cycle
+    IOClockList  *pstClockList;
 
-    bool         bAsleep;       // Whether or not the CPU is sleeping (wake by interrupt)
     //---------------------------------------------------------------------------
     // Temporary registers used for optimizing opcodes - for various addressing modes
     uint16_t    *Rd16;
@@ -115,33 +201,96 @@ typedef struct
     uint8_t     q; // Displacement for direct addressing (6-bits)
 
     //---------------------------------------------------------------------------
-    // Setting up regions of memory for general-purpose RAM (shared with the
-    // IO space from 0-0xFF), ROM/FLASH, and EEPROM.
+    bool         bAsleep;       // Whether or not the CPU is sleeping (wake by interrupt)
+    bool         bIdle;         // CPU is running a loop that can't observe peripherals (see CPU_IsIdle())
+    bool         bHLE;          // Routines are bound to native implementations (see avr_hle.h)
+    uint8_t      u8IntPriority; // Priority of pending interrupts this cycle
+
+    //---------------------------------------------------------------------------
+    // Outstanding SREG update (see AVR_Opcode_SyncFlags()) - the last flag-setting
+    // operation executed, and which SREG bits it has yet to write.
+    uint8_t     u8FlagsOp;
+    uint8_t     u8FlagsMask;
+    uint16_t    u16FlagsRd;
+    uint16_t    u16FlagsRr;
+    uint16_t    u16FlagsResult;
+
+    //---------------------------------------------------------------------------
+    // Cold state
+    //---------------------------------------------------------------------------
+    // Jump tables for peripheral read/write functions.  This implementaton uses
+    // a table with function pointer arrays, enabling multiple peripherals to
+    // monitor reads/writes at particular addresses efficiently.
+    //---------------------------------------------------------------------------
+    IOReaderList *apstPeriphReadTable[CONFIG_IO_ADDRESS_BYTES] __attribute__((aligned(CONFIG_HOST_CACHE_LINE_BYTES)));
+    IOWriterList *apstPeriphWriteTable[CONFIG_IO_ADDRESS_BYTES];
+
+    //---------------------------------------------------------------------------
+    // List of data watchpoints
+    struct _WatchPoint *pstWatchPoints;
+
+    //---------------------------------------------------------------------------
+    // List of instruction breakpoints
+    struct _BreakPoint *pstBreakPoints;
+
+    //---------------------------------------------------------------------------
+    // Emulator variables
+    uint32_t     u32CoreFreq;   // CPU Frequency (Hz)
+    uint32_t     u32WDTCount;   // Current watchdog timer count
+
     //---------------------------------------------------------------------------
-    uint16_t     *pu16ROM;
     uint8_t      *pu8EEPROM;
-    AVR_RAM_t    *pstRAM;
 
     uint32_t    u32ROMSize;
     uint32_t    u32EEPROMSize;
     uint32_t    u32RAMSize;
 
     //---------------------------------------------------------------------------
-    uint8_t     u8IntPriority;  // Priority of pending interrupts this cycle
-    uint32_t    u32IntFlags;    // Bitmask for the 32 interrupts
+    uint64_t    u64IntFlags;    // Bitmask of pending interrupts, by vector
 
     //---------------------------------------------------------------------------
-    InterruptAck apfInterruptCallbacks[32]; // Interrupt callbacks
+    // Pages of SRAM and EEPROM written since the snapshot identified by
+    // u64DirtyBase was last saved or restored (see avr_snapshot.h).  Writes to
+    // the register file and I/O space aren't tracked.
+    uint64_t    au64DirtyRAM[CPU_DIRTY_WORDS(CONFIG_DATA_ADDRESS_BYTES)];
+    uint64_t    au64DirtyEEPROM[CPU_DIRTY_WORDS(CONFIG_EEPROM_ADDRESS_BYTES)];
+    uint64_t    u64DirtyBase;
+
+    //---------------------------------------------------------------------------
+    InterruptAck apfInterruptCallbacks[CPU_MAX_INTERRUPTS]; // Interrupt callbacks
+
+    //---------------------------------------------------------------------------
+    AVRPeripheral *apstPeriphs[CPU_MAX_PERIPHERALS]; // Peripherals added, in order (see CPU_AddPeriph())
+    uint32_t     u32PeriphCount;
 
     //---------------------------------------------------------------------------
     bool        bExitOnReset;   // Flag indicating behavior when we jump to 0.  true == exit emulator
     bool        bProfile;       // Flag indicating that CPU is running with active code profiling
+    bool        bIdleSkip;      // Flag indicating that delay/polling loops may be skipped over
+    bool        bFastIO;        // Peripherals are serviced once per instruction (see AVRPeripheral)
+    CPU_Engine_t eEngine;       // Execution engine used by CPU_Run()
 
     //---------------------------------------------------------------------------
     const AVR_Vector_Map_t  *pstVectorMap;   // part-specific interrupt vector map
     const AVR_Feature_Map_t *pstFeatureMap;  // part-specific feature map
+
+    //---------------------------------------------------------------------------
+    // Per-address dispatch table for the data space (DATA_MAP_* flags), so that
+    // loads and stores to plain RAM cost a single lookup, and only flagged
+    // addresses go on to the peripheral, callout and watchpoint lists.
+    uint8_t     au8DataMap[CONFIG_DATA_ADDRESS_BYTES];
 } AVR_CPU;
 
+//---------------------------------------------------------------------------
+// The hot execution state must fit in the first two host cache lines.
+_Static_assert( offsetof(AVR_CPU, apstPeriphReadTable) <= (2 * CONFIG_HOST_CACHE_LINE_BYTES),
+                "AVR_CPU hot execution state spills past two cache lines" );
+
+// Data addresses are 16 bits plus an LDD/STD displacement (0-63), and index
+// au8DataMap unchecked.
+_Static_assert( CONFIG_DATA_ADDRESS_BYTES >= (0x10000 + 64),
+                "au8DataMap doesn't cover every data address" );
+
 
 //---------------------------------------------------------------------------
 /*!
@@ -154,6 +303,10 @@ typedef struct
     uint32_t u32RAMSize;
     uint32_t u32EESize;
     bool     bExitOnReset;
+    bool     bIdleSkip;
+    bool     bHLE;
+    bool     bFastIO;
+    CPU_Engine_t eEngine;
     const AVR_Vector_Map_t  *pstVectorMap;   // part-specific interrupt vector map
     const AVR_Feature_Map_t *pstFeatureMap;  // part-specific feature map
 
@@ -167,6 +320,18 @@ typedef struct
  */
 void CPU_Init( AVR_CPU_Config_t *pstConfig_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_Free Release the memory held by the CPU object
+ *
+ * Frees the CPU's RAM, ROM and EEPROM, and removes all peripherals, callouts,
+ * breakpoints and watchpoints, so that the calling thread can host another
+ * CPU instance with CPU_Init().  Each host thread runs its own CPU instance
+ * (see FEATURE_USE_THREAD_INSTANCES); the shared decode tables, and the
+ * thread's decode cache and JIT code buffer, are kept for reuse.
+ */
+void CPU_Free( void );
+
 //---------------------------------------------------------------------------
 /*!
  * \brief CPU_Fetch Fetch the next opcode for the CPU object
@@ -183,6 +348,68 @@ uint16_t CPU_Fetch( void );
  */
 void CPU_RunCycle( void );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_Run Run a number of CPU instruction cycles back-to-back, using
+ *  the execution engine selected when the CPU was initialized.  This is
+ *  equivalent to calling CPU_RunCycle() the same number of times.
+ *
+ * \param u32Count_ Number of instruction cycles to run
+ */
+void CPU_Run( uint32_t u32Count_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SkipSleep
+ *
+ * Fast-forward a sleeping CPU over the cycles before the next peripheral
+ * event, in which it would otherwise do nothing.  The result is identical to
+ * calling CPU_RunCycle() the same number of times.
+ *
+ * \param u32Limit_ Maximum number of cycles to skip
+ *
+ * \return Number of cycles skipped - the caller must still run the next
+ *         cycle with CPU_RunCycle().
+ */
+uint32_t CPU_SkipSleep( uint32_t u32Limit_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SleepReport
+ *
+ * Print the number of cycles the CPU has spent asleep, and how many of those
+ * were skipped by CPU_SkipSleep().
+ */
+void CPU_SleepReport( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_InvalidateROM
+ *
+ * Notify the CPU that a range of its ROM has been modified (i.e. by the
+ * loader, or by a debugger), discarding any predecoded instructions that
+ * may have been cached from the previous contents.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of words modified
+ */
+void CPU_InvalidateROM( uint32_t u32Addr_, uint32_t u32Words_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_UpdateDataMap
+ *
+ * Set and clear DATA_MAP_* flags for a range of the data space map, and
+ * re-evaluate any predecoded instructions bound to the I/O registers in
+ * that range.
+ *
+ * \param u32Addr_  First data address to update
+ * \param u32Count_ Number of addresses to update
+ * \param u8Set_    Flags to set
+ * \param u8Clear_  Flags to clear
+ */
+void CPU_UpdateDataMap( uint32_t u32Addr_, uint32_t u32Count_, uint8_t u8Set_, uint8_t u8Clear_ );
+
 //---------------------------------------------------------------------------
 /*!
  * \brief CPU_AddPeriph Add a new I/O Peripheral to the CPU
@@ -205,7 +432,179 @@ void CPU_AddPeriph( AVRPeripheral *pstPeriph_ );
  */
 void CPU_RegisterInterruptCallback( InterruptAck pfIntAck_, uint8_t ucVector_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SetExitHandler
+ *
+ * Install a function to be called in place of exit() when the emulated
+ * program terminates on the calling thread.  The handler is kept across
+ * CPU_Init() and CPU_Free().
+ *
+ * \param pfHandler_ Handler to install, or NULL to exit the process
+ */
+void CPU_SetExitHandler( CPU_ExitHandler pfHandler_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_Exit
+ *
+ * Terminate the emulated program - runs the installed exit handler, or exits
+ * the process (with status 0 on reset, -1 on abort) if there is none.
+ *
+ * \param eReason_ Reason for terminating
+ */
+void CPU_Exit( CPU_Exit_t eReason_ ) __attribute__((noreturn));
+
+
+extern EMU_INSTANCE AVR_CPU stCPU;
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IO_ClockTick Advance the peripheral clock by one tick
+ *
+ * \return true if there are peripheral clocks to run on the new tick (see
+ *         IO_RunEvents())
+ */
+static inline bool IO_ClockTick( void )
+{
+    return (++stCPU.u64IOTicks >= stCPU.u64IONextEvent);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IO_Clock Clock the peripherals for a single CPU cycle
+ */
+static inline void IO_Clock( void )
+{
+    if (IO_ClockTick())
+    {
+        IO_RunEvents();
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IO_Advance Clock the peripherals for a number of CPU cycles
+ *
+ * Equivalent to calling IO_Clock() once per cycle, but only costs a single
+ * compare unless a peripheral event is due.
+ *
+ * \param u32Ticks_ Number of cycles to advance by
+ */
+static inline void IO_Advance( uint32_t u32Ticks_ )
+{
+    stCPU.u64IOTicks += u32Ticks_;
+    if (stCPU.u64IOTicks >= stCPU.u64IONextEvent)
+    {
+        IO_AdvanceEvents( u32Ticks_ );
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_DirtyRAM
+ *
+ * Record a write to the data space, for incremental snapshots.  Every store
+ * that can reach SRAM must be recorded, apart from those made by the program
+ * loader before the CPU first runs.
+ *
+ * \param u32Addr_ Data address written
+ */
+static inline void CPU_DirtyRAM( uint32_t u32Addr_ )
+{
+#if FEATURE_USE_DIRTY_PAGES
+    uint32_t u32Page = u32Addr_ / CONFIG_DIRTY_PAGE_BYTES;
+    stCPU.au64DirtyRAM[ u32Page / 64 ] |= (1ULL << (u32Page % 64));
+#endif
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_DirtyRAMRange
+ *
+ * Record a write to a range of the data space (see CPU_DirtyRAM()).
+ *
+ * \param u32Addr_ First data address written
+ * \param u32Len_  Number of bytes written
+ */
+static inline void CPU_DirtyRAMRange( uint32_t u32Addr_, uint32_t u32Len_ )
+{
+#if FEATURE_USE_DIRTY_PAGES
+    uint32_t u32Page;
+
+    if (!u32Len_)
+    {
+        return;
+    }
+    for (u32Page = u32Addr_ / CONFIG_DIRTY_PAGE_BYTES;
+         u32Page <= ((u32Addr_ + u32Len_ - 1) / CONFIG_DIRTY_PAGE_BYTES);
+         u32Page++)
+    {
+        stCPU.au64DirtyRAM[ u32Page / 64 ] |= (1ULL << (u32Page % 64));
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_DirtyEEPROM
+ *
+ * Record a write to EEPROM, for incremental snapshots.
+ *
+ * \param u32Addr_ EEPROM address written
+ */
+static inline void CPU_DirtyEEPROM( uint32_t u32Addr_ )
+{
+#if FEATURE_USE_DIRTY_PAGES
+    uint32_t u32Page = u32Addr_ / CONFIG_DIRTY_PAGE_BYTES;
+    stCPU.au64DirtyEEPROM[ u32Page / 64 ] |= (1ULL << (u32Page % 64));
+#endif
+}
 
-extern AVR_CPU stCPU;
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_IsIdle
+ *
+ * Peripherals may let registers which don't affect interrupts fall behind
+ * while this is true (see AVRPeripheral), since the CPU can't
+ * observe them - either because it's asleep, or because it's in a loop being
+ * skipped by AVR_IdleLoop_Skip().
+ *
+ * \return true if the CPU can't currently observe peripheral registers
+ */
+static inline bool CPU_IsIdle( void )
+{
+    return (stCPU.bAsleep || stCPU.bIdle);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IO_CanLookAhead
+ *
+ * Peripherals may schedule their next event past updates which can't raise
+ * an interrupt (i.e. timer counts between overflows) while this is true -
+ * either because the CPU is idle (see CPU_IsIdle()), or because fast IO mode
+ * is enabled, and the peripheral's read handler brings its registers up to
+ * date before the CPU observes them.
+ *
+ * \return true if peripherals may look ahead to their next interrupt
+ */
+static inline bool IO_CanLookAhead( void )
+{
+    return (CPU_IsIdle() || stCPU.bFastIO);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_Has22BitPC
+ *
+ * \return true if the part has more than 128KB of ROM, and thus a 22-bit
+ *         program counter - calls, returns and interrupts push/pop 3 bytes
+ *         of return address instead of 2.
+ */
+static inline bool CPU_Has22BitPC( void )
+{
+    return (stCPU.u32PCMask > CPU_PC_MASK_16BIT);
+}
 
 #endif
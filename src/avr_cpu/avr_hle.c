@@ -0,0 +1,1196 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_hle.c
+
+  \brief High-level emulation of C runtime library routines.
+
+  Much of the time spent by typical firmware goes into a handful of libgcc
+  and avr-libc routines - 32-bit multiplication and division, software
+  floating point, block memory operations and printf().  Each of these is a
+  long run of AVR instructions computing something the host can do in one
+  step.  When a program is loaded from an ELF file, the entry point of each
+  of these routines is found in the function symbol table, and bound to a
+  native implementation.
+
+  Whenever the PC lands on a bound entry point (i.e. the routine is called),
+  the native implementation takes its arguments from the registers (and
+  memory) as laid out by the avr-gcc calling convention, writes its results
+  back the same way, and returns to the caller as the routine's RET would.
+  The call is charged the cycles and instructions the AVR code would have
+  taken, clocking the peripherals as usual:
+
+  - Routines whose cost hardly depends on their arguments (multiplication,
+    division, floating point) are run on the AVR for their first few calls,
+    and charged the cost of the quickest of those from then on - so that an
+    interrupt taken partway through a call doesn't inflate the measurement.
+
+  - Routines whose cost depends on the amount of memory processed are charged
+    from a table of their per-call and per-byte costs, derived from the
+    avr-libc implementations.
+
+  The native implementations only handle the cases they can reproduce exactly
+  - integer results, floating point results which are normal numbers, and
+  memory within plain SRAM with no write callouts (including watchpoints).
+  Anything else is declined, and left to the AVR code.  vfprintf() handles
+  integer, character and string conversions, writing to string streams
+  directly, and calling the stream's put() function on the AVR for any other
+  stream.
+
+  Registers the AVR routines use as scratch (and SREG) aren't modified - the
+  calling convention leaves them undefined after a call anyway.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#include "avr_cpu.h"
+#include "avr_io.h"
+#include "avr_interrupt.h"
+#include "avr_hle.h"
+#include "write_callout.h"
+#include "debug_sym.h"
+
+//---------------------------------------------------------------------------
+// avr-libc FILE structure layout and flags
+#define HLE_FILE_BUF        (0)     //!< char *buf
+#define HLE_FILE_FLAGS      (3)     //!< uint8_t flags
+#define HLE_FILE_SIZE       (4)     //!< int size
+#define HLE_FILE_LEN        (6)     //!< int len
+#define HLE_FILE_PUT        (8)     //!< int (*put)(char, FILE *)
+#define HLE_FILE_BYTES      (14)    //!< sizeof(FILE)
+
+#define HLE_FILE_SWR        (0x02)  //!< Stream is open for writing
+#define HLE_FILE_SSTR       (0x04)  //!< Stream is a string (sprintf())
+#define HLE_FILE_SPGM       (0x08)  //!< Format string is in flash (printf_P())
+
+//---------------------------------------------------------------------------
+// Longest output formatted natively by vfprintf()
+#define HLE_PRINTF_MAX      (512)
+
+//---------------------------------------------------------------------------
+// vfprintf() conversion flags
+#define HLE_FLAG_LEFT       (0x01)
+#define HLE_FLAG_PLUS       (0x02)
+#define HLE_FLAG_SPACE      (0x04)
+#define HLE_FLAG_ZERO       (0x08)
+#define HLE_FLAG_PREC       (0x10)
+#define HLE_FLAG_LONG       (0x20)
+
+//---------------------------------------------------------------------------
+/*!
+    Native implementation of a routine.  Returns false to decline the call,
+    leaving the AVR state untouched, or true once the call is complete, with
+    the number of bytes processed (for routines charged per byte).
+*/
+typedef bool (*HLE_Handler_t)( uint32_t *pu32Bytes_ );
+
+//---------------------------------------------------------------------------
+typedef struct
+{
+    const char     *szName;         //!< Symbol name of the routine
+    HLE_Handler_t   pfHandler;      //!< Native implementation
+    uint16_t        u16Cycles;      //!< Cycles per call, including RET (0 = measure)
+    uint16_t        u16Insns;       //!< Instructions per call, including RET
+    uint8_t         u8ByteCycles;   //!< Additional cycles per byte processed
+    uint8_t         u8ByteInsns;    //!< Additional instructions per byte processed
+} HLE_Routine_t;
+
+//---------------------------------------------------------------------------
+typedef struct
+{
+    bool        bBound;         //!< Routine is bound to its entry point
+    uint8_t     u8Measured;     //!< Number of calls measured so far
+    uint32_t    u32Cycles;      //!< Cycles charged per call
+    uint32_t    u32Insns;       //!< Instructions charged per call
+    uint64_t    u64Native;      //!< Calls run natively
+    uint64_t    u64Emulated;    //!< Calls run on the AVR
+} HLE_State_t;
+
+//---------------------------------------------------------------------------
+static bool HLE_MulSI3( uint32_t *pu32Bytes_ );
+static bool HLE_UDivModSI4( uint32_t *pu32Bytes_ );
+static bool HLE_DivModHI4( uint32_t *pu32Bytes_ );
+static bool HLE_AddSF3( uint32_t *pu32Bytes_ );
+static bool HLE_MulSF3( uint32_t *pu32Bytes_ );
+static bool HLE_DivSF3( uint32_t *pu32Bytes_ );
+static bool HLE_Memcpy( uint32_t *pu32Bytes_ );
+static bool HLE_Memset( uint32_t *pu32Bytes_ );
+static bool HLE_Strlen( uint32_t *pu32Bytes_ );
+static bool HLE_Vfprintf( uint32_t *pu32Bytes_ );
+
+//---------------------------------------------------------------------------
+/*!
+    Routines with native implementations.  Table costs for the memory
+    routines are those of the avr-libc code; vfprintf()'s are approximate, as
+    its real cost depends on the conversions used (and excludes the cost of
+    put(), which is run on the AVR).
+*/
+static const HLE_Routine_t astRoutines[] =
+{
+    { "__mulsi3",       HLE_MulSI3,     0,  0,  0,  0 },
+    { "__udivmodsi4",   HLE_UDivModSI4, 0,  0,  0,  0 },
+    { "__divmodhi4",    HLE_DivModHI4,  0,  0,  0,  0 },
+    { "__addsf3",       HLE_AddSF3,     0,  0,  0,  0 },
+    { "__mulsf3",       HLE_MulSF3,     0,  0,  0,  0 },
+    { "__divsf3",       HLE_DivSF3,     0,  0,  0,  0 },
+    { "memcpy",         HLE_Memcpy,     11, 7,  8,  5 },
+    { "memset",         HLE_Memset,     10, 6,  6,  4 },
+    { "strlen",         HLE_Strlen,     13, 9,  5,  3 },
+    { "vfprintf",       HLE_Vfprintf,   60, 40, 50, 30 },
+};
+
+#define HLE_ROUTINE_COUNT   (sizeof(astRoutines) / sizeof(astRoutines[0]))
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE HLE_State_t astState[ HLE_ROUTINE_COUNT ];
+
+static EMU_INSTANCE uint8_t  *pu8Bound = NULL;   // Per ROM word: index of the routine bound there + 1, or 0
+static EMU_INSTANCE uint32_t  u32BoundWords = 0;
+
+static EMU_INSTANCE uint64_t  u64CyclesCharged = 0;
+
+//---------------------------------------------------------------------------
+static uint16_t HLE_GetReg16( uint8_t u8Reg_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    return (uint16_t)(pu8RAM[ u8Reg_ ] | (pu8RAM[ u8Reg_ + 1 ] << 8));
+}
+
+//---------------------------------------------------------------------------
+static void HLE_SetReg16( uint8_t u8Reg_, uint16_t u16Value_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    pu8RAM[ u8Reg_ ] = (uint8_t)u16Value_;
+    pu8RAM[ u8Reg_ + 1 ] = (uint8_t)(u16Value_ >> 8);
+}
+
+//---------------------------------------------------------------------------
+static uint32_t HLE_GetReg32( uint8_t u8Reg_ )
+{
+    return (uint32_t)HLE_GetReg16( u8Reg_ ) | ((uint32_t)HLE_GetReg16( u8Reg_ + 2 ) << 16);
+}
+
+//---------------------------------------------------------------------------
+static void HLE_SetReg32( uint8_t u8Reg_, uint32_t u32Value_ )
+{
+    HLE_SetReg16( u8Reg_, (uint16_t)u32Value_ );
+    HLE_SetReg16( u8Reg_ + 2, (uint16_t)(u32Value_ >> 16) );
+}
+
+//---------------------------------------------------------------------------
+static uint16_t HLE_GetSP( void )
+{
+    return (uint16_t)((stCPU.pstRAM->stRegisters.SPH.r << 8) | stCPU.pstRAM->stRegisters.SPL.r);
+}
+
+//---------------------------------------------------------------------------
+static void HLE_SetSP( uint16_t u16SP_ )
+{
+    stCPU.pstRAM->stRegisters.SPH.r = (uint8_t)(u16SP_ >> 8);
+    stCPU.pstRAM->stRegisters.SPL.r = (uint8_t)u16SP_;
+}
+
+//---------------------------------------------------------------------------
+static uint8_t HLE_ReturnBytes( void )
+{
+    // Size of a return address on the stack
+    return CPU_Has22BitPC() ? 3 : 2;
+}
+
+//---------------------------------------------------------------------------
+static uint32_t HLE_GetReturn( uint16_t u16SP_ )
+{
+    // Return address pushed by a call, most significant byte first from SP+1
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint32_t u32Return = 0;
+    uint8_t i;
+
+    for (i = 1; i <= HLE_ReturnBytes(); i++)
+    {
+        u32Return = (u32Return << 8) | pu8RAM[ (uint16_t)(u16SP_ + i) ];
+    }
+    return u32Return;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_IsRAM
+ *
+ * \param u32Addr_ Data memory address
+ * \param u32Len_  Number of bytes
+ * \return true if the range lies entirely within plain SRAM (not the
+ *         registers or IO range), within the u32RAMSize bytes backing the
+ *         data space
+ */
+static bool HLE_IsRAM( uint32_t u32Addr_, uint32_t u32Len_ )
+{
+    return ((u32Addr_ >= 256) && (u32Addr_ <= stCPU.u32RAMSize) &&
+            (u32Len_ <= (stCPU.u32RAMSize - u32Addr_)));
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_IsWritable
+ *
+ * \param u32Addr_ Data memory address
+ * \param u32Len_  Number of bytes
+ * \return true if the range lies entirely within plain SRAM, and no address
+ *         in it has a write callout
+ */
+static bool HLE_IsWritable( uint32_t u32Addr_, uint32_t u32Len_ )
+{
+    if (!HLE_IsRAM( u32Addr_, u32Len_ ))
+    {
+        return false;
+    }
+    return (WriteCallout_NextAddress( (uint16_t)u32Addr_, u32Addr_ + u32Len_ ) >= (u32Addr_ + u32Len_));
+}
+
+//---------------------------------------------------------------------------
+static uint16_t HLE_GetMem16( uint16_t u16Addr_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    return (uint16_t)(pu8RAM[ u16Addr_ ] | (pu8RAM[ u16Addr_ + 1 ] << 8));
+}
+
+//---------------------------------------------------------------------------
+static void HLE_SetMem16( uint16_t u16Addr_, uint16_t u16Value_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    pu8RAM[ u16Addr_ ] = (uint8_t)u16Value_;
+    pu8RAM[ u16Addr_ + 1 ] = (uint8_t)(u16Value_ >> 8);
+    CPU_DirtyRAMRange( u16Addr_, 2 );
+}
+
+//---------------------------------------------------------------------------
+static uint8_t HLE_ROMByte( uint32_t u32Addr_ )
+{
+    // Same byte order as LPM
+    return (uint8_t)(stCPU.pu16ROM[ u32Addr_ >> 1 ] >> ((u32Addr_ & 1) * 8));
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_Return
+ *
+ * Return from the routine at the PC to its caller, and charge the cost of
+ * the call - as if the routine's RET had just retired.
+ *
+ * \param u32Cycles_ Cycles to charge
+ * \param u32Insns_  Instructions to charge
+ */
+static void HLE_Return( uint32_t u32Cycles_, uint32_t u32Insns_ )
+{
+    uint16_t u16SP = HLE_GetSP();
+
+    stCPU.u32PC = HLE_GetReturn( u16SP );
+    HLE_SetSP( u16SP + HLE_ReturnBytes() );
+
+    stCPU.u64CycleCount += u32Cycles_;
+    stCPU.u64InstructionCount += u32Insns_;
+
+    // Jump the peripheral clock straight to the end of the call, running
+    // anything due on the way.
+    IO_Advance( u32Cycles_ );
+    AVR_Interrupt();
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_Measure
+ *
+ * Run the routine at the PC on the AVR until it returns to its caller, and
+ * record its cost.
+ *
+ * \param pstState_ Routine being measured
+ * \return Number of instructions run
+ */
+static uint32_t HLE_Measure( HLE_State_t *pstState_ )
+{
+    uint16_t u16SP = HLE_GetSP();
+    uint32_t u32Return = HLE_GetReturn( u16SP );
+    uint64_t u64Cycles = stCPU.u64CycleCount;
+    uint64_t u64Insns = stCPU.u64InstructionCount;
+    uint32_t u32Run = 0;
+
+    while (u32Run < AVR_HLE_MEASURE_MAX_INSNS)
+    {
+        CPU_RunCycle();
+        u32Run++;
+
+        if ((stCPU.u32PC == u32Return) && (HLE_GetSP() == (uint16_t)(u16SP + HLE_ReturnBytes())))
+        {
+            u64Cycles = stCPU.u64CycleCount - u64Cycles;
+            u64Insns = stCPU.u64InstructionCount - u64Insns;
+            if (!pstState_->u8Measured || (u64Cycles < pstState_->u32Cycles))
+            {
+                pstState_->u32Cycles = (uint32_t)u64Cycles;
+                pstState_->u32Insns = (uint32_t)u64Insns;
+            }
+            pstState_->u8Measured++;
+            break;
+        }
+    }
+
+    return u32Run;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_CallAVR
+ *
+ * Call a function on the AVR from within a native implementation, and run
+ * it until it returns.  The return address pushed is the PC - the entry of
+ * the routine being run natively.
+ *
+ * \param u16Addr_ ROM word address of the function
+ */
+static void HLE_CallAVR( uint16_t u16Addr_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint32_t u32Return = stCPU.u32PC;
+    uint16_t u16SP = HLE_GetSP();
+    uint16_t u16Push;
+    uint8_t i;
+
+    // Push the return address, low byte first (as CALL does)
+    for (i = 0; i < HLE_ReturnBytes(); i++)
+    {
+        u16Push = u16SP - i;
+        if (WriteCallout_Run( u16Push, (uint8_t)(u32Return >> (i * 8)) ))
+        {
+            pu8RAM[ u16Push ] = (uint8_t)(u32Return >> (i * 8));
+            CPU_DirtyRAM( u16Push );
+        }
+    }
+    HLE_SetSP( u16SP - HLE_ReturnBytes() );
+    stCPU.u32PC = u16Addr_;
+
+    while ((stCPU.u32PC != u32Return) || (HLE_GetSP() != u16SP))
+    {
+        CPU_RunCycle();
+    }
+}
+
+//---------------------------------------------------------------------------
+// uint32_t __mulsi3( uint32_t r22, uint32_t r18 )
+static bool HLE_MulSI3( uint32_t *pu32Bytes_ )
+{
+    (void)pu32Bytes_;
+    HLE_SetReg32( 22, HLE_GetReg32( 22 ) * HLE_GetReg32( 18 ) );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Quotient in r18, remainder in r22 = __udivmodsi4( uint32_t r22, uint32_t r18 )
+static bool HLE_UDivModSI4( uint32_t *pu32Bytes_ )
+{
+    uint32_t u32A = HLE_GetReg32( 22 );
+    uint32_t u32B = HLE_GetReg32( 18 );
+
+    (void)pu32Bytes_;
+
+    // Division by zero leaves all-ones and the dividend, as the AVR code does
+    if (u32B)
+    {
+        HLE_SetReg32( 18, u32A / u32B );
+        HLE_SetReg32( 22, u32A % u32B );
+    }
+    else
+    {
+        HLE_SetReg32( 18, 0xFFFFFFFF );
+        HLE_SetReg32( 22, u32A );
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Quotient in r22, remainder in r24 = __divmodhi4( int16_t r24, int16_t r22 )
+static bool HLE_DivModHI4( uint32_t *pu32Bytes_ )
+{
+    uint16_t u16A = HLE_GetReg16( 24 );
+    uint16_t u16B = HLE_GetReg16( 22 );
+    uint16_t u16AbsA = (u16A & 0x8000) ? (uint16_t)-u16A : u16A;
+    uint16_t u16AbsB = (u16B & 0x8000) ? (uint16_t)-u16B : u16B;
+    uint16_t u16Quot;
+    uint16_t u16Rem;
+
+    (void)pu32Bytes_;
+
+    // Unsigned division of the magnitudes, with the signs fixed up after - so
+    // division by zero comes out as it does on the AVR, too.
+    if (u16AbsB)
+    {
+        u16Quot = u16AbsA / u16AbsB;
+        u16Rem = u16AbsA % u16AbsB;
+    }
+    else
+    {
+        u16Quot = 0xFFFF;
+        u16Rem = u16AbsA;
+    }
+    if ((u16A ^ u16B) & 0x8000)
+    {
+        u16Quot = (uint16_t)-u16Quot;
+    }
+    if (u16A & 0x8000)
+    {
+        u16Rem = (uint16_t)-u16Rem;
+    }
+
+    HLE_SetReg16( 22, u16Quot );
+    HLE_SetReg16( 24, u16Rem );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+typedef enum
+{
+    HLE_FLOAT_ZERO,
+    HLE_FLOAT_NORMAL,
+    HLE_FLOAT_OTHER     //!< Subnormal, infinity or NaN
+} HLE_Float_t;
+
+//---------------------------------------------------------------------------
+static HLE_Float_t HLE_FloatClass( uint32_t u32Bits_ )
+{
+    uint32_t u32Exponent = (u32Bits_ >> 23) & 0xFF;
+
+    if (!(u32Bits_ & 0x7FFFFFFF))
+    {
+        return HLE_FLOAT_ZERO;
+    }
+    return ((u32Exponent == 0) || (u32Exponent == 0xFF)) ? HLE_FLOAT_OTHER : HLE_FLOAT_NORMAL;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_FloatOp
+ *
+ * Run a single-precision operation on r22 and r18, leaving the result in r22.
+ * Only normal numbers (and zeros, as operands) are handled - the AVR
+ * implementations differ from IEEE 754 (and each other) in their handling of
+ * subnormals, infinities, NaNs and the sign of zero.
+ *
+ * \param cOp_ Operation - '+', '*' or '/'
+ * \return true if the result was computed
+ */
+static bool HLE_FloatOp( char cOp_ )
+{
+    uint32_t u32A = HLE_GetReg32( 22 );
+    uint32_t u32B = HLE_GetReg32( 18 );
+    uint32_t u32Result;
+    HLE_Float_t eClassA = HLE_FloatClass( u32A );
+    HLE_Float_t eClassB = HLE_FloatClass( u32B );
+    float fA;
+    float fB;
+    float fResult;
+
+    if ((eClassA == HLE_FLOAT_OTHER) || (eClassB == HLE_FLOAT_OTHER))
+    {
+        return false;
+    }
+
+    memcpy( &fA, &u32A, sizeof(fA) );
+    memcpy( &fB, &u32B, sizeof(fB) );
+    switch (cOp_)
+    {
+        case '+':   fResult = fA + fB;  break;
+        case '*':   fResult = fA * fB;  break;
+        default:    fResult = fA / fB;  break;
+    }
+    memcpy( &u32Result, &fResult, sizeof(u32Result) );
+
+    // Zero results are only exact when multiplying or dividing zero - not
+    // from cancellation or underflow.
+    switch (HLE_FloatClass( u32Result ))
+    {
+        case HLE_FLOAT_ZERO:
+            if ((cOp_ == '+') || ((eClassA != HLE_FLOAT_ZERO) && (eClassB != HLE_FLOAT_ZERO)))
+            {
+                return false;
+            }
+            break;
+        case HLE_FLOAT_NORMAL:
+            break;
+        default:
+            return false;
+    }
+
+    HLE_SetReg32( 22, u32Result );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// float __addsf3( float r22, float r18 )
+static bool HLE_AddSF3( uint32_t *pu32Bytes_ )
+{
+    (void)pu32Bytes_;
+    return HLE_FloatOp( '+' );
+}
+
+//---------------------------------------------------------------------------
+// float __mulsf3( float r22, float r18 )
+static bool HLE_MulSF3( uint32_t *pu32Bytes_ )
+{
+    (void)pu32Bytes_;
+    return HLE_FloatOp( '*' );
+}
+
+//---------------------------------------------------------------------------
+// float __divsf3( float r22, float r18 )
+static bool HLE_DivSF3( uint32_t *pu32Bytes_ )
+{
+    (void)pu32Bytes_;
+    return HLE_FloatOp( '/' );
+}
+
+//---------------------------------------------------------------------------
+// void *memcpy( void *r24, const void *r22, size_t r20 )
+static bool HLE_Memcpy( uint32_t *pu32Bytes_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint16_t u16Dst = HLE_GetReg16( 24 );
+    uint16_t u16Src = HLE_GetReg16( 22 );
+    uint16_t u16Len = HLE_GetReg16( 20 );
+    uint16_t i;
+
+    if (!HLE_IsRAM( u16Src, u16Len ) || !HLE_IsWritable( u16Dst, u16Len ))
+    {
+        return false;
+    }
+
+    // The AVR code copies forwards one byte at a time, which repeats the
+    // start of the source if the destination overlaps its end.
+    if ((u16Dst > u16Src) && (u16Dst < (u16Src + u16Len)))
+    {
+        for (i = 0; i < u16Len; i++)
+        {
+            pu8RAM[ u16Dst + i ] = pu8RAM[ u16Src + i ];
+        }
+    }
+    else
+    {
+        memmove( &pu8RAM[ u16Dst ], &pu8RAM[ u16Src ], u16Len );
+    }
+    CPU_DirtyRAMRange( u16Dst, u16Len );
+
+    *pu32Bytes_ = u16Len;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// void *memset( void *r24, int r22, size_t r20 )
+static bool HLE_Memset( uint32_t *pu32Bytes_ )
+{
+    uint16_t u16Dst = HLE_GetReg16( 24 );
+    uint16_t u16Len = HLE_GetReg16( 20 );
+
+    if (!HLE_IsWritable( u16Dst, u16Len ))
+    {
+        return false;
+    }
+    memset( &stCPU.pstRAM->au8RAM[ u16Dst ], stCPU.pstRAM->au8RAM[ 22 ], u16Len );
+    CPU_DirtyRAMRange( u16Dst, u16Len );
+
+    *pu32Bytes_ = u16Len;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// size_t strlen( const char *r24 )
+static bool HLE_Strlen( uint32_t *pu32Bytes_ )
+{
+    uint16_t u16Str = HLE_GetReg16( 24 );
+    const uint8_t *pu8Str;
+    const uint8_t *pu8End;
+
+    if (!HLE_IsRAM( u16Str, 1 ))
+    {
+        return false;
+    }
+    pu8Str = &stCPU.pstRAM->au8RAM[ u16Str ];
+    pu8End = (const uint8_t*)memchr( pu8Str, 0, stCPU.u32RAMSize - u16Str );
+    if (!pu8End)
+    {
+        return false;
+    }
+
+    HLE_SetReg16( 24, (uint16_t)(pu8End - pu8Str) );
+    *pu32Bytes_ = (uint32_t)(pu8End - pu8Str);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_FormatByte
+ *
+ * \param u32Addr_ Address of the byte, in ROM or data memory
+ * \param bROM_    true to read from ROM
+ * \return The byte, or -1 if it doesn't lie within ROM/plain SRAM
+ */
+static int HLE_FormatByte( uint32_t u32Addr_, bool bROM_ )
+{
+    if (bROM_)
+    {
+        return (u32Addr_ < stCPU.u32ROMSize) ? HLE_ROMByte( u32Addr_ ) : -1;
+    }
+    return HLE_IsRAM( u32Addr_, 1 ) ? stCPU.pstRAM->au8RAM[ u32Addr_ ] : -1;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_FormatArg
+ *
+ * Take the next argument from a va_list - arguments are packed on the stack,
+ * each occupying its (promoted) size, least-significant byte first.
+ *
+ * \param pu16Ap_   va_list, advanced past the argument
+ * \param u8Bytes_  Size of the argument (2 or 4)
+ * \param pu32Arg_  [out] Argument value
+ * \return true if the argument lies within plain SRAM
+ */
+static bool HLE_FormatArg( uint16_t *pu16Ap_, uint8_t u8Bytes_, uint32_t *pu32Arg_ )
+{
+    if (!HLE_IsRAM( *pu16Ap_, u8Bytes_ ))
+    {
+        return false;
+    }
+    *pu32Arg_ = HLE_GetMem16( *pu16Ap_ );
+    if (u8Bytes_ == 4)
+    {
+        *pu32Arg_ |= (uint32_t)HLE_GetMem16( *pu16Ap_ + 2 ) << 16;
+    }
+    *pu16Ap_ += u8Bytes_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief HLE_Format
+ *
+ * Format a printf() format string and its arguments, for the conversions
+ * avr-libc's vfprintf() and the host's snprintf() agree on.
+ *
+ * \param u16Fmt_   Address of the format string
+ * \param bROM_     true if the format string is in ROM
+ * \param u16Ap_    va_list holding the arguments
+ * \param szOut_    [out] Formatted output (HLE_PRINTF_MAX bytes)
+ * \param pu32Len_  [out] Length of the formatted output
+ * \return true if the whole format string was formatted
+ */
+static bool HLE_Format( uint16_t u16Fmt_, bool bROM_, uint16_t u16Ap_, char *szOut_, uint32_t *pu32Len_ )
+{
+    char szSpec[16];
+    char szString[ HLE_PRINTF_MAX ];
+    uint32_t u32Fmt = u16Fmt_;
+    uint32_t u32Len = 0;
+    uint32_t u32Arg;
+    uint8_t u8Flags;
+    int iWidth;
+    int iPrec;
+    int iSpec;
+    int iWritten;
+    int c;
+    uint32_t i;
+
+    for (;;)
+    {
+        c = HLE_FormatByte( u32Fmt++, bROM_ );
+        if (c < 0)
+        {
+            return false;
+        }
+        if (!c)
+        {
+            break;
+        }
+
+        if (c != '%')
+        {
+            if (u32Len >= (HLE_PRINTF_MAX - 1))
+            {
+                return false;
+            }
+            szOut_[ u32Len++ ] = (char)c;
+            continue;
+        }
+
+        c = HLE_FormatByte( u32Fmt++, bROM_ );
+        if (c == '%')
+        {
+            if (u32Len >= (HLE_PRINTF_MAX - 1))
+            {
+                return false;
+            }
+            szOut_[ u32Len++ ] = '%';
+            continue;
+        }
+
+        // Flags, width, precision and length
+        u8Flags = 0;
+        iWidth = 0;
+        iPrec = 0;
+        for (;; c = HLE_FormatByte( u32Fmt++, bROM_ ))
+        {
+            if      (c == '-')  { u8Flags |= HLE_FLAG_LEFT; }
+            else if (c == '+')  { u8Flags |= HLE_FLAG_PLUS; }
+            else if (c == ' ')  { u8Flags |= HLE_FLAG_SPACE; }
+            else if (c == '0')  { u8Flags |= HLE_FLAG_ZERO; }
+            else                { break; }
+        }
+        if (c == '*')
+        {
+            if (!HLE_FormatArg( &u16Ap_, 2, &u32Arg ))
+            {
+                return false;
+            }
+            iWidth = (int16_t)u32Arg;
+            c = HLE_FormatByte( u32Fmt++, bROM_ );
+        }
+        else
+        {
+            for (; (c >= '0') && (c <= '9'); c = HLE_FormatByte( u32Fmt++, bROM_ ))
+            {
+                iWidth = (iWidth * 10) + (c - '0');
+                if (iWidth > 255)
+                {
+                    return false;
+                }
+            }
+        }
+        if (c == '.')
+        {
+            u8Flags |= HLE_FLAG_PREC;
+            c = HLE_FormatByte( u32Fmt++, bROM_ );
+            if (c == '*')
+            {
+                if (!HLE_FormatArg( &u16Ap_, 2, &u32Arg ))
+                {
+                    return false;
+                }
+                iPrec = (int16_t)u32Arg;
+                c = HLE_FormatByte( u32Fmt++, bROM_ );
+            }
+            else
+            {
+                for (; (c >= '0') && (c <= '9'); c = HLE_FormatByte( u32Fmt++, bROM_ ))
+                {
+                    iPrec = (iPrec * 10) + (c - '0');
+                    if (iPrec > 255)
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        while (c == 'h')
+        {
+            c = HLE_FormatByte( u32Fmt++, bROM_ );
+        }
+        if (c == 'l')
+        {
+            u8Flags |= HLE_FLAG_LONG;
+            c = HLE_FormatByte( u32Fmt++, bROM_ );
+        }
+
+        // avr-libc keeps widths and precisions in a byte; leave anything out
+        // of range, or negative, to the AVR code.
+        if ((iWidth < 0) || (iWidth > 255) || (iPrec < 0) || (iPrec > 255))
+        {
+            return false;
+        }
+
+        iSpec = 0;
+        szSpec[ iSpec++ ] = '%';
+        if (u8Flags & HLE_FLAG_LEFT)    { szSpec[ iSpec++ ] = '-'; }
+        if (u8Flags & HLE_FLAG_PLUS)    { szSpec[ iSpec++ ] = '+'; }
+        if (u8Flags & HLE_FLAG_SPACE)   { szSpec[ iSpec++ ] = ' '; }
+        if (u8Flags & HLE_FLAG_ZERO)    { szSpec[ iSpec++ ] = '0'; }
+        szSpec[ iSpec++ ] = '*';
+        szSpec[ iSpec++ ] = '.';
+        szSpec[ iSpec++ ] = '*';
+
+        // A negative precision is taken as if none were given
+        if (!(u8Flags & HLE_FLAG_PREC))
+        {
+            iPrec = -1;
+        }
+
+        switch (c)
+        {
+            case 'c':
+            {
+                // Formatted as a one-character string, so that the precision
+                // can be passed regardless - which can't hold a NUL.
+                if ((u8Flags & (HLE_FLAG_ZERO | HLE_FLAG_LONG)) || !HLE_FormatArg( &u16Ap_, 2, &u32Arg ) ||
+                    !(uint8_t)u32Arg)
+                {
+                    return false;
+                }
+                szString[0] = (char)u32Arg;
+                szString[1] = '\0';
+                szSpec[ iSpec++ ] = 's';
+                szSpec[ iSpec ] = '\0';
+                iWritten = snprintf( &szOut_[ u32Len ], HLE_PRINTF_MAX - u32Len, szSpec,
+                                     iWidth, -1, szString );
+            }
+                break;
+            case 's':
+            case 'S':
+            {
+                if ((u8Flags & (HLE_FLAG_ZERO | HLE_FLAG_LONG)) || !HLE_FormatArg( &u16Ap_, 2, &u32Arg ))
+                {
+                    return false;
+                }
+                // %S reads the string from ROM
+                for (i = 0; ; i++)
+                {
+                    int iByte = (c == 'S') ? HLE_FormatByte( u32Arg + i, true )
+                                           : HLE_FormatByte( u32Arg + i, false );
+                    if ((iByte < 0) || (i >= (HLE_PRINTF_MAX - 1)))
+                    {
+                        return false;
+                    }
+                    szString[i] = (char)iByte;
+                    if (!iByte)
+                    {
+                        break;
+                    }
+                }
+                szSpec[ iSpec++ ] = 's';
+                szSpec[ iSpec ] = '\0';
+                iWritten = snprintf( &szOut_[ u32Len ], HLE_PRINTF_MAX - u32Len, szSpec,
+                                     iWidth, iPrec, szString );
+            }
+                break;
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            {
+                if (!HLE_FormatArg( &u16Ap_, (u8Flags & HLE_FLAG_LONG) ? 4 : 2, &u32Arg ))
+                {
+                    return false;
+                }
+                // Sign-extend (or not) to a host long
+                if (!(u8Flags & HLE_FLAG_LONG))
+                {
+                    u32Arg = ((c == 'd') || (c == 'i')) ? (uint32_t)(int32_t)(int16_t)u32Arg
+                                                        : (uint16_t)u32Arg;
+                }
+                // Zero converted with zero precision is one corner left to the AVR
+                if ((u8Flags & HLE_FLAG_PREC) && !u32Arg)
+                {
+                    return false;
+                }
+                szSpec[ iSpec++ ] = 'l';
+                szSpec[ iSpec++ ] = (char)c;
+                szSpec[ iSpec ] = '\0';
+                if ((c == 'd') || (c == 'i'))
+                {
+                    iWritten = snprintf( &szOut_[ u32Len ], HLE_PRINTF_MAX - u32Len, szSpec,
+                                         iWidth, iPrec, (long)(int32_t)u32Arg );
+                }
+                else
+                {
+                    iWritten = snprintf( &szOut_[ u32Len ], HLE_PRINTF_MAX - u32Len, szSpec,
+                                         iWidth, iPrec, (unsigned long)u32Arg );
+                }
+            }
+                break;
+            default:
+                // Floating point, pointers, '#', and anything unrecognized
+                return false;
+        }
+
+        if ((iWritten < 0) || ((u32Len + (uint32_t)iWritten) >= (HLE_PRINTF_MAX - 1)))
+        {
+            return false;
+        }
+        u32Len += (uint32_t)iWritten;
+    }
+
+    *pu32Len_ = u32Len;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// int vfprintf( FILE *r24, const char *r22, va_list r20 )
+static bool HLE_Vfprintf( uint32_t *pu32Bytes_ )
+{
+    char szOut[ HLE_PRINTF_MAX ];
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint16_t u16Stream = HLE_GetReg16( 24 );
+    uint16_t u16Fmt = HLE_GetReg16( 22 );
+    uint16_t u16Ap = HLE_GetReg16( 20 );
+    uint16_t u16Buf;
+    uint16_t u16Put;
+    int16_t s16Size;
+    uint32_t u32Len;
+    uint32_t u32Copy;
+    uint8_t u8Flags;
+    uint32_t i;
+
+    if (!HLE_IsWritable( u16Stream, HLE_FILE_BYTES ))
+    {
+        return false;
+    }
+    u8Flags = pu8RAM[ u16Stream + HLE_FILE_FLAGS ];
+
+    if (!(u8Flags & HLE_FILE_SWR))
+    {
+        HLE_SetMem16( u16Stream + HLE_FILE_LEN, 0 );
+        HLE_SetReg16( 24, 0xFFFF );
+        *pu32Bytes_ = 0;
+        return true;
+    }
+
+    if (!HLE_Format( u16Fmt, (u8Flags & HLE_FILE_SPGM) != 0, u16Ap, szOut, &u32Len ))
+    {
+        return false;
+    }
+
+    if (u8Flags & HLE_FILE_SSTR)
+    {
+        // String stream - characters past the end of the buffer are counted,
+        // but not written.
+        u16Buf = HLE_GetMem16( u16Stream + HLE_FILE_BUF );
+        s16Size = (int16_t)HLE_GetMem16( u16Stream + HLE_FILE_SIZE );
+        u32Copy = (s16Size <= 0) ? 0 : (u32Len < (uint32_t)s16Size) ? u32Len : (uint32_t)s16Size;
+        if (!HLE_IsWritable( u16Buf, u32Copy ))
+        {
+            return false;
+        }
+        memcpy( &pu8RAM[ u16Buf ], szOut, u32Copy );
+        CPU_DirtyRAMRange( u16Buf, u32Copy );
+        HLE_SetMem16( u16Stream + HLE_FILE_BUF, (uint16_t)(u16Buf + u32Copy) );
+        HLE_SetMem16( u16Stream + HLE_FILE_LEN, (uint16_t)u32Len );
+    }
+    else
+    {
+        // Device stream - each character goes to put( c, stream ) on the AVR,
+        // and is counted if it returns 0.  The call pushes a return address.
+        u16Put = HLE_GetMem16( u16Stream + HLE_FILE_PUT );
+        if (!u16Put || !HLE_IsRAM( HLE_GetSP() - (HLE_ReturnBytes() - 1), HLE_ReturnBytes() ))
+        {
+            return false;
+        }
+        HLE_SetMem16( u16Stream + HLE_FILE_LEN, 0 );
+        for (i = 0; i < u32Len; i++)
+        {
+            HLE_SetReg16( 24, (uint8_t)szOut[i] );
+            HLE_SetReg16( 22, u16Stream );
+            HLE_CallAVR( u16Put );
+            if (!HLE_GetReg16( 24 ))
+            {
+                HLE_SetMem16( u16Stream + HLE_FILE_LEN, HLE_GetMem16( u16Stream + HLE_FILE_LEN ) + 1 );
+            }
+        }
+    }
+
+    HLE_SetReg16( 24, HLE_GetMem16( u16Stream + HLE_FILE_LEN ) );
+    *pu32Bytes_ = u32Len;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void AVR_HLE_Init( uint32_t u32ROMSize_ )
+{
+    free( pu8Bound );
+
+    u32BoundWords = u32ROMSize_ / sizeof(uint16_t);
+    pu8Bound = (uint8_t*)calloc( u32BoundWords, sizeof(uint8_t) );
+    memset( astState, 0, sizeof(astState) );
+    stCPU.bHLE = false;
+}
+
+//---------------------------------------------------------------------------
+uint32_t AVR_HLE_Bind( void )
+{
+    Debug_Symbol_t *pstSymbol;
+    uint32_t u32Bound = 0;
+    uint32_t i;
+
+    if (!pu8Bound)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < HLE_ROUTINE_COUNT; i++)
+    {
+        pstSymbol = Symbol_Find_Func_By_Name( astRoutines[i].szName );
+        if (!pstSymbol || (pstSymbol->u32StartAddr >= u32BoundWords))
+        {
+            continue;
+        }
+
+        pu8Bound[ pstSymbol->u32StartAddr ] = (uint8_t)(i + 1);
+        astState[i].bBound = true;
+        if (astRoutines[i].u16Cycles)
+        {
+            astState[i].u32Cycles = astRoutines[i].u16Cycles;
+            astState[i].u32Insns = astRoutines[i].u16Insns;
+            astState[i].u8Measured = AVR_HLE_MEASURE_CALLS;
+        }
+        u32Bound++;
+    }
+
+    stCPU.bHLE = (u32Bound != 0);
+    return u32Bound;
+}
+
+//---------------------------------------------------------------------------
+uint32_t AVR_HLE_Call( uint32_t u32Limit_ )
+{
+    const HLE_Routine_t *pstRoutine;
+    HLE_State_t *pstState;
+    uint64_t u64Insns = stCPU.u64InstructionCount;
+    uint32_t u32Bytes = 0;
+    uint32_t u32Cycles;
+    uint32_t u32Insns;
+    uint32_t u32Run;
+    uint8_t u8Index;
+
+    if ((stCPU.u32PC >= u32BoundWords) || !u32Limit_)
+    {
+        return 0;
+    }
+    u8Index = pu8Bound[ stCPU.u32PC ];
+    if (!u8Index)
+    {
+        return 0;
+    }
+    pstRoutine = &astRoutines[ u8Index - 1 ];
+    pstState = &astState[ u8Index - 1 ];
+
+    // The return address has to be where RET would find it
+    if (!HLE_IsRAM( HLE_GetSP() + 1, HLE_ReturnBytes() ))
+    {
+        pstState->u64Emulated++;
+        return 0;
+    }
+
+    // Calls always run to completion, and so may run past the limit - but
+    // the result doesn't depend on how the instructions run are batched up.
+    if (pstState->u8Measured < AVR_HLE_MEASURE_CALLS)
+    {
+        pstState->u64Emulated++;
+        u32Run = HLE_Measure( pstState );
+    }
+    else if (pstRoutine->pfHandler( &u32Bytes ))
+    {
+        u32Cycles = pstState->u32Cycles + (u32Bytes * pstRoutine->u8ByteCycles);
+        u32Insns = pstState->u32Insns + (u32Bytes * pstRoutine->u8ByteInsns);
+        HLE_Return( u32Cycles, u32Insns );
+
+        pstState->u64Native++;
+        u64CyclesCharged += u32Cycles;
+        u64Insns = stCPU.u64InstructionCount - u64Insns;
+        u32Run = (u64Insns < u32Limit_) ? (uint32_t)u64Insns : u32Limit_;
+    }
+    else
+    {
+        pstState->u64Emulated++;
+        return 0;
+    }
+    return (u32Run < u32Limit_) ? u32Run : u32Limit_;
+}
+
+//---------------------------------------------------------------------------
+void AVR_HLE_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+    uint32_t u32Bound = 0;
+    uint32_t i;
+
+    if (!pu8Bound)
+    {
+        return;
+    }
+
+    for (i = u32Addr_; (i < (u32Addr_ + u32Words_)) && (i < u32BoundWords); i++)
+    {
+        if (pu8Bound[i])
+        {
+            astState[ pu8Bound[i] - 1 ].bBound = false;
+            pu8Bound[i] = 0;
+        }
+    }
+
+    for (i = 0; i < HLE_ROUTINE_COUNT; i++)
+    {
+        u32Bound += astState[i].bBound;
+    }
+    stCPU.bHLE = (u32Bound != 0);
+}
+
+//---------------------------------------------------------------------------
+void AVR_HLE_Report( void )
+{
+    char szLabel[64];
+    uint32_t i;
+
+    printf( "=====================================================================================\n");
+    for (i = 0; i < HLE_ROUTINE_COUNT; i++)
+    {
+        if (!astState[i].bBound)
+        {
+            continue;
+        }
+        snprintf( szLabel, sizeof(szLabel), "%s calls run natively", astRoutines[i].szName );
+        printf( "%60s: %llu\n", szLabel, (unsigned long long)astState[i].u64Native );
+        snprintf( szLabel, sizeof(szLabel), "%s calls run on the AVR", astRoutines[i].szName );
+        printf( "%60s: %llu\n", szLabel, (unsigned long long)astState[i].u64Emulated );
+    }
+    printf( "%60s: %llu\n", "Cycles charged for native calls", (unsigned long long)u64CyclesCharged );
+}
+
+//---------------------------------------------------------------------------
+uint32_t AVR_HLE_StateSize( void )
+{
+    return sizeof(astState) + sizeof(u64CyclesCharged);
+}
+
+//---------------------------------------------------------------------------
+void AVR_HLE_SaveState( void *pvState_ )
+{
+    uint8_t *pu8State = (uint8_t*)pvState_;
+
+    memcpy( pu8State, astState, sizeof(astState) );
+    memcpy( pu8State + sizeof(astState), &u64CyclesCharged, sizeof(u64CyclesCharged) );
+}
+
+//---------------------------------------------------------------------------
+void AVR_HLE_RestoreState( const void *pvState_ )
+{
+    const uint8_t *pu8State = (const uint8_t*)pvState_;
+    uint32_t i;
+
+    for (i = 0; i < HLE_ROUTINE_COUNT; i++)
+    {
+        bool bBound = astState[i].bBound;
+        memcpy( &astState[i], pu8State + (i * sizeof(HLE_State_t)), sizeof(HLE_State_t) );
+        astState[i].bBound = bBound;
+    }
+    memcpy( &u64CyclesCharged, pu8State + sizeof(astState), sizeof(u64CyclesCharged) );
+}
@@ -0,0 +1,133 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_hle.h
+
+  \brief High-level emulation of C runtime library routines.
+*/
+
+#ifndef __AVR_HLE_H__
+#define __AVR_HLE_H__
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+/*!
+    Number of calls to a routine with no fixed cost that are run on the AVR,
+    to measure its cost, before it is run natively.
+*/
+#define AVR_HLE_MEASURE_CALLS       (4)
+
+//---------------------------------------------------------------------------
+/*!
+    Longest a call being measured may run for, in instructions - calls that
+    take longer (i.e. the routine was switched away from in an interrupt)
+    are left to finish as normal, and aren't counted as measured.
+*/
+#define AVR_HLE_MEASURE_MAX_INSNS   (4096)
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_Init
+ *
+ * Allocate the (empty) binding table for a ROM of the given size.  Routines
+ * are only run natively once this has been called, and the routines bound
+ * with AVR_HLE_Bind().
+ *
+ * \param u32ROMSize_ Size of the CPU's ROM in bytes
+ */
+void AVR_HLE_Init( uint32_t u32ROMSize_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_Bind
+ *
+ * Look up each routine with a native implementation in the function symbol
+ * table (populated when loading an ELF file), and bind it to the routine's
+ * entry point.
+ *
+ * \return Number of routines bound
+ */
+uint32_t AVR_HLE_Bind( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_Call
+ *
+ * Called before running the instruction at the PC.  If the PC is the entry
+ * point of a bound routine, run the whole routine natively and return to
+ * its caller, charging the cycles and instructions the AVR code would have
+ * taken.  Calls the native implementation can't reproduce exactly (memory
+ * outside of plain SRAM, watched addresses, unusual arguments) are left to
+ * the AVR code.
+ *
+ * \param u32Limit_ Maximum number of instructions to run
+ *
+ * \return Number of instructions run (at most u32Limit_), or 0 if the
+ *         instruction at the PC is to be run as normal
+ */
+uint32_t AVR_HLE_Call( uint32_t u32Limit_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_Invalidate
+ *
+ * Unbind any routines whose entry point lies in a modified range of ROM.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of words modified
+ */
+void AVR_HLE_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_Report
+ *
+ * Print the number of calls to each bound routine run natively and on the
+ * AVR, and the cycles charged for native calls, to standard output.
+ */
+void AVR_HLE_Report( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_StateSize
+ *
+ * \return Size of the buffer needed by AVR_HLE_SaveState()
+ */
+uint32_t AVR_HLE_StateSize( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_SaveState
+ *
+ * Copy the cost measured for each routine, and the call counts, into a
+ * buffer - the costs charged for later native calls depend on them.
+ *
+ * \param pvState_ Buffer of AVR_HLE_StateSize() bytes
+ */
+void AVR_HLE_SaveState( void *pvState_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_HLE_RestoreState
+ *
+ * Restore the state saved by AVR_HLE_SaveState().  The routine bindings are
+ * left as they are.
+ *
+ * \param pvState_ Buffer filled in by AVR_HLE_SaveState()
+ */
+void AVR_HLE_RestoreState( const void *pvState_ );
+
+#endif
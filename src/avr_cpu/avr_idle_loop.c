@@ -0,0 +1,1314 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_idle_loop.c
+
+  \brief Detection and skipping of delay, polling and block memory loops.
+
+  Firmware spends much of its time in small loops that do nothing but wait -
+  software delays counting a register down to zero, and busy-waits polling a
+  peripheral register, or a flag in RAM set from an interrupt - or that move
+  memory around one byte at a time.  Whenever an instruction branches
+  backwards, the loop it closes is analyzed (once, from ROM) to see whether
+  it falls into one of three classes:
+
+  - Delay loops: a DEC, SBIW or SUBI/SBCI chain decrementing a register (or
+    a run of registers) by one, followed by a BRNE back to the head.  The
+    number of iterations remaining is the counter value, so any number of
+    them short of the last can be run at once, by subtracting from the
+    counter.
+
+  - Polling loops: a straight run of loads, bit tests, logic and compares
+    ending in a backward branch, which writes nothing but registers and
+    flags, and never reads a register or flag before writing it in the same
+    iteration if the loop writes it at all.  Once an iteration has been seen
+    to run straight through, the registers and flags it leaves behind are a
+    fixed point - every later iteration re-computes the same values from the
+    same inputs - so iterations can be skipped for as long as nothing the
+    loop reads can change.
+
+  - Block loops: a post-increment load (LD or LPM) and/or store (ST),
+    followed by a tail that either counts a register down (as above),
+    compares one of the pointers against an end address (CP/CPI + CPC), or
+    compares the byte loaded against a terminator - memcpy(), memset(),
+    strcpy(), strlen() and the C runtime's .data/.bss initialization all
+    look like this.  The number of iterations remaining is known from the
+    counter, the pointer or a scan for the terminator, and the memory they
+    touch is moved with a single memmove()/memset() on the host.  Only plain
+    SRAM is ever touched this way: iterations which would access registers,
+    the IO range, or an address with a write callout (including watchpoints)
+    are left to the interpreter.  Since the tail is the only part of the
+    loop to write the flags, the skip stops just short of the tail of the
+    last iteration skipped, and leaves that to the interpreter too - so the
+    flags come out exactly as they would have.
+
+  Only peripheral events can change memory behind the CPU's back, and skips
+  always stop short of the next one, never starting with an interrupt
+  pending.  Loops that read nothing in the IO range can't observe the
+  peripherals at all, so for those the CPU is treated as idle (see
+  CPU_IsIdle()), and peripherals only schedule the events which can raise an
+  interrupt - exactly as when the CPU is asleep.
+
+  The cycle count, registers and peripheral state after a skip are identical
+  to running the loop one instruction at a time.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "emu_config.h"
+
+#include "avr_cpu.h"
+#include "avr_io.h"
+#include "avr_op_decode.h"
+#include "avr_op_cycles.h"
+#include "avr_op_size.h"
+#include "avr_opcodes.h"
+#include "avr_idle_loop.h"
+#include "write_callout.h"
+
+#if FEATURE_USE_IDLE_LOOPS
+
+//---------------------------------------------------------------------------
+// Per-word loop state.  Any other value is an index into astLoops[], offset
+// by IDLE_LOOP_FIRST.
+#define IDLE_LOOP_UNKNOWN       (0)     //!< Not yet analyzed
+#define IDLE_LOOP_NONE          (1)     //!< Not the backward branch of a loop that can be skipped
+#define IDLE_LOOP_FIRST         (2)
+
+#define IDLE_LOOP_MAX_LOOPS     (256 - IDLE_LOOP_FIRST)
+
+//! Widest delay loop counter, in bytes (SUBI + 3x SBCI)
+#define IDLE_LOOP_MAX_COUNTER   (4)
+
+//! Base register for memory reads at a fixed address
+#define IDLE_LOOP_ABSOLUTE      (0xFF)
+
+//! Block loop pointer that isn't used
+#define IDLE_LOOP_NO_POINTER    (0)
+
+//! SREG flags written by the instructions allowed in polling loops
+#define IDLE_LOOP_FLAGS_ARITH   (0x3F)  // H S V N Z C
+#define IDLE_LOOP_FLAGS_LOGIC   (0x1E)  // S V N Z
+#define IDLE_LOOP_FLAGS_CARRY   (0x03)  // Z C
+
+//---------------------------------------------------------------------------
+typedef enum
+{
+    IDLE_LOOP_DELAY,            //!< Counts a register down to zero
+    IDLE_LOOP_POLL,             //!< Re-reads memory until it changes
+    IDLE_LOOP_BLOCK             //!< Copies, fills or scans a block of memory
+} IdleLoop_Kind_t;
+
+//---------------------------------------------------------------------------
+typedef enum
+{
+    IDLE_LOOP_END_COUNT,        //!< Counts a register down to zero (or past it)
+    IDLE_LOOP_END_POINTER,      //!< Compares a pointer against an end address
+    IDLE_LOOP_END_TERMINATOR    //!< Compares the byte loaded against a terminator
+} IdleLoop_End_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Data memory read by a polling loop - either a fixed address, or an offset
+    from one of the X/Y/Z pointers (which the loop can't modify).
+*/
+typedef struct
+{
+    uint8_t     u8Base;         //!< Low register of the pointer, or IDLE_LOOP_ABSOLUTE
+    uint16_t    u16Offset;      //!< Address, or displacement from the pointer
+} IdleLoop_Read_t;
+
+//---------------------------------------------------------------------------
+typedef struct
+{
+    bool        bUsed;          //!< Slot holds a loop referenced from pu8State[]
+    IdleLoop_Kind_t eKind;
+    uint32_t    u32Head;        //!< ROM word address the loop branches back to
+    uint8_t     u8Insns;        //!< Instructions per iteration
+    uint8_t     u8Cycles;       //!< Cycles per iteration
+
+    // Delay loops
+    uint8_t     u8CounterBytes;
+    uint8_t     au8Counter[ IDLE_LOOP_MAX_COUNTER ];    //!< Counter registers, LSB first
+
+    // Polling loops
+    uint8_t     u8Reads;
+    IdleLoop_Read_t astReads[ AVR_IDLE_LOOP_MAX_INSNS ];
+
+    bool        bArmed;         //!< Counts below were taken at the head of an iteration
+    uint64_t    u64ArmInsns;
+    uint64_t    u64ArmCycles;
+    uint64_t    u64ArmEvent;    //!< Next peripheral event, as of the same point
+
+    // Block loops
+    uint8_t     u8Load;         //!< Low register of the pointer loaded through, or IDLE_LOOP_NO_POINTER
+    bool        bLoadROM;       //!< Loads are from ROM (LPM), rather than data memory
+    uint8_t     u8Store;        //!< Low register of the pointer stored through, or IDLE_LOOP_NO_POINTER
+    uint8_t     u8Value;        //!< Register loaded and/or stored
+    IdleLoop_End_t eEnd;
+    bool        bBorrow;        //!< Counter runs past zero (BRCC) rather than to it (BRNE)
+    uint8_t     u8EndPointer;   //!< Low register of the pointer compared against the end address
+    uint8_t     u8EndLow;       //!< Register holding the end address low byte, or IDLE_LOOP_ABSOLUTE
+    uint8_t     u8EndHigh;      //!< Register holding the end address high byte
+    uint8_t     u8Terminator;   //!< Register holding the terminator, or IDLE_LOOP_ABSOLUTE
+    uint8_t     u8K;            //!< End address low byte, or terminator, if IDLE_LOOP_ABSOLUTE
+    uint32_t    u32Tail;        //!< ROM word address of the first instruction after the load/store
+
+    uint8_t     u8TailInsns;    //!< Instructions per iteration left to the interpreter
+    uint8_t     u8TailCycles;   //!< Cycles per iteration left to the interpreter
+} IdleLoop_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Operands of an instruction within a candidate loop.
+*/
+typedef struct
+{
+    uint8_t     u8Index;        //!< Opcode function index (see AVR_Opcode_Index())
+    uint8_t     u8Size;
+    uint8_t     u8Cycles;
+    uint8_t     u8Rd;
+    uint8_t     u8Rr;
+    uint8_t     u8A;
+    uint8_t     u8q;
+    uint16_t    u16K;
+    uint32_t    u32Target;      //!< Destination of a relative jump or branch
+} IdleLoop_Insn_t;
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE uint8_t     *pu8State = NULL;        //!< Loop state, indexed by ROM word of the backward branch
+static EMU_INSTANCE uint32_t     u32StateWords = 0;
+static EMU_INSTANCE IdleLoop_t   astLoops[ IDLE_LOOP_MAX_LOOPS ];
+
+static EMU_INSTANCE uint64_t     u64DelayLoops = 0;      // Loops recognized...
+static EMU_INSTANCE uint64_t     u64PollLoops = 0;
+static EMU_INSTANCE uint64_t     u64BlockLoops = 0;
+static EMU_INSTANCE uint64_t     u64BytesMoved = 0;
+static EMU_INSTANCE uint64_t     u64Skips = 0;           // ... and skipped
+static EMU_INSTANCE uint64_t     u64InsnsSkipped = 0;
+static EMU_INSTANCE uint64_t     u64CyclesSkipped = 0;
+
+//---------------------------------------------------------------------------
+static bool IdleLoop_IsBranch( uint8_t u8Index_ )
+{
+    return ((u8Index_ >= AVR_OPCODE_INDEX_BREQ) && (u8Index_ <= AVR_OPCODE_INDEX_BRID));
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_Decode
+ *
+ * Decode the instruction at a given address.  Clobbers the CPU's PC and
+ * intermediate registers.
+ *
+ * \param u32Addr_ ROM word address of the instruction
+ * \param pstInsn_ [out] Decoded instruction
+ * \return true if the instruction was decoded
+ */
+static bool IdleLoop_Decode( uint32_t u32Addr_, IdleLoop_Insn_t *pstInsn_ )
+{
+    uintptr_t uRAM = (uintptr_t)stCPU.pstRAM->au8RAM;
+    uint16_t OP = stCPU.pu16ROM[ u32Addr_ ];
+
+    pstInsn_->u8Index  = AVR_Opcode_Index( AVR_Opcode_Function( OP ) );
+    pstInsn_->u8Size   = AVR_Opcode_Size( OP );
+    pstInsn_->u8Cycles = AVR_Opcode_Cycles( OP );
+
+    if ((pstInsn_->u8Index == AVR_OPCODE_INDEX_INVALID) ||
+        AVR_Decoder_ClocksIO( OP ) ||
+        ((u32Addr_ + pstInsn_->u8Size) > u32StateWords))
+    {
+        return false;
+    }
+
+    stCPU.u32PC = u32Addr_;
+    AVR_Decode( OP );
+
+    if (pstInsn_->u8Index == AVR_OPCODE_INDEX_SBIW)
+    {
+        pstInsn_->u8Rd = (uint8_t)((uintptr_t)stCPU.Rd16 - uRAM);
+    }
+    else
+    {
+        pstInsn_->u8Rd = (uint8_t)((uintptr_t)stCPU.Rd - uRAM);
+    }
+    pstInsn_->u8Rr      = (uint8_t)((uintptr_t)stCPU.Rr - uRAM);
+    pstInsn_->u8A       = stCPU.A;
+    pstInsn_->u8q       = stCPU.q;
+    pstInsn_->u16K      = stCPU.K;
+    pstInsn_->u32Target = (uint32_t)((int32_t)u32Addr_ + stCPU.k_s + 1) & stCPU.u32PCMask;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_MatchCounter
+ *
+ * Check whether the instructions before a loop's backward branch decrement a
+ * counter by one, and fill in the counter.
+ *
+ * \param pstLoop_  Loop to fill in
+ * \param astInsns_ Instructions to check, ending with the backward branch
+ * \param u8Count_  Number of instructions, including the branch
+ * \return true if the instructions decrement a counter
+ */
+static bool IdleLoop_MatchCounter( IdleLoop_t *pstLoop_, const IdleLoop_Insn_t *astInsns_, uint8_t u8Count_ )
+{
+    uint32_t u32Seen = 0;
+    uint8_t i;
+
+    if (u8Count_ < 2)
+    {
+        return false;
+    }
+
+    switch (astInsns_[0].u8Index)
+    {
+    case AVR_OPCODE_INDEX_DEC:
+        if (u8Count_ != 2)
+        {
+            return false;
+        }
+        pstLoop_->au8Counter[0] = astInsns_[0].u8Rd;
+        pstLoop_->u8CounterBytes = 1;
+        break;
+    case AVR_OPCODE_INDEX_SBIW:
+        if ((u8Count_ != 2) || (astInsns_[0].u16K != 1))
+        {
+            return false;
+        }
+        pstLoop_->au8Counter[0] = astInsns_[0].u8Rd;
+        pstLoop_->au8Counter[1] = astInsns_[0].u8Rd + 1;
+        pstLoop_->u8CounterBytes = 2;
+        break;
+    case AVR_OPCODE_INDEX_SUBI:
+        // SUBI on the low byte, then SBCI carrying into each higher byte
+        if ((u8Count_ > (IDLE_LOOP_MAX_COUNTER + 1)) || (astInsns_[0].u16K != 1))
+        {
+            return false;
+        }
+        for (i = 0; i < (u8Count_ - 1); i++)
+        {
+            if ((i && ((astInsns_[i].u8Index != AVR_OPCODE_INDEX_SBCI) || (astInsns_[i].u16K != 0))) ||
+                (u32Seen & (1UL << astInsns_[i].u8Rd)))
+            {
+                return false;
+            }
+            u32Seen |= (1UL << astInsns_[i].u8Rd);
+            pstLoop_->au8Counter[i] = astInsns_[i].u8Rd;
+        }
+        pstLoop_->u8CounterBytes = u8Count_ - 1;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_MatchDelay
+ *
+ * Check whether a loop body is a delay loop, and fill in its counter.
+ *
+ * \param pstLoop_  Loop to fill in
+ * \param astInsns_ Instructions in the loop, ending with the backward branch
+ * \param u8Count_  Number of instructions in the loop
+ * \return true if the loop is a delay loop
+ */
+static bool IdleLoop_MatchDelay( IdleLoop_t *pstLoop_, const IdleLoop_Insn_t *astInsns_, uint8_t u8Count_ )
+{
+    if ((astInsns_[ u8Count_ - 1 ].u8Index != AVR_OPCODE_INDEX_BRNE) ||
+        !IdleLoop_MatchCounter( pstLoop_, astInsns_, u8Count_ ))
+    {
+        return false;
+    }
+
+    pstLoop_->eKind = IDLE_LOOP_DELAY;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void IdleLoop_AddRead( IdleLoop_t *pstLoop_, uint8_t u8Base_, uint16_t u16Offset_ )
+{
+    pstLoop_->astReads[ pstLoop_->u8Reads ].u8Base = u8Base_;
+    pstLoop_->astReads[ pstLoop_->u8Reads ].u16Offset = u16Offset_;
+    pstLoop_->u8Reads++;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_MatchPoll
+ *
+ * Check whether a loop body is a polling loop, and fill in the memory it
+ * reads.
+ *
+ * \param pstLoop_   Loop to fill in
+ * \param astInsns_  Instructions in the loop, ending with the backward branch
+ * \param u8Count_   Number of instructions in the loop
+ * \param u32Branch_ ROM word address of the backward branch
+ * \return true if the loop is a polling loop
+ */
+static bool IdleLoop_MatchPoll( IdleLoop_t *pstLoop_, const IdleLoop_Insn_t *astInsns_, uint8_t u8Count_, uint32_t u32Branch_ )
+{
+    uint32_t u32RegsWritten = 0;
+    uint32_t u32RegsEarly = 0;      // Read before being written in the iteration
+    uint8_t  u8FlagsWritten = 0;
+    uint8_t  u8FlagsEarly = 0;
+    uint8_t  u8SREG = offsetof(AVRRegisterFile, SREG);
+    uint8_t i;
+
+    for (i = 0; i < u8Count_; i++)
+    {
+        const IdleLoop_Insn_t *pstInsn = &astInsns_[i];
+        uint32_t u32Rd = (1UL << (pstInsn->u8Rd & 0x1F));
+        uint32_t u32Rr = (1UL << (pstInsn->u8Rr & 0x1F));
+        uint32_t u32Reads = 0;
+        uint32_t u32Writes = 0;
+        uint8_t  u8FlagReads = 0;
+        uint8_t  u8FlagWrites = 0;
+
+        switch (pstInsn->u8Index)
+        {
+        case AVR_OPCODE_INDEX_NOP:
+            break;
+        case AVR_OPCODE_INDEX_IN:
+        case AVR_OPCODE_INDEX_SBIS:
+        case AVR_OPCODE_INDEX_SBIC:
+            // Reading SREG would observe flags the loop writes
+            if ((pstInsn->u8A + 32) == u8SREG)
+            {
+                return false;
+            }
+            IdleLoop_AddRead( pstLoop_, IDLE_LOOP_ABSOLUTE, pstInsn->u8A + 32 );
+            if (pstInsn->u8Index == AVR_OPCODE_INDEX_IN)
+            {
+                u32Writes = u32Rd;
+            }
+            break;
+        case AVR_OPCODE_INDEX_LDS:
+            IdleLoop_AddRead( pstLoop_, IDLE_LOOP_ABSOLUTE, pstInsn->u16K );
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_LD_X_Indirect:
+            IdleLoop_AddRead( pstLoop_, 26, 0 );
+            u32Reads = (3UL << 26);
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_LD_Y_Indirect:
+        case AVR_OPCODE_INDEX_LDD_Y:
+            IdleLoop_AddRead( pstLoop_, 28, (pstInsn->u8Index == AVR_OPCODE_INDEX_LDD_Y) ? pstInsn->u8q : 0 );
+            u32Reads = (3UL << 28);
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_LD_Z_Indirect:
+        case AVR_OPCODE_INDEX_LDD_Z:
+            IdleLoop_AddRead( pstLoop_, 30, (pstInsn->u8Index == AVR_OPCODE_INDEX_LDD_Z) ? pstInsn->u8q : 0 );
+            u32Reads = (3UL << 30);
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_SBRS:
+        case AVR_OPCODE_INDEX_SBRC:
+            u32Reads = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_ANDI:
+        case AVR_OPCODE_INDEX_ORI:
+        case AVR_OPCODE_INDEX_SBR:
+            u32Reads = u32Rd;
+            u32Writes = u32Rd;
+            u8FlagWrites = IDLE_LOOP_FLAGS_LOGIC;
+            break;
+        case AVR_OPCODE_INDEX_AND:
+        case AVR_OPCODE_INDEX_OR:
+            u32Reads = u32Rd | u32Rr;
+            u32Writes = u32Rd;
+            u8FlagWrites = IDLE_LOOP_FLAGS_LOGIC;
+            break;
+        case AVR_OPCODE_INDEX_CP:
+            u32Reads = u32Rd | u32Rr;
+            u8FlagWrites = IDLE_LOOP_FLAGS_ARITH;
+            break;
+        case AVR_OPCODE_INDEX_CPI:
+            u32Reads = u32Rd;
+            u8FlagWrites = IDLE_LOOP_FLAGS_ARITH;
+            break;
+        case AVR_OPCODE_INDEX_CPC:
+            u32Reads = u32Rd | u32Rr;
+            u8FlagReads = IDLE_LOOP_FLAGS_CARRY;
+            u8FlagWrites = IDLE_LOOP_FLAGS_ARITH;
+            break;
+        case AVR_OPCODE_INDEX_MOV:
+            u32Reads = u32Rr;
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_LDI:
+            u32Writes = u32Rd;
+            break;
+        case AVR_OPCODE_INDEX_RJMP:
+            if (i != (u8Count_ - 1))
+            {
+                return false;
+            }
+            break;
+        default:
+            if (!IdleLoop_IsBranch( pstInsn->u8Index ))
+            {
+                return false;
+            }
+            // Branches other than the one closing the loop must leave it
+            if ((i != (u8Count_ - 1)) &&
+                (pstInsn->u32Target >= pstLoop_->u32Head) &&
+                (pstInsn->u32Target <= u32Branch_))
+            {
+                return false;
+            }
+            u8FlagReads = 0xFF;
+            break;
+        }
+
+        u32RegsEarly   |= (u32Reads & ~u32RegsWritten);
+        u32RegsWritten |= u32Writes;
+        u8FlagsEarly   |= (u8FlagReads & ~u8FlagsWritten);
+        u8FlagsWritten |= u8FlagWrites;
+    }
+
+    // Anything carried from one iteration into the next could change the
+    // outcome of the next iteration.
+    if ((u32RegsEarly & u32RegsWritten) || (u8FlagsEarly & u8FlagsWritten))
+    {
+        return false;
+    }
+
+    pstLoop_->eKind = IDLE_LOOP_POLL;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static uint8_t IdleLoop_LoadPointer( uint8_t u8Index_, bool *pbROM_ )
+{
+    *pbROM_ = false;
+    switch (u8Index_)
+    {
+    case AVR_OPCODE_INDEX_LD_X_Indirect_Postinc:    return 26;
+    case AVR_OPCODE_INDEX_LD_Y_Indirect_Postinc:    return 28;
+    case AVR_OPCODE_INDEX_LD_Z_Indirect_Postinc:    return 30;
+    case AVR_OPCODE_INDEX_LPM_Z_Postinc:
+        *pbROM_ = true;
+        return 30;
+    default:
+        return IDLE_LOOP_NO_POINTER;
+    }
+}
+
+//---------------------------------------------------------------------------
+static uint8_t IdleLoop_StorePointer( uint8_t u8Index_ )
+{
+    switch (u8Index_)
+    {
+    case AVR_OPCODE_INDEX_ST_X_Indirect_Postinc:    return 26;
+    case AVR_OPCODE_INDEX_ST_Y_Indirect_Postinc:    return 28;
+    case AVR_OPCODE_INDEX_ST_Z_Indirect_Postinc:    return 30;
+    default:
+        return IDLE_LOOP_NO_POINTER;
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool IdleLoop_IsBlockPointer( const IdleLoop_t *pstLoop_, uint8_t u8Reg_ )
+{
+    return ((u8Reg_ != IDLE_LOOP_NO_POINTER) &&
+            ((u8Reg_ == pstLoop_->u8Load) || (u8Reg_ == pstLoop_->u8Store)));
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_MatchBlock
+ *
+ * Check whether a loop body is a block copy, fill or scan, and fill in its
+ * pointers and end condition.
+ *
+ * \param pstLoop_  Loop to fill in
+ * \param astInsns_ Instructions in the loop, ending with the backward branch
+ * \param u8Count_  Number of instructions in the loop
+ * \return true if the loop is a block loop
+ */
+static bool IdleLoop_MatchBlock( IdleLoop_t *pstLoop_, const IdleLoop_Insn_t *astInsns_, uint8_t u8Count_ )
+{
+    const IdleLoop_Insn_t *pstTail;
+    uint8_t  u8Branch = astInsns_[ u8Count_ - 1 ].u8Index;
+    uint32_t u32Pointers = 0;
+    uint32_t u32Written = 0;    // Registers written outside of the tail
+    uint32_t u32Tail = pstLoop_->u32Head;
+    uint8_t  u8Tail = 0;
+    uint8_t  u8TailCount;
+    uint8_t  i;
+
+    // A post-increment load, a post-increment store of the same register, or
+    // both, in that order...
+    pstLoop_->u8Load = IdleLoop_LoadPointer( astInsns_[0].u8Index, &pstLoop_->bLoadROM );
+    if (pstLoop_->u8Load != IDLE_LOOP_NO_POINTER)
+    {
+        pstLoop_->u8Value = astInsns_[0].u8Rd;
+        u32Pointers |= (3UL << pstLoop_->u8Load);
+        u32Written |= (1UL << pstLoop_->u8Value);
+        u32Tail += astInsns_[ u8Tail++ ].u8Size;
+    }
+    pstLoop_->u8Store = IDLE_LOOP_NO_POINTER;
+    if (u8Tail < u8Count_)
+    {
+        pstLoop_->u8Store = IdleLoop_StorePointer( astInsns_[ u8Tail ].u8Index );
+    }
+    if (pstLoop_->u8Store != IDLE_LOOP_NO_POINTER)
+    {
+        if (u8Tail && ((astInsns_[ u8Tail ].u8Rd != pstLoop_->u8Value) ||
+                       (pstLoop_->u8Store == pstLoop_->u8Load)))
+        {
+            return false;
+        }
+        pstLoop_->u8Value = astInsns_[ u8Tail ].u8Rd;
+        u32Pointers |= (3UL << pstLoop_->u8Store);
+        u32Tail += astInsns_[ u8Tail++ ].u8Size;
+    }
+
+    // ... followed by a tail, with no pointer doubling as the value moved.
+    u8TailCount = u8Count_ - u8Tail;
+    if (!u8Tail || (u8TailCount < 2) || (u32Pointers & (1UL << pstLoop_->u8Value)))
+    {
+        return false;
+    }
+    u32Written |= u32Pointers;
+    pstTail = &astInsns_[ u8Tail ];
+
+    if (IdleLoop_MatchCounter( pstLoop_, pstTail, u8TailCount ))
+    {
+        // SBIW and SUBI/SBCI borrow out of the top of the counter, DEC doesn't
+        if ((u8Branch != AVR_OPCODE_INDEX_BRNE) &&
+            ((u8Branch != AVR_OPCODE_INDEX_BRCC) || (pstTail->u8Index == AVR_OPCODE_INDEX_DEC)))
+        {
+            return false;
+        }
+        // The counter can't be stored, either
+        for (i = 0; i < pstLoop_->u8CounterBytes; i++)
+        {
+            if ((u32Written | (1UL << pstLoop_->u8Value)) & (1UL << pstLoop_->au8Counter[i]))
+            {
+                return false;
+            }
+        }
+        pstLoop_->eEnd = IDLE_LOOP_END_COUNT;
+        pstLoop_->bBorrow = (u8Branch == AVR_OPCODE_INDEX_BRCC);
+    }
+    else if (u8Branch != AVR_OPCODE_INDEX_BRNE)
+    {
+        return false;
+    }
+    else if ((u8TailCount == 3) && (pstTail[1].u8Index == AVR_OPCODE_INDEX_CPC) &&
+             ((pstTail->u8Index == AVR_OPCODE_INDEX_CP) || (pstTail->u8Index == AVR_OPCODE_INDEX_CPI)))
+    {
+        // CP/CPI + CPC of one of the pointers against an end address, either
+        // way around
+        if (IdleLoop_IsBlockPointer( pstLoop_, pstTail->u8Rd ) &&
+            (pstTail[1].u8Rd == (pstTail->u8Rd + 1)))
+        {
+            pstLoop_->u8EndPointer = pstTail->u8Rd;
+            pstLoop_->u8EndLow = pstTail->u8Rr;
+            pstLoop_->u8EndHigh = pstTail[1].u8Rr;
+            if (pstTail->u8Index == AVR_OPCODE_INDEX_CPI)
+            {
+                pstLoop_->u8EndLow = IDLE_LOOP_ABSOLUTE;
+                pstLoop_->u8K = (uint8_t)pstTail->u16K;
+            }
+        }
+        else if ((pstTail->u8Index == AVR_OPCODE_INDEX_CP) &&
+                 IdleLoop_IsBlockPointer( pstLoop_, pstTail->u8Rr ) &&
+                 (pstTail[1].u8Rr == (pstTail->u8Rr + 1)))
+        {
+            pstLoop_->u8EndPointer = pstTail->u8Rr;
+            pstLoop_->u8EndLow = pstTail->u8Rd;
+            pstLoop_->u8EndHigh = pstTail[1].u8Rd;
+        }
+        else
+        {
+            return false;
+        }
+
+        if ((u32Written & (1UL << pstLoop_->u8EndHigh)) ||
+            ((pstLoop_->u8EndLow != IDLE_LOOP_ABSOLUTE) && (u32Written & (1UL << pstLoop_->u8EndLow))))
+        {
+            return false;
+        }
+        pstLoop_->eEnd = IDLE_LOOP_END_POINTER;
+    }
+    else if ((u8TailCount == 2) && (pstLoop_->u8Load != IDLE_LOOP_NO_POINTER))
+    {
+        // TST (AND/OR with itself), CPI or CP of the value against a terminator
+        switch (pstTail->u8Index)
+        {
+        case AVR_OPCODE_INDEX_AND:
+        case AVR_OPCODE_INDEX_OR:
+            if ((pstTail->u8Rd != pstLoop_->u8Value) || (pstTail->u8Rr != pstLoop_->u8Value))
+            {
+                return false;
+            }
+            pstLoop_->u8Terminator = IDLE_LOOP_ABSOLUTE;
+            pstLoop_->u8K = 0;
+            break;
+        case AVR_OPCODE_INDEX_CPI:
+            if (pstTail->u8Rd != pstLoop_->u8Value)
+            {
+                return false;
+            }
+            pstLoop_->u8Terminator = IDLE_LOOP_ABSOLUTE;
+            pstLoop_->u8K = (uint8_t)pstTail->u16K;
+            break;
+        case AVR_OPCODE_INDEX_CP:
+            if (pstTail->u8Rd == pstLoop_->u8Value)
+            {
+                pstLoop_->u8Terminator = pstTail->u8Rr;
+            }
+            else if (pstTail->u8Rr == pstLoop_->u8Value)
+            {
+                pstLoop_->u8Terminator = pstTail->u8Rd;
+            }
+            else
+            {
+                return false;
+            }
+            if (u32Written & (1UL << pstLoop_->u8Terminator))
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        pstLoop_->eEnd = IDLE_LOOP_END_TERMINATOR;
+    }
+    else
+    {
+        return false;
+    }
+
+    // The tail ends with a conditional branch, which takes an extra cycle to
+    // branch back
+    pstLoop_->u32Tail = u32Tail;
+    pstLoop_->u8TailInsns = u8TailCount;
+    pstLoop_->u8TailCycles = 1;
+    for (i = u8Tail; i < u8Count_; i++)
+    {
+        pstLoop_->u8TailCycles += astInsns_[i].u8Cycles;
+    }
+    pstLoop_->eKind = IDLE_LOOP_BLOCK;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_Analyze
+ *
+ * Analyze the loop closed by a backward branch.
+ *
+ * \param u32Branch_ ROM word address of the backward branch
+ * \return New loop state for the address
+ */
+static uint8_t IdleLoop_Analyze( uint32_t u32Branch_ )
+{
+    IdleLoop_Insn_t astInsns[ AVR_IDLE_LOOP_MAX_INSNS ];
+    IdleLoop_t *pstLoop = NULL;
+    uint32_t u32SavedPC = stCPU.u32PC;
+    uint32_t u32Addr;
+    uint32_t u32Last = 0;
+    uint8_t u8Count = 0;
+    uint8_t u8Cycles = 0;
+    uint8_t i;
+
+    for (i = 0; i < IDLE_LOOP_MAX_LOOPS; i++)
+    {
+        if (!astLoops[i].bUsed)
+        {
+            pstLoop = &astLoops[i];
+            break;
+        }
+    }
+    if (!pstLoop || !IdleLoop_Decode( u32Branch_, &astInsns[0] ))
+    {
+        stCPU.u32PC = u32SavedPC;
+        return IDLE_LOOP_NONE;
+    }
+
+    memset( pstLoop, 0, sizeof(*pstLoop) );
+    pstLoop->u32Head = astInsns[0].u32Target;
+
+    // Collect the straight-line path from the loop head to the branch
+    if (((astInsns[0].u8Index == AVR_OPCODE_INDEX_RJMP) || IdleLoop_IsBranch( astInsns[0].u8Index )) &&
+        (pstLoop->u32Head <= u32Branch_) &&
+        ((u32Branch_ - pstLoop->u32Head) < AVR_IDLE_LOOP_MAX_WORDS))
+    {
+        u32Addr = pstLoop->u32Head;
+        while ((u8Count < AVR_IDLE_LOOP_MAX_INSNS) && IdleLoop_Decode( u32Addr, &astInsns[ u8Count ] ))
+        {
+            u8Cycles += astInsns[ u8Count ].u8Cycles;
+            u32Last = u32Addr;
+            u32Addr += astInsns[ u8Count ].u8Size;
+            u8Count++;
+            if (u32Addr > u32Branch_)
+            {
+                break;
+            }
+        }
+        if (u32Last != u32Branch_)
+        {
+            u8Count = 0;
+        }
+    }
+    stCPU.u32PC = u32SavedPC;
+
+    if (!u8Count ||
+        (!IdleLoop_MatchDelay( pstLoop, astInsns, u8Count ) &&
+         !IdleLoop_MatchPoll( pstLoop, astInsns, u8Count, u32Branch_ ) &&
+         !IdleLoop_MatchBlock( pstLoop, astInsns, u8Count )))
+    {
+        return IDLE_LOOP_NONE;
+    }
+
+    // Conditional branches take an extra cycle to branch back
+    if (IdleLoop_IsBranch( astInsns[ u8Count - 1 ].u8Index ))
+    {
+        u8Cycles++;
+    }
+    pstLoop->u8Insns = u8Count;
+    pstLoop->u8Cycles = u8Cycles;
+    pstLoop->bUsed = true;
+
+    if (pstLoop->eKind == IDLE_LOOP_DELAY)
+    {
+        u64DelayLoops++;
+    }
+    else if (pstLoop->eKind == IDLE_LOOP_POLL)
+    {
+        u64PollLoops++;
+    }
+    else
+    {
+        u64BlockLoops++;
+    }
+    return (uint8_t)((pstLoop - astLoops) + IDLE_LOOP_FIRST);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_Run
+ *
+ * Run iterations of a loop in a single step, stopping short of the next
+ * peripheral event.  The tail of the last iteration (if the loop has one) is
+ * not accounted for, and is left to the interpreter.
+ *
+ * \param pstLoop_ Loop to run
+ * \param u64Max_  Maximum number of iterations to run
+ * \param bIdle_   Whether the loop leaves the CPU idle (see CPU_IsIdle())
+ * \return Number of iterations run
+ */
+static uint64_t IdleLoop_Run( IdleLoop_t *pstLoop_, uint64_t u64Max_, bool bIdle_ )
+{
+    uint64_t u64Iterations = 0;
+    uint64_t u64Cycles = 0;
+    uint64_t u64Insns = 0;
+
+    if (!u64Max_)
+    {
+        return 0;
+    }
+
+    // Let the peripherals look ahead to their next interrupt
+    if (bIdle_)
+    {
+        stCPU.bIdle = true;
+        IO_RescheduleAll();
+    }
+
+    if (stCPU.u64IONextEvent > (stCPU.u64IOTicks + 1))
+    {
+        u64Iterations = (stCPU.u64IONextEvent - stCPU.u64IOTicks - 1 + pstLoop_->u8TailCycles) /
+                        pstLoop_->u8Cycles;
+    }
+    if (u64Iterations > u64Max_)
+    {
+        u64Iterations = u64Max_;
+    }
+    if (u64Iterations)
+    {
+        u64Cycles = (u64Iterations * pstLoop_->u8Cycles) - pstLoop_->u8TailCycles;
+        u64Insns = (u64Iterations * pstLoop_->u8Insns) - pstLoop_->u8TailInsns;
+    }
+
+    stCPU.u64CycleCount += u64Cycles;
+    stCPU.u64IOTicks += u64Cycles;
+    stCPU.u64InstructionCount += u64Insns;
+
+    // ... and bring them back up to date.
+    if (bIdle_)
+    {
+        stCPU.bIdle = false;
+        IO_RescheduleAll();
+    }
+
+    if (u64Iterations)
+    {
+        u64Skips++;
+        u64InsnsSkipped += u64Insns;
+        u64CyclesSkipped += u64Cycles;
+    }
+    return u64Iterations;
+}
+
+//---------------------------------------------------------------------------
+static uint32_t IdleLoop_SkipDelay( IdleLoop_t *pstLoop_, uint32_t u32Limit_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint32_t u32Counter = 0;
+    uint32_t u32Max;
+    uint32_t u32Iterations;
+    uint8_t i;
+
+    for (i = 0; i < pstLoop_->u8CounterBytes; i++)
+    {
+        u32Counter |= ((uint32_t)pu8RAM[ pstLoop_->au8Counter[i] ] << (8 * i));
+    }
+
+    // The last iteration runs normally, to leave the loop.  Leave at least one
+    // more instruction in the budget, too: the flags are left as of the last
+    // iteration actually run, and the next instruction - the head of the loop -
+    // overwrites them all.
+    if ((u32Counter < 2) || (u32Limit_ <= pstLoop_->u8Insns))
+    {
+        return 0;
+    }
+    u32Max = (u32Limit_ - 1) / pstLoop_->u8Insns;
+    if (u32Max > (u32Counter - 1))
+    {
+        u32Max = u32Counter - 1;
+    }
+
+    u32Iterations = (uint32_t)IdleLoop_Run( pstLoop_, u32Max, true );
+
+    u32Counter -= u32Iterations;
+    for (i = 0; i < pstLoop_->u8CounterBytes; i++)
+    {
+        pu8RAM[ pstLoop_->au8Counter[i] ] = (uint8_t)(u32Counter >> (8 * i));
+    }
+    return u32Iterations * pstLoop_->u8Insns;
+}
+
+//---------------------------------------------------------------------------
+static void IdleLoop_Arm( IdleLoop_t *pstLoop_ )
+{
+    pstLoop_->bArmed = true;
+    pstLoop_->u64ArmInsns = stCPU.u64InstructionCount;
+    pstLoop_->u64ArmCycles = stCPU.u64CycleCount;
+    pstLoop_->u64ArmEvent = stCPU.u64IONextEvent;
+}
+
+//---------------------------------------------------------------------------
+static uint32_t IdleLoop_SkipPoll( IdleLoop_t *pstLoop_, uint32_t u32Limit_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    bool bIdle = true;
+    uint32_t u32Addr;
+    uint32_t u32Iterations;
+    uint8_t i;
+
+    for (i = 0; i < pstLoop_->u8Reads; i++)
+    {
+        u32Addr = pstLoop_->astReads[i].u16Offset;
+        if (pstLoop_->astReads[i].u8Base != IDLE_LOOP_ABSOLUTE)
+        {
+            u32Addr += (uint32_t)pu8RAM[ pstLoop_->astReads[i].u8Base ] |
+                       ((uint32_t)pu8RAM[ pstLoop_->astReads[i].u8Base + 1 ] << 8);
+        }
+
+        // Registers may be written by the loop, and reads past the end of RAM
+        // abort the emulator - leave those to the interpreter.
+        if ((u32Addr < 32) || (u32Addr >= stCPU.u32RAMSize))
+        {
+            pstLoop_->bArmed = false;
+            return 0;
+        }
+        if (u32Addr < 256)
+        {
+            bIdle = false;
+        }
+
+        // In fast IO mode, peripherals bring their registers up to date as
+        // they're read, rather than in events - the loop could see them change
+        // with no event having run.
+        if (stCPU.bFastIO && (stCPU.au8DataMap[ u32Addr ] & DATA_MAP_PERIPH_READ))
+        {
+            pstLoop_->bArmed = false;
+            return 0;
+        }
+    }
+
+    // The last iteration must have run straight through from the head (same
+    // number of instructions and cycles as the path analyzed), and if it read
+    // peripheral registers, no peripheral events can have run since.
+    if (!pstLoop_->bArmed ||
+        ((stCPU.u64InstructionCount - pstLoop_->u64ArmInsns) != pstLoop_->u8Insns) ||
+        ((stCPU.u64CycleCount - pstLoop_->u64ArmCycles) != pstLoop_->u8Cycles) ||
+        (!bIdle && (stCPU.u64IONextEvent != pstLoop_->u64ArmEvent)))
+    {
+        IdleLoop_Arm( pstLoop_ );
+        return 0;
+    }
+
+    u32Iterations = (uint32_t)IdleLoop_Run( pstLoop_, u32Limit_ / pstLoop_->u8Insns, bIdle );
+    IdleLoop_Arm( pstLoop_ );
+    return u32Iterations * pstLoop_->u8Insns;
+}
+
+//---------------------------------------------------------------------------
+static uint16_t IdleLoop_GetPointer( uint8_t u8Reg_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    return (uint16_t)(pu8RAM[ u8Reg_ ] | (pu8RAM[ u8Reg_ + 1 ] << 8));
+}
+
+//---------------------------------------------------------------------------
+static void IdleLoop_SetPointer( uint8_t u8Reg_, uint16_t u16Value_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    pu8RAM[ u8Reg_ ] = (uint8_t)u16Value_;
+    pu8RAM[ u8Reg_ + 1 ] = (uint8_t)(u16Value_ >> 8);
+}
+
+//---------------------------------------------------------------------------
+static uint8_t IdleLoop_ROMByte( uint32_t u32Addr_ )
+{
+    // Same byte order as LPM
+    return (uint8_t)(stCPU.pu16ROM[ u32Addr_ >> 1 ] >> ((u32Addr_ & 1) * 8));
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IdleLoop_RAMExtent
+ *
+ * \param u32Addr_ Data memory address
+ * \return Number of bytes of plain SRAM from the address onwards, within the
+ *         u32RAMSize bytes backing the data space
+ */
+static uint32_t IdleLoop_RAMExtent( uint32_t u32Addr_ )
+{
+    uint32_t u32End = stCPU.u32RAMSize;
+
+    if ((u32Addr_ < 256) || (u32Addr_ >= u32End))
+    {
+        return 0;
+    }
+    return u32End - u32Addr_;
+}
+
+//---------------------------------------------------------------------------
+static uint32_t IdleLoop_SkipBlock( IdleLoop_t *pstLoop_, uint32_t u32Limit_ )
+{
+    uint8_t *pu8RAM = stCPU.pstRAM->au8RAM;
+    uint32_t u32Load = 0;
+    uint32_t u32Store = 0;
+    uint32_t u32Counter = 0;
+    uint32_t u32Extent;
+    uint64_t u64Max;
+    uint64_t u64Iterations;
+    uint32_t u32Iterations;
+    uint8_t  u8Terminator;
+    uint8_t  u8Value;
+    uint8_t  *pu8Found;
+    uint32_t i;
+
+    if (!u32Limit_)
+    {
+        return 0;
+    }
+
+    // Iterations remaining, including the one which leaves the loop
+    switch (pstLoop_->eEnd)
+    {
+    case IDLE_LOOP_END_COUNT:
+        for (i = 0; i < pstLoop_->u8CounterBytes; i++)
+        {
+            u32Counter |= ((uint32_t)pu8RAM[ pstLoop_->au8Counter[i] ] << (8 * i));
+        }
+        u64Max = (uint64_t)u32Counter + (pstLoop_->bBorrow ? 1 : 0);
+        break;
+    case IDLE_LOOP_END_POINTER:
+        u64Max = (uint16_t)(((pu8RAM[ pstLoop_->u8EndHigh ] << 8) |
+                             ((pstLoop_->u8EndLow == IDLE_LOOP_ABSOLUTE) ? pstLoop_->u8K : pu8RAM[ pstLoop_->u8EndLow ])) -
+                            IdleLoop_GetPointer( pstLoop_->u8EndPointer ));
+        break;
+    default:
+        // Found by scanning for the terminator, below
+        u64Max = UINT32_MAX;
+        break;
+    }
+
+    // Memory which can be moved on the host: loads from ROM, or plain SRAM,
+    // stores to plain SRAM with no write callouts, and no loads of data stored
+    // by an earlier iteration.
+    if (pstLoop_->u8Load != IDLE_LOOP_NO_POINTER)
+    {
+        u32Load = IdleLoop_GetPointer( pstLoop_->u8Load );
+        if (pstLoop_->bLoadROM)
+        {
+            u32Extent = 0x10000 - u32Load;
+            u32Load |= ((uint32_t)stCPU.pstRAM->stRegisters.RAMPZ << 16);
+            if (u32Load >= stCPU.u32ROMSize)
+            {
+                return 0;
+            }
+            if (u32Extent > (stCPU.u32ROMSize - u32Load))
+            {
+                u32Extent = stCPU.u32ROMSize - u32Load;
+            }
+        }
+        else
+        {
+            u32Extent = IdleLoop_RAMExtent( u32Load );
+        }
+        if (u64Max > u32Extent)
+        {
+            u64Max = u32Extent;
+        }
+    }
+    if (pstLoop_->u8Store != IDLE_LOOP_NO_POINTER)
+    {
+        u32Store = IdleLoop_GetPointer( pstLoop_->u8Store );
+        u32Extent = IdleLoop_RAMExtent( u32Store );
+        u32Extent = WriteCallout_NextAddress( (uint16_t)u32Store, u32Store + u32Extent ) - u32Store;
+        if ((pstLoop_->u8Load != IDLE_LOOP_NO_POINTER) && !pstLoop_->bLoadROM &&
+            (u32Load < u32Store) && (u32Extent > (u32Store - u32Load)))
+        {
+            u32Extent = u32Store - u32Load;
+        }
+        if (u64Max > u32Extent)
+        {
+            u64Max = u32Extent;
+        }
+    }
+
+    // Leave at least one instruction in the budget for the tail
+    if (u64Max > ((u32Limit_ - 1 + pstLoop_->u8TailInsns) / pstLoop_->u8Insns))
+    {
+        u64Max = (u32Limit_ - 1 + pstLoop_->u8TailInsns) / pstLoop_->u8Insns;
+    }
+
+    if (pstLoop_->eEnd == IDLE_LOOP_END_TERMINATOR)
+    {
+        u8Terminator = (pstLoop_->u8Terminator == IDLE_LOOP_ABSOLUTE) ?
+                       pstLoop_->u8K : pu8RAM[ pstLoop_->u8Terminator ];
+        if (pstLoop_->bLoadROM)
+        {
+            for (i = 0; i < u64Max; i++)
+            {
+                if (IdleLoop_ROMByte( u32Load + i ) == u8Terminator)
+                {
+                    u64Max = i + 1;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            pu8Found = (uint8_t*)memchr( &pu8RAM[ u32Load ], u8Terminator, (size_t)u64Max );
+            if (pu8Found)
+            {
+                u64Max = (pu8Found - &pu8RAM[ u32Load ]) + 1;
+            }
+        }
+    }
+
+    if (u64Max < 2)
+    {
+        return 0;
+    }
+    u64Iterations = IdleLoop_Run( pstLoop_, u64Max, true );
+    if (!u64Iterations)
+    {
+        return 0;
+    }
+    u32Iterations = (uint32_t)u64Iterations;
+
+    // Do the loads and stores of every iteration run...
+    if (pstLoop_->u8Load != IDLE_LOOP_NO_POINTER)
+    {
+        if (pstLoop_->bLoadROM)
+        {
+            u8Value = IdleLoop_ROMByte( u32Load + u32Iterations - 1 );
+            for (i = 0; (pstLoop_->u8Store != IDLE_LOOP_NO_POINTER) && (i < u32Iterations); i++)
+            {
+                pu8RAM[ u32Store + i ] = IdleLoop_ROMByte( u32Load + i );
+            }
+        }
+        else
+        {
+            u8Value = pu8RAM[ u32Load + u32Iterations - 1 ];
+            if (pstLoop_->u8Store != IDLE_LOOP_NO_POINTER)
+            {
+                memmove( &pu8RAM[ u32Store ], &pu8RAM[ u32Load ], u32Iterations );
+            }
+        }
+        pu8RAM[ pstLoop_->u8Value ] = u8Value;
+        IdleLoop_SetPointer( pstLoop_->u8Load, (uint16_t)(u32Load + u32Iterations) );
+    }
+    else
+    {
+        memset( &pu8RAM[ u32Store ], pu8RAM[ pstLoop_->u8Value ], u32Iterations );
+    }
+    if (pstLoop_->u8Store != IDLE_LOOP_NO_POINTER)
+    {
+        CPU_DirtyRAMRange( u32Store, u32Iterations );
+        IdleLoop_SetPointer( pstLoop_->u8Store, (uint16_t)(u32Store + u32Iterations) );
+    }
+
+    // ... and the tails of all but the last.
+    if (pstLoop_->eEnd == IDLE_LOOP_END_COUNT)
+    {
+        u32Counter -= (u32Iterations - 1);
+        for (i = 0; i < pstLoop_->u8CounterBytes; i++)
+        {
+            pu8RAM[ pstLoop_->au8Counter[i] ] = (uint8_t)(u32Counter >> (8 * i));
+        }
+    }
+    stCPU.u32PC = pstLoop_->u32Tail;
+
+    u64BytesMoved += u32Iterations;
+    return (u32Iterations * pstLoop_->u8Insns) - pstLoop_->u8TailInsns;
+}
+
+//---------------------------------------------------------------------------
+void AVR_IdleLoop_Init( uint32_t u32ROMSize_ )
+{
+    free( pu8State );
+
+    u32StateWords = u32ROMSize_ / sizeof(uint16_t);
+    pu8State = (uint8_t*)calloc( u32StateWords, sizeof(uint8_t) );
+    if (!pu8State)
+    {
+        fprintf( stderr, "Unable to allocate idle loop table\n" );
+        exit(-1);
+    }
+    memset( astLoops, 0, sizeof(astLoops) );
+}
+
+//---------------------------------------------------------------------------
+void AVR_IdleLoop_Free( void )
+{
+    free( pu8State );
+    pu8State = NULL;
+    u32StateWords = 0;
+}
+
+//---------------------------------------------------------------------------
+uint32_t AVR_IdleLoop_Skip( uint32_t u32From_, uint32_t u32Limit_ )
+{
+    IdleLoop_t *pstLoop;
+    uint8_t u8State;
+
+    if (u32From_ >= u32StateWords)
+    {
+        return 0;
+    }
+
+    u8State = pu8State[ u32From_ ];
+    if (u8State == IDLE_LOOP_UNKNOWN)
+    {
+        u8State = IdleLoop_Analyze( u32From_ );
+        pu8State[ u32From_ ] = u8State;
+    }
+    if (u8State == IDLE_LOOP_NONE)
+    {
+        return 0;
+    }
+
+    // Continue only if the branch went back to the head of the loop (rather
+    // than an interrupt being taken), and no interrupt is about to be.
+    pstLoop = &astLoops[ u8State - IDLE_LOOP_FIRST ];
+    if ((stCPU.u32PC != pstLoop->u32Head) ||
+        ((stCPU.u8IntPriority != 255) && stCPU.pstRAM->stRegisters.SREG.I))
+    {
+        pstLoop->bArmed = false;
+        return 0;
+    }
+
+    if (pstLoop->eKind == IDLE_LOOP_DELAY)
+    {
+        return IdleLoop_SkipDelay( pstLoop, u32Limit_ );
+    }
+    if (pstLoop->eKind == IDLE_LOOP_POLL)
+    {
+        return IdleLoop_SkipPoll( pstLoop, u32Limit_ );
+    }
+    return IdleLoop_SkipBlock( pstLoop, u32Limit_ );
+}
+
+//---------------------------------------------------------------------------
+void AVR_IdleLoop_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+    uint32_t u32Start = u32Addr_;
+    uint32_t u32End = u32Addr_ + u32Words_ + AVR_IDLE_LOOP_MAX_WORDS;
+    uint8_t u8State;
+
+    if (!pu8State)
+    {
+        return;
+    }
+
+    // Any loop whose branch falls within AVR_IDLE_LOOP_MAX_WORDS after the
+    // range (or the 2-word instruction just before it) may run through it.
+    if (u32Start)
+    {
+        u32Start--;
+    }
+    if (u32End > u32StateWords)
+    {
+        u32End = u32StateWords;
+    }
+
+    while (u32Start < u32End)
+    {
+        u8State = pu8State[ u32Start ];
+        if (u8State >= IDLE_LOOP_FIRST)
+        {
+            astLoops[ u8State - IDLE_LOOP_FIRST ].bUsed = false;
+        }
+        pu8State[ u32Start++ ] = IDLE_LOOP_UNKNOWN;
+    }
+}
+
+//---------------------------------------------------------------------------
+void AVR_IdleLoop_Report( void )
+{
+    printf( "=====================================================================================\n");
+    printf( "%60s: %llu\n", "Delay loops recognized", (unsigned long long)u64DelayLoops );
+    printf( "%60s: %llu\n", "Polling loops recognized", (unsigned long long)u64PollLoops );
+    printf( "%60s: %llu\n", "Block memory loops recognized", (unsigned long long)u64BlockLoops );
+    printf( "%60s: %llu\n", "Skips", (unsigned long long)u64Skips );
+    printf( "%60s: %llu\n", "Instructions skipped", (unsigned long long)u64InsnsSkipped );
+    printf( "%60s: %llu\n", "Cycles skipped", (unsigned long long)u64CyclesSkipped );
+    printf( "%60s: %llu\n", "Bytes copied, filled or scanned", (unsigned long long)u64BytesMoved );
+}
+
+#endif
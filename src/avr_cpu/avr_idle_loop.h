@@ -0,0 +1,93 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_idle_loop.h
+
+  \brief Detection and skipping of delay, polling and block memory loops.
+*/
+
+#ifndef __AVR_IDLE_LOOP_H__
+#define __AVR_IDLE_LOOP_H__
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+/*!
+    Longest loop considered, in ROM words from the loop head to the backward
+    branch (inclusive), and in instructions.
+*/
+#define AVR_IDLE_LOOP_MAX_WORDS     (16)
+#define AVR_IDLE_LOOP_MAX_INSNS     (8)
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_IdleLoop_Init
+ *
+ * Allocate the (empty) loop table for a ROM of the given size.  Loops are
+ * only skipped once this has been called.
+ *
+ * \param u32ROMSize_ Size of the CPU's ROM in bytes
+ */
+void AVR_IdleLoop_Init( uint32_t u32ROMSize_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_IdleLoop_Free
+ *
+ * Release the loop table; loops are no longer skipped until the next call to
+ * AVR_IdleLoop_Init().
+ */
+void AVR_IdleLoop_Free( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_IdleLoop_Skip
+ *
+ * Called after an instruction has transferred control backwards and retired
+ * (including the interrupt check).  If the instruction is the backward branch
+ * of a recognized delay, polling or block memory loop, and the outcome of the
+ * following iterations is known in advance, run as many of them as possible
+ * in a single step.  The PC may be left partway through the last iteration
+ * run.  The result is identical to executing the same number of instructions
+ * one at a time.
+ *
+ * \param u32From_  ROM word address of the instruction just retired
+ * \param u32Limit_ Maximum number of instructions to skip
+ *
+ * \return Number of instructions skipped
+ */
+uint32_t AVR_IdleLoop_Skip( uint32_t u32From_, uint32_t u32Limit_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_IdleLoop_Invalidate
+ *
+ * Forget any loops affected by a modification to a range of ROM.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of words modified
+ */
+void AVR_IdleLoop_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_IdleLoop_Report
+ *
+ * Print the number of loops recognized, and the instructions and cycles
+ * skipped over, to standard output.
+ */
+void AVR_IdleLoop_Report( void );
+
+#endif
@@ -21,16 +21,18 @@
 #include <stdint.h>
 #include "emu_config.h"
 #include "avr_cpu.h"
+#include "avr_io.h"
 #include "interrupt_callout.h"
+#include "avr_opcodes.h"
 
 //---------------------------------------------------------------------------
 static void AVR_NextInterrupt(void)
 {
-    uint32_t i = 0x80000000;
-    uint32_t j = 31;
+    uint64_t i = 1ULL << (CPU_MAX_INTERRUPTS - 1);
+    uint32_t j = CPU_MAX_INTERRUPTS - 1;
     while (i)
     {
-        if ((stCPU.u32IntFlags & i) == i)
+        if ((stCPU.u64IntFlags & i) == i)
         {
             stCPU.u8IntPriority = j;
             return;
@@ -40,7 +42,7 @@ static void AVR_NextInterrupt(void)
     }
 
     stCPU.u8IntPriority = 255;
-    stCPU.u32IntFlags = 0;
+    stCPU.u64IntFlags = 0;
 }
 
 //---------------------------------------------------------------------------
@@ -56,7 +58,7 @@ void AVR_InterruptCandidate( uint8_t u8Vector_ )
     {
         stCPU.u8IntPriority = u8Vector_;
     }
-    stCPU.u32IntFlags |= (1 << u8Vector_);
+    stCPU.u64IntFlags |= (1ULL << u8Vector_);
 }
 
 //---------------------------------------------------------------------------
@@ -66,7 +68,7 @@ void AVR_ClearCandidate( uint8_t u8Vector_ )
         return;
     }
 
-    stCPU.u32IntFlags &= ~(1 << u8Vector_ );
+    stCPU.u64IntFlags &= ~(1ULL << u8Vector_ );
     AVR_NextInterrupt();
 }
 
@@ -80,18 +82,31 @@ void AVR_Interrupt( void )
         return; // no interrupt pending
     }
 
+    // Bring SREG up-to-date before entering the ISR
+    AVR_Opcode_SyncFlags();
+
     // Push the current PC to stack.
     uint16_t u16SP = (((uint16_t)stCPU.pstRAM->stRegisters.SPH.r) << 8) |
                      (((uint16_t)stCPU.pstRAM->stRegisters.SPL.r));
 
-    uint16_t u16StoredPC = stCPU.u32PC;
+    uint32_t u32StoredPC = stCPU.u32PC;
 
-    stCPU.pstRAM->au8RAM[ u16SP ]     = (uint8_t)(u16StoredPC & 0x00FF);
-    stCPU.pstRAM->au8RAM[ u16SP - 1 ] = (uint8_t)(u16StoredPC >> 8);
+    stCPU.pstRAM->au8RAM[ u16SP ]     = (uint8_t)(u32StoredPC & 0x00FF);
+    stCPU.pstRAM->au8RAM[ (uint16_t)(u16SP - 1) ] = (uint8_t)(u32StoredPC >> 8);
+    CPU_DirtyRAM( u16SP );
+    CPU_DirtyRAM( (uint16_t)(u16SP - 1) );
 
     // Stack is post-decremented
     u16SP -= 2;
 
+    // Parts with a 22-bit PC push the upper bits as well
+    if (CPU_Has22BitPC())
+    {
+        stCPU.pstRAM->au8RAM[ u16SP ] = (uint8_t)(u32StoredPC >> 16);
+        CPU_DirtyRAM( u16SP );
+        u16SP--;
+    }
+
     // Store the new SP.
     stCPU.pstRAM->stRegisters.SPH.r = (u16SP >> 8);
     stCPU.pstRAM->stRegisters.SPL.r = (u16SP & 0x00FF);
@@ -108,18 +123,23 @@ void AVR_Interrupt( void )
 
     // Run the interrupt-acknowledge callback associated with this vector
     uint8_t u8Pri = stCPU.u8IntPriority;
-    if (u8Pri < 32 && stCPU.apfInterruptCallbacks[ u8Pri ])
+    if (u8Pri < CPU_MAX_INTERRUPTS && stCPU.apfInterruptCallbacks[ u8Pri ])
     {
         stCPU.apfInterruptCallbacks[ u8Pri ]( u8Pri );
     }
 
     // Reset the CPU interrupt priority
-    stCPU.u32IntFlags &= ~(1 << u8Pri);
+    stCPU.u64IntFlags &= ~(1ULL << u8Pri);
     AVR_NextInterrupt();
 
     // Run the generic interrupt callout routine
     InterruptCallout_Run( true, u8Pri );
 
-    // Clear any sleep-mode flags currently set
-    stCPU.bAsleep = false;
+    // Clear any sleep-mode flags currently set.  Peripherals may have scheduled
+    // themselves further ahead while the CPU slept, so re-evaluate them all.
+    if (stCPU.bAsleep)
+    {
+        stCPU.bAsleep = false;
+        IO_RescheduleAll();
+    }
 }
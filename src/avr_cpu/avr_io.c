@@ -29,6 +29,126 @@
 #include "avr_cpu.h"
 #include "avr_io.h"
 
+//---------------------------------------------------------------------------
+// Event scheduler - a binary min-heap of event-driven peripherals, keyed by
+// the absolute tick at which each one's clock next runs.
+static EMU_INSTANCE IOEvent **apstEventHeap = NULL;
+static EMU_INSTANCE uint32_t  u32EventCount = 0;
+static EMU_INSTANCE uint32_t  u32EventOrder = UINT32_MAX;
+
+//---------------------------------------------------------------------------
+static bool IO_EventBefore( const IOEvent *pstA_, const IOEvent *pstB_ )
+{
+    if (pstA_->u64Deadline != pstB_->u64Deadline)
+    {
+        return (pstA_->u64Deadline < pstB_->u64Deadline);
+    }
+    return (pstA_->u32Order < pstB_->u32Order);
+}
+
+//---------------------------------------------------------------------------
+static void IO_EventSwap( uint32_t u32A_, uint32_t u32B_ )
+{
+    IOEvent *pstTemp = apstEventHeap[u32A_];
+    apstEventHeap[u32A_] = apstEventHeap[u32B_];
+    apstEventHeap[u32B_] = pstTemp;
+
+    apstEventHeap[u32A_]->u32HeapIndex = u32A_;
+    apstEventHeap[u32B_]->u32HeapIndex = u32B_;
+}
+
+//---------------------------------------------------------------------------
+static void IO_EventSiftDown( uint32_t u32Index_ )
+{
+    // Move towards the leaves while either child is due before the entry
+    while (1)
+    {
+        uint32_t u32Child = (u32Index_ * 2) + 1;
+        if (u32Child >= u32EventCount)
+        {
+            break;
+        }
+        if (((u32Child + 1) < u32EventCount) &&
+            IO_EventBefore( apstEventHeap[u32Child + 1], apstEventHeap[u32Child] ))
+        {
+            u32Child++;
+        }
+        if (!IO_EventBefore( apstEventHeap[u32Child], apstEventHeap[u32Index_] ))
+        {
+            break;
+        }
+        IO_EventSwap( u32Index_, u32Child );
+        u32Index_ = u32Child;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void IO_EventSift( uint32_t u32Index_ )
+{
+    // Move towards the root while the entry is due before its parent...
+    while (u32Index_ && IO_EventBefore( apstEventHeap[u32Index_], apstEventHeap[(u32Index_ - 1) / 2] ))
+    {
+        IO_EventSwap( u32Index_, (u32Index_ - 1) / 2 );
+        u32Index_ = (u32Index_ - 1) / 2;
+    }
+
+    // ... and towards the leaves while either child is due before it
+    IO_EventSiftDown( u32Index_ );
+}
+
+//---------------------------------------------------------------------------
+static void IO_UpdateNextEvent( void )
+{
+    if (stCPU.pstClockList)
+    {
+        // Per-cycle clocks need servicing on every tick
+        stCPU.u64IONextEvent = stCPU.u64IOTicks + 1;
+    }
+    else if (u32EventCount)
+    {
+        stCPU.u64IONextEvent = apstEventHeap[0]->u64Deadline;
+    }
+    else
+    {
+        stCPU.u64IONextEvent = PERIPH_NO_EVENT;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void IO_EventDeadline( IOEvent *pstEvent_ )
+{
+    uint64_t u64Deadline = pstEvent_->pfNextEvent( pstEvent_->pvContext );
+
+    // An event can't be scheduled in the past - the earliest a peripheral can
+    // be clocked again is the next tick.
+    if (u64Deadline <= stCPU.u64IOTicks)
+    {
+        u64Deadline = stCPU.u64IOTicks + 1;
+    }
+    pstEvent_->u64Deadline = u64Deadline;
+}
+
+//---------------------------------------------------------------------------
+static void IO_EventSchedule( IOEvent *pstEvent_ )
+{
+    IO_EventDeadline( pstEvent_ );
+    IO_EventSift( pstEvent_->u32HeapIndex );
+}
+
+//---------------------------------------------------------------------------
+static IOEvent *IO_FindEvent( AVRPeripheral *pstPeriph_ )
+{
+    uint32_t i;
+    for (i = 0; i < u32EventCount; i++)
+    {
+        if (apstEventHeap[i]->pstPeriph == pstPeriph_)
+        {
+            return apstEventHeap[i];
+        }
+    }
+    return NULL;
+}
+
 //---------------------------------------------------------------------------
 void IO_AddReader(  AVRPeripheral *pstPeriph_, uint8_t addr_)
 {
@@ -44,7 +164,8 @@ void IO_AddReader(  AVRPeripheral *pstPeriph_, uint8_t addr_)
     node->pfReader = pstPeriph_->pfRead;
     node->pvContext = pstPeriph_->pvContext;
 
-    stCPU.apstPeriphReadTable[addr_] = node;    
+    stCPU.apstPeriphReadTable[addr_] = node;
+    CPU_UpdateDataMap( addr_, 1, DATA_MAP_PERIPH_READ, 0 );
 }
 
 //---------------------------------------------------------------------------
@@ -61,13 +182,50 @@ void IO_AddWriter(  AVRPeripheral *pstPeriph_, uint8_t addr_)
     node->next = stCPU.apstPeriphWriteTable[addr_];
     node->pfWriter = pstPeriph_->pfWrite;
     node->pvContext = pstPeriph_->pvContext;
+    node->pstEvent = IO_FindEvent( pstPeriph_ );
 
     stCPU.apstPeriphWriteTable[addr_] = node;
+    CPU_UpdateDataMap( addr_, 1, DATA_MAP_PERIPH_WRITE, 0 );
 }
 
 //---------------------------------------------------------------------------
 void IO_AddClocker(  AVRPeripheral *pstPeriph_ )
 {
+    if (!pstPeriph_->pfClock)
+    {
+        return;
+    }
+
+#if FEATURE_USE_EVENT_SCHEDULER
+    if (pstPeriph_->pfNextEvent)
+    {
+        IOEvent *pstEvent = (IOEvent*)malloc(sizeof(*pstEvent));
+        IOEvent **apstHeap = (IOEvent**)realloc(apstEventHeap, sizeof(IOEvent*) * (u32EventCount + 1));
+        if (!pstEvent || !apstHeap)
+        {
+            free(pstEvent);
+            return;
+        }
+        apstEventHeap = apstHeap;
+
+        // Peripherals registered later are clocked first, matching the order
+        // of the per-cycle clock list.
+        pstEvent->pfClock = pstPeriph_->pfClock;
+        pstEvent->pfNextEvent = pstPeriph_->pfNextEvent;
+        pstEvent->pfAdvance = pstPeriph_->pfAdvance;
+        pstEvent->pvContext = pstPeriph_->pvContext;
+        pstEvent->pstPeriph = pstPeriph_;
+        pstEvent->u32Order = u32EventOrder--;
+        pstEvent->u64Deadline = PERIPH_NO_EVENT;
+        pstEvent->u32HeapIndex = u32EventCount;
+
+        apstEventHeap[u32EventCount++] = pstEvent;
+        IO_EventSchedule( pstEvent );
+        IO_UpdateNextEvent();
+        return;
+    }
+#endif
+
     IOClockList *node = NULL;
 
     node = (IOClockList*)malloc(sizeof(*node));
@@ -81,6 +239,84 @@ void IO_AddClocker(  AVRPeripheral *pstPeriph_ )
     node->pvContext = pstPeriph_->pvContext;
 
     stCPU.pstClockList = node;
+    IO_UpdateNextEvent();
+}
+
+//---------------------------------------------------------------------------
+void IO_Free( void )
+{
+    uint32_t i;
+
+    for (i = 0; i < CONFIG_IO_ADDRESS_BYTES; i++)
+    {
+        while (stCPU.apstPeriphReadTable[i])
+        {
+            IOReaderList *node = stCPU.apstPeriphReadTable[i];
+            stCPU.apstPeriphReadTable[i] = node->next;
+            free(node);
+        }
+        while (stCPU.apstPeriphWriteTable[i])
+        {
+            IOWriterList *node = stCPU.apstPeriphWriteTable[i];
+            stCPU.apstPeriphWriteTable[i] = node->next;
+            free(node);
+        }
+    }
+
+    while (stCPU.pstClockList)
+    {
+        IOClockList *node = stCPU.pstClockList;
+        stCPU.pstClockList = node->next;
+        free(node);
+    }
+
+    for (i = 0; i < u32EventCount; i++)
+    {
+        free(apstEventHeap[i]);
+    }
+    free(apstEventHeap);
+    apstEventHeap = NULL;
+    u32EventCount = 0;
+    u32EventOrder = UINT32_MAX;
+
+    IO_UpdateNextEvent();
+}
+
+//---------------------------------------------------------------------------
+void IO_Reschedule( AVRPeripheral *pstPeriph_ )
+{
+    IOEvent *pstEvent = IO_FindEvent( pstPeriph_ );
+    if (pstEvent)
+    {
+        IO_RescheduleEvent( pstEvent );
+    }
+}
+
+//---------------------------------------------------------------------------
+void IO_RescheduleEvent( IOEvent *pstEvent_ )
+{
+    IO_EventSchedule( pstEvent_ );
+    IO_UpdateNextEvent();
+}
+
+//---------------------------------------------------------------------------
+void IO_RescheduleAll( void )
+{
+    uint32_t i;
+
+    // Every deadline may move, so rebuild the heap from scratch rather than
+    // sifting each entry (which would reorder the entries being walked).  The
+    // rebuild only moves entries towards the leaves - moving one towards the
+    // root would push its parent down, past subtrees not yet ordered.
+    for (i = 0; i < u32EventCount; i++)
+    {
+        IO_EventDeadline( apstEventHeap[i] );
+    }
+    for (i = u32EventCount / 2; i > 0; i--)
+    {
+        IO_EventSiftDown( i - 1 );
+    }
+    IO_UpdateNextEvent();
 }
 
 //---------------------------------------------------------------------------
@@ -93,6 +329,10 @@ void IO_Write(  uint8_t addr_, uint8_t value_ )
         {
             node->pfWriter( node->pvContext, addr_, value_ );
         }
+        if (node->pstEvent)
+        {
+            IO_RescheduleEvent( node->pstEvent );
+        }
         node = node->next;
     }
 }
@@ -112,15 +352,60 @@ void IO_Read(  uint8_t addr_, uint8_t *value_ )
 }
 
 //---------------------------------------------------------------------------
-void IO_Clock( void )
+void IO_RunEvents( void )
 {
     IOClockList *node = stCPU.pstClockList;
     while (node)
     {
-        if (node->pfClock)
+        node->pfClock( node->pvContext );
+        node = node->next;
+    }
+
+    while (u32EventCount && (apstEventHeap[0]->u64Deadline <= stCPU.u64IOTicks))
+    {
+        IOEvent *pstEvent = apstEventHeap[0];
+        pstEvent->pfClock( pstEvent->pvContext );
+        IO_EventSchedule( pstEvent );
+    }
+
+    IO_UpdateNextEvent();
+}
+
+//---------------------------------------------------------------------------
+void IO_AdvanceEvents( uint32_t u32Ticks_ )
+{
+    uint64_t u64Now = stCPU.u64IOTicks;
+    uint64_t u64Tick;
+
+    // Per-cycle clocks have to see every tick - replay them one at a time.
+    if (stCPU.pstClockList)
+    {
+        for (u64Tick = u64Now - u32Ticks_ + 1; u64Tick <= u64Now; u64Tick++)
         {
-            node->pfClock( node->pvContext );
+            stCPU.u64IOTicks = u64Tick;
+            IO_RunEvents();
         }
-        node = node->next;
+        return;
     }
+
+    // Otherwise, run each event on the tick it was due, rescheduling it from
+    // there, as if the ticks had been clocked one at a time.
+    while (u32EventCount && (apstEventHeap[0]->u64Deadline <= u64Now))
+    {
+        IOEvent *pstEvent = apstEventHeap[0];
+        if (stCPU.bFastIO && pstEvent->pfAdvance)
+        {
+            stCPU.u64IOTicks = u64Now;
+            pstEvent->pfAdvance( pstEvent->pvContext, u64Now - pstEvent->u64Deadline + 1 );
+        }
+        else
+        {
+            stCPU.u64IOTicks = pstEvent->u64Deadline;
+            pstEvent->pfClock( pstEvent->pvContext );
+        }
+        IO_EventSchedule( pstEvent );
+    }
+
+    stCPU.u64IOTicks = u64Now;
+    IO_UpdateNextEvent();
 }
@@ -24,6 +24,22 @@
 
 #include "avr_peripheral.h"
 
+//---------------------------------------------------------------------------
+/*!
+    Scheduler entry for an event-driven peripheral (one providing pfNextEvent)
+*/
+typedef struct _IOEvent
+{
+    uint64_t u64Deadline;       //!< Absolute tick at which the clock next runs
+    uint32_t u32Order;          //!< Tie-break for events due on the same tick
+    uint32_t u32HeapIndex;      //!< Current position in the scheduler heap
+    void *pvContext;
+    PeriphClock pfClock;
+    PeriphNextEvent pfNextEvent;
+    PeriphAdvance pfAdvance;    //!< Used in place of pfClock in fast IO mode (NULL if none)
+    AVRPeripheral *pstPeriph;
+} IOEvent;
+
 //---------------------------------------------------------------------------
 typedef struct _IOReaderList
 {
@@ -38,6 +54,7 @@ typedef struct _IOWriterList
     struct _IOWriterList *next;
     void *pvContext;
     PeriphWrite pfWriter;
+    IOEvent *pstEvent;          //!< Rescheduled after each write (NULL if none)
 } IOWriterList;
 
 //---------------------------------------------------------------------------
@@ -70,10 +87,55 @@ void IO_AddWriter(  AVRPeripheral *pstPeriph_, uint8_t addr_);
 /*!
  * \brief IO_AddClocker
  *
+ * Register a peripheral's clock.  Event-driven peripherals are added to the
+ * event scheduler, all others are clocked on every CPU cycle.
+ *
  * \param pstPeriph_
  */
 void IO_AddClocker(  AVRPeripheral *pstPeriph_ );
 
+//--------------------------------------------------------------------------
+/*!
+ * \brief IO_Free
+ *
+ * Unregister every peripheral reader, writer and clock, and release the
+ * event scheduler.  Called from CPU_Free().
+ */
+void IO_Free( void );
+
+//--------------------------------------------------------------------------
+/*!
+ * \brief IO_Reschedule
+ *
+ * Re-evaluate the next event for an event-driven peripheral, after its
+ * timing has changed through something other than a write to its own
+ * registers.  Has no effect for peripherals that aren't event-driven.
+ *
+ * \param pstPeriph_
+ */
+void IO_Reschedule( AVRPeripheral *pstPeriph_ );
+
+//--------------------------------------------------------------------------
+/*!
+ * \brief IO_RescheduleEvent
+ *
+ * Re-evaluate the next event for a given scheduler entry.
+ *
+ * \param pstEvent_
+ */
+void IO_RescheduleEvent( IOEvent *pstEvent_ );
+
+//--------------------------------------------------------------------------
+/*!
+ * \brief IO_RescheduleAll
+ *
+ * Re-evaluate the next event for every event-driven peripheral.  Used when
+ * the CPU changes state in a way that affects how far ahead peripherals can
+ * schedule themselves (i.e. on waking from sleep), and to bring lazily
+ * advanced peripheral state up to date before it's inspected.
+ */
+void IO_RescheduleAll( void );
+
 //--------------------------------------------------------------------------
 /*!
  * \brief IO_Write
@@ -94,9 +156,28 @@ void IO_Read(  uint8_t addr_, uint8_t *value_ );
 
 //---------------------------------------------------------------------------
 /*!
- * \brief IO_Clock
+ * \brief IO_RunEvents
+ *
+ * Run the peripheral clocks due on the current tick - every per-cycle
+ * clock, followed by any scheduled events, in the order the peripherals
+ * appear in the clock list.  Called from IO_Clock() (see avr_cpu.h) when the
+ * tick counter reaches the next scheduled event.
+ */
+void IO_RunEvents( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief IO_AdvanceEvents
+ *
+ * Run the peripheral clocks due over the last u32Ticks_ ticks, after the
+ * tick counter has been advanced past the next scheduled event (see
+ * IO_Advance() in avr_cpu.h).  Events are run on the ticks they're due, in
+ * the same order as running IO_RunEvents() on each tick, unless fast IO mode
+ * is enabled - in which case peripherals providing pfAdvance are brought up
+ * to the current tick in a single call.
  *
+ * \param u32Ticks_ Number of ticks the counter was advanced by
  */
-void IO_Clock( void );
+void IO_AdvanceEvents( uint32_t u32Ticks_ );
 
 #endif
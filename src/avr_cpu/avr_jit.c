@@ -0,0 +1,872 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_jit.c
+
+  \brief x86-64 basic-block translator for hot AVR code.
+
+  The translator works on top of the predecoded instruction cache.  Each ROM
+  address executed by the interpreter has a hit counter; once an address has
+  been executed CONFIG_JIT_HOT_THRESHOLD times, the straight-line run of
+  predecoded instructions starting at that address is translated into a
+  block of native code.
+
+  Register-only arithmetic, logic, moves, and conditional branches are
+  translated directly into x86-64 instructions operating on the AVR register
+  file in place, with SREG computed from the host flags through a lookup
+  table.  Every other instruction (memory, I/O, stack, multiply, etc.) is
+  executed by calling back into CPU_RunCycle(), so peripherals, watchpoints,
+  and write callouts behave exactly as they do in the interpreter.
+
+  Cycle counts are taken from the AVR_Opcode_Cycles() tables at translation
+  time.  Each instruction in a block is retired individually (PC, cycle
+  count, peripheral clocking, interrupt check), so that the AVR register
+  file, SREG, and PC are coherent whenever control leaves the block, and so
+  the results are identical to the interpreter's.
+
+  Blocks are flushed whenever the ROM is modified (see CPU_InvalidateROM()),
+  and the whole code buffer is recycled when it fills up.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "emu_config.h"
+
+#include "avr_cpu.h"
+#include "avr_io.h"
+#include "avr_interrupt.h"
+#include "avr_opcodes.h"
+#include "avr_op_cache.h"
+#include "avr_jit.h"
+#include "avr_idle_loop.h"
+#include "avr_hle.h"
+#include "breakpoint.h"
+
+#if FEATURE_USE_JIT
+
+//---------------------------------------------------------------------------
+//! Offset of SREG within the AVR register file, as addressed off of RBX
+#define JIT_SREG                (offsetof(AVRRegisterFile, SREG))
+
+//! Worst-case size of a single translated block, used to check for space
+#define JIT_MAX_BLOCK_BYTES     (CONFIG_JIT_MAX_BLOCK_LENGTH * 128 + 64)
+
+//! Hit count value marking an address that can't be translated
+#define JIT_HITS_UNTRANSLATABLE (0xFFFF)
+
+//! SREG flag bits
+#define JIT_FLAG_C              (0x01)
+#define JIT_FLAG_Z              (0x02)
+#define JIT_FLAG_N              (0x04)
+#define JIT_FLAG_V              (0x08)
+#define JIT_FLAG_S              (0x10)
+#define JIT_FLAG_H              (0x20)
+
+//! SREG flags affected by the various classes of translated instruction
+#define JIT_FLAGS_ARITH         (0x3F)  // H S V N Z C
+#define JIT_FLAGS_LOGIC         (0x1E)  // S V N Z
+#define JIT_FLAGS_WORD          (0x1F)  // S V N Z C
+
+//---------------------------------------------------------------------------
+/*!
+    Native code generated for a block.  Blocks return once they have retired
+    their last instruction, once control flow leaves the block, or once the
+    instruction budget for the current call to AVR_JIT_Run() is exhausted.
+*/
+typedef void (*AVR_JIT_Block)( void );
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE uint8_t         *pu8CodeBuffer = NULL;   //!< Executable code buffer
+static EMU_INSTANCE uint32_t         u32CodeUsed = 0;        //!< Bytes of code buffer in use
+static EMU_INSTANCE uint8_t         *pu8Emit;                //!< Current code emit pointer
+
+static EMU_INSTANCE AVR_JIT_Block   *apfBlocks = NULL;       //!< Translated blocks, indexed by ROM word
+static EMU_INSTANCE uint16_t        *au16Hits = NULL;        //!< Interpreter hit counts, indexed by ROM word
+static EMU_INSTANCE uint32_t         u32BlockWords = 0;      //!< Number of ROM words covered by the tables
+
+static EMU_INSTANCE uint32_t         u32Budget;              //!< Instructions remaining in the current run
+static EMU_INSTANCE uint32_t         u32Generation;          //!< Incremented each time blocks are flushed
+
+//---------------------------------------------------------------------------
+/*!
+    Host flag to SREG conversion table.  The first 512 entries are indexed by
+    (LAHF result | OF << 8) following an arithmetic or logical operation; the
+    last 256 entries are indexed by (LAHF result | CF) following a right-shift
+    (where the carry out is saved before the result is tested).
+*/
+static EMU_INSTANCE uint8_t          au8FlagTable[ 512 + 256 ];
+
+//---------------------------------------------------------------------------
+static void JIT_BuildFlagTable( void )
+{
+    uint32_t i;
+    for (i = 0; i < 512; i++)
+    {
+        uint8_t C = ((i & 0x01) != 0);
+        uint8_t Z = ((i & 0x40) != 0);
+        uint8_t N = ((i & 0x80) != 0);
+        uint8_t H = ((i & 0x10) != 0);
+        uint8_t V = ((i & 0x100) != 0);
+
+        au8FlagTable[i] = (C << 0) | (Z << 1) | (N << 2) | (V << 3)
+                        | ((N ^ V) << 4) | (H << 5);
+    }
+    for (i = 0; i < 256; i++)
+    {
+        uint8_t C = ((i & 0x01) != 0);
+        uint8_t Z = ((i & 0x40) != 0);
+        uint8_t N = ((i & 0x80) != 0);
+        uint8_t V = N ^ C;
+
+        au8FlagTable[512 + i] = (C << 0) | (Z << 1) | (N << 2) | (V << 3)
+                              | ((N ^ V) << 4);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void JIT_Flush( void )
+{
+    // Drop every translated block, and start filling the buffer from scratch.
+    memset( apfBlocks, 0, u32BlockWords * sizeof(AVR_JIT_Block) );
+    memset( au16Hits, 0, u32BlockWords * sizeof(uint16_t) );
+    u32CodeUsed = 0;
+    u32Generation++;
+}
+
+//---------------------------------------------------------------------------
+void AVR_JIT_Init( uint32_t u32ROMSize_ )
+{
+    free( apfBlocks );
+    free( au16Hits );
+
+    u32BlockWords = u32ROMSize_ / sizeof(uint16_t);
+    apfBlocks = (AVR_JIT_Block*)calloc( u32BlockWords, sizeof(AVR_JIT_Block) );
+    au16Hits = (uint16_t*)calloc( u32BlockWords, sizeof(uint16_t) );
+
+    if (!pu8CodeBuffer)
+    {
+        void *pvBuffer = mmap( NULL, CONFIG_JIT_CODE_BUFFER_SIZE,
+                               PROT_READ | PROT_WRITE | PROT_EXEC,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if (pvBuffer != MAP_FAILED)
+        {
+            pu8CodeBuffer = (uint8_t*)pvBuffer;
+        }
+    }
+
+    if (!apfBlocks || !au16Hits || !pu8CodeBuffer)
+    {
+        fprintf( stderr, "Unable to allocate JIT code buffer\n" );
+        exit(-1);
+    }
+
+    JIT_BuildFlagTable();
+    JIT_Flush();
+}
+
+//---------------------------------------------------------------------------
+void AVR_JIT_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+    // ROM modification is rare (program load, debugger writes), so rather
+    // than tracking which blocks overlap the range, just flush everything.
+    (void)u32Addr_;
+    (void)u32Words_;
+
+    if (apfBlocks)
+    {
+        JIT_Flush();
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Called from translated code after each natively-executed instruction.
+    Mirrors the retire logic in CPU_RunCycle().  Returns true if the block
+    must return to AVR_JIT_Run() (interrupt taken, or budget exhausted).
+*/
+static bool JIT_Retire( uint32_t u32NextPC_, uint32_t u32Cycles_ )
+{
+#if FEATURE_USE_IDLE_LOOPS
+    uint32_t u32PC = stCPU.u32PC;
+    uint32_t u32Skipped;
+#endif
+
+    stCPU.u32PC = u32NextPC_;
+    stCPU.u64CycleCount += u32Cycles_;
+    IO_Advance( u32Cycles_ );
+    stCPU.u64InstructionCount++;
+    AVR_Interrupt();
+
+    u32Budget--;
+
+#if FEATURE_USE_IDLE_LOOPS
+    // After skipping loop iterations, return to AVR_JIT_Run(), which picks the
+    // loop back up from wherever the skip left off.
+    if ((u32NextPC_ < u32PC) && (stCPU.u32PC == u32NextPC_))
+    {
+        u32Skipped = AVR_IdleLoop_Skip( u32PC, u32Budget );
+        if (u32Skipped)
+        {
+            u32Budget -= u32Skipped;
+            return true;
+        }
+    }
+#endif
+    return ((stCPU.u32PC != u32NextPC_) || !u32Budget);
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Called from translated code for instructions that aren't translated
+    natively.  Returns true if the block must return to AVR_JIT_Run() (control
+    flow left the block, CPU went to sleep, code was flushed, or the budget is
+    exhausted).
+*/
+static bool JIT_Step( uint32_t u32NextPC_ )
+{
+    uint32_t u32Generation_ = u32Generation;
+
+    // Translated code works on SREG directly
+    CPU_RunCycle();
+    AVR_Opcode_SyncFlags();
+
+    u32Budget--;
+    return ((stCPU.u32PC != u32NextPC_) || !u32Budget || stCPU.bAsleep
+            || (u32Generation_ != u32Generation));
+}
+
+//---------------------------------------------------------------------------
+static void JIT_Emit8( uint8_t u8Val_ )
+{
+    *pu8Emit++ = u8Val_;
+}
+
+//---------------------------------------------------------------------------
+static void JIT_Emit32( uint32_t u32Val_ )
+{
+    memcpy( pu8Emit, &u32Val_, sizeof(u32Val_) );
+    pu8Emit += sizeof(u32Val_);
+}
+
+//---------------------------------------------------------------------------
+static void JIT_Emit64( uint64_t u64Val_ )
+{
+    memcpy( pu8Emit, &u64Val_, sizeof(u64Val_) );
+    pu8Emit += sizeof(u64Val_);
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitBytes( const uint8_t *pu8Bytes_, uint32_t u32Len_ )
+{
+    memcpy( pu8Emit, pu8Bytes_, u32Len_ );
+    pu8Emit += u32Len_;
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitPatch32( uint8_t *pu8Rel_, uint8_t *pu8Target_ )
+{
+    // Fill in the rel32 operand of a jump, relative to the end of the jump
+    uint32_t u32Rel = (uint32_t)(pu8Target_ - (pu8Rel_ + 4));
+    memcpy( pu8Rel_, &u32Rel, sizeof(u32Rel) );
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitPrologue( void )
+{
+    // push rbx; push r12; push r13 (keeps the stack 16-byte aligned for calls)
+    static const uint8_t au8Push[] = { 0x53, 0x41, 0x54, 0x41, 0x55 };
+    JIT_EmitBytes( au8Push, sizeof(au8Push) );
+
+    // mov rax, &stCPU.pstRAM; mov rbx, [rax]
+    JIT_Emit8( 0x48 ); JIT_Emit8( 0xB8 ); JIT_Emit64( (uint64_t)(uintptr_t)&stCPU.pstRAM );
+    JIT_Emit8( 0x48 ); JIT_Emit8( 0x8B ); JIT_Emit8( 0x18 );
+
+    // mov r12, au8FlagTable
+    JIT_Emit8( 0x49 ); JIT_Emit8( 0xBC ); JIT_Emit64( (uint64_t)(uintptr_t)au8FlagTable );
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitEpilogue( void )
+{
+    // pop r13; pop r12; pop rbx; ret
+    static const uint8_t au8Pop[] = { 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 };
+    JIT_EmitBytes( au8Pop, sizeof(au8Pop) );
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitCall( void *pvFunc_, uint32_t u32Arg0_, uint32_t u32Arg1_ )
+{
+    // mov edi, imm32; mov esi, imm32; mov rax, imm64; call rax
+    JIT_Emit8( 0xBF ); JIT_Emit32( u32Arg0_ );
+    JIT_Emit8( 0xBE ); JIT_Emit32( u32Arg1_ );
+    JIT_Emit8( 0x48 ); JIT_Emit8( 0xB8 ); JIT_Emit64( (uint64_t)(uintptr_t)pvFunc_ );
+    JIT_Emit8( 0xFF ); JIT_Emit8( 0xD0 );
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitExitIfSet( void )
+{
+    // test al, al; jz +6; <epilogue>
+    JIT_Emit8( 0x84 ); JIT_Emit8( 0xC0 );
+    JIT_Emit8( 0x74 ); JIT_Emit8( 0x06 );
+    JIT_EmitEpilogue();
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitLoopOrExit( uint8_t *pu8Body_ )
+{
+    // test al, al; jz body; <epilogue>
+    JIT_Emit8( 0x84 ); JIT_Emit8( 0xC0 );
+    JIT_Emit8( 0x0F ); JIT_Emit8( 0x84 );
+    JIT_Emit32( 0 );
+    JIT_EmitPatch32( pu8Emit - 4, pu8Body_ );
+    JIT_EmitEpilogue();
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitRegOp( uint8_t u8Op_, uint8_t u8Reg_ )
+{
+    // <op> al, [rbx + u8Reg_]  (or the store/word variants, by opcode)
+    JIT_Emit8( u8Op_ ); JIT_Emit8( 0x43 ); JIT_Emit8( u8Reg_ );
+}
+
+//---------------------------------------------------------------------------
+static void JIT_EmitLoadCarry( void )
+{
+    // mov dl, [rbx + SREG]; shr dl, 1  (CF = SREG.C)
+    JIT_Emit8( 0x8A ); JIT_Emit8( 0x53 ); JIT_Emit8( JIT_SREG );
+    JIT_Emit8( 0xD0 ); JIT_Emit8( 0xEA );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Convert the host flags into AVR flags, and merge them into SREG.  For
+    right-shift operations, DL must hold the carry out of the shift, and the
+    flags must be those of the shift result being tested.
+*/
+static void JIT_EmitFlags( bool bShift_, uint8_t u8Mask_, bool bStickyZ_ )
+{
+    // lahf
+    JIT_Emit8( 0x9F );
+    if (!bShift_)
+    {
+        // seto dl; movzx ecx, ah; movzx edx, dl; shl edx, 8; or ecx, edx
+        static const uint8_t au8Arith[] =
+        {
+            0x0F, 0x90, 0xC2, 0x0F, 0xB6, 0xCC, 0x0F, 0xB6, 0xD2,
+            0xC1, 0xE2, 0x08, 0x09, 0xD1
+        };
+        JIT_EmitBytes( au8Arith, sizeof(au8Arith) );
+
+        // movzx ecx, byte [r12 + rcx]
+        static const uint8_t au8Lookup[] = { 0x41, 0x0F, 0xB6, 0x0C, 0x0C };
+        JIT_EmitBytes( au8Lookup, sizeof(au8Lookup) );
+    }
+    else
+    {
+        // or ah, dl; movzx ecx, ah; movzx ecx, byte [r12 + rcx + 512]
+        static const uint8_t au8Shift[] =
+        {
+            0x08, 0xD4, 0x0F, 0xB6, 0xCC,
+            0x41, 0x0F, 0xB6, 0x8C, 0x0C, 0x00, 0x02, 0x00, 0x00
+        };
+        JIT_EmitBytes( au8Shift, sizeof(au8Shift) );
+    }
+
+    // mov dl, [rbx + SREG]
+    JIT_Emit8( 0x8A ); JIT_Emit8( 0x53 ); JIT_Emit8( JIT_SREG );
+
+    if (bStickyZ_)
+    {
+        // Z is only ever cleared: mov al, dl; or al, ~Z; and cl, al
+        JIT_Emit8( 0x88 ); JIT_Emit8( 0xD0 );
+        JIT_Emit8( 0x0C ); JIT_Emit8( (uint8_t)~JIT_FLAG_Z );
+        JIT_Emit8( 0x20 ); JIT_Emit8( 0xC1 );
+    }
+
+    // and dl, ~mask; and cl, mask; or dl, cl; mov [rbx + SREG], dl
+    JIT_Emit8( 0x80 ); JIT_Emit8( 0xE2 ); JIT_Emit8( (uint8_t)~u8Mask_ );
+    JIT_Emit8( 0x80 ); JIT_Emit8( 0xE1 ); JIT_Emit8( u8Mask_ );
+    JIT_Emit8( 0x08 ); JIT_Emit8( 0xCA );
+    JIT_Emit8( 0x88 ); JIT_Emit8( 0x53 ); JIT_Emit8( JIT_SREG );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Two-operand 8-bit ALU operation.  u8Op_ is the x86 "op r8, r/m8" opcode;
+    the "op al, imm8" form is always u8Op_ + 2.
+*/
+static void JIT_EmitALU( uint8_t u8Op_, uint8_t u8Rd_, bool bImm_, uint8_t u8Src_,
+                         bool bCarryIn_, bool bStore_, uint8_t u8Mask_, bool bStickyZ_ )
+{
+    JIT_EmitRegOp( 0x8A, u8Rd_ );
+    if (bCarryIn_)
+    {
+        JIT_EmitLoadCarry();
+    }
+    if (bImm_)
+    {
+        JIT_Emit8( u8Op_ + 2 ); JIT_Emit8( u8Src_ );
+    }
+    else
+    {
+        JIT_EmitRegOp( u8Op_, u8Src_ );
+    }
+    if (bStore_)
+    {
+        JIT_EmitRegOp( 0x88, u8Rd_ );
+    }
+    JIT_EmitFlags( false, u8Mask_, bStickyZ_ );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Single-operand 8-bit operation, where u8ModRM_ selects the operation
+    within the x86 "grp" opcode u8Op_ operating on AL.
+*/
+static void JIT_EmitUnary( uint8_t u8Op_, uint8_t u8ModRM_, uint8_t u8Rd_, uint8_t u8Mask_ )
+{
+    JIT_EmitRegOp( 0x8A, u8Rd_ );
+    JIT_Emit8( u8Op_ ); JIT_Emit8( u8ModRM_ );
+    JIT_EmitRegOp( 0x88, u8Rd_ );
+    JIT_EmitFlags( false, u8Mask_, false );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Right shift/rotate (LSR, ROR, ASR), where u8ModRM_ selects the operation
+    within the x86 "shift al, 1" opcode.
+*/
+static void JIT_EmitShift( uint8_t u8ModRM_, uint8_t u8Rd_, bool bCarryIn_ )
+{
+    JIT_EmitRegOp( 0x8A, u8Rd_ );
+    if (bCarryIn_)
+    {
+        JIT_EmitLoadCarry();
+    }
+    JIT_Emit8( 0xD0 ); JIT_Emit8( u8ModRM_ );
+    JIT_EmitRegOp( 0x88, u8Rd_ );
+
+    // setc dl; test al, al
+    JIT_Emit8( 0x0F ); JIT_Emit8( 0x92 ); JIT_Emit8( 0xC2 );
+    JIT_Emit8( 0x84 ); JIT_Emit8( 0xC0 );
+    JIT_EmitFlags( true, JIT_FLAGS_WORD, false );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    16-bit immediate add/subtract on a register pair (ADIW, SBIW), where
+    u8Op_ is the x86 "op ax, imm16" opcode.
+*/
+static void JIT_EmitWord( uint8_t u8Op_, uint8_t u8Rd_, uint16_t u16K_ )
+{
+    JIT_Emit8( 0x66 ); JIT_EmitRegOp( 0x8B, u8Rd_ );
+    JIT_Emit8( 0x66 ); JIT_Emit8( u8Op_ );
+    JIT_Emit8( (uint8_t)u16K_ ); JIT_Emit8( (uint8_t)(u16K_ >> 8) );
+    JIT_Emit8( 0x66 ); JIT_EmitRegOp( 0x89, u8Rd_ );
+    JIT_EmitFlags( false, JIT_FLAGS_WORD, false );
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Return the SREG bit tested by a conditional branch, and whether the branch
+    is taken when that bit is set (true) or clear (false).  Returns 0 if the
+    opcode isn't a conditional branch.
+*/
+static uint8_t JIT_BranchFlag( uint8_t u8Index_, bool *pbTakenIfSet_ )
+{
+    switch (u8Index_)
+    {
+        case AVR_OPCODE_INDEX_BREQ: *pbTakenIfSet_ = true;  return JIT_FLAG_Z;
+        case AVR_OPCODE_INDEX_BRNE: *pbTakenIfSet_ = false; return JIT_FLAG_Z;
+        case AVR_OPCODE_INDEX_BRCS: *pbTakenIfSet_ = true;  return JIT_FLAG_C;
+        case AVR_OPCODE_INDEX_BRLO: *pbTakenIfSet_ = true;  return JIT_FLAG_C;
+        case AVR_OPCODE_INDEX_BRCC: *pbTakenIfSet_ = false; return JIT_FLAG_C;
+        case AVR_OPCODE_INDEX_BRSH: *pbTakenIfSet_ = false; return JIT_FLAG_C;
+        case AVR_OPCODE_INDEX_BRMI: *pbTakenIfSet_ = true;  return JIT_FLAG_N;
+        case AVR_OPCODE_INDEX_BRPL: *pbTakenIfSet_ = false; return JIT_FLAG_N;
+        case AVR_OPCODE_INDEX_BRLT: *pbTakenIfSet_ = true;  return JIT_FLAG_S;
+        case AVR_OPCODE_INDEX_BRGE: *pbTakenIfSet_ = false; return JIT_FLAG_S;
+        case AVR_OPCODE_INDEX_BRHC: *pbTakenIfSet_ = false; return JIT_FLAG_H;
+        case AVR_OPCODE_INDEX_BRTS: *pbTakenIfSet_ = true;  return 0x40;
+        case AVR_OPCODE_INDEX_BRTC: *pbTakenIfSet_ = false; return 0x40;
+        case AVR_OPCODE_INDEX_BRVS: *pbTakenIfSet_ = true;  return JIT_FLAG_V;
+        case AVR_OPCODE_INDEX_BRVC: *pbTakenIfSet_ = false; return JIT_FLAG_V;
+        case AVR_OPCODE_INDEX_BRIE: *pbTakenIfSet_ = true;  return 0x80;
+        case AVR_OPCODE_INDEX_BRID: *pbTakenIfSet_ = false; return 0x80;
+        default:
+            break;
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Return whether or not an instruction executed through JIT_Step() always
+    ends the block (i.e. it's a jump, call, return, or stops the CPU).
+*/
+static bool JIT_EndsBlock( uint8_t u8Index_ )
+{
+    switch (u8Index_)
+    {
+        case AVR_OPCODE_INDEX_IJMP:
+        case AVR_OPCODE_INDEX_EIJMP:
+        case AVR_OPCODE_INDEX_JMP:
+        case AVR_OPCODE_INDEX_RCALL:
+        case AVR_OPCODE_INDEX_ICALL:
+        case AVR_OPCODE_INDEX_EICALL:
+        case AVR_OPCODE_INDEX_CALL:
+        case AVR_OPCODE_INDEX_RET:
+        case AVR_OPCODE_INDEX_RETI:
+        case AVR_OPCODE_INDEX_RJMP:
+        case AVR_OPCODE_INDEX_SLEEP:
+        case AVR_OPCODE_INDEX_BREAK:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Emit the native code for a single register-only instruction.  Returns
+    false if the instruction has no native translation.
+*/
+static bool JIT_EmitNative( const AVR_OpCache_Entry_t *pstEntry_ )
+{
+    // Register operands are addressed by their offset within the register file
+    uintptr_t uRAM = (uintptr_t)stCPU.pstRAM->au8RAM;
+    uint8_t u8Rd = (uint8_t)((uintptr_t)pstEntry_->Rd - uRAM);
+    uint8_t u8Rr = (uint8_t)((uintptr_t)pstEntry_->Rr - uRAM);
+    uint8_t u8Rd16 = (uint8_t)((uintptr_t)pstEntry_->Rd16 - uRAM);
+    uint8_t u8Rr16 = (uint8_t)((uintptr_t)pstEntry_->Rr16 - uRAM);
+    uint8_t u8K = (uint8_t)pstEntry_->K;
+
+    switch (pstEntry_->u8Index)
+    {
+        case AVR_OPCODE_INDEX_NOP:
+            break;
+
+        //-- Moves
+        case AVR_OPCODE_INDEX_MOV:
+            JIT_EmitRegOp( 0x8A, u8Rr );
+            JIT_EmitRegOp( 0x88, u8Rd );
+            break;
+        case AVR_OPCODE_INDEX_MOVW:
+            JIT_Emit8( 0x66 ); JIT_EmitRegOp( 0x8B, u8Rr16 );
+            JIT_Emit8( 0x66 ); JIT_EmitRegOp( 0x89, u8Rd16 );
+            break;
+        case AVR_OPCODE_INDEX_LDI:
+            JIT_EmitRegOp( 0xC6, u8Rd ); JIT_Emit8( u8K );
+            break;
+        case AVR_OPCODE_INDEX_SER:
+            JIT_EmitRegOp( 0xC6, u8Rd ); JIT_Emit8( 0xFF );
+            break;
+        case AVR_OPCODE_INDEX_SWAP:
+            JIT_EmitRegOp( 0x8A, u8Rd );
+            JIT_Emit8( 0xC0 ); JIT_Emit8( 0xC0 ); JIT_Emit8( 0x04 );
+            JIT_EmitRegOp( 0x88, u8Rd );
+            break;
+
+        //-- Arithmetic
+        case AVR_OPCODE_INDEX_ADD:
+            JIT_EmitALU( 0x02, u8Rd, false, u8Rr, false, true, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_ADC:
+            JIT_EmitALU( 0x12, u8Rd, false, u8Rr, true, true, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_SUB:
+            JIT_EmitALU( 0x2A, u8Rd, false, u8Rr, false, true, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_SUBI:
+            JIT_EmitALU( 0x2A, u8Rd, true, u8K, false, true, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_SBC:
+            JIT_EmitALU( 0x1A, u8Rd, false, u8Rr, true, true, JIT_FLAGS_ARITH, true );
+            break;
+        case AVR_OPCODE_INDEX_SBCI:
+            JIT_EmitALU( 0x1A, u8Rd, true, u8K, true, true, JIT_FLAGS_ARITH, true );
+            break;
+        case AVR_OPCODE_INDEX_CP:
+            JIT_EmitALU( 0x3A, u8Rd, false, u8Rr, false, false, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_CPC:
+            JIT_EmitALU( 0x1A, u8Rd, false, u8Rr, true, false, JIT_FLAGS_ARITH, true );
+            break;
+        case AVR_OPCODE_INDEX_CPI:
+            JIT_EmitALU( 0x3A, u8Rd, true, u8K, false, false, JIT_FLAGS_ARITH, false );
+            break;
+        case AVR_OPCODE_INDEX_ADIW:
+            JIT_EmitWord( 0x05, u8Rd16, pstEntry_->K );
+            break;
+        case AVR_OPCODE_INDEX_SBIW:
+            JIT_EmitWord( 0x2D, u8Rd16, pstEntry_->K );
+            break;
+
+        //-- Logic
+        case AVR_OPCODE_INDEX_AND:
+            JIT_EmitALU( 0x22, u8Rd, false, u8Rr, false, true, JIT_FLAGS_LOGIC, false );
+            break;
+        case AVR_OPCODE_INDEX_ANDI:
+            JIT_EmitALU( 0x22, u8Rd, true, u8K, false, true, JIT_FLAGS_LOGIC, false );
+            break;
+        case AVR_OPCODE_INDEX_OR:
+            JIT_EmitALU( 0x0A, u8Rd, false, u8Rr, false, true, JIT_FLAGS_LOGIC, false );
+            break;
+        case AVR_OPCODE_INDEX_ORI:
+        case AVR_OPCODE_INDEX_SBR:
+            JIT_EmitALU( 0x0A, u8Rd, true, u8K, false, true, JIT_FLAGS_LOGIC, false );
+            break;
+        case AVR_OPCODE_INDEX_EOR:
+            JIT_EmitALU( 0x32, u8Rd, false, u8Rr, false, true, JIT_FLAGS_LOGIC, false );
+            break;
+
+        //-- Single-operand
+        case AVR_OPCODE_INDEX_COM:
+            // not al doesn't set flags; test the result, then force C
+            JIT_EmitRegOp( 0x8A, u8Rd );
+            JIT_Emit8( 0xF6 ); JIT_Emit8( 0xD0 );
+            JIT_EmitRegOp( 0x88, u8Rd );
+            JIT_Emit8( 0x84 ); JIT_Emit8( 0xC0 );
+            JIT_EmitFlags( false, JIT_FLAGS_LOGIC, false );
+            JIT_Emit8( 0x80 ); JIT_Emit8( 0x4B ); JIT_Emit8( JIT_SREG ); JIT_Emit8( JIT_FLAG_C );
+            break;
+        case AVR_OPCODE_INDEX_NEG:
+            JIT_EmitUnary( 0xF6, 0xD8, u8Rd, JIT_FLAGS_WORD );
+            break;
+        case AVR_OPCODE_INDEX_INC:
+            JIT_EmitUnary( 0xFE, 0xC0, u8Rd, JIT_FLAGS_LOGIC );
+            break;
+        case AVR_OPCODE_INDEX_DEC:
+            JIT_EmitUnary( 0xFE, 0xC8, u8Rd, JIT_FLAGS_LOGIC );
+            break;
+        case AVR_OPCODE_INDEX_LSR:
+            JIT_EmitShift( 0xE8, u8Rd, false );
+            break;
+        case AVR_OPCODE_INDEX_ROR:
+            JIT_EmitShift( 0xD8, u8Rd, true );
+            break;
+        case AVR_OPCODE_INDEX_ASR:
+            JIT_EmitShift( 0xF8, u8Rd, false );
+            break;
+
+        //-- SREG
+        case AVR_OPCODE_INDEX_BSET:
+            JIT_Emit8( 0x80 ); JIT_Emit8( 0x4B ); JIT_Emit8( JIT_SREG );
+            JIT_Emit8( (uint8_t)(1 << pstEntry_->b) );
+            break;
+        case AVR_OPCODE_INDEX_BCLR:
+            JIT_Emit8( 0x80 ); JIT_Emit8( 0x63 ); JIT_Emit8( JIT_SREG );
+            JIT_Emit8( (uint8_t)~(1 << pstEntry_->b) );
+            break;
+
+        default:
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+    Translate the run of predecoded instructions starting at a given ROM word
+    address into a native code block.  Returns false if nothing worthwhile
+    could be translated.
+*/
+static bool JIT_Translate( uint32_t u32Start_ )
+{
+    uint8_t *pu8Block;
+    uint8_t *pu8Body;
+    uint32_t u32Addr = u32Start_;
+    uint32_t u32Count = 0;
+    uint32_t u32Native = 0;
+    bool bDone = false;
+
+    if ((CONFIG_JIT_CODE_BUFFER_SIZE - u32CodeUsed) < JIT_MAX_BLOCK_BYTES)
+    {
+        JIT_Flush();
+    }
+
+    pu8Block = pu8CodeBuffer + u32CodeUsed;
+    pu8Emit = pu8Block;
+
+    JIT_EmitPrologue();
+    pu8Body = pu8Emit;
+
+    while (!bDone && (u32Count < CONFIG_JIT_MAX_BLOCK_LENGTH))
+    {
+        const AVR_OpCache_Entry_t *pstEntry = AVR_OpCache_Lookup( u32Addr );
+        uint32_t u32NextPC;
+        uint8_t u8Flag;
+        bool bTakenIfSet;
+
+        // Stop at code that hasn't been predecoded, or at breakpoints, so that
+        // the debugger gets a chance to see them from the interpreter.
+        if (!pstEntry || !pstEntry->bValid)
+        {
+            break;
+        }
+        if ((u32Addr != u32Start_) && BreakPoint_EnabledAtAddress( u32Addr ))
+        {
+            break;
+        }
+
+        u32NextPC = u32Addr + pstEntry->u8Size;
+        u8Flag = JIT_BranchFlag( pstEntry->u8Index, &bTakenIfSet );
+
+        if (u8Flag)
+        {
+            // Conditional branch: the taken path always leaves the block
+            // (unless it loops back to the start), the fall-through continues.
+            uint32_t u32Target = (uint32_t)((int32_t)u32Addr + (int32_t)pstEntry->k + 1) & stCPU.u32PCMask;
+            uint8_t *pu8NotTaken;
+
+            // test byte [rbx + SREG], flag; j(n)z not_taken
+            JIT_Emit8( 0xF6 ); JIT_Emit8( 0x43 ); JIT_Emit8( JIT_SREG ); JIT_Emit8( u8Flag );
+            JIT_Emit8( 0x0F ); JIT_Emit8( bTakenIfSet ? 0x84 : 0x85 );
+            JIT_Emit32( 0 );
+            pu8NotTaken = pu8Emit - 4;
+
+            JIT_EmitCall( (void*)JIT_Retire, u32Target, pstEntry->u8Cycles + 1 );
+            if (u32Target == u32Start_)
+            {
+                JIT_EmitLoopOrExit( pu8Body );
+            }
+            else
+            {
+                JIT_EmitEpilogue();
+            }
+
+            JIT_EmitPatch32( pu8NotTaken, pu8Emit );
+            JIT_EmitCall( (void*)JIT_Retire, u32NextPC, pstEntry->u8Cycles );
+            JIT_EmitExitIfSet();
+            u32Native++;
+        }
+        else if ((pstEntry->u8Index == AVR_OPCODE_INDEX_RJMP)
+                 && ((((uint32_t)((int32_t)u32Addr + (int32_t)pstEntry->k + 1)) & stCPU.u32PCMask) != 0))
+        {
+            // Relative jump (jumps to reset are left to the interpreter, which
+            // handles --exit-on-reset).
+            uint32_t u32Target = (uint32_t)((int32_t)u32Addr + (int32_t)pstEntry->k + 1) & stCPU.u32PCMask;
+
+            JIT_EmitCall( (void*)JIT_Retire, u32Target, pstEntry->u8Cycles );
+            if (u32Target == u32Start_)
+            {
+                JIT_EmitLoopOrExit( pu8Body );
+            }
+            else
+            {
+                JIT_EmitEpilogue();
+            }
+            u32Native++;
+            bDone = true;
+        }
+        else if (JIT_EmitNative( pstEntry ))
+        {
+            JIT_EmitCall( (void*)JIT_Retire, u32NextPC, pstEntry->u8Cycles );
+            JIT_EmitExitIfSet();
+            u32Native++;
+        }
+        else
+        {
+            // Everything else runs through the interpreter
+            JIT_EmitCall( (void*)JIT_Step, u32NextPC, 0 );
+            JIT_EmitExitIfSet();
+            bDone = JIT_EndsBlock( pstEntry->u8Index );
+        }
+
+        u32Addr = u32NextPC;
+        u32Count++;
+    }
+
+    JIT_EmitEpilogue();
+
+    if (!u32Native)
+    {
+        // Nothing gained over interpreting this code - discard the block.
+        return false;
+    }
+
+    u32CodeUsed += (uint32_t)(pu8Emit - pu8Block);
+    apfBlocks[ u32Start_ ] = (AVR_JIT_Block)pu8Block;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void AVR_JIT_Run( uint32_t u32Count_ )
+{
+    u32Budget = u32Count_;
+
+    while (u32Budget)
+    {
+        uint32_t u32PC = stCPU.u32PC;
+
+#if FEATURE_USE_HLE
+        if (stCPU.bHLE)
+        {
+            uint32_t u32Native = AVR_HLE_Call( u32Budget );
+            if (u32Native)
+            {
+                // Translated code works on SREG directly
+                AVR_Opcode_SyncFlags();
+                u32Budget -= u32Native;
+                continue;
+            }
+        }
+#endif
+
+        if (!stCPU.bAsleep && (u32PC < u32BlockWords))
+        {
+            AVR_JIT_Block pfBlock = apfBlocks[ u32PC ];
+            if (pfBlock)
+            {
+                pfBlock();
+                continue;
+            }
+
+            // Count executions of this address from the interpreter, and
+            // translate it once it becomes hot.
+            if (au16Hits[ u32PC ] < CONFIG_JIT_HOT_THRESHOLD)
+            {
+                au16Hits[ u32PC ]++;
+            }
+            else if (au16Hits[ u32PC ] != JIT_HITS_UNTRANSLATABLE)
+            {
+                if (JIT_Translate( u32PC ))
+                {
+                    continue;
+                }
+                au16Hits[ u32PC ] = JIT_HITS_UNTRANSLATABLE;
+            }
+        }
+
+#if FEATURE_USE_SLEEP_SKIP
+        if (stCPU.bAsleep)
+        {
+            u32Budget -= CPU_SkipSleep( u32Budget - 1 );
+        }
+#endif
+        CPU_RunCycle();
+        AVR_Opcode_SyncFlags();
+        u32Budget--;
+    }
+}
+
+#endif
@@ -0,0 +1,61 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_jit.h
+
+  \brief x86-64 basic-block translator for hot AVR code.
+*/
+
+#ifndef __AVR_JIT_H__
+#define __AVR_JIT_H__
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_JIT_Init
+ *
+ * Allocate the translated code buffer and block tables for a ROM of the
+ * given size.
+ *
+ * \param u32ROMSize_ Size of the CPU's ROM in bytes
+ */
+void AVR_JIT_Init( uint32_t u32ROMSize_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_JIT_Run
+ *
+ * Run a number of CPU instruction cycles, executing translated blocks of
+ * native code wherever they are available, and translating blocks of code
+ * once they have been executed often enough by the interpreter.  The results
+ * are identical to calling CPU_RunCycle() the same number of times.
+ *
+ * \param u32Count_ Number of instruction cycles to run
+ */
+void AVR_JIT_Run( uint32_t u32Count_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_JIT_Invalidate
+ *
+ * Discard any translated code covering a range of ROM that has been modified.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of ROM words modified
+ */
+void AVR_JIT_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ );
+
+#endif
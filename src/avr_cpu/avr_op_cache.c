@@ -0,0 +1,219 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_op_cache.c
+
+  \brief Predecoded instruction cache, indexed by ROM word address.
+
+  Entries are built lazily, the first time the instruction at a given address
+  is executed, and are invalidated whenever the corresponding ROM is modified
+  (loader, debugger memory writes, etc.).
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#include "avr_op_cache.h"
+#include "avr_op_decode.h"
+#include "avr_op_size.h"
+#include "avr_op_cycles.h"
+#include "avr_op_fusion.h"
+
+_Static_assert( AVR_IO_BIND_DISPATCH(AVR_IO_BIND_COUNT) < AVR_OPCODE_INDEX_INVALID,
+                "Bound I/O dispatch indexes overlap AVR_OPCODE_INDEX_INVALID" );
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE AVR_OpCache_Entry_t *pstOpCache = NULL;
+static EMU_INSTANCE uint32_t             u32CacheWords = 0;
+
+//---------------------------------------------------------------------------
+void AVR_OpCache_Init( uint32_t u32ROMSize_ )
+{
+    free( pstOpCache );
+
+    u32CacheWords = u32ROMSize_ / sizeof(uint16_t);
+    pstOpCache = (AVR_OpCache_Entry_t*)calloc( u32CacheWords, sizeof(AVR_OpCache_Entry_t) );
+    if (!pstOpCache)
+    {
+        fprintf( stderr, "Unable to allocate instruction cache\n" );
+        exit(-1);
+    }
+}
+
+//---------------------------------------------------------------------------
+AVR_OpCache_Entry_t *AVR_OpCache_Lookup( uint32_t u32Addr_ )
+{
+    if (u32Addr_ >= u32CacheWords)
+    {
+        return NULL;
+    }
+    return &pstOpCache[ u32Addr_ ];
+}
+
+//---------------------------------------------------------------------------
+void AVR_OpCache_Store( AVR_OpCache_Entry_t *pstEntry_, uint16_t OP_ )
+{
+    pstEntry_->pfOpcode = AVR_Opcode_Function( OP_ );
+
+    pstEntry_->Rd16     = stCPU.Rd16;
+    pstEntry_->Rd       = stCPU.Rd;
+    pstEntry_->Rr16     = stCPU.Rr16;
+    pstEntry_->Rr       = stCPU.Rr;
+    pstEntry_->k        = stCPU.k;
+    pstEntry_->K        = stCPU.K;
+    pstEntry_->A        = stCPU.A;
+    pstEntry_->b        = stCPU.b;
+    pstEntry_->s        = stCPU.s;
+    pstEntry_->q        = stCPU.q;
+
+    pstEntry_->u8Index      = AVR_Opcode_Index( pstEntry_->pfOpcode );
+    pstEntry_->u8Size       = AVR_Opcode_Size( OP_ );
+    pstEntry_->u8Cycles     = AVR_Opcode_Cycles( OP_ );
+    pstEntry_->bDecodeClock = AVR_Decoder_ClocksIO( OP_ );
+    pstEntry_->u8Dispatch   = AVR_OpCache_Dispatch( pstEntry_ );
+    pstEntry_->bValid       = true;
+
+#if FEATURE_USE_FUSION
+    AVR_Fusion_Update( (uint32_t)(pstEntry_ - pstOpCache) );
+#endif
+}
+
+//---------------------------------------------------------------------------
+uint8_t AVR_OpCache_Dispatch( const AVR_OpCache_Entry_t *pstEntry_ )
+{
+#if FEATURE_USE_IO_BINDING
+    // The I/O address is a constant in the opcode, so an instruction accessing
+    // a register with nothing attached can go straight to the RAM byte.
+    uint8_t u8Map = stCPU.au8DataMap[ 32 + pstEntry_->A ];
+
+    switch (pstEntry_->u8Index)
+    {
+    case AVR_OPCODE_INDEX_IN:
+        if (!(u8Map & DATA_MAP_READ_MASK))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_IN );
+        }
+        break;
+    case AVR_OPCODE_INDEX_OUT:
+        if (!(u8Map & DATA_MAP_WRITE_MASK))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_OUT );
+        }
+        break;
+    case AVR_OPCODE_INDEX_SBI:
+        if (!(u8Map & (DATA_MAP_READ_MASK | DATA_MAP_WRITE_MASK)))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_SBI );
+        }
+        break;
+    case AVR_OPCODE_INDEX_CBI:
+        if (!(u8Map & (DATA_MAP_READ_MASK | DATA_MAP_WRITE_MASK)))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_CBI );
+        }
+        break;
+    case AVR_OPCODE_INDEX_SBIS:
+        if (!(u8Map & DATA_MAP_READ_MASK))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_SBIS );
+        }
+        break;
+    case AVR_OPCODE_INDEX_SBIC:
+        if (!(u8Map & DATA_MAP_READ_MASK))
+        {
+            return AVR_IO_BIND_DISPATCH( AVR_IO_BIND_SBIC );
+        }
+        break;
+    default:
+        break;
+    }
+#endif
+    return AVR_Opcode_DispatchIndex( pstEntry_->pfOpcode );
+}
+
+//---------------------------------------------------------------------------
+void AVR_OpCache_Rebind( void )
+{
+    uint32_t i;
+
+    for (i = 0; i < u32CacheWords; i++)
+    {
+        switch (pstOpCache[i].u8Index)
+        {
+        case AVR_OPCODE_INDEX_IN:
+        case AVR_OPCODE_INDEX_OUT:
+        case AVR_OPCODE_INDEX_SBI:
+        case AVR_OPCODE_INDEX_CBI:
+        case AVR_OPCODE_INDEX_SBIS:
+        case AVR_OPCODE_INDEX_SBIC:
+            if (pstOpCache[i].bValid)
+            {
+                pstOpCache[i].u8Dispatch = AVR_OpCache_Dispatch( &pstOpCache[i] );
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+uint32_t AVR_OpCache_Size( void )
+{
+    return u32CacheWords;
+}
+
+//---------------------------------------------------------------------------
+void AVR_OpCache_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ )
+{
+    uint32_t u32Start = u32Addr_;
+    uint32_t u32End = u32Addr_ + u32Words_;
+    uint32_t u32Fused;
+
+    if (!pstOpCache)
+    {
+        return;
+    }
+
+    // The previous word may be a 2-word instruction using this one as operand
+    if (u32Start)
+    {
+        u32Start--;
+    }
+    if (u32End > u32CacheWords)
+    {
+        u32End = u32CacheWords;
+    }
+
+    // Entries before the range may start a fused sequence running into it.
+    // (Entries run through the generic handler never start one.)
+    for (u32Fused = (u32Start >= (AVR_FUSION_MAX_WORDS - 1)) ? (u32Start - (AVR_FUSION_MAX_WORDS - 1)) : 0;
+         u32Fused < u32Start; u32Fused++)
+    {
+        if (pstOpCache[ u32Fused ].u8Dispatch != AVR_OPCODE_INDEX_INVALID)
+        {
+            pstOpCache[ u32Fused ].u8Dispatch = AVR_OpCache_Dispatch( &pstOpCache[ u32Fused ] );
+        }
+    }
+
+    while (u32Start < u32End)
+    {
+        pstOpCache[ u32Start++ ].bValid = false;
+    }
+}
@@ -0,0 +1,192 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_op_cache.h
+
+  \brief Predecoded instruction cache, indexed by ROM word address.
+*/
+
+#ifndef __AVR_OP_CACHE_H__
+#define __AVR_OP_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "avr_cpu.h"
+#include "avr_opcodes.h"
+#include "avr_op_fusion.h"
+
+//---------------------------------------------------------------------------
+/*!
+    Predecoded form of the instruction located at a single ROM word address.
+    Holds the opcode execution handler, the operands produced by the
+    instruction decoder, as well as the instruction's size and base cycle
+    count, so that none of these need to be re-derived each time the
+    instruction is executed.
+*/
+typedef struct
+{
+    AVR_Opcode  pfOpcode;       //!< Opcode execution function
+
+    uint16_t   *Rd16;           //!< Decoded operands (see AVR_CPU)
+    uint8_t    *Rd;
+    uint16_t   *Rr16;
+    uint8_t    *Rr;
+    uint32_t    k;
+    uint16_t    K;
+    uint8_t     A;
+    uint8_t     b;
+    uint8_t     s;
+    uint8_t     q;
+
+    uint8_t     u8Index;        //!< Opcode function index (see AVR_Opcode_Index())
+    uint8_t     u8Dispatch;     //!< Threaded-engine handler index (see AVR_Opcode_DispatchIndex()), or a fused sequence
+    uint8_t     u8Size;         //!< Size of the instruction, in words
+    uint8_t     u8Cycles;       //!< Minimum number of cycles to execute the instruction
+    bool        bDecodeClock;   //!< Decoding this instruction clocks the peripherals
+    bool        bValid;         //!< Entry has been populated for the current ROM contents
+} AVR_OpCache_Entry_t;
+
+//---------------------------------------------------------------------------
+/*!
+    X-macro listing the I/O instructions that can be bound to the RAM byte
+    backing their I/O register when predecoded (see FEATURE_USE_IO_BINDING).
+*/
+#define AVR_IO_BIND_LIST(X) \
+    X(IN) X(OUT) X(SBI) X(CBI) X(SBIS) X(SBIC)
+
+#define AVR_IO_BIND_ENUM(x)         AVR_IO_BIND_##x,
+
+//---------------------------------------------------------------------------
+typedef enum
+{
+    AVR_IO_BIND_LIST(AVR_IO_BIND_ENUM)
+//---
+    AVR_IO_BIND_COUNT
+} AVR_IO_Bind_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Threaded-engine dispatch index for a bound I/O instruction.  Bound
+    handlers are numbered after the fused sequence handlers.
+*/
+#define AVR_IO_BIND_DISPATCH(x)     ((uint8_t)(AVR_FUSION_DISPATCH(AVR_FUSION_COUNT) + (x)))
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Init
+ *
+ * Allocate an (empty) instruction cache for a ROM of the given size.
+ *
+ * \param u32ROMSize_ Size of the CPU's ROM in bytes
+ */
+void AVR_OpCache_Init( uint32_t u32ROMSize_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Lookup
+ *
+ * Return the cache entry corresponding to a given ROM word address.  The
+ * entry returned may not have been populated yet (check bValid).
+ *
+ * \param u32Addr_ ROM word address
+ * \return Pointer to the cache entry, or NULL if the address is not cacheable
+ */
+AVR_OpCache_Entry_t *AVR_OpCache_Lookup( uint32_t u32Addr_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Store
+ *
+ * Populate a cache entry for the specified opcode, taking the operands from
+ * the CPU's intermediate registers.  The opcode must have just been decoded
+ * on the CPU object before calling this function.
+ *
+ * \param pstEntry_ Pointer to the entry to populate
+ * \param OP_       Opcode that was decoded
+ */
+void AVR_OpCache_Store( AVR_OpCache_Entry_t *pstEntry_, uint16_t OP_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Dispatch
+ *
+ * Determine the threaded-engine dispatch index for a populated cache entry,
+ * when it's not run as part of a fused sequence - the bound handler for an
+ * I/O instruction whose register is plain RAM, or otherwise the opcode's own
+ * handler (see AVR_Opcode_DispatchIndex()).
+ *
+ * \param pstEntry_ Pointer to the populated entry
+ * \return Dispatch index for the entry
+ */
+uint8_t AVR_OpCache_Dispatch( const AVR_OpCache_Entry_t *pstEntry_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Rebind
+ *
+ * Re-evaluate the binding of every predecoded I/O instruction, following a
+ * change to the I/O range of the data space map (peripherals, callouts or
+ * watchpoints being added or removed).
+ */
+void AVR_OpCache_Rebind( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Size
+ *
+ * \return Number of entries in the cache (i.e. words of ROM)
+ */
+uint32_t AVR_OpCache_Size( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Restore
+ *
+ * Load the CPU's intermediate registers with the operands stored in a
+ * populated cache entry - equivalent to decoding the instruction.  Inline,
+ * as this is run for every instruction executed from the cache.
+ *
+ * \param pstEntry_ Pointer to the populated entry
+ */
+static inline void AVR_OpCache_Restore( const AVR_OpCache_Entry_t *pstEntry_ )
+{
+    stCPU.Rd16  = pstEntry_->Rd16;
+    stCPU.Rd    = pstEntry_->Rd;
+    stCPU.Rr16  = pstEntry_->Rr16;
+    stCPU.Rr    = pstEntry_->Rr;
+    stCPU.k     = pstEntry_->k;
+    stCPU.K     = pstEntry_->K;
+    stCPU.A     = pstEntry_->A;
+    stCPU.b     = pstEntry_->b;
+    stCPU.s     = pstEntry_->s;
+    stCPU.q     = pstEntry_->q;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_OpCache_Invalidate
+ *
+ * Invalidate all cache entries affected by a modification to a range of ROM.
+ * Since 2-word instructions take operands from the following word, the entry
+ * preceding the range is invalidated as well.  Fused sequences overlapping the
+ * range are broken up.
+ *
+ * \param u32Addr_  First ROM word address modified
+ * \param u32Words_ Number of words modified
+ */
+void AVR_OpCache_Invalidate( uint32_t u32Addr_, uint32_t u32Words_ );
+
+#endif
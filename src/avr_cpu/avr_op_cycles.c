@@ -231,13 +231,13 @@ static uint8_t AVR_Opcode_Cycles_JMP()
 //---------------------------------------------------------------------------
 static uint8_t AVR_Opcode_Cycles_RCALL()
 {
-    return 3; //!! ToDo -- n cycles on devices w/22-bit PC
+    return CPU_Has22BitPC() ? 4 : 3;
 }
 
 //---------------------------------------------------------------------------
 static uint8_t AVR_Opcode_Cycles_ICALL()
 {
-    return 3; //!! ToDo -- n cycles on devices w/22-bit PC
+    return CPU_Has22BitPC() ? 4 : 3;
 }
 
 //---------------------------------------------------------------------------
@@ -249,19 +249,19 @@ static uint8_t AVR_Opcode_Cycles_EICALL()
 //---------------------------------------------------------------------------
 static uint8_t AVR_Opcode_Cycles_CALL()
 {
-    return 4; //!! ToDo -- 5 cycles on devices w/22-bit PC
+    return CPU_Has22BitPC() ? 5 : 4;
 }
 
 //---------------------------------------------------------------------------
 static uint8_t AVR_Opcode_Cycles_RET()
 {
-    return 4; //!! ToDo -- 5 cycles on devices w/22-bit PC
+    return CPU_Has22BitPC() ? 5 : 4;
 }
 
 //---------------------------------------------------------------------------
 static uint8_t AVR_Opcode_Cycles_RETI()
 {
-    return 4; //!! ToDo -- 5 cycles on devices w/22-bit PC
+    return CPU_Has22BitPC() ? 5 : 4;
 }
 
 //---------------------------------------------------------------------------
@@ -403,3 +403,9 @@ void AVR_Decode( uint16_t OP_ )
     myDecoder = AVR_Decoder_Function(OP_);
     myDecoder( OP_);
 }
+
+//---------------------------------------------------------------------------
+bool AVR_Decoder_ClocksIO( uint16_t OP_ )
+{
+    return (AVR_Decoder_Function(OP_) == AVR_Decoder_JMP_CALL_22);
+}
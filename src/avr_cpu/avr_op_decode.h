@@ -22,6 +22,7 @@
 #define __AVR_OP_DECODE_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "avr_cpu.h"
 
 //---------------------------------------------------------------------------
@@ -51,5 +52,18 @@ AVR_Decoder AVR_Decoder_Function( uint16_t OP_ );
  */
 void AVR_Decode( uint16_t OP_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Decoder_ClocksIO
+ *
+ * Determine whether or not decoding the specified opcode clocks the CPU's
+ * peripherals as a side-effect (i.e. 2-word JMP/CALL, which clock the
+ * peripherals while fetching the second word of the instruction).
+ *
+ * \param OP_ Opcode to check
+ * \return true if decoding the opcode runs a peripheral clock cycle
+ */
+bool AVR_Decoder_ClocksIO( uint16_t OP_ );
+
 #endif
 
@@ -0,0 +1,205 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_op_fusion.c
+
+  \brief Detection of fused instruction sequences in the predecoded cache.
+
+  Common sequences of instructions are recognized at decode time, and the
+  cache entry for the first instruction in the sequence is tagged with a
+  fused dispatch index.  The threaded engine runs a tagged entry through a
+  single handler that executes each instruction in the sequence back-to-back,
+  without going through the dispatcher in between.
+
+  Each instruction in a sequence is still retired individually - cycles are
+  counted, peripherals clocked, and interrupts serviced at every instruction
+  boundary - so fusion is never observable to the running program.  If an
+  interrupt is taken part-way through a sequence, the remainder of the
+  sequence is abandoned and dispatched normally.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emu_config.h"
+
+#include "avr_op_fusion.h"
+#include "avr_op_cache.h"
+
+#if FEATURE_USE_FUSION
+
+_Static_assert( AVR_FUSION_DISPATCH(AVR_FUSION_COUNT) < AVR_OPCODE_INDEX_INVALID,
+                "Fused dispatch indexes overlap AVR_OPCODE_INDEX_INVALID" );
+
+//---------------------------------------------------------------------------
+EMU_INSTANCE uint64_t au64FusionHits[ AVR_FUSION_COUNT ];
+
+//---------------------------------------------------------------------------
+#define AVR_FUSION_NAME(x)          [AVR_FUSION_##x] = #x,
+
+static const char *aszFusionNames[ AVR_FUSION_COUNT ] =
+{
+    AVR_FUSION_LIST(AVR_FUSION_NAME)
+};
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Fusion_Next
+ *
+ * Return the populated cache entry for the instruction following a given
+ * entry, or NULL if it hasn't been predecoded (or can't be run fused).
+ *
+ * \param u32Addr_ ROM word address of the entry
+ * \param pstEntry_ Entry at that address
+ * \param pu32Next_ [out] ROM word address of the following entry
+ * \return Following entry, or NULL
+ */
+static AVR_OpCache_Entry_t *Fusion_Next( uint32_t u32Addr_, const AVR_OpCache_Entry_t *pstEntry_, uint32_t *pu32Next_ )
+{
+    AVR_OpCache_Entry_t *pstNext;
+
+    *pu32Next_ = u32Addr_ + pstEntry_->u8Size;
+    pstNext = AVR_OpCache_Lookup( *pu32Next_ );
+    if (!pstNext || !pstNext->bValid || pstNext->bDecodeClock)
+    {
+        return NULL;
+    }
+    return pstNext;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Fusion_Match
+ *
+ * Determine which fused sequence (if any) starts at a given address.
+ *
+ * \param u32Addr_ ROM word address to evaluate
+ * \param pstEntry_ Populated cache entry at that address
+ * \return Fused sequence starting at the address, or AVR_FUSION_NONE
+ */
+static AVR_Fusion_t Fusion_Match( uint32_t u32Addr_, const AVR_OpCache_Entry_t *pstEntry_ )
+{
+    AVR_OpCache_Entry_t *pstSecond;
+    AVR_OpCache_Entry_t *pstThird;
+    uint32_t u32Next;
+
+    if (pstEntry_->bDecodeClock)
+    {
+        return AVR_FUSION_NONE;
+    }
+    pstSecond = Fusion_Next( u32Addr_, pstEntry_, &u32Next );
+    if (!pstSecond)
+    {
+        return AVR_FUSION_NONE;
+    }
+
+    switch (pstEntry_->u8Index)
+    {
+    case AVR_OPCODE_INDEX_LDI:
+        if (pstSecond->u8Index == AVR_OPCODE_INDEX_LDI)
+        {
+            return AVR_FUSION_LDI_LDI;
+        }
+        break;
+    case AVR_OPCODE_INDEX_CP:
+        if (pstSecond->u8Index == AVR_OPCODE_INDEX_CPC)
+        {
+            pstThird = Fusion_Next( u32Next, pstSecond, &u32Next );
+            if (pstThird && (pstThird->u8Index == AVR_OPCODE_INDEX_BRNE))
+            {
+                return AVR_FUSION_CP_CPC_BRNE;
+            }
+            return AVR_FUSION_CP_CPC;
+        }
+        break;
+    case AVR_OPCODE_INDEX_MOVW:
+        if (pstSecond->u8Index == AVR_OPCODE_INDEX_ADIW)
+        {
+            return AVR_FUSION_MOVW_ADIW;
+        }
+        break;
+    case AVR_OPCODE_INDEX_PUSH:
+        if (pstSecond->u8Index == AVR_OPCODE_INDEX_PUSH)
+        {
+            return AVR_FUSION_PUSH_PUSH;
+        }
+        break;
+    case AVR_OPCODE_INDEX_POP:
+        if (pstSecond->u8Index == AVR_OPCODE_INDEX_POP)
+        {
+            return AVR_FUSION_POP_POP;
+        }
+        break;
+    default:
+        break;
+    }
+    return AVR_FUSION_NONE;
+}
+
+//---------------------------------------------------------------------------
+void AVR_Fusion_Update( uint32_t u32Addr_ )
+{
+    AVR_OpCache_Entry_t *pstEntry;
+    AVR_Fusion_t eFusion;
+    uint32_t u32Start = 0;
+
+    // Any sequence containing this instruction starts no more than
+    // AVR_FUSION_MAX_WORDS - 1 words before it.
+    if (u32Addr_ >= (AVR_FUSION_MAX_WORDS - 1))
+    {
+        u32Start = u32Addr_ - (AVR_FUSION_MAX_WORDS - 1);
+    }
+
+    for (; u32Start <= u32Addr_; u32Start++)
+    {
+        pstEntry = AVR_OpCache_Lookup( u32Start );
+        if (!pstEntry || !pstEntry->bValid)
+        {
+            continue;
+        }
+        eFusion = Fusion_Match( u32Start, pstEntry );
+        if (eFusion != AVR_FUSION_NONE)
+        {
+            pstEntry->u8Dispatch = AVR_FUSION_DISPATCH( eFusion );
+        }
+        else
+        {
+            pstEntry->u8Dispatch = AVR_OpCache_Dispatch( pstEntry );
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+void AVR_Fusion_Report( void )
+{
+    uint64_t u64Total = 0;
+    int i;
+
+    for (i = AVR_FUSION_NONE + 1; i < AVR_FUSION_COUNT; i++)
+    {
+        u64Total += au64FusionHits[i];
+    }
+
+    printf( "=====================================================================================\n");
+    printf( "%60s: Count\n", "Fused Sequence");
+    printf( "=====================================================================================\n");
+    for (i = AVR_FUSION_NONE + 1; i < AVR_FUSION_COUNT; i++)
+    {
+        printf( "%60s: %llu\n", aszFusionNames[i], (unsigned long long)au64FusionHits[i] );
+    }
+    printf( "%60s: %llu\n", "Total", (unsigned long long)u64Total );
+}
+
+#endif
@@ -0,0 +1,93 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_op_fusion.h
+
+  \brief Detection of fused instruction sequences in the predecoded cache.
+*/
+
+#ifndef __AVR_OP_FUSION_H__
+#define __AVR_OP_FUSION_H__
+
+#include <stdint.h>
+
+#include "emu_config.h"
+
+#include "avr_opcodes.h"
+
+//---------------------------------------------------------------------------
+/*!
+    X-macro listing the instruction sequences recognized as fusion candidates,
+    named after the opcode functions making up each sequence.  These are the
+    idioms that show up most frequently in avr-gcc output: constant loads,
+    16-bit compare-and-branch chains, pointer setup, and the register
+    save/restore runs in function prologues and epilogues.
+*/
+#define AVR_FUSION_LIST(X) \
+    X(LDI_LDI) X(CP_CPC) X(CP_CPC_BRNE) X(MOVW_ADIW) X(PUSH_PUSH) X(POP_POP)
+
+#define AVR_FUSION_ENUM(x)          AVR_FUSION_##x,
+
+//---------------------------------------------------------------------------
+typedef enum
+{
+    AVR_FUSION_NONE,                //!< Instruction isn't the head of a fused sequence
+    AVR_FUSION_LIST(AVR_FUSION_ENUM)
+//---
+    AVR_FUSION_COUNT
+} AVR_Fusion_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Longest fused sequence, in ROM words.
+*/
+#define AVR_FUSION_MAX_WORDS        (3)
+
+//---------------------------------------------------------------------------
+/*!
+    Threaded-engine dispatch index for a fused sequence.  Fused handlers are
+    numbered after the regular opcode functions (see AVR_Opcode_Index_t).
+*/
+#define AVR_FUSION_DISPATCH(x)      ((uint8_t)(AVR_OPCODE_INDEX_COUNT + (x)))
+
+//---------------------------------------------------------------------------
+/*!
+    Number of times each fused sequence has been dispatched.
+*/
+extern EMU_INSTANCE uint64_t au64FusionHits[ AVR_FUSION_COUNT ];
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Fusion_Update
+ *
+ * Re-evaluate fusion for the cache entries which could start a sequence
+ * covering the given address.  Called whenever an instruction is
+ * predecoded into the cache, so that sequences are recognized as soon as
+ * all of their instructions have been decoded.
+ *
+ * \param u32Addr_ ROM word address of the instruction just predecoded
+ */
+void AVR_Fusion_Update( uint32_t u32Addr_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Fusion_Report
+ *
+ * Print the number of times each fused sequence was executed to standard
+ * output.
+ */
+void AVR_Fusion_Report( void );
+
+#endif
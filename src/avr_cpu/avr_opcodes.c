@@ -19,6 +19,7 @@
 */
 
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,16 +30,233 @@
 #include "interactive.h"
 #include "write_callout.h"
 #include "interrupt_callout.h"
+#include "avr_interrupt.h"
+#include "avr_io.h"
+#include "avr_op_cache.h"
+#include "avr_op_fusion.h"
+#include "avr_idle_loop.h"
+#include "avr_hle.h"
 
 //---------------------------------------------------------------------------
 #define DEBUG_PRINT(...)
 
+//---------------------------------------------------------------------------
+/*!
+    Status register flag updates.
+
+    Rather than computing each SREG flag as an instruction executes, the
+    flag-setting instructions record the kind of operation performed, along
+    with its operands and result, and the flags are only computed once
+    something needs to read them (see AVR_Opcode_SyncFlags()).  Most flags are
+    overwritten by the next ALU instruction before anything looks at them, so
+    this skips the bulk of the flag computation in arithmetic-heavy code.
+
+    Only the arithmetic flags (H, S, V, N, Z, C) are ever deferred - I and T
+    are always written to SREG directly.
+*/
+typedef enum
+{
+    FLAGS_OP_NONE,
+    FLAGS_OP_ADD,       //!< ADD, ADC
+    FLAGS_OP_SUB,       //!< SUB, SUBI, SBC, SBCI, CP, CPC, CPI
+    FLAGS_OP_LOGIC,     //!< AND, ANDI, OR, ORI, EOR, SBR, CBR
+    FLAGS_OP_COM,
+    FLAGS_OP_NEG,
+    FLAGS_OP_INC,
+    FLAGS_OP_DEC,
+    FLAGS_OP_ADIW,
+    FLAGS_OP_SBIW,
+    FLAGS_OP_LSL,       //!< LSL, ROL
+    FLAGS_OP_LSR,
+    FLAGS_OP_ROR,       //!< ROR, ASR
+    FLAGS_OP_MUL        //!< MUL, MULS, MULSU, FMUL, FMULS, FMULSU
+} Flags_Op_t;
+
+//---------------------------------------------------------------------------
+#define SREG_C                  (0x01)
+#define SREG_Z                  (0x02)
+#define SREG_N                  (0x04)
+#define SREG_V                  (0x08)
+#define SREG_S                  (0x10)
+#define SREG_H                  (0x20)
+
+#define FLAGS_MASK_HSVNZC       (SREG_H | SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C)
+#define FLAGS_MASK_HSVNC        (SREG_H | SREG_S | SREG_V | SREG_N | SREG_C)
+#define FLAGS_MASK_SVNZC        (SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C)
+#define FLAGS_MASK_SVNZ         (SREG_S | SREG_V | SREG_N | SREG_Z)
+#define FLAGS_MASK_ZC           (SREG_Z | SREG_C)
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Flags_Write
+ *
+ * Compute the flags for the deferred operation, and write the bits it
+ * modifies into SREG.
+ */
+static void Flags_Write( void )
+{
+    uint16_t u16Rd = stCPU.u16FlagsRd;
+    uint16_t u16Rr = stCPU.u16FlagsRr;
+    uint16_t u16Result = stCPU.u16FlagsResult;
+    uint16_t u16Carry;
+    uint8_t u8H = 0;
+    uint8_t u8V = 0;
+    uint8_t u8N = (u16Result >> 7) & 1;
+    uint8_t u8C = 0;
+    uint8_t u8Flags;
+
+    switch (stCPU.u8FlagsOp)
+    {
+    case FLAGS_OP_ADD:
+        u16Carry = (u16Rd & u16Rr) | (u16Rr & ~u16Result) | (~u16Result & u16Rd);
+        u8H = (u16Carry >> 3) & 1;
+        u8C = (u16Carry >> 7) & 1;
+        u8V = (((u16Rd & u16Rr & ~u16Result) | (~u16Rd & ~u16Rr & u16Result)) >> 7) & 1;
+        break;
+    case FLAGS_OP_SUB:
+        u16Carry = (~u16Rd & u16Rr) | (u16Rr & u16Result) | (u16Result & ~u16Rd);
+        u8H = (u16Carry >> 3) & 1;
+        u8C = (u16Carry >> 7) & 1;
+        u8V = (((u16Rd & ~u16Rr & ~u16Result) | (~u16Rd & u16Rr & u16Result)) >> 7) & 1;
+        break;
+    case FLAGS_OP_LOGIC:
+        break;
+    case FLAGS_OP_COM:
+        u8C = 1;
+        break;
+    case FLAGS_OP_NEG:
+        u8V = (u16Result == 0x80);
+        u8C = (u16Result != 0);
+        break;
+    case FLAGS_OP_INC:
+        u8V = (u16Result == 0x80);
+        break;
+    case FLAGS_OP_DEC:
+        u8V = (u16Result == 0x7F);
+        break;
+    case FLAGS_OP_ADIW:
+        u8N = (u16Result >> 15) & 1;
+        u8V = !(u16Rd & 0x8000) && (u16Result & 0x8000);
+        u8C = (u16Rd & 0x8000) && !(u16Result & 0x8000);
+        break;
+    case FLAGS_OP_SBIW:
+        u8N = (u16Result >> 15) & 1;
+        u8V = (u16Rd & 0x8000) && !(u16Result & 0x8000);
+        u8C = !(u16Rd & 0x8000) && (u16Result & 0x8000);
+        break;
+    case FLAGS_OP_LSL:
+        u8H = (u16Result >> 3) & 1;
+        u8C = (u16Rd >> 7) & 1;
+        u8V = u8N ^ u8C;
+        break;
+    case FLAGS_OP_LSR:
+        u8N = 0;
+        u8C = u16Rd & 1;
+        u8V = u8C;
+        break;
+    case FLAGS_OP_ROR:
+        u8C = u16Rd & 1;
+        u8V = u8N ^ u8C;
+        break;
+    case FLAGS_OP_MUL:
+        u8C = (u16Result >> 15) & 1;
+        break;
+    default:
+        break;
+    }
+
+    u8Flags = (u8C)
+            | ((u16Result == 0) << 1)
+            | (u8N << 2)
+            | (u8V << 3)
+            | ((u8N ^ u8V) << 4)
+            | (u8H << 5);
+
+    stCPU.pstRAM->stRegisters.SREG.r = (stCPU.pstRAM->stRegisters.SREG.r & ~stCPU.u8FlagsMask)
+                                     | (u8Flags & stCPU.u8FlagsMask);
+    stCPU.u8FlagsOp = FLAGS_OP_NONE;
+    stCPU.u8FlagsMask = 0;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Flags_Sync
+ *
+ * Bring SREG up to date before an instruction reads it.
+ */
+static inline void Flags_Sync( void )
+{
+    if (stCPU.u8FlagsMask)
+    {
+        Flags_Write();
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Flags_Defer
+ *
+ * Record the result of a flag-setting operation.  If a previous operation's
+ * flags are still outstanding, and this operation doesn't overwrite all of
+ * them, they're written out first.
+ *
+ * \param eOp_       Kind of operation performed
+ * \param u8Mask_    SREG bits modified by the operation
+ * \param u16Rd_     Destination operand (before the operation)
+ * \param u16Rr_     Source operand
+ * \param u16Result_ Result of the operation
+ */
+static inline void Flags_Defer( Flags_Op_t eOp_, uint8_t u8Mask_, uint16_t u16Rd_, uint16_t u16Rr_, uint16_t u16Result_ )
+{
+    if (stCPU.u8FlagsMask & ~u8Mask_)
+    {
+        Flags_Write();
+    }
+
+    stCPU.u8FlagsOp = eOp_;
+    stCPU.u8FlagsMask = u8Mask_;
+    stCPU.u16FlagsRd = u16Rd_;
+    stCPU.u16FlagsRr = u16Rr_;
+    stCPU.u16FlagsResult = u16Result_;
+
+#if !FEATURE_USE_LAZY_SREG
+    Flags_Write();
+#endif
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Flags_Z
+ *
+ * Read the Z flag without bringing the rest of SREG up to date - for
+ * BREQ/BRNE, the most common consumers of the flags.
+ *
+ * \return Value of the Z flag
+ */
+static inline uint8_t Flags_Z( void )
+{
+    if (stCPU.u8FlagsMask & SREG_Z)
+    {
+        return (stCPU.u16FlagsResult == 0);
+    }
+    return stCPU.pstRAM->stRegisters.SREG.Z;
+}
+
+//---------------------------------------------------------------------------
+void AVR_Opcode_SyncFlags( void )
+{
+    Flags_Sync();
+}
+
+#if !FEATURE_USE_GUARD_PAGES
 //---------------------------------------------------------------------------
 static void AVR_Abort(void)
 {
+    Flags_Sync();
     print_core_regs();
-    exit(-1);
+    CPU_Exit( CPU_EXIT_ABORT );
 }
+#endif
 
 //---------------------------------------------------------------------------
 static uint32_t Get_ZAddress(void)
@@ -89,6 +307,12 @@ static uint32_t Get_ZAddressPreDecWithRAMP(void)
            (((uint32_t)stCPU.pstRAM->stRegisters.RAMPZ) << 16));
 }
 
+//---------------------------------------------------------------------------
+static uint32_t Get_ZAddressWithEIND(void)
+{
+    return (((uint32_t)stCPU.pstRAM->stRegisters.CORE_REGISTERS.Z) |
+           (((uint32_t)stCPU.pstRAM->stRegisters.EIND) << 16)) & CPU_PC_MASK_22BIT;
+}
 
 //---------------------------------------------------------------------------
 static uint32_t Get_YAddress(void)
@@ -108,45 +332,58 @@ static void Data_Write( uint32_t u32Addr_, uint8_t u8Val_ )
     // Writing to RAM can be a tricky deal, because the address space is shared
     // between RAM, the core registers, and a bunch of peripheral I/O registers.
     DEBUG_PRINT("Write: 0x%08X=%02X\n", u32Addr_, u8Val_ );
-    if (!WriteCallout_Run( u32Addr_, u8Val_ ))
+    uint8_t u8Map = stCPU.au8DataMap[ u32Addr_ ];
+
+    // Plain RAM (the common case) - direct write-through.
+    if (!(u8Map & DATA_MAP_WRITE_MASK))
     {
+        stCPU.pstRAM->au8RAM[ u32Addr_ ] = u8Val_;
+        CPU_DirtyRAM( u32Addr_ );
         return;
     }
 
-    // Check to see if the write operation falls within the peripheral I/O range
-    if (u32Addr_ >= 32 && u32Addr_ <= 255)
+    if ((u8Map & (DATA_MAP_CALLOUT | DATA_MAP_WATCH)) &&
+        !WriteCallout_Run( u32Addr_, u8Val_ ))
     {
-        // I/O range - check to see if there's a peripheral installed at this address
-        IOWriterList *pstIOWrite = stCPU.apstPeriphWriteTable[ u32Addr_ ];
+        return;
+    }
+
+#if !FEATURE_USE_GUARD_PAGES
+    // (Otherwise, writes past the end of RAM are caught by CPU_DataFault())
+    if (u8Map & DATA_MAP_INVALID)
+    {
+        fprintf( stderr, "[Write Abort] RAM Address 0x%08X is out of range!\n", u32Addr_ );
+        AVR_Abort();
+    }
+#endif
+
+    // Don't let outstanding flag updates clobber a write to SREG
+    if (u8Map & DATA_MAP_SREG)
+    {
+        Flags_Sync();
+    }
 
-        // If there is a peripheral or peripherals
-        if (pstIOWrite)
+    // If there is a peripheral or peripherals installed at this address,
+    // iterate through the list and call their write handler
+    if (u8Map & DATA_MAP_PERIPH_WRITE)
+    {
+        IOWriterList *pstIOWrite = stCPU.apstPeriphWriteTable[ u32Addr_ ];
+        while (pstIOWrite)
         {
-            // Iterate through the list of installed peripherals at this address, and
-            // call their write handler
-            while (pstIOWrite)
+            pstIOWrite->pfWriter( pstIOWrite->pvContext, (uint8_t)u32Addr_, u8Val_ );
+            if (pstIOWrite->pstEvent)
             {
-                pstIOWrite->pfWriter( pstIOWrite->pvContext, (uint8_t)u32Addr_, u8Val_ );
-                pstIOWrite = pstIOWrite->next;
+                IO_RescheduleEvent( pstIOWrite->pstEvent );
             }
+            pstIOWrite = pstIOWrite->next;
         }
-        // Otherwise, there is no peripheral -- just assume we can treat this as normal RAM.
-        else
-        {
-            stCPU.pstRAM->au8RAM[ u32Addr_ ] = u8Val_;
-        }
-    }
-    else if (u32Addr_ >= (stCPU.u32RAMSize + 256))
-    {
-        fprintf( stderr, "[Write Abort] RAM Address 0x%08X is out of range!\n", u32Addr_ );
-        AVR_Abort();
     }
-    // RAM address range - direct write-through.
+    // Otherwise, there is no peripheral -- just assume we can treat this as normal RAM.
     else
     {
         stCPU.pstRAM->au8RAM[ u32Addr_ ] = u8Val_;
+        CPU_DirtyRAM( u32Addr_ );
     }
-
 }
 
 //---------------------------------------------------------------------------
@@ -157,211 +394,125 @@ static uint8_t Data_Read( uint32_t u32Addr_)
 
     // Check to see if the write operation falls within the peripheral I/O range
     DEBUG_PRINT( "Data Read: %08X\n", u32Addr_ );
-    if (u32Addr_ >= 32 && u32Addr_ <= 255)
+    uint8_t u8Map = stCPU.au8DataMap[ u32Addr_ ];
+
+    // Plain RAM (the common case) - direct read
+    if (!(u8Map & DATA_MAP_READ_MASK))
     {
-        // I/O range - check to see if there's a peripheral installed at this address
-        IOReaderList *pstIORead = stCPU.apstPeriphReadTable[ u32Addr_ ];
-        DEBUG_PRINT( "Peripheral Read: 0x%08X\n", u32Addr_ );
-        // If there is a peripheral or peripherals
-        if (pstIORead)
-        {
-            DEBUG_PRINT(" Found peripheral\n");
-            // Iterate through the list of installed peripherals at this address, and
-            // call their read handler
-            uint8_t u8Val;
-            while (pstIORead)
-            {
-                pstIORead->pfReader( pstIORead->pvContext,  (uint8_t)u32Addr_, &u8Val);
-                pstIORead = pstIORead->next;
-            }
-            return u8Val;
-        }
-        // Otherwise, there is no peripheral -- just assume we can treat this as normal RAM.
-        else
-        {
-            DEBUG_PRINT(" No peripheral\n");
-            return stCPU.pstRAM->au8RAM[ u32Addr_ ];
-        }
+        return stCPU.pstRAM->au8RAM[ u32Addr_ ];
     }
-    else if (u32Addr_ >= (stCPU.u32RAMSize + 256))
+
+#if !FEATURE_USE_GUARD_PAGES
+    // (Otherwise, reads past the end of RAM are caught by CPU_DataFault())
+    if (u8Map & DATA_MAP_INVALID)
     {
         fprintf( stderr, "[Read Abort] RAM Address 0x%04X is out of range!\n", u32Addr_ );
         AVR_Abort();
     }
-    // RAM address range - direct read
-    else
+#endif
+
+    if (u8Map & DATA_MAP_SREG)
     {
-        return stCPU.pstRAM->au8RAM[ u32Addr_ ];
+        Flags_Sync();
     }
-}
 
-//---------------------------------------------------------------------------
-static void AVR_Opcode_NOP( void )
-{
-    // Nop - do nothing.
+    // If there is a peripheral or peripherals installed at this address,
+    // iterate through the list and call their read handler
+    if (u8Map & DATA_MAP_PERIPH_READ)
+    {
+        IOReaderList *pstIORead = stCPU.apstPeriphReadTable[ u32Addr_ ];
+        DEBUG_PRINT( "Peripheral Read: 0x%08X\n", u32Addr_ );
+        uint8_t u8Val;
+        while (pstIORead)
+        {
+            pstIORead->pfReader( pstIORead->pvContext,  (uint8_t)u32Addr_, &u8Val);
+            pstIORead = pstIORead->next;
+        }
+        return u8Val;
+    }
+    // Otherwise, there is no peripheral -- just assume we can treat this as normal RAM.
+    return stCPU.pstRAM->au8RAM[ u32Addr_ ];
 }
 
 //---------------------------------------------------------------------------
-static void ADD_Half_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
+static void Push_PC22( uint32_t u32StoredPC_ )
 {
-    stCPU.pstRAM->stRegisters.SREG.H =
-            ( ((Rd_ & Rr_)    & 0x08 )
-            | ((Rr_ & (~Result_)) & 0x08 )
-            | (((~Result_) & Rd_) & 0x08) ) != false;
-}
+    // Push a 3-byte return address, low byte first (see AVR_Opcode_CALL_22)
+    uint32_t u32SP = (((uint32_t)stCPU.pstRAM->stRegisters.SPH.r) << 8) |
+                     (((uint32_t)stCPU.pstRAM->stRegisters.SPL.r));
 
-//---------------------------------------------------------------------------
-static void ADD_Full_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.C =
-            ( ((Rd_ & Rr_)    & 0x80 )
-            | ((Rr_ & (~Result_)) & 0x80 )
-            | (((~Result_) & Rd_) & 0x80) ) != false;
-}
+    Data_Write(  u32SP, (uint8_t)(u32StoredPC_ & 0x00FF));
+    Data_Write(  (uint16_t)(u32SP - 1), (uint8_t)(u32StoredPC_ >> 8));
+    Data_Write(  (uint16_t)(u32SP - 2), (uint8_t)(u32StoredPC_ >> 16));
 
-//---------------------------------------------------------------------------
-static void ADD_Overflow_Flag( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.V =
-             ( ((Rd_ & Rr_ & ~Result_)  & 0x80 )
-             | ((~Rd_ & ~Rr_ & Result_) & 0x80 ) ) != 0;
+    // Stack is post-decremented
+    u32SP -= 3;
+
+    stCPU.pstRAM->stRegisters.SPH.r = (u32SP >> 8);
+    stCPU.pstRAM->stRegisters.SPL.r = (u32SP & 0x00FF);
 }
 
 //---------------------------------------------------------------------------
-static void Signed_Flag( void )
+static uint32_t Pop_PC22( void )
 {
-    unsigned int N = stCPU.pstRAM->stRegisters.SREG.N;
-    unsigned int V = stCPU.pstRAM->stRegisters.SREG.V;
+    // Pop a 3-byte return address, pre-incrementing
+    uint32_t u32SP = (((uint32_t)stCPU.pstRAM->stRegisters.SPH.r) << 8) |
+                     (((uint32_t)stCPU.pstRAM->stRegisters.SPL.r));
+    u32SP = (uint16_t)(u32SP + 3);
 
-    stCPU.pstRAM->stRegisters.SREG.S = N ^ V;
-}
+    uint32_t u32High = Data_Read(  (uint16_t)(u32SP - 2) );
+    uint32_t u32Mid = Data_Read(  (uint16_t)(u32SP - 1) );
+    uint32_t u32Low = Data_Read(  u32SP );
 
-//---------------------------------------------------------------------------
-static void R8_Zero_Flag( uint8_t R_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.Z = (R_ == 0);
-}
+    stCPU.pstRAM->stRegisters.SPH.r = (u32SP >> 8);
+    stCPU.pstRAM->stRegisters.SPL.r = (u32SP & 0x00FF);
 
-//---------------------------------------------------------------------------
-static void R8_CPC_Zero_Flag( uint8_t R_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.Z = (stCPU.pstRAM->stRegisters.SREG.Z && (R_ == 0));
+    return ((u32High << 16) | (u32Mid << 8) | u32Low) & CPU_PC_MASK_22BIT;
 }
 
 //---------------------------------------------------------------------------
-static void R8_Negative_Flag( uint8_t R_ )
+static void AVR_Opcode_NOP( void )
 {
-    stCPU.pstRAM->stRegisters.SREG.N = ((R_ & 0x80) == 0x80);
+    // Nop - do nothing.
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ADD( void )
 {
-    uint8_t u8Result;
-    uint8_t u8Rd = *(stCPU.Rd);
-    uint8_t u8Rr = *(stCPU.Rr);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Rr = *stCPU.Rr;
+    uint8_t u8Result = u8Rd + u8Rr;
 
-    u8Result = u8Rd + u8Rr;
-    *(stCPU.Rd) = u8Result;
+    *stCPU.Rd = u8Result;
 
-// ---- Update flags ----
-    ADD_Half_Carry(  u8Rd, u8Rr, u8Result );
-    ADD_Full_Carry(  u8Rd, u8Rr, u8Result );
-    ADD_Overflow_Flag(  u8Rd, u8Rr, u8Result );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_ADD, FLAGS_MASK_HSVNZC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ADC( void )
 {
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Rr = *stCPU.Rr;
     uint8_t u8Result;
-    uint8_t u8Rd = *(stCPU.Rd);
-    uint8_t u8Rr = *(stCPU.Rr);
-    uint8_t u8Carry = (stCPU.pstRAM->stRegisters.SREG.C);
 
-    u8Result = u8Rd + u8Rr + u8Carry;
-    *(stCPU.Rd) = u8Result;
-
-// ---- Update flags ----
-    ADD_Half_Carry(  u8Rd, u8Rr, u8Result );
-    ADD_Full_Carry(  u8Rd, u8Rr, u8Result );
-    ADD_Overflow_Flag(  u8Rd, u8Rr, u8Result );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
-}
-
-//---------------------------------------------------------------------------
-static void R16_Negative_Flag( uint16_t Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.N =
-            ((Result_ & 0x8000) != 0);
-}
-
-//---------------------------------------------------------------------------
-static void R16_Zero_Flag( uint16_t Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.Z =
-            (Result_ == 0);
-}
-
-//---------------------------------------------------------------------------
-static void ADIW_Overflow_Flag( uint16_t Rd_, uint16_t Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.V =
-            (((Rd_ & 0x8000) == 0) && ((Result_ & 0x8000) == 0x8000));
-}
+    Flags_Sync();
+    u8Result = u8Rd + u8Rr + stCPU.pstRAM->stRegisters.SREG.C;
+    *stCPU.Rd = u8Result;
 
-//---------------------------------------------------------------------------
-static void ADIW_Carry_Flag( uint16_t Rd_, uint16_t Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.C =
-            (((Rd_ & 0x8000) == 0x8000) && ((Result_ & 0x8000) == 0));
+    Flags_Defer( FLAGS_OP_ADD, FLAGS_MASK_HSVNZC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ADIW( void )
 {
-    uint16_t u16K = (stCPU.K);
-    uint16_t u16Rd = *(stCPU.Rd16);
-    uint16_t u16Result;
+    uint16_t u16Rd = *stCPU.Rd16;
+    uint16_t u16Result = u16Rd + stCPU.K;
 
-    u16Result = u16Rd + u16K;
-    *(stCPU.Rd16) = u16Result;
+    *stCPU.Rd16 = u16Result;
 
-// ---- Update Flags ----   
-    ADIW_Carry_Flag(  u16Rd, u16Result);
-    ADIW_Overflow_Flag(  u16Rd, u16Result );
-    R16_Negative_Flag(  u16Result );
-    R16_Zero_Flag(  u16Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_ADIW, FLAGS_MASK_SVNZC, u16Rd, stCPU.K, u16Result );
 }
 
-//---------------------------------------------------------------------------
-static void SUB_Overflow_Flag( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.V =
-             ( ((Rd_ & ~Rr_ & ~Result_) & 0x80 )
-             | ((~Rd_ & Rr_ & Result_) & 0x80 ) ) != 0;
-}
-//---------------------------------------------------------------------------
-static void SUB_Half_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.H =
-             ( ((~Rd_ & Rr_) & 0x08 )
-             | ((Rr_ & Result_) & 0x08 )
-             | ((Result_ & ~Rd_) & 0x08 ) ) == 0x08;
-}
-//---------------------------------------------------------------------------
-static void SUB_Full_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.C =
-             ( ((~Rd_ & Rr_) & 0x80 )
-             | ((Rr_ & Result_) & 0x80 )
-             | ((Result_ & ~Rd_) & 0x80 ) ) == 0x80;
-}
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_SUB( void )
@@ -372,13 +523,7 @@ static void AVR_Opcode_SUB( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Flags
-    SUB_Half_Carry( u8Rd, u8Rr, u8Result);
-    SUB_Full_Carry( u8Rd, u8Rr, u8Result);
-    SUB_Overflow_Flag( u8Rd, u8Rr, u8Result);
-    R8_Negative_Flag( u8Result);
-    R8_Zero_Flag( u8Result);
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNZC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -390,13 +535,7 @@ static void AVR_Opcode_SUBI( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Flags
-    SUB_Half_Carry( u8Rd, u8K, u8Result);
-    SUB_Full_Carry( u8Rd, u8K, u8Result);
-    SUB_Overflow_Flag( u8Rd, u8K, u8Result);
-    R8_Negative_Flag( u8Result);
-    R8_Zero_Flag( u8Result);
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNZC, u8Rd, u8K, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -404,21 +543,18 @@ static void AVR_Opcode_SBC( void )
 {
     uint8_t u8Rd = *stCPU.Rd;
     uint8_t u8Rr = *stCPU.Rr;
-    uint8_t u8C = stCPU.pstRAM->stRegisters.SREG.C;
-    uint8_t u8Result = u8Rd - u8Rr - u8C;
+    uint8_t u8Result;
 
+    Flags_Sync();
+    u8Result = u8Rd - u8Rr - stCPU.pstRAM->stRegisters.SREG.C;
     *stCPU.Rd = u8Result;
 
-    //--Flags
-    SUB_Half_Carry( u8Rd, u8Rr, u8Result);
-    SUB_Full_Carry( u8Rd, u8Rr, u8Result);
-    SUB_Overflow_Flag( u8Rd, u8Rr, u8Result);
-    R8_Negative_Flag( u8Result);
+    // Z is only ever cleared by a subtract-with-carry
     if (u8Result)
     {
         stCPU.pstRAM->stRegisters.SREG.Z = 0;
     }
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -426,57 +562,29 @@ static void AVR_Opcode_SBCI( void )
 {
     uint8_t u8Rd = *stCPU.Rd;
     uint8_t u8K = (uint8_t)stCPU.K;
-    uint8_t u8C = stCPU.pstRAM->stRegisters.SREG.C;
-    uint8_t u8Result = u8Rd - u8K - u8C;
+    uint8_t u8Result;
 
+    Flags_Sync();
+    u8Result = u8Rd - u8K - stCPU.pstRAM->stRegisters.SREG.C;
     *stCPU.Rd = u8Result;
 
-    //--Flags
-    SUB_Half_Carry( u8Rd, u8K, u8Result);
-    SUB_Full_Carry( u8Rd, u8K, u8Result);
-    SUB_Overflow_Flag( u8Rd, u8K, u8Result);
-    R8_Negative_Flag( u8Result);
+    // Z is only ever cleared by a subtract-with-carry
     if (u8Result)
     {
         stCPU.pstRAM->stRegisters.SREG.Z = 0;
     }
-    Signed_Flag();
-}
-
-
-//---------------------------------------------------------------------------
-static void SBIW_Overflow_Flag( uint16_t Rd_, uint16_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.V =
-             ((Rd_ & 0x8000 ) == 0x8000) && ((Result_ & 0x8000) == 0);
-
-}
-
-//---------------------------------------------------------------------------
-static void SBIW_Full_Carry( uint16_t Rd_, uint16_t Result_)
-{
-    stCPU.pstRAM->stRegisters.SREG.C =
-             ((Rd_ & 0x8000 ) == 0) && ((Result_ & 0x8000) == 0x8000);
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNC, u8Rd, u8K, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_SBIW( void )
 {
     uint16_t u16Rd = *stCPU.Rd16;
-    uint16_t u16Result;
-
-    //fprintf( stderr, "SBIW: RD=[%4X], K=[%2X]\n", u16Rd, stCPU.K );
-    u16Result = u16Rd - stCPU.K;
+    uint16_t u16Result = u16Rd - stCPU.K;
 
     *stCPU.Rd16 = u16Result;
-    //fprintf( stderr, "  Result=[%4X]\n", u16Result );
-
-    SBIW_Full_Carry( u16Rd, u16Result);
-    SBIW_Overflow_Flag( u16Rd, u16Result);
-    R16_Negative_Flag( u16Result);
-    R16_Zero_Flag( u16Result);
-    Signed_Flag();
 
+    Flags_Defer( FLAGS_OP_SBIW, FLAGS_MASK_SVNZC, u16Rd, stCPU.K, u16Result );
 }
 
 //---------------------------------------------------------------------------
@@ -488,11 +596,7 @@ static void AVR_Opcode_AND( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -503,11 +607,7 @@ static void AVR_Opcode_ANDI( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -519,11 +619,7 @@ static void AVR_Opcode_OR( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -534,11 +630,7 @@ static void AVR_Opcode_ORI( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -550,129 +642,78 @@ static void AVR_Opcode_EOR( void )
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_COM( void )
 {
     // 1's complement.
-    uint8_t u8Result = *stCPU.Rd;
-    u8Result = (0xFF - u8Result);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (0xFF - u8Rd);
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    stCPU.pstRAM->stRegisters.SREG.C = 1;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
-}
-
-//---------------------------------------------------------------------------
-static void NEG_Overflow_Flag( uint8_t u8Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.V = (u8Result_ == 0x80);
-}
-
-//---------------------------------------------------------------------------
-static void NEG_Carry_Flag( uint8_t u8Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.C = (u8Result_ != 0x00);
+    Flags_Defer( FLAGS_OP_COM, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_NEG( void )
 {
     // 2's complement.
-    uint8_t u8Result = *stCPU.Rd;
-    u8Result = (0 - u8Result);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (0 - u8Rd);
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    NEG_Overflow_Flag(  u8Result );
-    NEG_Carry_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    // Note - H is not updated
+    Flags_Defer( FLAGS_OP_NEG, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_SBR( void )
 {
     // Set Bits in Register
-    uint8_t u8Result = *stCPU.Rd;
-    u8Result |= ((uint8_t)stCPU.K);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = u8Rd | (uint8_t)stCPU.K;
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_CBR( void )
 {
     // Clear Bits in Register
-    uint8_t u8Result = *stCPU.Rd;
-    u8Result &= ~((uint8_t)stCPU.K);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = u8Rd & ~((uint8_t)stCPU.K);
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    stCPU.pstRAM->stRegisters.SREG.V = 0;
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LOGIC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
-//---------------------------------------------------------------------------
-static void INC_Overflow_Flag( uint8_t u8Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.V = (u8Result_ == 0x80);
-}
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_INC( void )
 {
-    uint8_t u8Result;
-    u8Result = *stCPU.Rd + 1;
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = u8Rd + 1;
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    INC_Overflow_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
-}
-//---------------------------------------------------------------------------
-static void DEC_Overflow_Flag( uint8_t u8Result_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.V = (u8Result_ == 0x7F);
+    Flags_Defer( FLAGS_OP_INC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 //---------------------------------------------------------------------------
 static void AVR_Opcode_DEC( void )
-{   
-    uint8_t u8Result;   
-    u8Result = *stCPU.Rd - 1;
+{
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = u8Rd - 1;
 
     *stCPU.Rd = u8Result;
 
-    //--Update Status registers;
-    DEC_Overflow_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_DEC, FLAGS_MASK_SVNZ, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -681,18 +722,6 @@ static void AVR_Opcode_SER( void )
     *stCPU.Rd = 0xFF;
 }
 
-//---------------------------------------------------------------------------
-static void Mul_Carry_Flag( uint16_t R_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.C = ((R_  & 0x8000) == 0x8000);
-}
-
-//---------------------------------------------------------------------------
-static void Mul_Zero_Flag( uint16_t R_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.Z = (R_ == 0);
-}
-
 //---------------------------------------------------------------------------
 static void AVR_Opcode_MUL( void )
 {
@@ -707,9 +736,7 @@ static void AVR_Opcode_MUL( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = u16Product;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( u16Product);
-    Mul_Carry_Flag( u16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, u16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -726,9 +753,7 @@ static void AVR_Opcode_MULS( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = (uint16_t)s16Product;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( (uint16_t)s16Product);
-    Mul_Carry_Flag( (uint16_t)s16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, (uint16_t)s16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -745,9 +770,7 @@ static void AVR_Opcode_MULSU( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = (uint16_t)s16Product;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( (uint16_t)s16Product);
-    Mul_Carry_Flag( (uint16_t)s16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, (uint16_t)s16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -764,9 +787,7 @@ static void AVR_Opcode_FMUL( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = u16Product << 1;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( u16Product);
-    Mul_Carry_Flag( u16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, u16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -783,9 +804,7 @@ static void AVR_Opcode_FMULS( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = ((uint16_t)s16Product) << 1;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( (uint16_t)s16Product);
-    Mul_Carry_Flag( (uint16_t)s16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, (uint16_t)s16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -802,9 +821,7 @@ static void AVR_Opcode_FMULSU( void )
 
     stCPU.pstRAM->stRegisters.CORE_REGISTERS.r1_0 = ((uint16_t)s16Product) << 1;
 
-    //-- Update Flags --
-    Mul_Zero_Flag( (uint16_t)s16Product);
-    Mul_Carry_Flag( (uint16_t)s16Product);
+    Flags_Defer( FLAGS_OP_MUL, FLAGS_MASK_ZC, 0, 0, (uint16_t)s16Product );
 }
 
 //---------------------------------------------------------------------------
@@ -814,15 +831,15 @@ static void AVR_Opcode_DES( void )
 }
 
 //---------------------------------------------------------------------------
-static void Unconditional_Jump( uint16_t u16Addr_ )
+static void Unconditional_Jump( uint32_t u32Addr_ )
 {
-    stCPU.u32PC = u16Addr_;
+    stCPU.u32PC = u32Addr_;
     stCPU.u16ExtraPC = 0;
 
     // Feature -- Terminate emulator if jump-to-zero encountered at runtime.
     if (stCPU.u32PC == 0 && stCPU.bExitOnReset)
     {
-        exit(0);
+        CPU_Exit( CPU_EXIT_RESET );
     }
 }
 
@@ -842,7 +859,7 @@ static void AVR_Opcode_RJMP( void )
 {
     int32_t s32NewPC = (int32_t)stCPU.u32PC + (int32_t)stCPU.k_s + 1;
 
-    Unconditional_Jump(  (uint16_t)s32NewPC );
+    Unconditional_Jump(  (uint32_t)s32NewPC & stCPU.u32PCMask );
 }
 
 //---------------------------------------------------------------------------
@@ -854,13 +871,13 @@ static void AVR_Opcode_IJMP( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_EIJMP( void )
 {
-    //! ToDo - implement EIND instructions
+    Unconditional_Jump( Get_ZAddressWithEIND() );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_JMP( void )
 {
-    Unconditional_Jump(  (uint16_t)stCPU.k );
+    Unconditional_Jump(  stCPU.k & stCPU.u32PCMask );
 }
 
 //---------------------------------------------------------------------------
@@ -873,14 +890,14 @@ static void AVR_Opcode_RCALL( void )
     uint32_t u32StoredPC = stCPU.u32PC + 1;
 
     Data_Write(  u32PC, (uint8_t)(u32StoredPC & 0x00FF));
-    Data_Write(  u32PC - 1, (uint8_t)(u32StoredPC >> 8));
+    Data_Write(  (uint16_t)(u32PC - 1), (uint8_t)(u32StoredPC >> 8));
 
     // Stack is post-decremented
     u32PC -= 2;
 
     // Set the new PC (relative call)
     int32_t s32NewPC = (int32_t)stCPU.u32PC + (int32_t)stCPU.k_s + 1;
-    uint32_t u32NewPC = (uint32_t)s32NewPC;
+    uint32_t u32NewPC = (uint32_t)s32NewPC & CPU_PC_MASK_16BIT;
 
     // Store the new SP.
     stCPU.pstRAM->stRegisters.SPH.r = (u32PC >> 8);
@@ -900,7 +917,7 @@ static void AVR_Opcode_ICALL( void )
     uint32_t u32StoredPC = stCPU.u32PC + 1;
 
     Data_Write(  u32SP, (uint8_t)(u32StoredPC & 0x00FF));
-    Data_Write(  u32SP - 1, (uint8_t)(u32StoredPC >> 8));
+    Data_Write(  (uint16_t)(u32SP - 1), (uint8_t)(u32StoredPC >> 8));
 
     // Stack is post-decremented
     u32SP -= 2;
@@ -919,7 +936,8 @@ static void AVR_Opcode_ICALL( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_EICALL( void )
 {
-    //!! ToDo - Implement EIND calling!
+    Push_PC22( stCPU.u32PC + 1 );
+    Unconditional_Jump( Get_ZAddressWithEIND() );
 }
 
 //---------------------------------------------------------------------------
@@ -932,11 +950,11 @@ static void AVR_Opcode_CALL( void )
     uint32_t u32StoredPC = stCPU.u32PC + 2;
 
     Data_Write(  u32SP, (uint8_t)(u32StoredPC & 0x00FF));
-    Data_Write(  u32SP - 1, (uint8_t)(u32StoredPC >> 8));
+    Data_Write(  (uint16_t)(u32SP - 1), (uint8_t)(u32StoredPC >> 8));
 
     u32SP -= 2;
 
-    uint32_t u32NewPC = stCPU.k;
+    uint32_t u32NewPC = stCPU.k & CPU_PC_MASK_16BIT;
 
     stCPU.pstRAM->stRegisters.SPH.r = (u32SP >> 8);
     stCPU.pstRAM->stRegisters.SPL.r = (u32SP & 0x00FF);
@@ -950,9 +968,9 @@ static void AVR_Opcode_RET( void )
     // Pop the next instruction off of the stack, pre-incrementing
     uint32_t u32SP = (((uint32_t)stCPU.pstRAM->stRegisters.SPH.r) << 8) |
                      (((uint32_t)stCPU.pstRAM->stRegisters.SPL.r));
-    u32SP += 2;
+    u32SP = (uint16_t)(u32SP + 2);
 
-    uint32_t u32High = Data_Read(  u32SP - 1 );
+    uint32_t u32High = Data_Read(  (uint16_t)(u32SP - 1) );
     uint32_t u32Low = Data_Read(  u32SP );
     uint32_t u32NewPC = (u32High << 8) | u32Low;
 
@@ -968,9 +986,9 @@ static void AVR_Opcode_RETI( void )
 {
     uint32_t u32SP = (((uint32_t)stCPU.pstRAM->stRegisters.SPH.r) << 8) |
                      (((uint32_t)stCPU.pstRAM->stRegisters.SPL.r));
-    u32SP += 2;
+    u32SP = (uint16_t)(u32SP + 2);
 
-    uint32_t u32High = Data_Read(  u32SP - 1 );
+    uint32_t u32High = Data_Read(  (uint16_t)(u32SP - 1) );
     uint32_t u32Low = Data_Read(  u32SP );
     uint32_t u32NewPC = (u32High << 8) | u32Low;
 
@@ -986,103 +1004,102 @@ static void AVR_Opcode_RETI( void )
 }
 
 //---------------------------------------------------------------------------
-static void AVR_Opcode_CPSE( void )
-{    
-    if (*stCPU.Rr == *stCPU.Rd)
-    {        
-        uint8_t u8NextOpSize = AVR_Opcode_Size( stCPU.pu16ROM[ stCPU.u32PC + 1 ] );
-        Relative_Jump(  u8NextOpSize + 1 );
-    }
+/*!
+    Call/return handlers for parts with a 22-bit PC (see CPU_Has22BitPC()),
+    which push and pop 3-byte return addresses.  These are selected in place
+    of the 16-bit handlers above when the opcode is decoded, so that parts
+    with smaller ROMs don't pay for the check on every call.
+*/
+static void AVR_Opcode_RCALL_22( void )
+{
+    int32_t s32NewPC = (int32_t)stCPU.u32PC + (int32_t)stCPU.k_s + 1;
+
+    Push_PC22( stCPU.u32PC + 1 );
+    Unconditional_Jump( (uint32_t)s32NewPC & CPU_PC_MASK_22BIT );
 }
 
 //---------------------------------------------------------------------------
-static void CP_Half_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
+static void AVR_Opcode_ICALL_22( void )
 {
-    stCPU.pstRAM->stRegisters.SREG.H =
-            ( ((~Rd_ & Rr_)    & 0x08 )
-            | ((Rr_ & (Result_)) & 0x08 )
-            | (((Result_) & ~Rd_) & 0x08) ) != false;
+    Push_PC22( stCPU.u32PC + 1 );
+    Unconditional_Jump( Get_ZAddress() );
 }
 
 //---------------------------------------------------------------------------
-static void CP_Full_Carry( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
+static void AVR_Opcode_CALL_22( void )
 {
-    stCPU.pstRAM->stRegisters.SREG.C =
-            ( ((~Rd_ & Rr_)    & 0x80 )
-            | ((Rr_ & (Result_)) & 0x80 )
-            | (((Result_) & ~Rd_) & 0x80) ) != false;
+    Push_PC22( stCPU.u32PC + 2 );
+    Unconditional_Jump( stCPU.k & CPU_PC_MASK_22BIT );
 }
 
 //---------------------------------------------------------------------------
-static void CP_Overflow_Flag( uint8_t Rd_, uint8_t Rr_, uint8_t Result_)
+static void AVR_Opcode_RET_22( void )
 {
-    stCPU.pstRAM->stRegisters.SREG.V =
-             ( ((Rd_ & ~Rr_ & ~Result_)  & 0x80 )
-             | ((~Rd_ & Rr_ & Result_) & 0x80 ) ) != 0;
+    Unconditional_Jump( Pop_PC22() );
 }
 
 //---------------------------------------------------------------------------
-static void AVR_Opcode_CP( void )
+static void AVR_Opcode_RETI_22( void )
 {
-    // Compare
-    uint8_t u8Result;
-    uint8_t u8Rd = *stCPU.Rd;
-    uint8_t u8Rr  = *stCPU.Rr;
+    uint32_t u32NewPC = Pop_PC22();
 
-    u8Result = u8Rd - u8Rr;
+//-- Enable interrupts
+    stCPU.pstRAM->stRegisters.SREG.I = 1;
+    Unconditional_Jump( u32NewPC );
+
+//-- Run callout functions registered when we return from interrupt.
+    InterruptCallout_Run( false, 0 );
+}
 
-    //---
-    CP_Half_Carry(  u8Rd, u8Rr, u8Result );
-    CP_Overflow_Flag(  u8Rd, u8Rr, u8Result );
-    CP_Full_Carry(  u8Rd, u8Rr, u8Result );
+//---------------------------------------------------------------------------
+static void AVR_Opcode_CPSE( void )
+{    
+    if (*stCPU.Rr == *stCPU.Rd)
+    {        
+        uint8_t u8NextOpSize = AVR_Opcode_Size( stCPU.pu16ROM[ stCPU.u32PC + 1 ] );
+        Relative_Jump(  u8NextOpSize + 1 );
+    }
+}
 
-    R8_Zero_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
+//---------------------------------------------------------------------------
+static void AVR_Opcode_CP( void )
+{
+    // Compare
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Rr = *stCPU.Rr;
+    uint8_t u8Result = u8Rd - u8Rr;
 
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNZC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_CPC( void )
 {
     // Compare with carry
-    uint8_t u8Result;
     uint8_t u8Rd = *stCPU.Rd;
-    uint8_t u8Rr  = *stCPU.Rr;
-    uint8_t u8C = (stCPU.pstRAM->stRegisters.SREG.C == 1);
-
-    u8Result = u8Rd - u8Rr - u8C;
-
-    //---
-    CP_Half_Carry(  u8Rd, u8Rr, u8Result );
-    CP_Overflow_Flag(  u8Rd, u8Rr, u8Result );
-    CP_Full_Carry(  u8Rd, u8Rr, u8Result );
+    uint8_t u8Rr = *stCPU.Rr;
+    uint8_t u8Result;
 
-    R8_CPC_Zero_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
+    Flags_Sync();
+    u8Result = u8Rd - u8Rr - stCPU.pstRAM->stRegisters.SREG.C;
 
-    Signed_Flag();
+    // Z is only ever cleared by a compare-with-carry
+    if (u8Result)
+    {
+        stCPU.pstRAM->stRegisters.SREG.Z = 0;
+    }
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNC, u8Rd, u8Rr, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_CPI( void )
 {
     // Compare with immediate
-    uint8_t u8Result;
     uint8_t u8Rd = *stCPU.Rd;
-    uint8_t u8K  = stCPU.K;
-
-    u8Result = u8Rd - u8K;
-
-    //---
-    CP_Half_Carry(  u8Rd, u8K, u8Result );
-    CP_Overflow_Flag(  u8Rd, u8K, u8Result );
-    CP_Full_Carry(  u8Rd, u8K, u8Result );
-
-    R8_Zero_Flag(  u8Result );
-    R8_Negative_Flag(  u8Result );
+    uint8_t u8K = (uint8_t)stCPU.K;
+    uint8_t u8Result = u8Rd - u8K;
 
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_SUB, FLAGS_MASK_HSVNZC, u8Rd, u8K, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -1134,7 +1151,7 @@ static void AVR_Opcode_SBIS( void )
 //---------------------------------------------------------------------------
 static void Conditional_Branch( void )
 {
-    stCPU.u32PC = (uint16_t)((int16_t)stCPU.u32PC + stCPU.k_s + 1);
+    stCPU.u32PC = (uint32_t)((int32_t)stCPU.u32PC + stCPU.k_s + 1) & stCPU.u32PCMask;
     stCPU.u16ExtraPC = 0;
     stCPU.u16ExtraCycles++;
 }
@@ -1142,6 +1159,7 @@ static void Conditional_Branch( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRBS( void )
 {
+    Flags_Sync();
     if (0 != (stCPU.pstRAM->stRegisters.SREG.r & (1 << stCPU.b)))
     {
         Conditional_Branch();
@@ -1151,6 +1169,7 @@ static void AVR_Opcode_BRBS( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRBC( void )
 {
+    Flags_Sync();
     if (0 == (stCPU.pstRAM->stRegisters.SREG.r & (1 << stCPU.b)))
     {
         Conditional_Branch();
@@ -1160,7 +1179,7 @@ static void AVR_Opcode_BRBC( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BREQ( void )
 {
-    if (1 == stCPU.pstRAM->stRegisters.SREG.Z)
+    if (1 == Flags_Z())
     {
         Conditional_Branch();
     }
@@ -1169,7 +1188,7 @@ static void AVR_Opcode_BREQ( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRNE( void )
 {
-    if (0 == stCPU.pstRAM->stRegisters.SREG.Z)
+    if (0 == Flags_Z())
     {
         Conditional_Branch();
     }
@@ -1178,6 +1197,7 @@ static void AVR_Opcode_BRNE( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRCS( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.C)
     {
         Conditional_Branch();
@@ -1187,6 +1207,7 @@ static void AVR_Opcode_BRCS( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRCC( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.C)
     {
         Conditional_Branch();
@@ -1196,6 +1217,7 @@ static void AVR_Opcode_BRCC( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRSH( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.C)
     {
         Conditional_Branch();
@@ -1205,6 +1227,7 @@ static void AVR_Opcode_BRSH( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRLO( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.C)
     {
         Conditional_Branch();
@@ -1214,6 +1237,7 @@ static void AVR_Opcode_BRLO( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRMI( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.N)
     {
         Conditional_Branch();
@@ -1223,6 +1247,7 @@ static void AVR_Opcode_BRMI( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRPL( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.N)
     {
         Conditional_Branch();
@@ -1232,6 +1257,7 @@ static void AVR_Opcode_BRPL( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRGE( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.S)
     {
         Conditional_Branch();
@@ -1241,6 +1267,7 @@ static void AVR_Opcode_BRGE( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRLT( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.S)
     {
         Conditional_Branch();
@@ -1250,6 +1277,7 @@ static void AVR_Opcode_BRLT( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRHS( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.H)
     {
         Conditional_Branch();
@@ -1259,6 +1287,7 @@ static void AVR_Opcode_BRHS( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRHC( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.H)
     {
         Conditional_Branch();
@@ -1286,6 +1315,7 @@ static void AVR_Opcode_BRTC( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRVS( void )
 {
+    Flags_Sync();
     if (1 == stCPU.pstRAM->stRegisters.SREG.V)
     {
         Conditional_Branch();
@@ -1295,6 +1325,7 @@ static void AVR_Opcode_BRVS( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BRVC( void )
 {
+    Flags_Sync();
     if (0 == stCPU.pstRAM->stRegisters.SREG.V)
     {
         Conditional_Branch();
@@ -1614,6 +1645,57 @@ static void AVR_Opcode_OUT( void )
      Data_Write(  32 + stCPU.A , *stCPU.Rd );
 }
 
+#if FEATURE_USE_IO_BINDING
+//---------------------------------------------------------------------------
+/*!
+    I/O instructions bound to a register with no peripheral, callout or
+    watchpoint attached (see AVR_OpCache_Dispatch()), which access the RAM
+    byte backing the register directly.
+*/
+static void AVR_Opcode_IN_RAM( void )
+{
+    *stCPU.Rd = stCPU.pstRAM->au8RAM[ 32 + stCPU.A ];
+}
+
+//---------------------------------------------------------------------------
+static void AVR_Opcode_OUT_RAM( void )
+{
+    stCPU.pstRAM->au8RAM[ 32 + stCPU.A ] = *stCPU.Rd;
+}
+
+//---------------------------------------------------------------------------
+static void AVR_Opcode_SBI_RAM( void )
+{
+    stCPU.pstRAM->au8RAM[ 32 + stCPU.A ] |= (1 << stCPU.b);
+}
+
+//---------------------------------------------------------------------------
+static void AVR_Opcode_CBI_RAM( void )
+{
+    stCPU.pstRAM->au8RAM[ 32 + stCPU.A ] &= ~(1 << stCPU.b);
+}
+
+//---------------------------------------------------------------------------
+static void AVR_Opcode_SBIS_RAM( void )
+{
+    if ((stCPU.pstRAM->au8RAM[ 32 + stCPU.A ] & (1 << stCPU.b)) != 0)
+    {
+        uint8_t u8NextOpSize = AVR_Opcode_Size( stCPU.pu16ROM[ stCPU.u32PC + 1 ] );
+        Relative_Jump(  u8NextOpSize + 1 );
+    }
+}
+
+//---------------------------------------------------------------------------
+static void AVR_Opcode_SBIC_RAM( void )
+{
+    if ((stCPU.pstRAM->au8RAM[ 32 + stCPU.A ] & (1 << stCPU.b)) == 0)
+    {
+        uint8_t u8NextOpSize = AVR_Opcode_Size( stCPU.pu16ROM[ stCPU.u32PC + 1 ] );
+        Relative_Jump(  u8NextOpSize + 1 );
+    }
+}
+#endif
+
 //---------------------------------------------------------------------------
 static void AVR_Opcode_PUSH( void )
 {    
@@ -1637,7 +1719,7 @@ static void AVR_Opcode_POP( void )
     // Preincrement the SP
     uint32_t u32SP = (stCPU.pstRAM->stRegisters.SPL.r) |
                      ((uint16_t)(stCPU.pstRAM->stRegisters.SPH.r) << 8);
-    u32SP++;
+    u32SP = (uint16_t)(u32SP + 1);
 
     // Load contents from SP to destination register
     *stCPU.Rd = Data_Read(  u32SP );
@@ -1706,127 +1788,76 @@ static void AVR_Opcode_LAT( void )
     Data_Write(  u32Addr, u8Temp );
 }
 
-//---------------------------------------------------------------------------
-static void LSL_HalfCarry_Flag( uint8_t R_ )
-{
-    stCPU.pstRAM->stRegisters.SREG.H = ((R_ & 0x08) == 0x08);
-}
-
-//---------------------------------------------------------------------------
-static void Left_Carry_Flag( uint8_t R_  )
-{
-    stCPU.pstRAM->stRegisters.SREG.C = ((R_ & 0x80) == 0x80);
-}
-
-//---------------------------------------------------------------------------
-static void Rotate_Overflow_Flag()
-{
-    stCPU.pstRAM->stRegisters.SREG.V = ( stCPU.pstRAM->stRegisters.SREG.N ^ stCPU.pstRAM->stRegisters.SREG.C );
-}
-
 //---------------------------------------------------------------------------
 static void AVR_Opcode_LSL( void )
 {
     // Logical shift left
-    uint8_t u8Result = 0;
-    uint8_t u8Temp = *stCPU.Rd;
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (u8Rd << 1);
 
-    u8Result = (u8Temp << 1);
     *stCPU.Rd = u8Result;
 
-    // ---- Update flags ----
-    LSL_HalfCarry_Flag(  u8Result);
-    Left_Carry_Flag( u8Temp);
-
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Rotate_Overflow_Flag();
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LSL, FLAGS_MASK_HSVNZC, u8Rd, 0, u8Result );
 }
 
-//---------------------------------------------------------------------------
-static void Right_Carry_Flag( uint8_t R_  )
-{
-    stCPU.pstRAM->stRegisters.SREG.C = ((R_ & 0x01) == 0x01);
-}
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_LSR( void )
 {
-    // Logical shift left
-    uint8_t u8Result = 0;
-    uint8_t u8Temp = *stCPU.Rd;
+    // Logical shift right
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (u8Rd >> 1);
 
-    u8Result = (u8Temp >> 1);
     *stCPU.Rd = u8Result;
 
-    // ---- Update flags ----
-    Right_Carry_Flag(  u8Temp );
-    stCPU.pstRAM->stRegisters.SREG.N = 0;
-    R8_Zero_Flag(  u8Result );
-    Rotate_Overflow_Flag();
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_LSR, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ROL( void )
 {
     // Rotate left through carry
-    uint8_t u8Result = 0;
-    uint8_t u8Temp = *stCPU.Rd;
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (u8Rd << 1);
 
-    u8Result = (u8Temp << 1);
+    Flags_Sync();
     if (stCPU.pstRAM->stRegisters.SREG.C)
     {
         u8Result |= 0x01;
     }
     *stCPU.Rd = u8Result;
 
-    // ---- Update flags ----
-    Left_Carry_Flag(  u8Temp );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Rotate_Overflow_Flag();
-    Signed_Flag();
+    // Note - H is not updated
+    Flags_Defer( FLAGS_OP_LSL, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ROR( void )
 {
     // Rotate right through carry
-    uint8_t u8Result = 0;
-    uint8_t u8Temp = *stCPU.Rd;
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (u8Rd >> 1);
 
-    u8Result = (u8Temp >> 1);
+    Flags_Sync();
     if (stCPU.pstRAM->stRegisters.SREG.C)
     {
         u8Result |= 0x80;
     }
     *stCPU.Rd = u8Result;
 
-    // ---- Update flags ----
-    Right_Carry_Flag(  u8Temp );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Rotate_Overflow_Flag();
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_ROR, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_ASR( void )
 {
     // Shift all bits to the right, keeping sign bit intact
-    uint8_t u8Result;
-    uint8_t u8Temp = *stCPU.Rd;
-    u8Result = (u8Temp & 0x80) | (u8Temp >> 1);
+    uint8_t u8Rd = *stCPU.Rd;
+    uint8_t u8Result = (u8Rd & 0x80) | (u8Rd >> 1);
+
     *stCPU.Rd = u8Result;
 
-    // ---- Update flags ----
-    Right_Carry_Flag(  u8Temp );
-    R8_Negative_Flag(  u8Result );
-    R8_Zero_Flag(  u8Result );
-    Rotate_Overflow_Flag();
-    Signed_Flag();
+    Flags_Defer( FLAGS_OP_ROR, FLAGS_MASK_SVNZC, u8Rd, 0, u8Result );
 }
 
 //---------------------------------------------------------------------------
@@ -1842,12 +1873,14 @@ static void AVR_Opcode_SWAP( void )
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BSET( void )
 {
+    Flags_Sync();
     stCPU.pstRAM->stRegisters.SREG.r |= (1 << stCPU.b);
 }
 
 //---------------------------------------------------------------------------
 static void AVR_Opcode_BCLR( void )
 {
+    Flags_Sync();
     stCPU.pstRAM->stRegisters.SREG.r &= ~(1 << stCPU.b);
 }
 
@@ -1912,7 +1945,7 @@ static void AVR_Opcode_WDR( void )
 }
 
 //---------------------------------------------------------------------------
-AVR_Opcode AVR_Opcode_Function( uint16_t OP_ )
+static AVR_Opcode AVR_Opcode_Decode( uint16_t OP_ )
 {
     switch (OP_)
     {
@@ -2112,9 +2145,440 @@ AVR_Opcode AVR_Opcode_Function( uint16_t OP_ )
     return AVR_Opcode_NOP;
 }
 
+//---------------------------------------------------------------------------
+/*!
+    Opcode functions replaced on parts with a 22-bit PC, and their
+    replacements.  EIJMP/EICALL only exist on these parts - elsewhere, they're
+    run as IJMP/ICALL.
+*/
+typedef struct
+{
+    AVR_Opcode pfOpcode16;
+    AVR_Opcode pfOpcode22;
+} AVR_Opcode_PC22_t;
+
+static const AVR_Opcode_PC22_t astPC22Opcodes[] =
+{
+    { AVR_Opcode_RCALL, AVR_Opcode_RCALL_22 },
+    { AVR_Opcode_ICALL, AVR_Opcode_ICALL_22 },
+    { AVR_Opcode_CALL,  AVR_Opcode_CALL_22 },
+    { AVR_Opcode_RET,   AVR_Opcode_RET_22 },
+    { AVR_Opcode_RETI,  AVR_Opcode_RETI_22 },
+};
+
+//---------------------------------------------------------------------------
+AVR_Opcode AVR_Opcode_Function( uint16_t OP_ )
+{
+    AVR_Opcode pfOpcode = AVR_Opcode_Decode( OP_ );
+    uint8_t i;
+
+    if (!CPU_Has22BitPC())
+    {
+        if (pfOpcode == AVR_Opcode_EIJMP)
+        {
+            return AVR_Opcode_IJMP;
+        }
+        if (pfOpcode == AVR_Opcode_EICALL)
+        {
+            return AVR_Opcode_ICALL;
+        }
+        return pfOpcode;
+    }
+
+    for (i = 0; i < (sizeof(astPC22Opcodes) / sizeof(AVR_Opcode_PC22_t)); i++)
+    {
+        if (astPC22Opcodes[i].pfOpcode16 == pfOpcode)
+        {
+            return astPC22Opcodes[i].pfOpcode22;
+        }
+    }
+    return pfOpcode;
+}
+
 //---------------------------------------------------------------------------
 void AVR_RunOpcode(  uint16_t OP_ )
 {
     AVR_Opcode myOpcode = AVR_Opcode_Function( OP_);
     myOpcode();
 }
+
+//---------------------------------------------------------------------------
+#define AVR_OPCODE_FUNCTION(x)      AVR_Opcode_##x,
+
+static const AVR_Opcode apfOpcodeList[] =
+{
+    AVR_OPCODE_LIST(AVR_OPCODE_FUNCTION)
+};
+
+//---------------------------------------------------------------------------
+uint8_t AVR_Opcode_DispatchIndex( AVR_Opcode pfOpcode_ )
+{
+    uint8_t i;
+    for (i = 0; i < (sizeof(apfOpcodeList) / sizeof(AVR_Opcode)); i++)
+    {
+        if (apfOpcodeList[i] == pfOpcode_)
+        {
+            return i;
+        }
+    }
+    return AVR_OPCODE_INDEX_INVALID;
+}
+
+//---------------------------------------------------------------------------
+uint8_t AVR_Opcode_Index( AVR_Opcode pfOpcode_ )
+{
+    uint8_t i;
+    for (i = 0; i < (sizeof(astPC22Opcodes) / sizeof(AVR_Opcode_PC22_t)); i++)
+    {
+        if (astPC22Opcodes[i].pfOpcode22 == pfOpcode_)
+        {
+            return AVR_Opcode_DispatchIndex( astPC22Opcodes[i].pfOpcode16 );
+        }
+    }
+    return AVR_Opcode_DispatchIndex( pfOpcode_ );
+}
+
+#if FEATURE_USE_THREADED_ENGINE
+//---------------------------------------------------------------------------
+/*!
+    Threaded-code execution engine.
+
+    Each opcode function is inlined into a single dispatch function, and
+    followed by its own copy of the instruction retire/dispatch logic, so that
+    each AVR instruction executed costs a single (well-predicted) indirect
+    jump on the host.  Instructions are dispatched from the predecoded
+    instruction cache; anything that can't be serviced from the cache (cache
+    misses, sleeping CPU) runs a cycle through CPU_RunCycle() instead, which
+    also populates the cache.
+
+    While running, the PC, cycle count and instruction count are kept in
+    host locals (u32PC, u64Cycles, u64Insns) rather than in stCPU.  They're
+    written back to stCPU only at observation points - before the peripheral
+    clock callbacks, before interrupt entry, around any instruction which
+    reads or writes the PC or goes through the data-space callouts, and on
+    return to the caller - and re-loaded wherever the code that ran in the
+    meantime may have changed them.
+
+    Note that the retire logic below must be kept in sync with CPU_RunCycle().
+*/
+//---------------------------------------------------------------------------
+/*!
+    Opcodes that operate purely on the register file and SREG, and can be run
+    entirely against the cached engine state.  All other opcodes (flow
+    control, skips, memory and IO access, sleep) see a fully-synchronized
+    stCPU.  Every opcode in AVR_OPCODE_LIST must be in exactly one of these
+    two lists.
+*/
+#define AVR_THREADED_LOCAL_LIST(X) \
+    X(NOP) X(ADD) X(ADC) X(ADIW) X(SUB) X(SUBI) X(SBC) X(SBCI) X(SBIW)    \
+    X(AND) X(ANDI) X(OR) X(ORI) X(EOR) X(COM) X(NEG) X(SBR) X(INC) X(DEC) \
+    X(SER) X(MUL) X(MULS) X(MULSU) X(FMUL) X(FMULS) X(FMULSU) X(DES)      \
+    X(CP) X(CPC) X(CPI) X(MOV) X(MOVW) X(LDI) X(LSL) X(LSR) X(ROL)        \
+    X(ROR) X(ASR) X(SWAP) X(BSET) X(BCLR) X(BST) X(BLD)
+
+#define AVR_THREADED_SYNC_LIST(X) \
+    X(RJMP) X(IJMP) X(EIJMP) X(JMP) X(RCALL) X(ICALL) X(EICALL) X(CALL)   \
+    X(RET) X(RETI) X(CPSE) X(SBRC) X(SBRS) X(SBIC) X(SBIS) X(BREQ)        \
+    X(BRNE) X(BRCS) X(BRCC) X(BRSH) X(BRLO) X(BRMI) X(BRPL) X(BRGE)       \
+    X(BRLT) X(BRHC) X(BRTS) X(BRTC) X(BRVS) X(BRVC) X(BRIE) X(BRID)       \
+    X(LDS) X(LD_X_Indirect) X(LD_X_Indirect_Postinc)                      \
+    X(LD_X_Indirect_Predec) X(LD_Y_Indirect) X(LD_Y_Indirect_Postinc)     \
+    X(LD_Y_Indirect_Predec) X(LDD_Y) X(LD_Z_Indirect)                     \
+    X(LD_Z_Indirect_Postinc) X(LD_Z_Indirect_Predec) X(LDD_Z) X(STS)      \
+    X(ST_X_Indirect) X(ST_X_Indirect_Postinc) X(ST_X_Indirect_Predec)     \
+    X(ST_Y_Indirect) X(ST_Y_Indirect_Postinc) X(ST_Y_Indirect_Predec)     \
+    X(STD_Y) X(ST_Z_Indirect) X(ST_Z_Indirect_Postinc)                    \
+    X(ST_Z_Indirect_Predec) X(STD_Z) X(LPM) X(LPM_Z) X(LPM_Z_Postinc)     \
+    X(ELPM) X(ELPM_Z) X(ELPM_Z_Postinc) X(SPM) X(SPM_Z_Postinc2) X(IN)    \
+    X(OUT) X(PUSH) X(POP) X(XCH) X(LAS) X(LAC) X(LAT) X(SBI) X(CBI)       \
+    X(BREAK) X(SLEEP) X(WDR)
+
+//---------------------------------------------------------------------------
+#define AVR_THREADED_SYNC()                                                 \
+    stCPU.u32PC = u32PC;                                                    \
+    stCPU.u64CycleCount = u64Cycles;                                        \
+    stCPU.u64InstructionCount = u64Insns;
+
+#define AVR_THREADED_RELOAD()                                               \
+    u32PC = stCPU.u32PC;                                                    \
+    u64Cycles = stCPU.u64CycleCount;                                        \
+    u64Insns = stCPU.u64InstructionCount;
+
+//---------------------------------------------------------------------------
+/*!
+    Retire an instruction run against the cached engine state.  Peripheral
+    clock callbacks may observe - but never modify - the PC and cycle count,
+    so those are published on the ticks where peripherals actually run, but
+    nothing needs to be re-loaded unless an interrupt is actually taken.
+*/
+#define AVR_THREADED_RETIRE_LOCAL()                                         \
+    u32PC += pstEntry->u8Size;                                              \
+    u8Clocks = pstEntry->u8Cycles;                                          \
+    u64Cycles += u8Clocks;                                                  \
+    stCPU.u64IOTicks += u8Clocks;                                           \
+    if (stCPU.u64IOTicks >= stCPU.u64IONextEvent)                           \
+    {                                                                       \
+        stCPU.u32PC = u32PC;                                                \
+        stCPU.u64CycleCount = u64Cycles;                                    \
+        IO_AdvanceEvents( u8Clocks );                                       \
+    }                                                                       \
+    u64Insns++;                                                             \
+    if ((stCPU.u8IntPriority != 255) &&                                     \
+        stCPU.pstRAM->stRegisters.SREG.I)                                   \
+    {                                                                       \
+        AVR_THREADED_SYNC();                                                \
+        AVR_Interrupt();                                                    \
+        AVR_THREADED_RELOAD();                                              \
+    }
+
+//---------------------------------------------------------------------------
+/*!
+    After an instruction has transferred control backwards, skip over any
+    iterations of the loop it closes that can't change anything but the
+    cycle count (see avr_idle_loop.c).
+*/
+#if FEATURE_USE_IDLE_LOOPS
+#define AVR_THREADED_IDLE_SKIP()                                            \
+    if (stCPU.u32PC < u32PC)                                                \
+    {                                                                       \
+        u32Count_ -= AVR_IdleLoop_Skip( u32PC, u32Count_ );                 \
+    }
+#else
+#define AVR_THREADED_IDLE_SKIP()
+#endif
+
+//---------------------------------------------------------------------------
+/*!
+    Before running the next instruction, run the routine it starts natively
+    if it's bound to a native implementation (see avr_hle.c).  Calls always
+    go through the interpreter or a synchronized handler, so this is only
+    checked on those paths.
+*/
+#if FEATURE_USE_HLE
+#define AVR_THREADED_HLE()                                                  \
+    if (stCPU.bHLE)                                                         \
+    {                                                                       \
+        u32Count_ -= AVR_HLE_Call( u32Count_ );                             \
+    }
+#else
+#define AVR_THREADED_HLE()
+#endif
+
+//---------------------------------------------------------------------------
+/*!
+    Retire an instruction run against stCPU (following AVR_THREADED_SYNC()),
+    and re-load the cached engine state from the result.
+*/
+#define AVR_THREADED_RETIRE_SYNC()                                          \
+    stCPU.u32PC += stCPU.u16ExtraPC;                                        \
+    stCPU.u64CycleCount += stCPU.u16ExtraCycles;                            \
+    IO_Advance( stCPU.u16ExtraCycles );                                     \
+    stCPU.u64InstructionCount++;                                            \
+    AVR_Interrupt();                                                        \
+    AVR_THREADED_IDLE_SKIP();                                               \
+    AVR_THREADED_HLE();                                                     \
+    AVR_THREADED_RELOAD();
+
+//---------------------------------------------------------------------------
+#define AVR_THREADED_EXEC_LOCAL(x)                                          \
+    AVR_Opcode_##x();                                                       \
+    AVR_THREADED_RETIRE_LOCAL();
+
+#define AVR_THREADED_EXEC_SYNC(x)                                           \
+    AVR_THREADED_SYNC();                                                    \
+    stCPU.u16ExtraPC = pstEntry->u8Size;                                    \
+    stCPU.u16ExtraCycles = pstEntry->u8Cycles;                              \
+    AVR_Opcode_##x();                                                       \
+    AVR_THREADED_RETIRE_SYNC();
+
+//---------------------------------------------------------------------------
+#define AVR_THREADED_DISPATCH()                                             \
+    if (!u32Count_--)                                                       \
+    {                                                                       \
+        AVR_THREADED_SYNC();                                                \
+        return;                                                             \
+    }                                                                       \
+    if (stCPU.bAsleep || (u32PC >= u32CacheWords))                          \
+    {                                                                       \
+        goto Label_Interpret;                                               \
+    }                                                                       \
+    pstEntry = &pstCache[ u32PC ];                                          \
+    if (!pstEntry->bValid)                                                  \
+    {                                                                       \
+        goto Label_Interpret;                                               \
+    }                                                                       \
+    AVR_OpCache_Restore( pstEntry );                                        \
+    if (pstEntry->bDecodeClock)                                             \
+    {                                                                       \
+        AVR_THREADED_SYNC();                                                \
+        IO_Clock();                                                         \
+    }                                                                       \
+    goto *apvLabels[ pstEntry->u8Dispatch ];
+
+//---------------------------------------------------------------------------
+#define AVR_THREADED_LABEL(x)       [AVR_OPCODE_INDEX_##x] = &&Label_##x,
+#define AVR_THREADED_HANDLER_LOCAL(x)                                       \
+Label_##x:                                                                  \
+    AVR_THREADED_EXEC_LOCAL(x);                                             \
+    AVR_THREADED_DISPATCH();
+
+#define AVR_THREADED_HANDLER_SYNC(x)                                        \
+Label_##x:                                                                  \
+    AVR_THREADED_EXEC_SYNC(x);                                              \
+    AVR_THREADED_DISPATCH();
+
+#if FEATURE_USE_FUSION
+//---------------------------------------------------------------------------
+/*!
+    Fused sequence handlers.  The first instruction of the sequence has been
+    dispatched as usual; each following instruction is run directly from the
+    next cache entry, without re-checking the entry (the sequence would have
+    been broken up if it had been invalidated).  If the previous instruction
+    didn't fall through to the next one in the sequence - i.e. an interrupt
+    was taken - the rest of the sequence is dispatched normally instead.
+*/
+#define AVR_THREADED_FUSED_FIRST(x, mode)                                   \
+    u32FusedNext = u32PC + pstEntry->u8Size;                                \
+    AVR_THREADED_EXEC_##mode(x);
+
+#define AVR_THREADED_FUSED_NEXT(x, mode)                                    \
+    if (u32PC != u32FusedNext)                                              \
+    {                                                                       \
+        AVR_THREADED_DISPATCH();                                            \
+    }                                                                       \
+    if (!u32Count_--)                                                       \
+    {                                                                       \
+        AVR_THREADED_SYNC();                                                \
+        return;                                                             \
+    }                                                                       \
+    pstEntry = &pstCache[ u32FusedNext ];                                   \
+    u32FusedNext += pstEntry->u8Size;                                       \
+    AVR_OpCache_Restore( pstEntry );                                        \
+    AVR_THREADED_EXEC_##mode(x);
+
+#define AVR_THREADED_FUSED_LABEL(x) [AVR_FUSION_DISPATCH(AVR_FUSION_##x)] = &&Label_Fused_##x,
+#endif
+
+#if FEATURE_USE_IO_BINDING
+//---------------------------------------------------------------------------
+/*!
+    Bound I/O instruction handlers.  Those that only move data between the
+    register file and RAM run against the cached engine state; the skips need
+    the PC, and run synchronized.
+*/
+#define AVR_THREADED_BOUND_LABEL(x) [AVR_IO_BIND_DISPATCH(AVR_IO_BIND_##x)] = &&Label_Bound_##x,
+#define AVR_THREADED_BOUND_HANDLER(x, mode)                                 \
+Label_Bound_##x:                                                            \
+    AVR_THREADED_EXEC_##mode(x##_RAM);                                      \
+    AVR_THREADED_DISPATCH();
+#endif
+
+//---------------------------------------------------------------------------
+__attribute__((flatten))
+void AVR_Opcode_RunThreaded( uint32_t u32Count_ )
+{
+    static const void *apvLabels[256] =
+    {
+        AVR_OPCODE_LIST(AVR_THREADED_LABEL)
+#if FEATURE_USE_FUSION
+        AVR_FUSION_LIST(AVR_THREADED_FUSED_LABEL)
+#endif
+#if FEATURE_USE_IO_BINDING
+        AVR_IO_BIND_LIST(AVR_THREADED_BOUND_LABEL)
+#endif
+        [AVR_OPCODE_INDEX_INVALID] = &&Label_Generic
+    };
+
+    AVR_OpCache_Entry_t *pstCache = AVR_OpCache_Lookup( 0 );
+    AVR_OpCache_Entry_t *pstEntry;
+    uint32_t u32CacheWords = AVR_OpCache_Size();
+#if FEATURE_USE_FUSION
+    uint32_t u32FusedNext;
+#endif
+
+    // Cached engine state - see AVR_THREADED_SYNC()/AVR_THREADED_RELOAD()
+    uint32_t u32PC;
+    uint64_t u64Cycles;
+    uint64_t u64Insns;
+    uint8_t  u8Clocks;
+
+    AVR_THREADED_HLE();
+    AVR_THREADED_RELOAD();
+    AVR_THREADED_DISPATCH();
+
+    AVR_THREADED_LOCAL_LIST(AVR_THREADED_HANDLER_LOCAL)
+    AVR_THREADED_SYNC_LIST(AVR_THREADED_HANDLER_SYNC)
+
+#if FEATURE_USE_FUSION
+Label_Fused_LDI_LDI:
+    au64FusionHits[ AVR_FUSION_LDI_LDI ]++;
+    AVR_THREADED_FUSED_FIRST(LDI, LOCAL);
+    AVR_THREADED_FUSED_NEXT(LDI, LOCAL);
+    AVR_THREADED_DISPATCH();
+
+Label_Fused_CP_CPC:
+    au64FusionHits[ AVR_FUSION_CP_CPC ]++;
+    AVR_THREADED_FUSED_FIRST(CP, LOCAL);
+    AVR_THREADED_FUSED_NEXT(CPC, LOCAL);
+    AVR_THREADED_DISPATCH();
+
+Label_Fused_CP_CPC_BRNE:
+    au64FusionHits[ AVR_FUSION_CP_CPC_BRNE ]++;
+    AVR_THREADED_FUSED_FIRST(CP, LOCAL);
+    AVR_THREADED_FUSED_NEXT(CPC, LOCAL);
+    AVR_THREADED_FUSED_NEXT(BRNE, SYNC);
+    AVR_THREADED_DISPATCH();
+
+Label_Fused_MOVW_ADIW:
+    au64FusionHits[ AVR_FUSION_MOVW_ADIW ]++;
+    AVR_THREADED_FUSED_FIRST(MOVW, LOCAL);
+    AVR_THREADED_FUSED_NEXT(ADIW, LOCAL);
+    AVR_THREADED_DISPATCH();
+
+Label_Fused_PUSH_PUSH:
+    au64FusionHits[ AVR_FUSION_PUSH_PUSH ]++;
+    AVR_THREADED_FUSED_FIRST(PUSH, SYNC);
+    AVR_THREADED_FUSED_NEXT(PUSH, SYNC);
+    AVR_THREADED_DISPATCH();
+
+Label_Fused_POP_POP:
+    au64FusionHits[ AVR_FUSION_POP_POP ]++;
+    AVR_THREADED_FUSED_FIRST(POP, SYNC);
+    AVR_THREADED_FUSED_NEXT(POP, SYNC);
+    AVR_THREADED_DISPATCH();
+#endif
+
+#if FEATURE_USE_IO_BINDING
+    AVR_THREADED_BOUND_HANDLER(IN, LOCAL)
+    AVR_THREADED_BOUND_HANDLER(OUT, LOCAL)
+    AVR_THREADED_BOUND_HANDLER(SBI, LOCAL)
+    AVR_THREADED_BOUND_HANDLER(CBI, LOCAL)
+    AVR_THREADED_BOUND_HANDLER(SBIS, SYNC)
+    AVR_THREADED_BOUND_HANDLER(SBIC, SYNC)
+#endif
+
+Label_Generic:
+    // Opcode function not known to the threaded engine
+    AVR_THREADED_SYNC();
+    stCPU.u16ExtraPC = pstEntry->u8Size;
+    stCPU.u16ExtraCycles = pstEntry->u8Cycles;
+    pstEntry->pfOpcode();
+    AVR_THREADED_RETIRE_SYNC();
+    AVR_THREADED_DISPATCH();
+
+Label_Interpret:
+    // CPU is asleep, or the instruction hasn't been predecoded yet - run a
+    // full instruction cycle through the interpreter.
+    AVR_THREADED_SYNC();
+#if FEATURE_USE_SLEEP_SKIP
+    if (stCPU.bAsleep)
+    {
+        u32Count_ -= CPU_SkipSleep( u32Count_ );
+    }
+#endif
+    CPU_RunCycle();
+    AVR_THREADED_HLE();
+    AVR_THREADED_RELOAD();
+    AVR_THREADED_DISPATCH();
+}
+#endif
@@ -51,4 +51,95 @@ AVR_Opcode AVR_Opcode_Function( uint16_t OP_ );
  */
 void AVR_RunOpcode(  uint16_t OP_ );
 
+//---------------------------------------------------------------------------
+/*!
+    List of all opcode execution functions returned by AVR_Opcode_Function(),
+    used to build the opcode index table, as well as the dispatch labels used
+    by the threaded execution engine.
+*/
+#define AVR_OPCODE_LIST(X) \
+    X(NOP) X(ADD) X(ADC) X(ADIW) X(SUB) X(SUBI) X(SBC) X(SBCI) X(SBIW)    \
+    X(AND) X(ANDI) X(OR) X(ORI) X(EOR) X(COM) X(NEG) X(SBR) X(INC) X(DEC) \
+    X(SER) X(MUL) X(MULS) X(MULSU) X(FMUL) X(FMULS) X(FMULSU) X(DES)      \
+    X(RJMP) X(IJMP) X(EIJMP) X(JMP) X(RCALL) X(ICALL) X(EICALL) X(CALL)   \
+    X(RET) X(RETI) X(CPSE) X(CP) X(CPC) X(CPI) X(SBRC) X(SBRS) X(SBIC)    \
+    X(SBIS) X(BREQ) X(BRNE) X(BRCS) X(BRCC) X(BRSH) X(BRLO) X(BRMI)       \
+    X(BRPL) X(BRGE) X(BRLT) X(BRHC) X(BRTS) X(BRTC) X(BRVS) X(BRVC)       \
+    X(BRIE) X(BRID) X(MOV) X(MOVW) X(LDI) X(LDS) X(LD_X_Indirect)         \
+    X(LD_X_Indirect_Postinc) X(LD_X_Indirect_Predec) X(LD_Y_Indirect)     \
+    X(LD_Y_Indirect_Postinc) X(LD_Y_Indirect_Predec) X(LDD_Y)             \
+    X(LD_Z_Indirect) X(LD_Z_Indirect_Postinc) X(LD_Z_Indirect_Predec)     \
+    X(LDD_Z) X(STS) X(ST_X_Indirect) X(ST_X_Indirect_Postinc)             \
+    X(ST_X_Indirect_Predec) X(ST_Y_Indirect) X(ST_Y_Indirect_Postinc)     \
+    X(ST_Y_Indirect_Predec) X(STD_Y) X(ST_Z_Indirect)                     \
+    X(ST_Z_Indirect_Postinc) X(ST_Z_Indirect_Predec) X(STD_Z) X(LPM)      \
+    X(LPM_Z) X(LPM_Z_Postinc) X(ELPM) X(ELPM_Z) X(ELPM_Z_Postinc) X(SPM)  \
+    X(SPM_Z_Postinc2) X(IN) X(OUT) X(PUSH) X(POP) X(XCH) X(LAS) X(LAC)    \
+    X(LAT) X(LSL) X(LSR) X(ROL) X(ROR) X(ASR) X(SWAP) X(BSET) X(BCLR)     \
+    X(SBI) X(CBI) X(BST) X(BLD) X(BREAK) X(SLEEP) X(WDR)
+
+//---------------------------------------------------------------------------
+#define AVR_OPCODE_ENUM(x)          AVR_OPCODE_INDEX_##x,
+
+//! Opcode function indexes, as returned by AVR_Opcode_Index()
+typedef enum
+{
+    AVR_OPCODE_LIST(AVR_OPCODE_ENUM)
+//---
+    AVR_OPCODE_INDEX_COUNT
+} AVR_Opcode_Index_t;
+
+//---------------------------------------------------------------------------
+//! Index returned by AVR_Opcode_Index() for unrecognized opcode functions
+#define AVR_OPCODE_INDEX_INVALID        (0xFF)
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Opcode_Index
+ *
+ * Return a small integer uniquely identifying an opcode execution function,
+ * suitable for indexing dispatch tables.  The call/return functions used on
+ * parts with a 22-bit PC share the index of their 16-bit counterparts.
+ *
+ * \param pfOpcode_ Opcode execution function, from AVR_Opcode_Function()
+ * \return Index of the opcode function, or AVR_OPCODE_INDEX_INVALID
+ */
+uint8_t AVR_Opcode_Index( AVR_Opcode pfOpcode_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Opcode_DispatchIndex
+ *
+ * Return the threaded-engine handler index for an opcode execution function.
+ * This is the same as AVR_Opcode_Index(), except for functions which have no
+ * handler of their own in the threaded engine (i.e. the 22-bit PC variants),
+ * which must be run through the generic handler.
+ *
+ * \param pfOpcode_ Opcode execution function, from AVR_Opcode_Function()
+ * \return Handler index of the opcode function, or AVR_OPCODE_INDEX_INVALID
+ */
+uint8_t AVR_Opcode_DispatchIndex( AVR_Opcode pfOpcode_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Opcode_RunThreaded
+ *
+ * Run a number of CPU instruction cycles using the threaded-code execution
+ * engine.  The results are identical to calling CPU_RunCycle() the same
+ * number of times.
+ *
+ * \param u32Count_ Number of instruction cycles to run
+ */
+void AVR_Opcode_RunThreaded( uint32_t u32Count_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief AVR_Opcode_SyncFlags
+ *
+ * Write any outstanding (lazily-evaluated) flag updates into SREG.  Must be
+ * called before SREG is accessed directly from outside of the opcode
+ * handlers - CPU_Run() does so before returning.
+ */
+void AVR_Opcode_SyncFlags( void );
+
 #endif
@@ -131,7 +131,7 @@ typedef struct
     uint8_t     RESERVED_0x59;
     uint8_t     RESERVED_0x5A;
     uint8_t     RAMPZ;
-    uint8_t     RESERVED_0x5C;
+    uint8_t     EIND;
     AVR_SPL     SPL;
     AVR_SPH     SPH;
     AVR_SREG    SREG;
@@ -0,0 +1,720 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_snapshot.c
+
+  \brief In-memory snapshots of the complete machine state, from which the
+         CPU can be resumed exactly.
+
+  The execution state is saved field by field (see CPU_SnapshotCore_t), so
+  that nothing belonging to the CPU instance - pointers to its memory and
+  tables, or the operands of the last instruction decoded - is carried over
+  from one instance to another.
+
+  The peripheral event scheduler isn't saved - every deadline is a function
+  of the peripheral state and the current tick, so the schedule is rebuilt
+  on restore instead.
+
+  Each save gives the snapshot a new id, which the CPU then records as its
+  dirty-page base (AVR_CPU::u64DirtyBase), clearing its dirty-page bitmaps.
+  While the two match, the snapshot and CPU memory differ only in the pages
+  marked dirty since, plus the register file and I/O space - which aren't
+  tracked, since every engine writes them directly - so only those are
+  copied.  Restoring a snapshot with any other id copies everything.
+
+  A state file is laid out so that it can be used in place once mapped: a
+  header, followed by the execution state and each buffer, each starting on
+  a CPU_SNAPSHOT_FILE_ALIGN boundary.  The header and execution state have
+  fixed layouts of their own (CPU_SnapshotFile_t and CPU_SnapshotFileCore_t),
+  independent of the in-memory structures and the compiler's padding, and
+  the header records the format version, so that files written by an
+  incompatible build are rejected rather than misread.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "emu_config.h"
+
+#if FEATURE_USE_STATE_FILE
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#include "avr_cpu.h"
+#include "avr_io.h"
+#include "avr_hle.h"
+#include "avr_snapshot.h"
+
+//---------------------------------------------------------------------------
+// Size of a page bitmap large enough for either RAM or EEPROM
+#define SNAPSHOT_PAGE_WORDS     (CPU_DIRTY_WORDS(CONFIG_DATA_ADDRESS_BYTES))
+
+//---------------------------------------------------------------------------
+// Source of snapshot ids, shared by all CPU instances so that an id always
+// identifies a single set of snapshot contents.
+static uint64_t u64NextId = 0;
+
+#if FEATURE_USE_STATE_FILE
+//---------------------------------------------------------------------------
+#define CPU_SNAPSHOT_FILE_MAGIC     "FLAVRSTA"  //!< First 8 bytes of a state file
+#define CPU_SNAPSHOT_FILE_VERSION   (2)         //!< Bumped on any change to the layout
+#define CPU_SNAPSHOT_FILE_ALIGN     (64)        //!< Alignment of each section of the file
+
+//---------------------------------------------------------------------------
+/*!
+    Header at the start of a state file.  The offsets are from the start of
+    the file.  Every field is naturally aligned, with no padding, so the
+    layout is fixed by the order of the fields - any change to it needs a new
+    CPU_SNAPSHOT_FILE_VERSION.
+*/
+typedef struct
+{
+    char        acMagic[8];         //!< CPU_SNAPSHOT_FILE_MAGIC
+    uint32_t    u32Version;         //!< CPU_SNAPSHOT_FILE_VERSION
+
+    uint32_t    u32RAMSize;         //!< Sizes of each buffer
+    uint32_t    u32EEPROMSize;
+    uint32_t    u32PeriphSize;
+    uint32_t    u32HLESize;
+    uint32_t    u32Reserved;        //!< Zero
+
+    uint64_t    u64Key;             //!< Program and configuration saved with
+
+    uint64_t    u64CoreOffset;      //!< Offset of the execution state (CPU_SnapshotFileCore_t)
+    uint64_t    u64RAMOffset;       //!< Offsets of each buffer
+    uint64_t    u64EEPROMOffset;
+    uint64_t    u64PeriphOffset;
+    uint64_t    u64HLEOffset;
+    uint64_t    u64FileSize;        //!< Total size of the file
+} CPU_SnapshotFile_t;
+
+_Static_assert( sizeof(CPU_SnapshotFile_t) == 88, "State file header layout has changed" );
+
+//---------------------------------------------------------------------------
+/*!
+    Execution state, as laid out in a state file (see CPU_SnapshotCore_t).
+    Fixed in the same way as the header.
+*/
+typedef struct
+{
+    uint64_t    u64CycleCount;
+    uint64_t    u64InstructionCount;
+    uint64_t    u64IOTicks;
+    uint64_t    u64IntFlags;
+
+    uint32_t    u32PC;
+    uint32_t    u32WDTCount;
+
+    uint16_t    u16FlagsRd;
+    uint16_t    u16FlagsRr;
+    uint16_t    u16FlagsResult;
+    uint8_t     u8FlagsOp;
+    uint8_t     u8FlagsMask;
+
+    uint8_t     u8IntPriority;
+    uint8_t     u8Asleep;
+    uint8_t     au8Reserved[6];     //!< Zero
+} CPU_SnapshotFileCore_t;
+
+_Static_assert( sizeof(CPU_SnapshotFileCore_t) == 56, "State file execution state layout has changed" );
+#endif
+
+//---------------------------------------------------------------------------
+static uint32_t CPU_SnapshotPeriphSize( void )
+{
+    uint32_t u32Size = 0;
+    uint32_t i;
+
+    for (i = 0; i < stCPU.u32PeriphCount; i++)
+    {
+        if (stCPU.apstPeriphs[i]->pfSave)
+        {
+            u32Size += stCPU.apstPeriphs[i]->u32StateSize;
+        }
+    }
+    return u32Size;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotPages
+ *
+ * Build the set of pages that may differ between the calling thread's CPU
+ * and a snapshot.
+ *
+ * \param pau64Pages_ [out] Page bitmap
+ * \param pau64Dirty_ CPU's dirty-page bitmap for the memory
+ * \param u32Words_   Size of both bitmaps, in words
+ * \param bAll_       true to select every page, false for the dirty pages
+ * \param u32Always_  Number of bytes at the start of the memory that are
+ *                    selected regardless
+ */
+static void CPU_SnapshotPages( uint64_t *pau64Pages_, const uint64_t *pau64Dirty_,
+                               uint32_t u32Words_, bool bAll_, uint32_t u32Always_ )
+{
+    uint32_t u32Page;
+
+    if (bAll_)
+    {
+        memset( pau64Pages_, 0xFF, u32Words_ * sizeof(uint64_t) );
+        return;
+    }
+
+    memcpy( pau64Pages_, pau64Dirty_, u32Words_ * sizeof(uint64_t) );
+    for (u32Page = 0; u32Page < CPU_DIRTY_PAGES( u32Always_ ); u32Page++)
+    {
+        pau64Pages_[ u32Page / 64 ] |= (1ULL << (u32Page % 64));
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotCopyPages
+ *
+ * \param pu8Dst_     Memory to copy to
+ * \param pu8Src_     Memory to copy from
+ * \param u32Size_    Size of both, in bytes
+ * \param pau64Pages_ Bitmap of the pages to copy (see CPU_SnapshotPages())
+ */
+static void CPU_SnapshotCopyPages( uint8_t *pu8Dst_, const uint8_t *pu8Src_,
+                                   uint32_t u32Size_, const uint64_t *pau64Pages_ )
+{
+    uint32_t u32Word;
+
+    for (u32Word = 0; u32Word < CPU_DIRTY_WORDS( u32Size_ ); u32Word++)
+    {
+        uint64_t u64Bits = pau64Pages_[ u32Word ];
+        while (u64Bits)
+        {
+            uint32_t u32Offset = ((u32Word * 64) + __builtin_ctzll( u64Bits )) * CONFIG_DIRTY_PAGE_BYTES;
+            u64Bits &= (u64Bits - 1);
+
+            if (u32Offset >= u32Size_)
+            {
+                break;
+            }
+            if (u32Size_ - u32Offset < CONFIG_DIRTY_PAGE_BYTES)
+            {
+                memcpy( pu8Dst_ + u32Offset, pu8Src_ + u32Offset, u32Size_ - u32Offset );
+            }
+            else
+            {
+                memcpy( pu8Dst_ + u32Offset, pu8Src_ + u32Offset, CONFIG_DIRTY_PAGE_BYTES );
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotCompare
+ *
+ * \return true if two blocks of memory have the same contents
+ */
+static bool CPU_SnapshotCompare( const uint8_t *pu8A_, const uint8_t *pu8B_, uint32_t u32Len_ )
+{
+    uint32_t u32Offset = 0;
+
+#if defined(__SSE2__)
+    __m128i xmmDiff = _mm_setzero_si128();
+
+    // OR together the XOR of each 16-byte block, and test the result once
+    for (; (u32Offset + 16) <= u32Len_; u32Offset += 16)
+    {
+        __m128i xmmA = _mm_loadu_si128( (const __m128i*)(pu8A_ + u32Offset) );
+        __m128i xmmB = _mm_loadu_si128( (const __m128i*)(pu8B_ + u32Offset) );
+        xmmDiff = _mm_or_si128( xmmDiff, _mm_xor_si128( xmmA, xmmB ) );
+    }
+    if (_mm_movemask_epi8( _mm_cmpeq_epi8( xmmDiff, _mm_setzero_si128() ) ) != 0xFFFF)
+    {
+        return false;
+    }
+#endif
+    return !memcmp( pu8A_ + u32Offset, pu8B_ + u32Offset, u32Len_ - u32Offset );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotDiffPages
+ *
+ * \param pu8A_       Memory to compare
+ * \param pu8B_       Memory to compare against
+ * \param u32Size_    Size of both, in bytes
+ * \param pau64Pages_ Bitmap of the pages to compare (see CPU_SnapshotPages())
+ * \return Number of those pages whose contents differ
+ */
+static uint32_t CPU_SnapshotDiffPages( const uint8_t *pu8A_, const uint8_t *pu8B_,
+                                       uint32_t u32Size_, const uint64_t *pau64Pages_ )
+{
+    uint32_t u32Count = 0;
+    uint32_t u32Word;
+
+    for (u32Word = 0; u32Word < CPU_DIRTY_WORDS( u32Size_ ); u32Word++)
+    {
+        uint64_t u64Bits = pau64Pages_[ u32Word ];
+        while (u64Bits)
+        {
+            uint32_t u32Offset = ((u32Word * 64) + __builtin_ctzll( u64Bits )) * CONFIG_DIRTY_PAGE_BYTES;
+            uint32_t u32Len = CONFIG_DIRTY_PAGE_BYTES;
+            u64Bits &= (u64Bits - 1);
+
+            if (u32Offset >= u32Size_)
+            {
+                break;
+            }
+            if (u32Size_ - u32Offset < u32Len)
+            {
+                u32Len = u32Size_ - u32Offset;
+            }
+            if (!CPU_SnapshotCompare( pu8A_ + u32Offset, pu8B_ + u32Offset, u32Len ))
+            {
+                u32Count++;
+            }
+        }
+    }
+    return u32Count;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t CPU_SnapshotNewId( void )
+{
+    return __atomic_add_fetch( &u64NextId, 1, __ATOMIC_RELAXED );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotSetBase
+ *
+ * Record that the calling thread's CPU memory now matches a snapshot.
+ *
+ * \param u64Id_ Id of the snapshot
+ */
+static void CPU_SnapshotSetBase( uint64_t u64Id_ )
+{
+    stCPU.u64DirtyBase = u64Id_;
+    memset( stCPU.au64DirtyRAM, 0, sizeof(stCPU.au64DirtyRAM) );
+    memset( stCPU.au64DirtyEEPROM, 0, sizeof(stCPU.au64DirtyEEPROM) );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotIsBase
+ *
+ * \return true if the calling thread's CPU memory differs from a snapshot
+ *         only in the pages marked dirty (and the I/O space)
+ */
+static bool CPU_SnapshotIsBase( const CPU_Snapshot_t *pstSnapshot_ )
+{
+#if FEATURE_USE_DIRTY_PAGES
+    return (pstSnapshot_->u64Id != 0) && (pstSnapshot_->u64Id == stCPU.u64DirtyBase);
+#else
+    return false;
+#endif
+}
+
+//---------------------------------------------------------------------------
+CPU_Snapshot_t *CPU_SnapshotAlloc( void )
+{
+    CPU_Snapshot_t *pstSnapshot = (CPU_Snapshot_t*)calloc( 1, sizeof(CPU_Snapshot_t) );
+    if (!pstSnapshot)
+    {
+        return NULL;
+    }
+
+    pstSnapshot->u32RAMSize = stCPU.u32RAMSize;
+    pstSnapshot->u32EEPROMSize = stCPU.u32EEPROMSize;
+    pstSnapshot->u32PeriphSize = CPU_SnapshotPeriphSize();
+    pstSnapshot->u32HLESize = AVR_HLE_StateSize();
+
+    // Allocate at least a byte each, so that a NULL buffer always means failure
+    pstSnapshot->pu8RAM = (uint8_t*)malloc( pstSnapshot->u32RAMSize + 1 );
+    pstSnapshot->pu8EEPROM = (uint8_t*)malloc( pstSnapshot->u32EEPROMSize + 1 );
+    pstSnapshot->pu8Periph = (uint8_t*)malloc( pstSnapshot->u32PeriphSize + 1 );
+    pstSnapshot->pu8HLE = (uint8_t*)malloc( pstSnapshot->u32HLESize + 1 );
+
+    if (!pstSnapshot->pu8RAM || !pstSnapshot->pu8EEPROM ||
+        !pstSnapshot->pu8Periph || !pstSnapshot->pu8HLE)
+    {
+        CPU_SnapshotFree( pstSnapshot );
+        return NULL;
+    }
+    return pstSnapshot;
+}
+
+//---------------------------------------------------------------------------
+void CPU_SnapshotFree( CPU_Snapshot_t *pstSnapshot_ )
+{
+    if (!pstSnapshot_)
+    {
+        return;
+    }
+#if FEATURE_USE_STATE_FILE
+    if (pstSnapshot_->pvMap)
+    {
+        munmap( pstSnapshot_->pvMap, pstSnapshot_->szMap );
+        free( pstSnapshot_ );
+        return;
+    }
+#endif
+    free( pstSnapshot_->pu8RAM );
+    free( pstSnapshot_->pu8EEPROM );
+    free( pstSnapshot_->pu8Periph );
+    free( pstSnapshot_->pu8HLE );
+    free( pstSnapshot_ );
+}
+
+//---------------------------------------------------------------------------
+void CPU_SnapshotSave( CPU_Snapshot_t *pstSnapshot_ )
+{
+    CPU_SnapshotCore_t *pstCore = &pstSnapshot_->stCore;
+    uint8_t *pu8Periph = pstSnapshot_->pu8Periph;
+    uint32_t i;
+
+    // Bring any lazily-advanced peripheral state up to date, so that the
+    // state saved is complete as of the current tick.
+    IO_RescheduleAll();
+
+    pstCore->u64CycleCount = stCPU.u64CycleCount;
+    pstCore->u64InstructionCount = stCPU.u64InstructionCount;
+    pstCore->u64IOTicks = stCPU.u64IOTicks;
+    pstCore->u64IntFlags = stCPU.u64IntFlags;
+    pstCore->u32PC = stCPU.u32PC;
+    pstCore->u32WDTCount = stCPU.u32WDTCount;
+    pstCore->u16FlagsRd = stCPU.u16FlagsRd;
+    pstCore->u16FlagsRr = stCPU.u16FlagsRr;
+    pstCore->u16FlagsResult = stCPU.u16FlagsResult;
+    pstCore->u8FlagsOp = stCPU.u8FlagsOp;
+    pstCore->u8FlagsMask = stCPU.u8FlagsMask;
+    pstCore->u8IntPriority = stCPU.u8IntPriority;
+    pstCore->bAsleep = stCPU.bAsleep;
+
+    if (CPU_SnapshotIsBase( pstSnapshot_ ))
+    {
+        uint64_t au64Pages[ SNAPSHOT_PAGE_WORDS ];
+
+        CPU_SnapshotPages( au64Pages, stCPU.au64DirtyRAM, CPU_DIRTY_WORDS( stCPU.u32RAMSize ),
+                           false, CONFIG_IO_ADDRESS_BYTES );
+        CPU_SnapshotCopyPages( pstSnapshot_->pu8RAM, (const uint8_t*)stCPU.pstRAM,
+                               pstSnapshot_->u32RAMSize, au64Pages );
+        CPU_SnapshotPages( au64Pages, stCPU.au64DirtyEEPROM, CPU_DIRTY_WORDS( stCPU.u32EEPROMSize ),
+                           false, 0 );
+        CPU_SnapshotCopyPages( pstSnapshot_->pu8EEPROM, stCPU.pu8EEPROM,
+                               pstSnapshot_->u32EEPROMSize, au64Pages );
+    }
+    else
+    {
+        memcpy( pstSnapshot_->pu8RAM, stCPU.pstRAM, pstSnapshot_->u32RAMSize );
+        memcpy( pstSnapshot_->pu8EEPROM, stCPU.pu8EEPROM, pstSnapshot_->u32EEPROMSize );
+    }
+
+    // New contents, so a new id - any other CPU based on this snapshot's
+    // previous contents must now restore it in full.
+    pstSnapshot_->u64Id = CPU_SnapshotNewId();
+    CPU_SnapshotSetBase( pstSnapshot_->u64Id );
+
+    for (i = 0; i < stCPU.u32PeriphCount; i++)
+    {
+        AVRPeripheral *pstPeriph = stCPU.apstPeriphs[i];
+        if (pstPeriph->pfSave)
+        {
+            pstPeriph->pfSave( pstPeriph->pvContext, pu8Periph );
+            pu8Periph += pstPeriph->u32StateSize;
+        }
+    }
+
+    AVR_HLE_SaveState( pstSnapshot_->pu8HLE );
+}
+
+//---------------------------------------------------------------------------
+bool CPU_SnapshotRestore( const CPU_Snapshot_t *pstSnapshot_ )
+{
+    const CPU_SnapshotCore_t *pstCore = &pstSnapshot_->stCore;
+    const uint8_t *pu8Periph = pstSnapshot_->pu8Periph;
+    bool bIsBase = CPU_SnapshotIsBase( pstSnapshot_ );
+    uint32_t i;
+
+    if ((pstSnapshot_->u32RAMSize != stCPU.u32RAMSize) ||
+        (pstSnapshot_->u32EEPROMSize != stCPU.u32EEPROMSize) ||
+        (pstSnapshot_->u32PeriphSize != CPU_SnapshotPeriphSize()) ||
+        (pstSnapshot_->u32HLESize != AVR_HLE_StateSize()))
+    {
+        return false;
+    }
+
+    stCPU.u64CycleCount = pstCore->u64CycleCount;
+    stCPU.u64InstructionCount = pstCore->u64InstructionCount;
+    stCPU.u64IOTicks = pstCore->u64IOTicks;
+    stCPU.u64IntFlags = pstCore->u64IntFlags;
+    stCPU.u32PC = pstCore->u32PC;
+    stCPU.u32WDTCount = pstCore->u32WDTCount;
+    stCPU.u16FlagsRd = pstCore->u16FlagsRd;
+    stCPU.u16FlagsRr = pstCore->u16FlagsRr;
+    stCPU.u16FlagsResult = pstCore->u16FlagsResult;
+    stCPU.u8FlagsOp = pstCore->u8FlagsOp;
+    stCPU.u8FlagsMask = pstCore->u8FlagsMask;
+    stCPU.u8IntPriority = pstCore->u8IntPriority;
+    stCPU.bAsleep = pstCore->bAsleep;
+
+    if (bIsBase)
+    {
+        uint64_t au64Pages[ SNAPSHOT_PAGE_WORDS ];
+
+        CPU_SnapshotPages( au64Pages, stCPU.au64DirtyRAM, CPU_DIRTY_WORDS( stCPU.u32RAMSize ),
+                           false, CONFIG_IO_ADDRESS_BYTES );
+        CPU_SnapshotCopyPages( (uint8_t*)stCPU.pstRAM, pstSnapshot_->pu8RAM,
+                               pstSnapshot_->u32RAMSize, au64Pages );
+        CPU_SnapshotPages( au64Pages, stCPU.au64DirtyEEPROM, CPU_DIRTY_WORDS( stCPU.u32EEPROMSize ),
+                           false, 0 );
+        CPU_SnapshotCopyPages( stCPU.pu8EEPROM, pstSnapshot_->pu8EEPROM,
+                               pstSnapshot_->u32EEPROMSize, au64Pages );
+    }
+    else
+    {
+        memcpy( stCPU.pstRAM, pstSnapshot_->pu8RAM, pstSnapshot_->u32RAMSize );
+        memcpy( stCPU.pu8EEPROM, pstSnapshot_->pu8EEPROM, pstSnapshot_->u32EEPROMSize );
+    }
+    CPU_SnapshotSetBase( pstSnapshot_->u64Id );
+
+    for (i = 0; i < stCPU.u32PeriphCount; i++)
+    {
+        AVRPeripheral *pstPeriph = stCPU.apstPeriphs[i];
+        if (pstPeriph->pfRestore)
+        {
+            pstPeriph->pfRestore( pstPeriph->pvContext, pu8Periph );
+            pu8Periph += pstPeriph->u32StateSize;
+        }
+    }
+
+    AVR_HLE_RestoreState( pstSnapshot_->pu8HLE );
+
+    // Rebuild the peripheral schedule from the restored state
+    IO_RescheduleAll();
+    return true;
+}
+
+//---------------------------------------------------------------------------
+uint32_t CPU_SnapshotDiff( const CPU_Snapshot_t *pstSnapshot_ )
+{
+    uint64_t au64Pages[ SNAPSHOT_PAGE_WORDS ];
+    bool bAll = !CPU_SnapshotIsBase( pstSnapshot_ );
+    uint32_t u32Count;
+
+    CPU_SnapshotPages( au64Pages, stCPU.au64DirtyRAM, CPU_DIRTY_WORDS( stCPU.u32RAMSize ),
+                       bAll, CONFIG_IO_ADDRESS_BYTES );
+    u32Count = CPU_SnapshotDiffPages( (const uint8_t*)stCPU.pstRAM, pstSnapshot_->pu8RAM,
+                                      pstSnapshot_->u32RAMSize, au64Pages );
+    CPU_SnapshotPages( au64Pages, stCPU.au64DirtyEEPROM, CPU_DIRTY_WORDS( stCPU.u32EEPROMSize ),
+                       bAll, 0 );
+    u32Count += CPU_SnapshotDiffPages( stCPU.pu8EEPROM, pstSnapshot_->pu8EEPROM,
+                                       pstSnapshot_->u32EEPROMSize, au64Pages );
+    return u32Count;
+}
+
+#if FEATURE_USE_STATE_FILE
+//---------------------------------------------------------------------------
+static uint64_t CPU_SnapshotFileAlign( uint64_t u64Offset_ )
+{
+    return (u64Offset_ + CPU_SNAPSHOT_FILE_ALIGN - 1) & ~(uint64_t)(CPU_SNAPSHOT_FILE_ALIGN - 1);
+}
+
+//---------------------------------------------------------------------------
+static bool CPU_SnapshotFilePut( FILE *fp_, uint64_t u64Offset_, const void *pvData_, uint32_t u32Size_ )
+{
+    if (0 != fseek( fp_, (long)u64Offset_, SEEK_SET ))
+    {
+        return false;
+    }
+    return (u32Size_ == fwrite( pvData_, 1, u32Size_, fp_ ));
+}
+
+//---------------------------------------------------------------------------
+static void CPU_SnapshotFileCorePut( CPU_SnapshotFileCore_t *pstFile_, const CPU_SnapshotCore_t *pstCore_ )
+{
+    memset( pstFile_, 0, sizeof(*pstFile_) );
+    pstFile_->u64CycleCount = pstCore_->u64CycleCount;
+    pstFile_->u64InstructionCount = pstCore_->u64InstructionCount;
+    pstFile_->u64IOTicks = pstCore_->u64IOTicks;
+    pstFile_->u64IntFlags = pstCore_->u64IntFlags;
+    pstFile_->u32PC = pstCore_->u32PC;
+    pstFile_->u32WDTCount = pstCore_->u32WDTCount;
+    pstFile_->u16FlagsRd = pstCore_->u16FlagsRd;
+    pstFile_->u16FlagsRr = pstCore_->u16FlagsRr;
+    pstFile_->u16FlagsResult = pstCore_->u16FlagsResult;
+    pstFile_->u8FlagsOp = pstCore_->u8FlagsOp;
+    pstFile_->u8FlagsMask = pstCore_->u8FlagsMask;
+    pstFile_->u8IntPriority = pstCore_->u8IntPriority;
+    pstFile_->u8Asleep = pstCore_->bAsleep ? 1 : 0;
+}
+
+//---------------------------------------------------------------------------
+static void CPU_SnapshotFileCoreGet( CPU_SnapshotCore_t *pstCore_, const CPU_SnapshotFileCore_t *pstFile_ )
+{
+    pstCore_->u64CycleCount = pstFile_->u64CycleCount;
+    pstCore_->u64InstructionCount = pstFile_->u64InstructionCount;
+    pstCore_->u64IOTicks = pstFile_->u64IOTicks;
+    pstCore_->u64IntFlags = pstFile_->u64IntFlags;
+    pstCore_->u32PC = pstFile_->u32PC;
+    pstCore_->u32WDTCount = pstFile_->u32WDTCount;
+    pstCore_->u16FlagsRd = pstFile_->u16FlagsRd;
+    pstCore_->u16FlagsRr = pstFile_->u16FlagsRr;
+    pstCore_->u16FlagsResult = pstFile_->u16FlagsResult;
+    pstCore_->u8FlagsOp = pstFile_->u8FlagsOp;
+    pstCore_->u8FlagsMask = pstFile_->u8FlagsMask;
+    pstCore_->u8IntPriority = pstFile_->u8IntPriority;
+    pstCore_->bAsleep = (pstFile_->u8Asleep != 0);
+}
+
+//---------------------------------------------------------------------------
+bool CPU_SnapshotWrite( const CPU_Snapshot_t *pstSnapshot_, const char *szPath_, uint64_t u64Key_ )
+{
+    CPU_SnapshotFile_t stHeader;
+    CPU_SnapshotFileCore_t stCore;
+    uint8_t u8Pad = 0;
+    bool bOk;
+    FILE *fp;
+
+    memset( &stHeader, 0, sizeof(stHeader) );
+    memcpy( stHeader.acMagic, CPU_SNAPSHOT_FILE_MAGIC, sizeof(stHeader.acMagic) );
+    stHeader.u32Version = CPU_SNAPSHOT_FILE_VERSION;
+    stHeader.u64Key = u64Key_;
+
+    stHeader.u32RAMSize = pstSnapshot_->u32RAMSize;
+    stHeader.u32EEPROMSize = pstSnapshot_->u32EEPROMSize;
+    stHeader.u32PeriphSize = pstSnapshot_->u32PeriphSize;
+    stHeader.u32HLESize = pstSnapshot_->u32HLESize;
+
+    stHeader.u64CoreOffset = CPU_SnapshotFileAlign( sizeof(stHeader) );
+    stHeader.u64RAMOffset = CPU_SnapshotFileAlign( stHeader.u64CoreOffset + sizeof(stCore) );
+    stHeader.u64EEPROMOffset = CPU_SnapshotFileAlign( stHeader.u64RAMOffset + stHeader.u32RAMSize );
+    stHeader.u64PeriphOffset = CPU_SnapshotFileAlign( stHeader.u64EEPROMOffset + stHeader.u32EEPROMSize );
+    stHeader.u64HLEOffset = CPU_SnapshotFileAlign( stHeader.u64PeriphOffset + stHeader.u32PeriphSize );
+    stHeader.u64FileSize = CPU_SnapshotFileAlign( stHeader.u64HLEOffset + stHeader.u32HLESize );
+
+    CPU_SnapshotFileCorePut( &stCore, &pstSnapshot_->stCore );
+
+    fp = fopen( szPath_, "wb" );
+    if (!fp)
+    {
+        fprintf( stderr, "Unable to create machine state file %s\n", szPath_ );
+        return false;
+    }
+
+    bOk = CPU_SnapshotFilePut( fp, 0, &stHeader, sizeof(stHeader) ) &&
+          CPU_SnapshotFilePut( fp, stHeader.u64CoreOffset, &stCore, sizeof(stCore) ) &&
+          CPU_SnapshotFilePut( fp, stHeader.u64RAMOffset, pstSnapshot_->pu8RAM, stHeader.u32RAMSize ) &&
+          CPU_SnapshotFilePut( fp, stHeader.u64EEPROMOffset, pstSnapshot_->pu8EEPROM, stHeader.u32EEPROMSize ) &&
+          CPU_SnapshotFilePut( fp, stHeader.u64PeriphOffset, pstSnapshot_->pu8Periph, stHeader.u32PeriphSize ) &&
+          CPU_SnapshotFilePut( fp, stHeader.u64HLEOffset, pstSnapshot_->pu8HLE, stHeader.u32HLESize ) &&
+          // Pad out the last section, so the whole of the file can be mapped
+          CPU_SnapshotFilePut( fp, stHeader.u64FileSize - 1, &u8Pad, 1 );
+
+    if ((0 != fclose( fp )) || !bOk)
+    {
+        fprintf( stderr, "Unable to write machine state file %s\n", szPath_ );
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+CPU_Snapshot_t *CPU_SnapshotMap( const char *szPath_, uint64_t u64Key_ )
+{
+    const CPU_SnapshotFile_t *pstHeader;
+    CPU_Snapshot_t *pstSnapshot;
+    struct stat stStat;
+    uint8_t *pu8Map;
+    int iFd;
+
+    iFd = open( szPath_, O_RDONLY );
+    if (iFd < 0)
+    {
+        fprintf( stderr, "Unable to open machine state file %s\n", szPath_ );
+        return NULL;
+    }
+    if ((0 != fstat( iFd, &stStat )) || ((size_t)stStat.st_size < sizeof(CPU_SnapshotFile_t)))
+    {
+        fprintf( stderr, "%s is not a machine state file\n", szPath_ );
+        close( iFd );
+        return NULL;
+    }
+
+    // Private and writable, so that the buffers can be saved over in place
+    pu8Map = (uint8_t*)mmap( NULL, (size_t)stStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, iFd, 0 );
+    close( iFd );
+    if (pu8Map == (uint8_t*)MAP_FAILED)
+    {
+        fprintf( stderr, "Unable to map machine state file %s\n", szPath_ );
+        return NULL;
+    }
+
+    pstHeader = (const CPU_SnapshotFile_t*)pu8Map;
+    if (memcmp( pstHeader->acMagic, CPU_SNAPSHOT_FILE_MAGIC, sizeof(pstHeader->acMagic) ) ||
+        (pstHeader->u32Version != CPU_SNAPSHOT_FILE_VERSION) ||
+        (pstHeader->u64FileSize != (uint64_t)stStat.st_size) ||
+        (pstHeader->u64RAMOffset + pstHeader->u32RAMSize > pstHeader->u64FileSize) ||
+        (pstHeader->u64EEPROMOffset + pstHeader->u32EEPROMSize > pstHeader->u64FileSize) ||
+        (pstHeader->u64PeriphOffset + pstHeader->u32PeriphSize > pstHeader->u64FileSize) ||
+        (pstHeader->u64HLEOffset + pstHeader->u32HLESize > pstHeader->u64FileSize) ||
+        (pstHeader->u64CoreOffset + sizeof(CPU_SnapshotFileCore_t) > pstHeader->u64FileSize))
+    {
+        fprintf( stderr, "%s is not a compatible machine state file\n", szPath_ );
+        munmap( pu8Map, (size_t)stStat.st_size );
+        return NULL;
+    }
+    if (pstHeader->u64Key != u64Key_)
+    {
+        fprintf( stderr, "%s was saved from a different program or configuration\n", szPath_ );
+        munmap( pu8Map, (size_t)stStat.st_size );
+        return NULL;
+    }
+
+    pstSnapshot = (CPU_Snapshot_t*)calloc( 1, sizeof(CPU_Snapshot_t) );
+    if (!pstSnapshot)
+    {
+        munmap( pu8Map, (size_t)stStat.st_size );
+        return NULL;
+    }
+
+    // The execution state is held in the snapshot itself; the buffers are
+    // used straight out of the mapping.
+    CPU_SnapshotFileCoreGet( &pstSnapshot->stCore,
+                             (const CPU_SnapshotFileCore_t*)(pu8Map + pstHeader->u64CoreOffset) );
+
+    pstSnapshot->u32RAMSize = pstHeader->u32RAMSize;
+    pstSnapshot->u32EEPROMSize = pstHeader->u32EEPROMSize;
+    pstSnapshot->u32PeriphSize = pstHeader->u32PeriphSize;
+    pstSnapshot->u32HLESize = pstHeader->u32HLESize;
+
+    pstSnapshot->pu8RAM = pu8Map + pstHeader->u64RAMOffset;
+    pstSnapshot->pu8EEPROM = pu8Map + pstHeader->u64EEPROMOffset;
+    pstSnapshot->pu8Periph = pu8Map + pstHeader->u64PeriphOffset;
+    pstSnapshot->pu8HLE = pu8Map + pstHeader->u64HLEOffset;
+
+    pstSnapshot->pvMap = pu8Map;
+    pstSnapshot->szMap = (size_t)stStat.st_size;
+    pstSnapshot->u64Id = CPU_SnapshotNewId();
+    return pstSnapshot;
+}
+#endif
@@ -0,0 +1,203 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+  \file  avr_snapshot.h
+
+  \brief In-memory snapshots of the complete machine state, from which the
+         CPU can be resumed exactly.
+
+  A snapshot holds everything that determines how the program runs from the
+  point it was taken: the CPU's execution state (PC, cycle and instruction
+  counts, peripheral clock, sleep state, pending interrupts), the watchdog
+  count, RAM (including the register file and I/O space), EEPROM, each
+  peripheral's private state (see AVRPeripheral::pfSave), and the costs
+  measured for natively-run routines (see avr_hle.h).
+
+  ROM, the peripheral and callout tables, breakpoints and watchpoints, and
+  the CPU's configuration are not included - a snapshot can only be restored
+  onto a CPU running the same program, with the same variant and peripherals,
+  though not necessarily the same CPU instance.
+
+  With FEATURE_USE_DIRTY_PAGES, the CPU tracks which pages of SRAM and EEPROM
+  have been written since it was last saved to, or restored from, a
+  snapshot.  Saving to or restoring from that same snapshot again only
+  copies those pages, along with the register file and I/O space - so
+  repeatedly resetting to a post-boot snapshot, or checkpointing into the
+  same one, costs in proportion to the memory the program has touched.
+
+  With FEATURE_USE_STATE_FILE, a snapshot can also be written to a file, and
+  later mapped straight back into memory - by another process, so long as it
+  has loaded the same program.  Each file is tagged with a caller-supplied
+  key identifying the program and configuration it was saved from, and is
+  only mapped by callers presenting the same key.
+*/
+
+#ifndef __AVR_SNAPSHOT_H__
+#define __AVR_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "emu_config.h"
+#include "avr_cpu.h"
+
+//---------------------------------------------------------------------------
+/*!
+    CPU execution state kept in a snapshot - the architectural state that
+    isn't held in memory.  The rest of AVR_CPU either belongs to the CPU
+    instance (memory, tables and configuration), is decoded afresh by every
+    instruction, or is rebuilt on restore (the peripheral schedule).
+*/
+typedef struct
+{
+    uint64_t    u64CycleCount;      //!< AVR_CPU::u64CycleCount
+    uint64_t    u64InstructionCount;//!< AVR_CPU::u64InstructionCount
+    uint64_t    u64IOTicks;         //!< AVR_CPU::u64IOTicks
+    uint64_t    u64IntFlags;        //!< Pending interrupts
+
+    uint32_t    u32PC;              //!< AVR_CPU::u32PC
+    uint32_t    u32WDTCount;        //!< Watchdog timer count
+
+    uint16_t    u16FlagsRd;         //!< Outstanding SREG update (see AVR_Opcode_SyncFlags())
+    uint16_t    u16FlagsRr;
+    uint16_t    u16FlagsResult;
+    uint8_t     u8FlagsOp;
+    uint8_t     u8FlagsMask;
+
+    uint8_t     u8IntPriority;      //!< Priority of pending interrupts this cycle
+    bool        bAsleep;            //!< CPU is sleeping
+} CPU_SnapshotCore_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Saved machine state.  The buffers are allocated once, by
+    CPU_SnapshotAlloc(), so that saving and restoring only copy memory.
+*/
+typedef struct _CPU_Snapshot
+{
+    uint64_t    u64Id;              //!< Identifies the saved contents (see AVR_CPU::u64DirtyBase)
+
+    CPU_SnapshotCore_t stCore;      //!< Execution state
+
+    uint32_t    u32RAMSize;         //!< Size of pu8RAM (AVR_CPU::u32RAMSize)
+    uint32_t    u32EEPROMSize;      //!< Size of pu8EEPROM
+    uint32_t    u32PeriphSize;      //!< Size of pu8Periph
+    uint32_t    u32HLESize;         //!< Size of pu8HLE
+
+    uint8_t     *pu8RAM;            //!< Data space contents
+    uint8_t     *pu8EEPROM;         //!< EEPROM contents
+    uint8_t     *pu8Periph;         //!< Private state of each peripheral, in the order added
+    uint8_t     *pu8HLE;            //!< Native routine state (see AVR_HLE_SaveState())
+
+    void        *pvMap;             //!< File mapping holding the buffers, or NULL if allocated
+    size_t      szMap;              //!< Size of pvMap
+} CPU_Snapshot_t;
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotAlloc
+ *
+ * Allocate a snapshot sized for the calling thread's CPU, which must have
+ * been initialized, and had its peripherals added.
+ *
+ * \return Newly-allocated snapshot (with no state saved), or NULL if out of
+ *         memory
+ */
+CPU_Snapshot_t *CPU_SnapshotAlloc( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotFree
+ *
+ * \param pstSnapshot_ Snapshot allocated with CPU_SnapshotAlloc(), or mapped
+ *                     with CPU_SnapshotMap()
+ */
+void CPU_SnapshotFree( CPU_Snapshot_t *pstSnapshot_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotSave
+ *
+ * Save the state of the calling thread's CPU.  Must be called between calls
+ * to CPU_Run(), and not from within an instruction (i.e. a peripheral or
+ * callout handler).
+ *
+ * \param pstSnapshot_ Snapshot to overwrite
+ */
+void CPU_SnapshotSave( CPU_Snapshot_t *pstSnapshot_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotRestore
+ *
+ * Return the calling thread's CPU to the state saved in a snapshot.  Running
+ * the CPU from there gives the same results as running it on from the point
+ * the snapshot was taken.  The snapshot is left unchanged, so it can be
+ * restored any number of times.
+ *
+ * \param pstSnapshot_ Snapshot to restore
+ * \return true on success, false if the snapshot was taken from a CPU with
+ *         different memory sizes or peripherals
+ */
+bool CPU_SnapshotRestore( const CPU_Snapshot_t *pstSnapshot_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotDiff
+ *
+ * Count the pages of RAM and EEPROM (of CONFIG_DIRTY_PAGE_BYTES each) whose
+ * contents differ between the calling thread's CPU and a snapshot.  If the
+ * CPU was last saved to, or restored from, the snapshot, only the pages
+ * written since are compared.
+ *
+ * \param pstSnapshot_ Snapshot to compare against
+ * \return Number of pages that differ
+ */
+uint32_t CPU_SnapshotDiff( const CPU_Snapshot_t *pstSnapshot_ );
+
+#if FEATURE_USE_STATE_FILE
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotWrite
+ *
+ * Write a snapshot out to a file, in a form that CPU_SnapshotMap() can map
+ * directly into memory.
+ *
+ * \param pstSnapshot_ Snapshot to write
+ * \param szPath_      Path of the file to create
+ * \param u64Key_      Identifies the program and configuration the snapshot
+ *                     was taken with
+ * \return true on success, false if the file couldn't be written
+ */
+bool CPU_SnapshotWrite( const CPU_Snapshot_t *pstSnapshot_, const char *szPath_, uint64_t u64Key_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief CPU_SnapshotMap
+ *
+ * Map a snapshot written by CPU_SnapshotWrite() into memory.  The mapping is
+ * private, so the snapshot can be saved over without changing the file.
+ *
+ * \param szPath_ Path of the file
+ * \param u64Key_ Key the file must have been written with
+ * \return Snapshot, to be released with CPU_SnapshotFree(), or NULL if the
+ *         file couldn't be mapped, isn't a snapshot written by this build,
+ *         or was written with a different key
+ */
+CPU_Snapshot_t *CPU_SnapshotMap( const char *szPath_, uint64_t u64Key_ );
+#endif
+
+#endif
@@ -19,6 +19,7 @@
             be triggered on interrupts.
 */
 
+#include "emu_config.h"
 #include "interrupt_callout.h"
 
 #include <stdint.h>
@@ -33,7 +34,7 @@ typedef struct Interrupt_Callout_
 } Interrupt_Callout_t;
 
 //---------------------------------------------------------------------------
-static Interrupt_Callout_t *pstCallouts = 0;
+static EMU_INSTANCE Interrupt_Callout_t *pstCallouts = 0;
 
 //---------------------------------------------------------------------------
 void InterruptCallout_Add( InterruptCalloutFunc pfCallout_ )
@@ -46,6 +47,17 @@ void InterruptCallout_Add( InterruptCalloutFunc pfCallout_ )
     pstCallouts = pstNewCallout;
 }
 
+//---------------------------------------------------------------------------
+void InterruptCallout_Free( void )
+{
+    while (pstCallouts)
+    {
+        Interrupt_Callout_t *pstCallout = pstCallouts;
+        pstCallouts = pstCallout->pstNext;
+        free(pstCallout);
+    }
+}
+
 //---------------------------------------------------------------------------
 void InterruptCallout_Run( bool bEntry_, uint8_t u8Vector_ )
 {
@@ -51,6 +51,14 @@ void InterruptCallout_Add( InterruptCalloutFunc pfCallout_ );
  */
 void InterruptCallout_Run( bool bEntry_, uint8_t u8Vector_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief InterruptCallout_Free
+ *
+ * Remove all interrupt callouts currently installed.
+ */
+void InterruptCallout_Free( void );
+
 
 #endif
 
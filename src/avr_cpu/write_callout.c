@@ -20,6 +20,7 @@
 */
 
 #include "write_callout.h"
+#include "avr_cpu.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -36,12 +37,23 @@ typedef struct Write_Callout_
 } Write_Callout_t;
 
 //---------------------------------------------------------------------------
-static Write_Callout_t *pstCallouts = 0;
+static EMU_INSTANCE Write_Callout_t *pstCallouts = 0;
+static EMU_INSTANCE Write_Callout_t *pstWatchCallouts = 0;
 
 //---------------------------------------------------------------------------
-static bool WriteCallout_IsDuplicate( WriteCalloutFunc pfCallout_, uint16_t u16Addr_ )
+static void WriteCallout_FreeList( Write_Callout_t **ppstList_ )
+{
+    while (*ppstList_)
+    {
+        Write_Callout_t *pstCallout = *ppstList_;
+        *ppstList_ = pstCallout->pstNext;
+        free(pstCallout);
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool WriteCallout_IsDuplicate( Write_Callout_t *pstCallout, WriteCalloutFunc pfCallout_, uint16_t u16Addr_ )
 {
-    Write_Callout_t *pstCallout = pstCallouts;
 
     while (pstCallout)
     {
@@ -57,26 +69,20 @@ static bool WriteCallout_IsDuplicate( WriteCalloutFunc pfCallout_, uint16_t u16A
 }
 
 //---------------------------------------------------------------------------
-void WriteCallout_Add( WriteCalloutFunc pfCallout_, uint16_t u16Addr_ )
+static void WriteCallout_Prepend( Write_Callout_t **ppstList_, WriteCalloutFunc pfCallout_, uint16_t u16Addr_ )
 {
-    if (WriteCallout_IsDuplicate(pfCallout_, u16Addr_))
-    {
-        return;
-    }
-
     Write_Callout_t *pstNewCallout = (Write_Callout_t*)(malloc(sizeof(*pstNewCallout)));
 
-    pstNewCallout->pstNext = pstCallouts;
+    pstNewCallout->pstNext = *ppstList_;
     pstNewCallout->u16Addr = u16Addr_;
     pstNewCallout->pfCallout = pfCallout_;
 
-    pstCallouts = pstNewCallout;
+    *ppstList_ = pstNewCallout;
 }
 
 //---------------------------------------------------------------------------
-bool WriteCallout_Run( uint16_t u16Addr_, uint8_t u8Data_ )
+static bool WriteCallout_RunList( Write_Callout_t *pstCallout, uint16_t u16Addr_, uint8_t u8Data_ )
 {
-    Write_Callout_t *pstCallout = pstCallouts;
     bool bRet = true;
     while (pstCallout)
     {
@@ -92,3 +98,111 @@ bool WriteCallout_Run( uint16_t u16Addr_, uint8_t u8Data_ )
     }
     return bRet;
 }
+
+//---------------------------------------------------------------------------
+void WriteCallout_Add( WriteCalloutFunc pfCallout_, uint16_t u16Addr_ )
+{
+    if (WriteCallout_IsDuplicate(pstCallouts, pfCallout_, u16Addr_))
+    {
+        return;
+    }
+
+    WriteCallout_Prepend( &pstCallouts, pfCallout_, u16Addr_ );
+
+    // Flag the address in the data map, so that writes to it come here - a
+    // wildcard callout monitors the whole data space.
+    if (u16Addr_ == 0)
+    {
+        CPU_UpdateDataMap( 0, CONFIG_DATA_ADDRESS_BYTES, DATA_MAP_CALLOUT, 0 );
+    }
+    else
+    {
+        CPU_UpdateDataMap( u16Addr_, 1, DATA_MAP_CALLOUT, 0 );
+    }
+}
+
+//---------------------------------------------------------------------------
+void WriteCallout_AddWatch( WriteCalloutFunc pfCallout_ )
+{
+    if (WriteCallout_IsDuplicate(pstWatchCallouts, pfCallout_, 0))
+    {
+        return;
+    }
+
+    WriteCallout_Prepend( &pstWatchCallouts, pfCallout_, 0 );
+}
+
+//---------------------------------------------------------------------------
+void WriteCallout_Watch( uint16_t u16Addr_, bool bWatch_ )
+{
+    if (bWatch_)
+    {
+        CPU_UpdateDataMap( u16Addr_, 1, DATA_MAP_WATCH, 0 );
+    }
+    else
+    {
+        CPU_UpdateDataMap( u16Addr_, 1, 0, DATA_MAP_WATCH );
+    }
+}
+
+//---------------------------------------------------------------------------
+bool WriteCallout_Run( uint16_t u16Addr_, uint8_t u8Data_ )
+{
+    uint8_t u8Map = stCPU.au8DataMap[u16Addr_];
+    bool bRet = true;
+
+    // Only walk the lists for addresses that have been flagged as monitored
+    if ((u8Map & DATA_MAP_CALLOUT) &&
+        !WriteCallout_RunList( pstCallouts, u16Addr_, u8Data_ ))
+    {
+        bRet = false;
+    }
+    if ((u8Map & DATA_MAP_WATCH) &&
+        !WriteCallout_RunList( pstWatchCallouts, u16Addr_, u8Data_ ))
+    {
+        bRet = false;
+    }
+    return bRet;
+}
+
+//---------------------------------------------------------------------------
+uint32_t WriteCallout_NextAddress( uint16_t u16Addr_, uint32_t u32Limit_ )
+{
+    uint32_t u32Next = u16Addr_;
+    uint8_t u8Mask = 0;
+
+    // Addresses flagged with no callouts to run aren't monitored
+    if (pstCallouts)
+    {
+        u8Mask |= DATA_MAP_CALLOUT;
+    }
+    if (pstWatchCallouts)
+    {
+        u8Mask |= DATA_MAP_WATCH;
+    }
+    if (u32Limit_ > 0x10000)
+    {
+        u32Limit_ = 0x10000;
+    }
+    if (!u8Mask)
+    {
+        return u32Limit_;
+    }
+
+    while (u32Next < u32Limit_)
+    {
+        if (stCPU.au8DataMap[u32Next] & u8Mask)
+        {
+            return u32Next;
+        }
+        u32Next++;
+    }
+    return u32Limit_;
+}
+
+//---------------------------------------------------------------------------
+void WriteCallout_Free( void )
+{
+    WriteCallout_FreeList( &pstCallouts );
+    WriteCallout_FreeList( &pstWatchCallouts );
+}
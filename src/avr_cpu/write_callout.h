@@ -42,13 +42,37 @@ typedef bool (*WriteCalloutFunc)(uint16_t u16Addr_, uint8_t u8Data_);
  */
 void WriteCallout_Add( WriteCalloutFunc pfCallout_, uint16_t u16Addr_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief WriteCallout_AddWatch
+ *
+ * Registers a function to be called whenever an address with a data
+ * watchpoint set against it (see WriteCallout_Watch()) is modified.
+ *
+ * \param pfCallout_ - Pointer to the callout function
+ */
+void WriteCallout_AddWatch( WriteCalloutFunc pfCallout_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief WriteCallout_Watch
+ *
+ * Set or clear a data watchpoint at an address, which determines whether or
+ * not writes to it trigger the callouts registered with WriteCallout_AddWatch().
+ *
+ * \param u16Addr_   - Address in RAM being watched
+ * \param bWatch_    - true to set the watchpoint, false to clear it
+ */
+void WriteCallout_Watch( uint16_t u16Addr_, bool bWatch_ );
+
 //---------------------------------------------------------------------------
 /*!
  * \brief WriteCallout_Run
  *
- * Function called by the AVR CPU core whenever a word in memory is written.
- * This searches the list of write callouts and executes any callouts registered
- * at the specific address.
+ * Function called by the AVR CPU core whenever a monitored word in memory is
+ * written (i.e. one flagged with DATA_MAP_CALLOUT or DATA_MAP_WATCH in the
+ * CPU's data map).  This searches the list of write callouts and executes any
+ * callouts registered at the specific address.
  *
  * \param u16Addr_   - Address in RAM currently being modified
  * \param u8Data_    - Data that will be written to the address
@@ -57,6 +81,30 @@ void WriteCallout_Add( WriteCalloutFunc pfCallout_, uint16_t u16Addr_ );
  */
 bool WriteCallout_Run( uint16_t u16Addr_, uint8_t u8Data_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief WriteCallout_NextAddress
+ *
+ * Find the lowest address at or above a given address that has a callout or
+ * watchpoint registered against it.  Callouts registered against address 0
+ * are run on every write, and so monitor every address.
+ *
+ * \param u16Addr_   First address in RAM to check
+ * \param u32Limit_  Address past the last one to check (at most 0x10000)
+ *
+ * \return Lowest monitored address, or u32Limit_ if no address in the range
+ *          is monitored.
+ */
+uint32_t WriteCallout_NextAddress( uint16_t u16Addr_, uint32_t u32Limit_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief WriteCallout_Free
+ *
+ * Remove all write callouts and watch callouts currently installed.
+ */
+void WriteCallout_Free( void );
+
 
 #endif
 
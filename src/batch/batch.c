@@ -0,0 +1,721 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   batch.c
+
+    \brief  Batch runner - runs a manifest of programs on a pool of host
+            threads, each with its own emulator instance, and writes a
+            summary of each run to a results file.
+
+    Every worker thread owns a single emulator instance (see
+    FEATURE_USE_THREAD_INSTANCES), which is initialized and freed for each job
+    it picks up.  Jobs are claimed from a shared cursor, so a thread that
+    finishes a short job goes straight on to the next unclaimed one, and the
+    results don't depend on which thread ran which job.
+
+    Programs that exit the emulator (on reset, or on a bad memory access) do
+    so through CPU_Exit(), which unwinds back to the worker rather than ending
+    the process.
+
+    The first job to run a program on a given variant loads it from disk, and
+    keeps a copy of the resulting ROM, RAM, EEPROM and debug symbols.  Later
+    jobs start from that copy.  The decode tables are shared by all instances
+    already.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#if FEATURE_USE_BATCH
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avr_cpu.h"
+#include "avr_hle.h"
+#include "avr_loader.h"
+#include "variant.h"
+#include "debug_sym.h"
+#include "options.h"
+#include "mega_uart.h"
+#include "batch.h"
+
+//---------------------------------------------------------------------------
+/*!
+    A single job from the manifest, and its results.
+*/
+typedef struct
+{
+    char       *szProgram;          //!< Programming file
+    char       *szInput;            //!< File received by the UART, or NULL
+    const AVR_Variant_t *pstVariant;    //!< CPU variant
+    uint64_t    u64CycleLimit;      //!< Cycles to run for, or 0 for no limit
+
+    CPU_Engine_t eEngine;           //!< Execution engine
+    bool        bExitOnReset;       //!< --exitreset
+    bool        bIdleSkip;          //!< !--no-idle-skip
+    bool        bHLE;               //!< --hle
+    bool        bFastIO;            //!< --fast
+
+    Batch_Exit_t eExit;             //!< How the job ended
+    uint64_t    u64Cycles;          //!< CPU cycles run
+    uint64_t    u64Instructions;    //!< Instructions executed
+    uint64_t    u64UARTBytes;       //!< Bytes transmitted by the UART
+    uint64_t    u64UARTHash;        //!< FNV-1a hash of the bytes transmitted
+    uint64_t    u64WallTime;        //!< Host time taken, in microseconds
+} Batch_Job_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Program image, as it was left by the loader.
+*/
+typedef struct _Batch_Image
+{
+    struct _Batch_Image *pstNext;
+
+    const char *szProgram;          //!< Programming file the image was loaded from
+    const AVR_Variant_t *pstVariant;    //!< Variant the image was loaded for
+
+    uint8_t    *pu8ROM;             //!< ROM contents (variant's ROM size)
+    uint8_t    *pu8RAM;             //!< Data space contents (CPU's RAM size)
+    uint8_t    *pu8EEPROM;          //!< EEPROM contents (variant's EEPROM size)
+    uint32_t    u32RAMSize;
+
+    Debug_Symbol_t *pstFuncs;       //!< Function symbols
+    uint32_t    u32FuncCount;
+    Debug_Symbol_t *pstObjs;        //!< Object symbols
+    uint32_t    u32ObjCount;
+} Batch_Image_t;
+
+//---------------------------------------------------------------------------
+static const char *aszExitNames[ BATCH_EXIT_COUNT ] =
+{
+    "limit",
+    "reset",
+    "abort",
+    "error"
+};
+
+//---------------------------------------------------------------------------
+#define BATCH_MAX_LINE          (4096)          //!< Longest manifest line accepted
+#define BATCH_FNV_OFFSET        (0xCBF29CE484222325ULL)
+#define BATCH_FNV_PRIME         (0x00000100000001B3ULL)
+
+#define BATCH_STEP_CYCLES_MAX   (16)            //!< Most cycles a single step of CPU_Run() can take (longest instruction, interrupt entry and EEPROM stall)
+
+//---------------------------------------------------------------------------
+static Batch_Job_t *pstJobs = NULL;             //!< Jobs parsed from the manifest
+static uint32_t u32JobCount = 0;
+static uint32_t u32NextJob = 0;                 //!< Index of the next job to be claimed
+
+static Batch_AddPlugins pfAddPlugins;
+
+static Batch_Image_t *pstImages = NULL;         //!< Images loaded so far
+static pthread_mutex_t stImageLock = PTHREAD_MUTEX_INITIALIZER;
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE sigjmp_buf stExitJump;      //!< Where CPU_Exit() returns to
+static EMU_INSTANCE Batch_Job_t *pstCurrent;    //!< Job running on this thread
+
+//---------------------------------------------------------------------------
+static void Batch_Exit( CPU_Exit_t eReason_ )
+{
+    siglongjmp( stExitJump, (eReason_ == CPU_EXIT_RESET) ? BATCH_EXIT_RESET : BATCH_EXIT_ABORT );
+}
+
+//---------------------------------------------------------------------------
+static void Batch_UARTTx( uint8_t u8Byte_ )
+{
+    pstCurrent->u64UARTHash = (pstCurrent->u64UARTHash ^ u8Byte_) * BATCH_FNV_PRIME;
+    pstCurrent->u64UARTBytes++;
+}
+
+//---------------------------------------------------------------------------
+static bool Batch_ReadFile( const char *szPath_, uint8_t **ppu8Data_, uint32_t *pu32Size_ )
+{
+    FILE *fp = fopen( szPath_, "rb" );
+    long lSize;
+
+    if (!fp)
+    {
+        fprintf( stderr, "[Batch] Unable to open %s\n", szPath_ );
+        return false;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    lSize = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    *ppu8Data_ = (uint8_t*)malloc( lSize + 1 );
+    *pu32Size_ = (uint32_t)fread( *ppu8Data_, 1, lSize, fp );
+    fclose( fp );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool Batch_IsELF( const char *szPath_ )
+{
+    FILE *fp = fopen( szPath_, "rb" );
+    char acMagic[4] = { 0 };
+
+    if (!fp)
+    {
+        return false;
+    }
+    fread( acMagic, 1, sizeof(acMagic), fp );
+    fclose( fp );
+
+    return (0 == memcmp( acMagic, "\177ELF", sizeof(acMagic) ));
+}
+
+//---------------------------------------------------------------------------
+static Debug_Symbol_t *Batch_CopySymbols( uint32_t u32Count_, Debug_Symbol_t *(*pfAtIndex_)( uint32_t ) )
+{
+    Debug_Symbol_t *pstCopy = (Debug_Symbol_t*)malloc( (u32Count_ + 1) * sizeof(Debug_Symbol_t) );
+    uint32_t i;
+
+    for (i = 0; i < u32Count_; i++)
+    {
+        pstCopy[i] = *pfAtIndex_( i );
+        pstCopy[i].szName = strdup( pstCopy[i].szName );
+    }
+    return pstCopy;
+}
+
+//---------------------------------------------------------------------------
+static Batch_Image_t *Batch_FindImage( const Batch_Job_t *pstJob_ )
+{
+    Batch_Image_t *pstImage = pstImages;
+    while (pstImage)
+    {
+        if ((pstImage->pstVariant == pstJob_->pstVariant) &&
+            (0 == strcmp( pstImage->szProgram, pstJob_->szProgram )))
+        {
+            return pstImage;
+        }
+        pstImage = pstImage->pstNext;
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+static Batch_Image_t *Batch_CaptureImage( const Batch_Job_t *pstJob_ )
+{
+    Batch_Image_t *pstImage = (Batch_Image_t*)calloc( 1, sizeof(Batch_Image_t) );
+
+    pstImage->szProgram = pstJob_->szProgram;
+    pstImage->pstVariant = pstJob_->pstVariant;
+    pstImage->u32RAMSize = stCPU.u32RAMSize;
+
+    pstImage->pu8ROM = (uint8_t*)malloc( stCPU.u32ROMSize );
+    memcpy( pstImage->pu8ROM, stCPU.pu16ROM, stCPU.u32ROMSize );
+    pstImage->pu8RAM = (uint8_t*)malloc( stCPU.u32RAMSize );
+    memcpy( pstImage->pu8RAM, stCPU.pstRAM->au8RAM, stCPU.u32RAMSize );
+    pstImage->pu8EEPROM = (uint8_t*)malloc( stCPU.u32EEPROMSize + 1 );
+    memcpy( pstImage->pu8EEPROM, stCPU.pu8EEPROM, stCPU.u32EEPROMSize );
+
+    pstImage->u32FuncCount = Symbol_Get_Func_Count();
+    pstImage->pstFuncs = Batch_CopySymbols( pstImage->u32FuncCount, Symbol_Func_At_Index );
+    pstImage->u32ObjCount = Symbol_Get_Obj_Count();
+    pstImage->pstObjs = Batch_CopySymbols( pstImage->u32ObjCount, Symbol_Obj_At_Index );
+
+    return pstImage;
+}
+
+//---------------------------------------------------------------------------
+static void Batch_FreeImage( Batch_Image_t *pstImage_ )
+{
+    uint32_t i;
+
+    for (i = 0; i < pstImage_->u32FuncCount; i++)
+    {
+        free( (void*)pstImage_->pstFuncs[i].szName );
+    }
+    for (i = 0; i < pstImage_->u32ObjCount; i++)
+    {
+        free( (void*)pstImage_->pstObjs[i].szName );
+    }
+    free( pstImage_->pstFuncs );
+    free( pstImage_->pstObjs );
+    free( pstImage_->pu8ROM );
+    free( pstImage_->pu8RAM );
+    free( pstImage_->pu8EEPROM );
+    free( pstImage_ );
+}
+
+//---------------------------------------------------------------------------
+static void Batch_RestoreImage( const Batch_Image_t *pstImage_ )
+{
+    const Debug_Symbol_t *pstSymbol;
+    uint32_t i;
+
+    memcpy( stCPU.pu16ROM, pstImage_->pu8ROM, stCPU.u32ROMSize );
+    memcpy( stCPU.pstRAM->au8RAM, pstImage_->pu8RAM, pstImage_->u32RAMSize );
+    memcpy( stCPU.pu8EEPROM, pstImage_->pu8EEPROM, stCPU.u32EEPROMSize );
+    CPU_InvalidateROM( 0, stCPU.u32ROMSize / sizeof(uint16_t) );
+
+    for (i = 0; i < pstImage_->u32FuncCount; i++)
+    {
+        pstSymbol = &pstImage_->pstFuncs[i];
+        Symbol_Add_Func( pstSymbol->szName, pstSymbol->u32StartAddr,
+                         pstSymbol->u32EndAddr - pstSymbol->u32StartAddr + 1 );
+    }
+    for (i = 0; i < pstImage_->u32ObjCount; i++)
+    {
+        pstSymbol = &pstImage_->pstObjs[i];
+        Symbol_Add_Obj( pstSymbol->szName, pstSymbol->u32StartAddr,
+                        pstSymbol->u32EndAddr - pstSymbol->u32StartAddr + 1 );
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_LoadImage
+ *
+ * Load a job's program into the CPU - from a previously-loaded image if
+ * there is one, otherwise from disk, keeping a copy of the result for later
+ * jobs.  If two threads load the same program at once, the first copy to be
+ * kept wins.
+ *
+ * \param pstJob_ Job to load the program for
+ * \return true on success, false if the program couldn't be loaded
+ */
+static bool Batch_LoadImage( const Batch_Job_t *pstJob_ )
+{
+    Batch_Image_t *pstImage;
+    bool bLoaded;
+
+    pthread_mutex_lock( &stImageLock );
+    pstImage = Batch_FindImage( pstJob_ );
+    pthread_mutex_unlock( &stImageLock );
+
+    if (pstImage)
+    {
+        Batch_RestoreImage( pstImage );
+        return true;
+    }
+
+    if (Batch_IsELF( pstJob_->szProgram ))
+    {
+        bLoaded = AVR_Load_ELF( pstJob_->szProgram );
+    }
+    else
+    {
+        bLoaded = AVR_Load_HEX( pstJob_->szProgram );
+    }
+    if (!bLoaded)
+    {
+        return false;
+    }
+
+    pstImage = Batch_CaptureImage( pstJob_ );
+
+    pthread_mutex_lock( &stImageLock );
+    if (Batch_FindImage( pstJob_ ))
+    {
+        Batch_FreeImage( pstImage );
+    }
+    else
+    {
+        pstImage->pstNext = pstImages;
+        pstImages = pstImage;
+    }
+    pthread_mutex_unlock( &stImageLock );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+Batch_Exit_t Batch_Execute( uint64_t u64CycleLimit_ )
+{
+    uint64_t u64Left;
+    int iExit;
+
+    iExit = sigsetjmp( stExitJump, 1 );
+    if (iExit)
+    {
+        CPU_SetExitHandler( NULL );
+        return (Batch_Exit_t)iExit;
+    }
+    CPU_SetExitHandler( Batch_Exit );
+
+    // CPU_Run() counts steps (instructions, or cycles of sleep and skipped
+    // loops) rather than cycles, so only ask for as many steps as are sure
+    // to fit in the cycles remaining, and finish one step at a time.  The run
+    // then stops at the first step boundary at or after the limit, however
+    // it was split up - so a resumed run stops in exactly the same place as
+    // one run straight from reset.
+    while (!u64CycleLimit_ || (stCPU.u64CycleCount < u64CycleLimit_))
+    {
+        u64Left = CONFIG_EXECUTION_BATCH_SIZE;
+        if (u64CycleLimit_)
+        {
+            u64Left = (u64CycleLimit_ - stCPU.u64CycleCount) / BATCH_STEP_CYCLES_MAX;
+            if (u64Left > CONFIG_EXECUTION_BATCH_SIZE)
+            {
+                u64Left = CONFIG_EXECUTION_BATCH_SIZE;
+            }
+            else if (!u64Left)
+            {
+                u64Left = 1;
+            }
+        }
+        CPU_Run( (uint32_t)u64Left );
+    }
+
+    CPU_SetExitHandler( NULL );
+    return BATCH_EXIT_LIMIT;
+}
+
+//---------------------------------------------------------------------------
+Batch_Exit_t Batch_RunTo( const char *szPoint_ )
+{
+    Debug_Symbol_t *pstSymbol;
+    uint64_t u64Cycles;
+    char *szEnd;
+    int iExit;
+
+    u64Cycles = strtoull( szPoint_, &szEnd, 10 );
+    if (!*szEnd)
+    {
+        // A limit of 0 would run forever - cycle 0 is where we are already
+        return u64Cycles ? Batch_Execute( u64Cycles ) : BATCH_EXIT_LIMIT;
+    }
+
+    pstSymbol = Symbol_Find_Func_By_Name( szPoint_ );
+    if (!pstSymbol)
+    {
+        fprintf( stderr, "No function named %s\n", szPoint_ );
+        return BATCH_EXIT_ERROR;
+    }
+
+    iExit = sigsetjmp( stExitJump, 1 );
+    if (iExit)
+    {
+        CPU_SetExitHandler( NULL );
+        return (Batch_Exit_t)iExit;
+    }
+    CPU_SetExitHandler( Batch_Exit );
+
+    u64Cycles = stCPU.u64CycleCount + BATCH_RUN_TO_CYCLES;
+    while (stCPU.u32PC != pstSymbol->u32StartAddr)
+    {
+        if (stCPU.u64CycleCount >= u64Cycles)
+        {
+            CPU_SetExitHandler( NULL );
+            fprintf( stderr, "%s not reached within %llu cycles\n", szPoint_,
+                     (unsigned long long)BATCH_RUN_TO_CYCLES );
+            return BATCH_EXIT_ERROR;
+        }
+        CPU_Run( 1 );
+    }
+
+    CPU_SetExitHandler( NULL );
+    return BATCH_EXIT_LIMIT;
+}
+
+//---------------------------------------------------------------------------
+const char *Batch_ExitName( Batch_Exit_t eExit_ )
+{
+    return aszExitNames[ eExit_ ];
+}
+
+//---------------------------------------------------------------------------
+static void Batch_RunJob( Batch_Job_t *pstJob_ )
+{
+    AVR_CPU_Config_t stConfig;
+    struct timespec stStart;
+    struct timespec stEnd;
+    uint8_t *pu8Input = NULL;
+    uint32_t u32InputSize = 0;
+
+    clock_gettime( CLOCK_MONOTONIC, &stStart );
+
+    pstJob_->eExit = BATCH_EXIT_ERROR;
+    pstJob_->u64UARTHash = BATCH_FNV_OFFSET;
+    pstCurrent = pstJob_;
+
+    memset( &stConfig, 0, sizeof(stConfig) );
+    stConfig.u32ROMSize = pstJob_->pstVariant->u32ROMSize;
+    stConfig.u32RAMSize = pstJob_->pstVariant->u32RAMSize;
+    stConfig.u32EESize = pstJob_->pstVariant->u32EESize;
+    stConfig.pstFeatureMap = pstJob_->pstVariant->pstFeatures;
+    stConfig.pstVectorMap = pstJob_->pstVariant->pstVectors;
+    stConfig.bExitOnReset = pstJob_->bExitOnReset;
+    stConfig.bIdleSkip = pstJob_->bIdleSkip;
+    stConfig.bHLE = pstJob_->bHLE;
+    stConfig.bFastIO = pstJob_->bFastIO;
+    stConfig.eEngine = pstJob_->eEngine;
+
+    CPU_Init( &stConfig );
+
+    if ((!pstJob_->szInput || Batch_ReadFile( pstJob_->szInput, &pu8Input, &u32InputSize )) &&
+        Batch_LoadImage( pstJob_ ))
+    {
+#if FEATURE_USE_HLE
+        if (pstJob_->bHLE)
+        {
+            AVR_HLE_Bind();
+        }
+#endif
+        pfAddPlugins();
+        UART_SetTxCallout( Batch_UARTTx );
+        UART_SetInput( pu8Input, u32InputSize );
+
+        pstJob_->eExit = Batch_Execute( pstJob_->u64CycleLimit );
+    }
+
+    pstJob_->u64Cycles = stCPU.u64CycleCount;
+    pstJob_->u64Instructions = stCPU.u64InstructionCount;
+
+    CPU_Free();
+    Symbol_Free();
+    free( pu8Input );
+
+    clock_gettime( CLOCK_MONOTONIC, &stEnd );
+    pstJob_->u64WallTime = ((uint64_t)(stEnd.tv_sec - stStart.tv_sec) * 1000000ULL) +
+                           (stEnd.tv_nsec / 1000) - (stStart.tv_nsec / 1000);
+}
+
+//---------------------------------------------------------------------------
+static void *Batch_Worker( void *pvArg_ )
+{
+    uint32_t u32Job;
+
+    (void)pvArg_;
+
+    while ((u32Job = __atomic_fetch_add( &u32NextJob, 1, __ATOMIC_RELAXED )) < u32JobCount)
+    {
+        Batch_RunJob( &pstJobs[u32Job] );
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_ParseJob
+ *
+ * Parse a single line of the manifest into a new job.
+ *
+ * \param szLine_         Manifest line (modified in place)
+ * \param u32Line_        Line number, for error reporting
+ * \param pfEngineByName_ Resolves --engine names
+ * \return true if the line was a valid job (or empty), false on error
+ */
+static bool Batch_ParseJob( char *szLine_, uint32_t u32Line_, Batch_EngineByName pfEngineByName_ )
+{
+    const char *szDelim = " \t\r\n";
+    char *szSave = NULL;
+    char *aszFields[4];
+    char *szToken;
+    char *szEnd;
+    Batch_Job_t stJob;
+    int i;
+
+    szToken = strtok_r( szLine_, szDelim, &szSave );
+    if (!szToken || (*szToken == '#'))
+    {
+        return true;
+    }
+
+    aszFields[0] = szToken;
+    for (i = 1; i < 4; i++)
+    {
+        aszFields[i] = strtok_r( NULL, szDelim, &szSave );
+        if (!aszFields[i])
+        {
+            fprintf( stderr, "[Batch] Line %u: expected <program> <variant> <cycle limit> <UART input>\n", u32Line_ );
+            return false;
+        }
+    }
+
+    memset( &stJob, 0, sizeof(stJob) );
+
+    stJob.pstVariant = Variant_GetByName( aszFields[1] );
+    if (!stJob.pstVariant)
+    {
+        fprintf( stderr, "[Batch] Line %u: unknown variant %s\n", u32Line_, aszFields[1] );
+        return false;
+    }
+
+    stJob.u64CycleLimit = strtoull( aszFields[2], &szEnd, 10 );
+    if (*szEnd)
+    {
+        fprintf( stderr, "[Batch] Line %u: invalid cycle limit %s\n", u32Line_, aszFields[2] );
+        return false;
+    }
+
+    stJob.szProgram = strdup( aszFields[0] );
+    stJob.szInput = (0 == strcmp( aszFields[3], "-" )) ? NULL : strdup( aszFields[3] );
+
+    // Commandline options are the defaults for every job
+    stJob.bExitOnReset = (Options_GetByName("--exitreset") != NULL);
+    stJob.bIdleSkip = !Options_GetByName("--no-idle-skip");
+    stJob.bHLE = (Options_GetByName("--hle") != NULL);
+    stJob.bFastIO = (Options_GetByName("--fast") != NULL);
+    pfEngineByName_( Options_GetByName("--engine"), &stJob.eEngine );
+
+    while ((szToken = strtok_r( NULL, szDelim, &szSave )))
+    {
+        if (0 == strcmp( szToken, "--exitreset" ))
+        {
+            stJob.bExitOnReset = true;
+        }
+        else if (0 == strcmp( szToken, "--no-idle-skip" ))
+        {
+            stJob.bIdleSkip = false;
+        }
+        else if (0 == strcmp( szToken, "--hle" ))
+        {
+            stJob.bHLE = true;
+        }
+        else if (0 == strcmp( szToken, "--fast" ))
+        {
+            stJob.bFastIO = true;
+        }
+        else if (0 == strcmp( szToken, "--engine" ))
+        {
+            szToken = strtok_r( NULL, szDelim, &szSave );
+            if (!szToken || !pfEngineByName_( szToken, &stJob.eEngine ))
+            {
+                fprintf( stderr, "[Batch] Line %u: invalid engine\n", u32Line_ );
+                return false;
+            }
+        }
+        else
+        {
+            fprintf( stderr, "[Batch] Line %u: unsupported option %s\n", u32Line_, szToken );
+            return false;
+        }
+    }
+
+    pstJobs = (Batch_Job_t*)realloc( pstJobs, (u32JobCount + 1) * sizeof(Batch_Job_t) );
+    pstJobs[u32JobCount++] = stJob;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool Batch_ParseManifest( const char *szManifest_, Batch_EngineByName pfEngineByName_ )
+{
+    FILE *fp = fopen( szManifest_, "r" );
+    char szLine[BATCH_MAX_LINE];
+    uint32_t u32Line = 0;
+    bool bOk = true;
+
+    if (!fp)
+    {
+        fprintf( stderr, "[Batch] Unable to open manifest %s\n", szManifest_ );
+        return false;
+    }
+
+    while (bOk && fgets( szLine, sizeof(szLine), fp ))
+    {
+        bOk = Batch_ParseJob( szLine, ++u32Line, pfEngineByName_ );
+    }
+    fclose( fp );
+    return bOk;
+}
+
+//---------------------------------------------------------------------------
+static bool Batch_WriteResults( const char *szResults_ )
+{
+    FILE *fp = fopen( szResults_, "w" );
+    Batch_Job_t *pstJob;
+    uint32_t i;
+
+    if (!fp)
+    {
+        fprintf( stderr, "[Batch] Unable to open results file %s\n", szResults_ );
+        return false;
+    }
+
+    fprintf( fp, "# job\tprogram\tvariant\texit\tcycles\tinstructions\tuart_bytes\tuart_hash\twall_us\n" );
+    for (i = 0; i < u32JobCount; i++)
+    {
+        pstJob = &pstJobs[i];
+        fprintf( fp, "%u\t%s\t%s\t%s\t%llu\t%llu\t%llu\t%016llx\t%llu\n",
+                 i,
+                 pstJob->szProgram,
+                 pstJob->pstVariant->szName,
+                 Batch_ExitName( pstJob->eExit ),
+                 (unsigned long long)pstJob->u64Cycles,
+                 (unsigned long long)pstJob->u64Instructions,
+                 (unsigned long long)pstJob->u64UARTBytes,
+                 (unsigned long long)pstJob->u64UARTHash,
+                 (unsigned long long)pstJob->u64WallTime );
+    }
+    fclose( fp );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+int Batch_Run( const Batch_Config_t *pstConfig_ )
+{
+    pthread_t *pstThreads;
+    uint32_t u32Threads = pstConfig_->u32Threads;
+    uint32_t u32Errors = 0;
+    uint32_t i;
+
+    if (!Batch_ParseManifest( pstConfig_->szManifest, pstConfig_->pfEngineByName ))
+    {
+        return -1;
+    }
+
+    if (!u32Threads)
+    {
+        long lCPUs = sysconf( _SC_NPROCESSORS_ONLN );
+        u32Threads = (lCPUs > 0) ? (uint32_t)lCPUs : 1;
+    }
+    if (u32Threads > u32JobCount)
+    {
+        u32Threads = u32JobCount;
+    }
+
+    pfAddPlugins = pstConfig_->pfAddPlugins;
+    u32NextJob = 0;
+
+    pstThreads = (pthread_t*)malloc( (u32Threads + 1) * sizeof(pthread_t) );
+    for (i = 0; i < u32Threads; i++)
+    {
+        pthread_create( &pstThreads[i], NULL, Batch_Worker, NULL );
+    }
+    for (i = 0; i < u32Threads; i++)
+    {
+        pthread_join( pstThreads[i], NULL );
+    }
+    free( pstThreads );
+
+    for (i = 0; i < u32JobCount; i++)
+    {
+        if (pstJobs[i].eExit == BATCH_EXIT_ERROR)
+        {
+            u32Errors++;
+        }
+    }
+
+    if (!Batch_WriteResults( pstConfig_->szResults ))
+    {
+        return -1;
+    }
+    return (int)u32Errors;
+}
+
+#endif
@@ -0,0 +1,155 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   batch.h
+
+    \brief  Batch runner - runs a manifest of programs on a pool of host
+            threads, each with its own emulator instance, and writes a
+            summary of each run to a results file.
+
+    Each line of the manifest describes one job, as whitespace-separated
+    fields:
+
+        <program> <variant> <cycle limit> <UART input> [options...]
+
+    - program     - Intel HEX or ELF file to run (detected from its contents)
+    - variant     - CPU variant, by model name (as with --variant)
+    - cycle limit - CPU cycles to run for, or 0 to run until the program exits
+    - UART input  - File whose contents are received by the UART, or "-"
+    - options     - Any of --engine <name>, --fast, --no-idle-skip,
+                    --exitreset and --hle, which apply to this job only
+
+    Blank lines, and lines starting with '#', are ignored.  Options given on
+    the flavr commandline are the defaults for every job.
+
+    The results file has one line per job, in manifest order, holding
+    tab-separated fields:
+
+        <job> <program> <variant> <exit> <cycles> <instructions>
+        <UART bytes> <UART hash> <wall time>
+
+    - exit        - "limit" if the cycle limit was reached, "reset" on a jump
+                    to 0 with --exitreset, "abort" on an out-of-range memory
+                    access, or "error" if the job couldn't be run at all
+    - UART hash   - 64-bit FNV-1a hash of every byte the UART transmitted
+    - wall time   - Host time taken by the job, in microseconds
+*/
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "avr_cpu.h"
+
+//---------------------------------------------------------------------------
+#define BATCH_RUN_TO_CYCLES     (1000000000ULL) //!< Cycles Batch_RunTo() runs looking for a function entry before giving up
+
+//---------------------------------------------------------------------------
+/*!
+    How a run came to an end.
+*/
+typedef enum
+{
+    BATCH_EXIT_LIMIT,       //!< Ran up to the cycle limit
+    BATCH_EXIT_RESET,       //!< Jumped to the reset vector, with --exitreset
+    BATCH_EXIT_ABORT,       //!< Accessed memory outside of the part's memories
+    BATCH_EXIT_ERROR,       //!< Couldn't be run (i.e. bad programming file)
+//---
+    BATCH_EXIT_COUNT
+} Batch_Exit_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Function adding the emulator's peripherals to a freshly-initialized CPU.
+*/
+typedef void (*Batch_AddPlugins)( void );
+
+//---------------------------------------------------------------------------
+/*!
+    Function looking up an execution engine by its commandline name.
+*/
+typedef bool (*Batch_EngineByName)( const char *szName_, CPU_Engine_t *peEngine_ );
+
+//---------------------------------------------------------------------------
+/*!
+    Parameters of a batch run.
+*/
+typedef struct
+{
+    const char *szManifest;             //!< Path of the job manifest
+    const char *szResults;              //!< Path of the results file to write
+    uint32_t    u32Threads;             //!< Worker threads to run, or 0 for one per host CPU
+    Batch_AddPlugins   pfAddPlugins;    //!< Adds peripherals to each job's CPU
+    Batch_EngineByName pfEngineByName;  //!< Resolves --engine names
+} Batch_Config_t;
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_Run
+ *
+ * Run every job in a manifest, and write out the results.  Jobs are handed to
+ * the worker threads one at a time as each thread becomes free.  Programs are
+ * only loaded from disk once per variant - later jobs on the same program
+ * start from a copy of the loaded image.
+ *
+ * \param pstConfig_ Parameters of the batch run
+ * \return Number of jobs that couldn't be run, or -1 if the manifest or the
+ *         results file couldn't be processed
+ */
+int Batch_Run( const Batch_Config_t *pstConfig_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_Execute
+ *
+ * Run the calling thread's CPU until it reaches a cycle limit, or the program
+ * exits.  Program exits (see CPU_Exit()) return from here, rather than ending
+ * the process.  The run stops at the first instruction boundary at or after
+ * the limit, wherever the CPU was started or resumed from.
+ *
+ * \param u64CycleLimit_ Total CPU cycle count to stop at, or 0 for no limit
+ * \return How the run ended - BATCH_EXIT_LIMIT, _RESET or _ABORT
+ */
+Batch_Exit_t Batch_Execute( uint64_t u64CycleLimit_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_RunTo
+ *
+ * Run the calling thread's CPU up to a point in the program - a total CPU
+ * cycle count, or the entry of a named function (which is single-stepped up
+ * to, so that execution stops exactly on its first instruction).  Program
+ * exits return from here, as with Batch_Execute().
+ *
+ * \param szPoint_ Cycle count, or function name from the loaded ELF symbols
+ * \return BATCH_EXIT_LIMIT if the point was reached, BATCH_EXIT_ERROR if
+ *         there's no function by that name or it isn't reached within
+ *         BATCH_RUN_TO_CYCLES (both reported on stderr), or how the program
+ *         exited first
+ */
+Batch_Exit_t Batch_RunTo( const char *szPoint_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Batch_ExitName
+ *
+ * \param eExit_ Exit reason
+ * \return Name of the exit reason, as written to the results file
+ */
+const char *Batch_ExitName( Batch_Exit_t eExit_ );
+
+#endif
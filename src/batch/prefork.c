@@ -0,0 +1,304 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   prefork.c
+
+    \brief  Prefork server - boots a program once, then serves each job
+            request on a UNIX socket from a forked copy of the booted
+            emulator.
+
+    Loading the program, building the decode tables, running the firmware's
+    startup code and warming up the instruction cache and JIT all happen once,
+    in the server process.  Each accepted connection is handed to a child
+    process, which inherits all of that state through copy-on-write pages, and
+    only pays for the memory its own run modifies.  The server never runs the
+    CPU past the ready point, so every child starts from the same state.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#if FEATURE_USE_PREFORK
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "avr_cpu.h"
+#include "mega_uart.h"
+#include "batch.h"
+#include "prefork.h"
+
+//---------------------------------------------------------------------------
+#define PREFORK_MAX_REQUEST     (64)    //!< Longest request line accepted
+#define PREFORK_BACKLOG         (64)    //!< Connections queued while forking
+
+//---------------------------------------------------------------------------
+// UART output collected by a child process
+static uint8_t *pu8Output = NULL;
+static uint32_t u32OutputSize = 0;
+static uint32_t u32OutputAlloc = 0;
+
+//---------------------------------------------------------------------------
+static void Prefork_UARTTx( uint8_t u8Byte_ )
+{
+    if (u32OutputSize == u32OutputAlloc)
+    {
+        u32OutputAlloc = u32OutputAlloc ? (u32OutputAlloc * 2) : 4096;
+        pu8Output = (uint8_t*)realloc( pu8Output, u32OutputAlloc );
+    }
+    pu8Output[ u32OutputSize++ ] = u8Byte_;
+}
+
+//---------------------------------------------------------------------------
+static bool Prefork_Write( int iFd_, const void *pvData_, size_t szLen_ )
+{
+    const uint8_t *pu8Data = (const uint8_t*)pvData_;
+    while (szLen_)
+    {
+        // Don't take SIGPIPE if the client has gone away
+        ssize_t iWritten = send( iFd_, pu8Data, szLen_, MSG_NOSIGNAL );
+        if (iWritten <= 0)
+        {
+            return false;
+        }
+        pu8Data += iWritten;
+        szLen_ -= (size_t)iWritten;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool Prefork_Read( int iFd_, void *pvData_, size_t szLen_ )
+{
+    uint8_t *pu8Data = (uint8_t*)pvData_;
+    while (szLen_)
+    {
+        ssize_t iRead = read( iFd_, pu8Data, szLen_ );
+        if (iRead <= 0)
+        {
+            return false;
+        }
+        pu8Data += iRead;
+        szLen_ -= (size_t)iRead;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Prefork_ReadRequest
+ *
+ * Read a job request from a client connection.
+ *
+ * \param iFd_        Client connection
+ * \param pu64Limit_  [out] Cycle limit requested
+ * \param ppu8Input_  [out] Newly-allocated buffer holding the UART input
+ * \param pu32Size_   [out] Size of the UART input
+ * \return true on success, false if the request was malformed or too large
+ */
+static bool Prefork_ReadRequest( int iFd_, uint64_t *pu64Limit_, uint8_t **ppu8Input_, uint32_t *pu32Size_ )
+{
+    char szLine[PREFORK_MAX_REQUEST];
+    uint32_t i = 0;
+
+    // Read the request line a byte at a time, leaving the UART input unread
+    while (true)
+    {
+        if ((i == (sizeof(szLine) - 1)) || !Prefork_Read( iFd_, &szLine[i], 1 ))
+        {
+            return false;
+        }
+        if (szLine[i] == '\n')
+        {
+            break;
+        }
+        i++;
+    }
+    szLine[i] = '\0';
+
+    if (2 != sscanf( szLine, "%" SCNu64 " %" SCNu32, pu64Limit_, pu32Size_ ))
+    {
+        return false;
+    }
+
+    if (*pu32Size_ > PREFORK_MAX_INPUT)
+    {
+        return false;
+    }
+
+    *ppu8Input_ = (uint8_t*)malloc( *pu32Size_ + 1 );
+    if (!*ppu8Input_)
+    {
+        return false;
+    }
+    return Prefork_Read( iFd_, *ppu8Input_, *pu32Size_ );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Prefork_Serve
+ *
+ * Run a single job request, and send back the results.  Called in the child
+ * process forked for the connection.
+ *
+ * \param iFd_ Client connection
+ */
+static void Prefork_Serve( int iFd_ )
+{
+    Batch_Exit_t eExit = BATCH_EXIT_ERROR;
+    uint64_t u64Limit = 0;
+    uint8_t *pu8Input = NULL;
+    uint32_t u32InputSize = 0;
+    char szHeader[PREFORK_MAX_REQUEST];
+    int iLen;
+
+    if (Prefork_ReadRequest( iFd_, &u64Limit, &pu8Input, &u32InputSize ))
+    {
+        UART_SetTxCallout( Prefork_UARTTx );
+        UART_SetInput( pu8Input, u32InputSize );
+        eExit = Batch_Execute( u64Limit );
+    }
+
+    iLen = snprintf( szHeader, sizeof(szHeader), "%s %" PRIu64 " %" PRIu64 " %" PRIu32 "\n",
+                     Batch_ExitName( eExit ),
+                     stCPU.u64CycleCount,
+                     stCPU.u64InstructionCount,
+                     u32OutputSize );
+
+    if (Prefork_Write( iFd_, szHeader, (size_t)iLen ))
+    {
+        Prefork_Write( iFd_, pu8Output, u32OutputSize );
+    }
+    free( pu8Input );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Prefork_Boot
+ *
+ * Run the program from reset up to its ready point.
+ *
+ * \param szReady_ Function name, cycle count, or NULL (see Prefork_Run())
+ * \return true on success, false if the ready point couldn't be reached
+ */
+static bool Prefork_Boot( const char *szReady_ )
+{
+    Batch_Exit_t eExit;
+
+    if (!szReady_)
+    {
+        return true;
+    }
+
+    eExit = Batch_RunTo( szReady_ );
+    if (eExit == BATCH_EXIT_ERROR)
+    {
+        fprintf( stderr, "[Prefork] Ready point %s not reached\n", szReady_ );
+        return false;
+    }
+    if (eExit != BATCH_EXIT_LIMIT)
+    {
+        fprintf( stderr, "[Prefork] Program exited before its ready point\n" );
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+int Prefork_Run( const char *szSocket_, const char *szReady_ )
+{
+    struct sockaddr_un stAddr;
+    int iListener;
+    int iConn;
+    pid_t pid;
+
+    if (!Prefork_Boot( szReady_ ))
+    {
+        return -1;
+    }
+
+    memset( &stAddr, 0, sizeof(stAddr) );
+    stAddr.sun_family = AF_UNIX;
+    if (strlen( szSocket_ ) >= sizeof(stAddr.sun_path))
+    {
+        fprintf( stderr, "[Prefork] Socket path %s is too long\n", szSocket_ );
+        return -1;
+    }
+    strcpy( stAddr.sun_path, szSocket_ );
+
+    iListener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    unlink( szSocket_ );
+    if ((iListener < 0) ||
+        (0 != bind( iListener, (struct sockaddr*)&stAddr, sizeof(stAddr) )) ||
+        (0 != listen( iListener, PREFORK_BACKLOG )))
+    {
+        fprintf( stderr, "[Prefork] Unable to listen on %s\n", szSocket_ );
+        return -1;
+    }
+
+    // Children are never waited on - let the kernel reap them
+    signal( SIGCHLD, SIG_IGN );
+
+    fprintf( stderr, "[Prefork] Ready at cycle %" PRIu64 ", serving on %s\n",
+             stCPU.u64CycleCount, szSocket_ );
+
+    while (1)
+    {
+        iConn = accept( iListener, NULL, NULL );
+        if (iConn < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf( stderr, "[Prefork] Unable to accept connections on %s\n", szSocket_ );
+            return -1;
+        }
+
+        // Don't let the child repeat anything still buffered in the server
+        fflush( stdout );
+        fflush( stderr );
+
+        pid = fork();
+        if (pid == 0)
+        {
+            close( iListener );
+            Prefork_Serve( iConn );
+            close( iConn );
+
+            // Skip the server's exit handlers (reports, etc.)
+            fflush( stdout );
+            _exit( 0 );
+        }
+        if (pid < 0)
+        {
+            fprintf( stderr, "[Prefork] Unable to fork\n" );
+        }
+        close( iConn );
+    }
+    return -1;
+}
+
+#endif
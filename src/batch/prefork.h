@@ -0,0 +1,66 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   prefork.h
+
+    \brief  Prefork server - boots a program once, then serves each job
+            request on a UNIX socket from a forked copy of the booted
+            emulator.
+
+    A client connects to the socket, and sends a request consisting of a
+    single text line, followed by the bytes to be received by the UART:
+
+        <cycle limit> <UART input size>\n
+        <UART input>
+
+    The cycle limit counts from the start of the program (not from the ready
+    point), and 0 runs until the program exits.  The server responds with a
+    single text line, followed by every byte the UART transmitted, then closes
+    the connection:
+
+        <exit> <cycles> <instructions> <UART output size>\n
+        <UART output>
+
+    The exit reasons are as described in batch.h.  A malformed request, or
+    one with more than PREFORK_MAX_INPUT bytes of UART input, gets an "error"
+    response without running the program.
+*/
+
+#ifndef __PREFORK_H__
+#define __PREFORK_H__
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+#define PREFORK_MAX_INPUT       (16 * 1024 * 1024)  //!< Most UART input bytes accepted in a request
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Prefork_Run
+ *
+ * Run the loaded program up to its ready point, then serve job requests
+ * until the process is killed.  Every request is run in a child process
+ * forked from the booted emulator, so each one starts with the same CPU,
+ * peripheral and translated-code state, with memory shared copy-on-write.
+ * The CPU must have been initialized, and the program loaded, beforehand.
+ *
+ * \param szSocket_ Path of the UNIX socket to listen on
+ * \param szReady_  Name of the function whose entry marks the ready point,
+ *                  or a CPU cycle count, or NULL to serve from reset
+ * \return -1 on error - doesn't return otherwise
+ */
+int Prefork_Run( const char *szSocket_, const char *szReady_ );
+
+#endif
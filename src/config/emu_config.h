@@ -26,6 +26,10 @@
 #include <stdbool.h>
 
 #define CONFIG_IO_ADDRESS_BYTES        (256)                       // First bytes of address space are I/O range
+#define CONFIG_HOST_CACHE_LINE_BYTES   (64)                        // Alignment used for hot emulator state
+#define CONFIG_DATA_ADDRESS_BYTES      (0x10000 + 64)              // Data space, plus the reach of LDD/STD displacements past its end
+#define CONFIG_EEPROM_ADDRESS_BYTES    (0x10000)                   // EEPROM space addressable through EEAR
+#define CONFIG_DIRTY_PAGE_BYTES        (64)                        // Granularity of RAM/EEPROM write tracking (see FEATURE_USE_DIRTY_PAGES)
 
 /*!
     Jump-tables can be used to optimize the execution of opcodes by building
@@ -43,6 +47,212 @@
 */
 #define FEATURE_USE_JUMPTABLES          (1)
 
+/*!
+    Evaluate SREG flags lazily.  ALU instructions record their operands and
+    result rather than computing each flag, and SREG is only brought up to date
+    when it is read (branches, IN/LD from SREG, interrupts, debugger, etc.).
+*/
+#define FEATURE_USE_LAZY_SREG           (1)
+
+/*!
+    Clock event-driven peripherals (those providing pfNextEvent) only on the
+    ticks where they have work to do, instead of on every CPU cycle.
+*/
+#define FEATURE_USE_EVENT_SCHEDULER     (1)
+
+/*!
+    While the CPU is asleep, skip directly over the cycles in which no
+    peripheral is due to run, rather than stepping through them one at a time.
+    Requires FEATURE_USE_EVENT_SCHEDULER to be of any use.
+*/
+#define FEATURE_USE_SLEEP_SKIP          (FEATURE_USE_EVENT_SCHEDULER)
+
+/*!
+    Recognize small delay, polling and block memory loops at their backward
+    branch, and skip over iterations whose outcome is already known - delay
+    loops by counting them down in closed form, polling loops up to the next
+    peripheral event that could change the value polled, and memory copy,
+    fill and scan loops over plain SRAM as a single host memmove(), memset()
+    or memchr().  Can be disabled at runtime with "--no-idle-skip".  Requires
+    FEATURE_USE_EVENT_SCHEDULER.
+*/
+#define FEATURE_USE_IDLE_LOOPS          (FEATURE_USE_EVENT_SCHEDULER)
+
+/*!
+    Support running calls to common libgcc/avr-libc routines (multiplication,
+    division, soft-float, memcpy(), vfprintf(), etc.) natively, bound by name
+    from the ELF symbol table, and charged the cycles the AVR code would have
+    taken.  Enabled at runtime with "--hle".
+*/
+#define FEATURE_USE_HLE                 (1)
+
+/*!
+    Maintain a cache of predecoded instructions, indexed by ROM address.  Each
+    entry holds the opcode handler, decoded operands, size and cycle count of
+    the instruction at that address, built the first time the instruction is
+    executed.  This avoids re-running the size/cycle/decode/opcode lookups
+    on every instruction, at the cost of one cache entry per word of ROM.
+*/
+#define FEATURE_USE_DECODE_CACHE        (1)
+
+/*!
+    Build the threaded-code execution engine (selected at runtime using
+    "--engine threaded").  This engine dispatches instructions out of the
+    predecoded instruction cache using computed-goto, and thus requires
+    FEATURE_USE_DECODE_CACHE, as well as a GCC-compatible compiler.
+*/
+#define FEATURE_USE_THREADED_ENGINE     (FEATURE_USE_DECODE_CACHE)
+
+/*!
+    Recognize common instruction sequences (LDI/LDI, CP/CPC/BRNE, MOVW/ADIW,
+    PUSH and POP runs) when predecoding, and run them through fused handlers
+    in the threaded-code engine.
+*/
+#define FEATURE_USE_FUSION              (FEATURE_USE_THREADED_ENGINE)
+
+/*!
+    When predecoding IN, OUT, SBI, CBI, SBIS and SBIC, bind those whose I/O
+    register is plain RAM (no peripheral, callout or watchpoint attached) to
+    handlers in the threaded-code engine that access the RAM byte directly.
+    Bindings are re-evaluated whenever the data space map changes.
+*/
+#define FEATURE_USE_IO_BINDING          (FEATURE_USE_THREADED_ENGINE)
+
+/*!
+    Build the x86-64 basic-block translator (selected at runtime using
+    "--engine jit").  Frequently-executed runs of predecoded instructions are
+    translated into native code; requires FEATURE_USE_DECODE_CACHE, as well as
+    an x86-64 host that allows executable memory to be mapped.
+*/
+#if defined(__x86_64__) && !defined(_WIN32)
+# define FEATURE_USE_JIT                (FEATURE_USE_DECODE_CACHE)
+#else
+# define FEATURE_USE_JIT                (0)
+#endif
+
+/*!
+    Support ahead-of-time translation of programs into C ("--aot-emit"), and
+    running the resulting shared objects ("--aot-load").  Requires dlopen().
+*/
+#if !defined(_WIN32)
+# define FEATURE_USE_AOT                (1)
+#else
+# define FEATURE_USE_AOT                (0)
+#endif
+
+/*!
+    Support checking one execution engine against another ("--lockstep"), and
+    randomized single-instruction engine tests ("--fuzz").  Each comparison is
+    made between forked copies of the emulator, and thus requires fork().
+*/
+#if !defined(_WIN32)
+# define FEATURE_USE_LOCKSTEP           (1)
+#else
+# define FEATURE_USE_LOCKSTEP           (0)
+#endif
+
+/*!
+    Back the AVR data space with a 64KB+ host mapping, in which everything past
+    the end of the part's RAM is left inaccessible.  Out-of-range loads and
+    stores are caught by a SIGSEGV handler, rather than being range-checked on
+    every access.  Requires mmap() and POSIX signals.
+*/
+#if !defined(_WIN32)
+# define FEATURE_USE_GUARD_PAGES        (1)
+#else
+# define FEATURE_USE_GUARD_PAGES        (0)
+#endif
+
+/*!
+    Give each host thread its own emulator instance - the CPU, its peripherals,
+    callouts, profiling and kernel-aware state are all thread-local, so several
+    independent instances can be run side-by-side in a single process.  The
+    read-only decode tables are shared between all instances.
+*/
+#define FEATURE_USE_THREAD_INSTANCES    (1)
+
+//---------------------------------------------------------------------------
+/*!
+    Storage class for per-instance state, used in place of plain "static" (or
+    external linkage) for every variable that belongs to an emulator instance.
+*/
+#if FEATURE_USE_THREAD_INSTANCES
+# define EMU_INSTANCE                   __thread
+#else
+# define EMU_INSTANCE
+#endif
+
+/*!
+    Support running a manifest of programs on a pool of host threads
+    ("--batch"), one emulator instance per thread.  Requires thread instances,
+    as well as POSIX threads and sigsetjmp().
+*/
+#if !defined(_WIN32) && FEATURE_USE_THREAD_INSTANCES
+# define FEATURE_USE_BATCH              (1)
+#else
+# define FEATURE_USE_BATCH              (0)
+#endif
+
+/*!
+    Support serving job requests on a UNIX socket from forked copies of a
+    booted emulator ("--prefork").  Requires --batch support, and fork().
+*/
+#if !defined(_WIN32) && FEATURE_USE_BATCH
+# define FEATURE_USE_PREFORK            (1)
+#else
+# define FEATURE_USE_PREFORK            (0)
+#endif
+
+/*!
+    Support saving the machine state at a point in the program to a file, and
+    starting later runs from it ("--save-state", "--load-state").  Requires
+    --batch support (to run up to the save point), and mmap().
+*/
+#if !defined(_WIN32) && FEATURE_USE_BATCH
+# define FEATURE_USE_STATE_FILE         (1)
+#else
+# define FEATURE_USE_STATE_FILE         (0)
+#endif
+
+/*!
+    Support recording every input the program receives from the host to a
+    log, and replaying runs from it without the host ("--record",
+    "--replay" - see replay.h).
+*/
+#define FEATURE_USE_REPLAY              (1)
+
+/*!
+    Track which pages of RAM and EEPROM have been written since the CPU was
+    last snapshotted or restored, so that saving to, or restoring from, that
+    same snapshot only copies the pages written since.  Costs a bit-set on
+    every store to SRAM.
+*/
+#define FEATURE_USE_DIRTY_PAGES         (1)
+
+/*!
+    Number of times an address must be executed by the interpreter before the
+    JIT translates a block of code starting at that address.
+*/
+#define CONFIG_JIT_HOT_THRESHOLD        (64)
+
+/*!
+    Maximum number of AVR instructions translated into a single JIT block.
+*/
+#define CONFIG_JIT_MAX_BLOCK_LENGTH     (64)
+
+/*!
+    Size of the executable buffer holding JIT-translated code.  When the buffer
+    fills, all translated code is discarded and retranslated as needed.
+*/
+#define CONFIG_JIT_CODE_BUFFER_SIZE     (16 * 1024 * 1024)
+
+/*!
+    Number of instruction cycles run back-to-back by the emulator loop when
+    there is nothing (debugger, tracebuffer, profiler) that needs to observe
+    the CPU state between each instruction.
+*/
+#define CONFIG_EXECUTION_BATCH_SIZE     (10000)
+
 /*!
     Sets the "execution history" buffer to a set number of instructions.  The
     larger the number, the further back in time you can look.  Note that for
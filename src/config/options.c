@@ -56,6 +56,30 @@ typedef enum
     OPTION_EXITRESET,
     OPTION_PROFILE,
     OPTION_UART,
+    OPTION_ENGINE,
+    OPTION_AOT_EMIT,
+    OPTION_AOT_LOAD,
+    OPTION_FUSION_REPORT,
+    OPTION_SLEEP_REPORT,
+    OPTION_NO_IDLE_SKIP,
+    OPTION_IDLE_REPORT,
+    OPTION_HLE,
+    OPTION_HLE_REPORT,
+    OPTION_LOCKSTEP,
+    OPTION_LOCKSTEP_INTERVAL,
+    OPTION_FUZZ,
+    OPTION_FUZZ_SEED,
+    OPTION_FAST,
+    OPTION_BATCH,
+    OPTION_BATCH_OUT,
+    OPTION_THREADS,
+    OPTION_PREFORK,
+    OPTION_PREFORK_READY,
+    OPTION_SAVE_STATE,
+    OPTION_AT,
+    OPTION_LOAD_STATE,
+    OPTION_RECORD,
+    OPTION_REPLAY,
 //-- New options go here ^^^
     OPTION_NUM      //!< Total count of command-line options supported
 } OptionIndex_t;
@@ -80,6 +104,30 @@ static Option_t astAttributes[OPTION_NUM] =
     {"--exitreset", "Exit simulator if a jump-to-zero operation is encountered", NULL, true },
     {"--profile",   "Run with code profile and code coverage enabled", NULL, true },
     {"--uart",      "Run UART over the specified TCP port", NULL, false },
+    {"--engine",    "CPU execution engine - interpreter (default), threaded, or jit", NULL, false },
+    {"--aot-emit",  "Translate the programming file into C source at the specified path, then exit", NULL, false },
+    {"--aot-load",  "Run using code translated by --aot-emit, from the specified shared object", NULL, false },
+    {"--fusion-report", "Print the number of fused instruction sequences executed on exit", NULL, true },
+    {"--sleep-report", "Print the number of CPU cycles spent asleep, and skipped over, on exit", NULL, true },
+    {"--no-idle-skip", "Run delay and polling loops one instruction at a time, rather than skipping over them", NULL, true },
+    {"--idle-report", "Print the number of delay/polling loop instructions skipped over on exit", NULL, true },
+    {"--hle",       "Run calls to common C runtime routines natively, bound by name from --elffile symbols", NULL, true },
+    {"--hle-report", "Print the number of calls run natively by --hle on exit", NULL, true },
+    {"--lockstep",  "Check --engine against the specified reference engine as the program runs, stopping where they diverge.  Mutually exclusive with --uart and --mark3", NULL, false },
+    {"--lockstep-interval", "Number of instruction cycles run between --lockstep comparisons (default - 10000)", NULL, false },
+    {"--fuzz",      "Run the specified number of random single-instruction tests on --engine and the --lockstep engine, then exit", NULL, false },
+    {"--fuzz-seed", "Random seed used to generate --fuzz tests (default - 1)", NULL, false },
+    {"--fast",      "Service peripherals once per instruction instead of once per CPU cycle - faster, but events within an instruction are no longer cycle-ordered", NULL, true },
+    {"--batch",     "Run each job listed in the specified manifest file on a pool of threads, then exit (see batch.h)", NULL, false },
+    {"--batch-out", "File the results of --batch are written to (default - flavr_batch.txt)", NULL, false },
+    {"--threads",   "Number of threads used to run --batch jobs (default - one per host CPU)", NULL, false },
+    {"--prefork",   "Boot the program, then run each job request on the specified UNIX socket in a forked copy (see prefork.h)", NULL, false },
+    {"--prefork-ready", "Function name or CPU cycle count at which --prefork stops booting and starts serving (default - reset)", NULL, false },
+    {"--save-state", "Run the program up to --at, save the machine state to the specified file, then exit", NULL, false },
+    {"--at",        "Function name or CPU cycle count at which --save-state saves the machine state (default - reset)", NULL, false },
+    {"--load-state", "Start running from the machine state saved by --save-state in the specified file", NULL, false },
+    {"--record",    "Record every input received from the host (UART, GDB breaks, kernel-aware files and joystick) to the specified log", NULL, false },
+    {"--replay",    "Replay the inputs recorded by --record in the specified log, instead of reading them from the host", NULL, false },
 };
 
 //---------------------------------------------------------------------------
@@ -94,6 +142,11 @@ static void Options_SetDefaults( void )
 {
     astAttributes[ OPTION_VARIANT ].szParameter  = strdup( "atmega328p" );
     astAttributes[ OPTION_FREQ ].szParameter     = strdup( "16000000" );
+    astAttributes[ OPTION_ENGINE ].szParameter   = strdup( "interpreter" );
+    astAttributes[ OPTION_LOCKSTEP_INTERVAL ].szParameter = strdup( "10000" );
+    astAttributes[ OPTION_FUZZ_SEED ].szParameter = strdup( "1" );
+    astAttributes[ OPTION_BATCH_OUT ].szParameter = strdup( "flavr_batch.txt" );
+    astAttributes[ OPTION_THREADS ].szParameter = strdup( "0" );
 }
 //---------------------------------------------------------------------------
 const char *Options_GetByName (const char *szAttribute_)
@@ -150,6 +150,47 @@ static const AVR_Vector_Map_t stLargeAtMegaVectors = {
     .TIMER3_OVF = 0x22
 };
 
+//---------------------------------------------------------------------------
+// Map for atMega640, 1280, 1281, 2560, 2561 (57 vectors - those for peripherals
+// not emulated are left unmapped)
+static const AVR_Vector_Map_t stXLargeAtMegaVectors = {
+    .RESET = 0x00,
+    .INT0 = 0x01,
+    .INT1 = 0x02,
+    .INT2 = 0x03,
+    .PCINT0 = 0x09,
+    .PCINT1 = 0x0A,
+    .PCINT2 = 0x0B,
+    .PCINT3 = VECTOR_NOT_SUPPORTED,
+    .WDT = 0x0C,
+    .TIMER2_COMPA = 0x0D,
+    .TIMER2_COMPB = 0x0E,
+    .TIMER2_OVF = 0x0F,
+    .TIMER1_CAPT = 0x10,
+    .TIMER1_COMPA = 0x11,
+    .TIMER1_COMPB = 0x12,
+    .TIMER1_OVF = 0x14,
+    .TIMER0_COMPA = 0x15,
+    .TIMER0_COMPB = 0x16,
+    .TIMER0_OVF = 0x17,
+    .SPI_STC = 0x18,
+    .USART0_RX = 0x19,
+    .USART0_UDRE = 0x1A,
+    .USART0_TX = 0x1B,
+    .ANALOG_COMP = 0x1C,
+    .ADC = 0x1D,
+    .EE_READY = 0x1E,
+    .TIMER3_CAPT = 0x1F,
+    .TIMER3_COMPA = 0x20,
+    .TIMER3_COMPB = 0x21,
+    .TIMER3_OVF = 0x23,
+    .USART1_RX = 0x24,
+    .USART1_UDRE = 0x25,
+    .USART1_TX = 0x26,
+    .TWI = 0x27,
+    .SPM_READY = 0x28
+};
+
 //---------------------------------------------------------------------------
 static AVR_Feature_Map_t stSmallAtMegaFeatures = {
     .bHasTimer3 = false,
@@ -175,8 +216,24 @@ static AVR_Feature_Map_t stLargeAtMegaFeatures = {
 };
 
 //---------------------------------------------------------------------------
+static AVR_Feature_Map_t stXLargeAtMegaFeatures = {
+    .bHasTimer3 = true,
+    .bHasUSART1 = true,
+    .bHasInt2 = true,
+    .bHasPCInt3 = false
+};
+
+//---------------------------------------------------------------------------
+// NB: The atMega640/1280/2560 family has extended IO registers up to 0x1FF, with
+// SRAM starting at 0x200 - the RAM sizes listed for those parts include the
+// extra 256 bytes, so that RAMEND matches the real device.
 static AVR_Variant_t astVariants[] =
 {
+    { "atmega2560",  8.25 KB, 256 KB, 4 KB, &stXLargeAtMegaFeatures, &stXLargeAtMegaVectors },
+    { "atmega2561",  8.25 KB, 256 KB, 4 KB, &stXLargeAtMegaFeatures, &stXLargeAtMegaVectors },
+    { "atmega1280",  8.25 KB, 128 KB, 4 KB, &stXLargeAtMegaFeatures, &stXLargeAtMegaVectors },
+    { "atmega1281",  8.25 KB, 128 KB, 4 KB, &stXLargeAtMegaFeatures, &stXLargeAtMegaVectors },
+    { "atmega640",   8.25 KB, 64 KB,  4 KB, &stXLargeAtMegaFeatures, &stXLargeAtMegaVectors },
     { "atmega1284p", 16 KB,  128 KB, 4 KB, &stLargeAtMegaFeatures, &stLargeAtMegaVectors },
     { "atmega1284",  16 KB,  128 KB, 4 KB, &stLargeAtMegaFeatures, &stLargeAtMegaVectors },
     { "atmega644p",  4 KB,   64 KB,  2 KB, &stMediumAtMegaFeatures, &stMediumAtMegaVectors },
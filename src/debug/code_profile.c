@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "emu_config.h"
 #include "debug_sym.h"
 #include "code_profile.h"
 #include "avr_disasm.h"
@@ -60,13 +61,13 @@ typedef struct
 } AddressCoverageTLV_t;
 
 //---------------------------------------------------------------------------
-static Profile_t *pstProfile = 0;
-static uint32_t  u32ROMSize = 0;
+static EMU_INSTANCE Profile_t *pstProfile = 0;
+static EMU_INSTANCE uint32_t  u32ROMSize = 0;
 
 //---------------------------------------------------------------------------
-static TLV_t *pstFunctionCoverageTLV = NULL;
-static TLV_t *pstFunctionProfileTLV = NULL;
-static TLV_t *pstAddressCoverageTLV = NULL;
+static EMU_INSTANCE TLV_t *pstFunctionCoverageTLV = NULL;
+static EMU_INSTANCE TLV_t *pstFunctionProfileTLV = NULL;
+static EMU_INSTANCE TLV_t *pstAddressCoverageTLV = NULL;
 
 //---------------------------------------------------------------------------
 static void Profile_TLVInit(void)
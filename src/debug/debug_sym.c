@@ -19,6 +19,7 @@
 */
 
 
+#include "emu_config.h"
 #include "debug_sym.h"
 #include <stdint.h>
 #include <stdio.h>
@@ -26,11 +27,11 @@
 #include <string.h>
 
 //---------------------------------------------------------------------------
-static Debug_Symbol_t *pstFuncSymbols = 0;
-static uint32_t        u32FuncCount = 0;
+static EMU_INSTANCE Debug_Symbol_t *pstFuncSymbols = 0;
+static EMU_INSTANCE uint32_t        u32FuncCount = 0;
 
-static Debug_Symbol_t *pstObjSymbols = 0;
-static uint32_t        u32ObjCount = 0;
+static EMU_INSTANCE Debug_Symbol_t *pstObjSymbols = 0;
+static EMU_INSTANCE uint32_t        u32ObjCount = 0;
 
 //---------------------------------------------------------------------------
 void Symbol_Add_Func( const char *szName_, const uint32_t u32Addr_, const uint32_t u32Len_ )
@@ -122,4 +123,25 @@ Debug_Symbol_t *Symbol_Find_Obj_By_Name( const char *szName_ )
     return 0;
 }
 
+//---------------------------------------------------------------------------
+void Symbol_Free( void )
+{
+    uint32_t i = 0;
+    for (i = 0; i < u32FuncCount; i++)
+    {
+        free( (void*)pstFuncSymbols[i].szName );
+    }
+    for (i = 0; i < u32ObjCount; i++)
+    {
+        free( (void*)pstObjSymbols[i].szName );
+    }
+    free( pstFuncSymbols );
+    free( pstObjSymbols );
+
+    pstFuncSymbols = 0;
+    u32FuncCount = 0;
+    pstObjSymbols = 0;
+    u32ObjCount = 0;
+}
+
 
@@ -136,4 +136,13 @@ Debug_Symbol_t *Symbol_Find_Func_By_Name( const char *szName_ );
  */
 Debug_Symbol_t *Symbol_Find_Obj_By_Name( const char *szName_ );
 
+//---------------------------------------------------------------------------
+/*!
+ * \brief Symbol_Free
+ *
+ * Remove all functions and objects from the symbol table, i.e. before a
+ * different program is loaded.
+ */
+void Symbol_Free( void );
+
 #endif
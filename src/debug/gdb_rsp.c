@@ -6,10 +6,12 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include "avr_cpu.h"
+#include "write_callout.h"
 #include "options.h"
 #include "kernel_aware.h"
 #include "ka_thread.h"
 #include "debug_sym.h"
+#include "replay.h"
 
 #if USE_WINDOWS
 # include "Ws2tcpip.h"
@@ -144,6 +146,7 @@ static const GDBCommandMap_t astCommands[] =
 //---------------------------------------------------------------------------
 static volatile bool bRetrigger = false;
 static volatile bool bIsInteractive = false;
+static volatile bool bBreakReceived = false; // Set (before bIsInteractive) on a break from the client
 static volatile bool bStepping = false;
 static volatile int break_count = 0;
 static int mark3_thread = -1;
@@ -429,6 +432,7 @@ static void *GDB_CatchIO(void *unused_)
                     if (ch == 3) // Ctrl^C
                     {
                         fprintf(stderr, "[GDB - Signal Break]\n");
+                        bBreakReceived = true;
                         bIsInteractive = true;
                     }
                     else if (ch == 0)
@@ -461,6 +465,21 @@ static void GDB_InstallBreakHandler( void )
 //---------------------------------------------------------------------------
 bool GDB_CheckAndExecute( void )
 {
+#if FEATURE_USE_REPLAY
+    // A break from the client stops the CPU wherever this happens to notice
+    // it - log where that was, or stop in the same place when replaying.
+    if (bIsInteractive && bBreakReceived)
+    {
+        bBreakReceived = false;
+        Replay_Record( REPLAY_GDB_BREAK, stCPU.u64CycleCount, NULL, 0 );
+    }
+    else if (!bIsInteractive && (Replay_Play( REPLAY_GDB_BREAK, stCPU.u64CycleCount, NULL, 0 ) >= 0))
+    {
+        fprintf(stderr, "[GDB - Replayed Break]\n");
+        bIsInteractive = true;
+    }
+#endif
+
     // If we're in non-interactive mode (i.e. native execution), then return
     // out instantly.    
     if (false == bIsInteractive)
@@ -535,13 +554,13 @@ static bool GDB_Handler_ReadMem( const char *pcCmd_, char *ppcResponse_ )
     }
     else if ((u32Addr >= 0x800000) && (u32Addr < 0x810000))
     {
-        if ((u32Addr - 0x800000) > stCPU.u32RAMSize) {
+        if ((u32Addr - 0x800000) >= stCPU.u32RAMSize) {
             sprintf(ppcResponse_, "E01");
             return false;
         }
 
         if (((u32Addr - 0x800000) + u32Count) > stCPU.u32RAMSize) {
-            u32Count = ((u32Addr - 0x800000) + u32Count) - stCPU.u32RAMSize;
+            u32Count = stCPU.u32RAMSize - (u32Addr - 0x800000);
         }
 
         r = (char*)&stCPU.pstRAM->au8RAM[u32Addr & 0xFFFFF];
@@ -556,7 +575,7 @@ static bool GDB_Handler_ReadMem( const char *pcCmd_, char *ppcResponse_ )
         if (((u32Addr - 0x810000) + u32Count) > stCPU.u32EEPROMSize) {
             u32Count = ((u32Addr - 0x810000) + u32Count) - stCPU.u32EEPROMSize;
         }
-        r = (char*)&stCPU.pu8EEPROM[ u32Addr & 0xFFFFF ];
+        r = (char*)&stCPU.pu8EEPROM[ u32Addr - 0x810000 ];
     }
     else
     {
@@ -573,7 +592,7 @@ static bool GDB_Handler_ReadMem( const char *pcCmd_, char *ppcResponse_ )
 
 //---------------------------------------------------------------------------
 static bool GDB_Handler_ReadReg_i( const char *pcCmd_, char *ppcResponse_, uint8_t* r,
-                                   uint8_t SREG, uint8_t SPH, uint8_t SPL, uint16_t u16PC_)
+                                   uint8_t SREG, uint8_t SPH, uint8_t SPL, uint32_t u32PC_)
 {
     char *src = (char*)&pcCmd_[1];
     char *dst = ppcResponse_;
@@ -597,10 +616,10 @@ static bool GDB_Handler_ReadReg_i( const char *pcCmd_, char *ppcResponse_, uint8
     }
     else if (u8Reg == 34)
     {
-        uint16_t PC = u16PC_ << 1;
+        uint32_t PC = u32PC_ << 1;
         WRITE_HEX_BYTE(dst, PC & 0x00FF );
-        WRITE_HEX_BYTE(dst, PC >> 8 );
-        WRITE_HEX_BYTE(dst, 0);
+        WRITE_HEX_BYTE(dst, (PC >> 8) & 0x00FF );
+        WRITE_HEX_BYTE(dst, (PC >> 16) & 0x00FF );
         WRITE_HEX_BYTE(dst, 0);
     }
     *dst = 0;
@@ -620,7 +639,7 @@ static bool GDB_Handler_ReadReg( const char *pcCmd_, char *ppcResponse_ )
 
 //---------------------------------------------------------------------------
 static bool GDB_Handler_ReadRegs_i( const char *pcCmd_, char *ppcResponse_, uint8_t* r,
-                                    uint8_t SREG, uint8_t SPH, uint8_t SPL, uint16_t u16PC_)
+                                    uint8_t SREG, uint8_t SPH, uint8_t SPL, uint32_t u32PC_)
 {
     char *dst = ppcResponse_;
     int i;
@@ -634,10 +653,10 @@ static bool GDB_Handler_ReadRegs_i( const char *pcCmd_, char *ppcResponse_, uint
     WRITE_HEX_BYTE(dst, SPL);
     WRITE_HEX_BYTE(dst, SPH);
 
-    uint16_t PC = u16PC_ << 1;
+    uint32_t PC = u32PC_ << 1;
     WRITE_HEX_BYTE(dst, PC & 0x00FF );
-    WRITE_HEX_BYTE(dst, PC >> 8 );
-    WRITE_HEX_BYTE(dst, 0);
+    WRITE_HEX_BYTE(dst, (PC >> 8) & 0x00FF );
+    WRITE_HEX_BYTE(dst, (PC >> 16) & 0x00FF );
     WRITE_HEX_BYTE(dst, 0);
 
     *dst = 0;
@@ -704,6 +723,7 @@ static bool GDB_Handler_WriteMem( const char *pcCmd_, char *ppcResponse_ )
             data += 4;
 
             stCPU.pu16ROM[ u32Addr ] = r16;
+            CPU_InvalidateROM( u32Addr, 1 );
             u32Count -= 2;
             u32Addr ++;
         }
@@ -712,16 +732,17 @@ static bool GDB_Handler_WriteMem( const char *pcCmd_, char *ppcResponse_ )
     }
     else if ((u32Addr >= 0x800000) && (u32Addr < 0x810000))
     {
-        if ((u32Addr - 0x800000) > stCPU.u32RAMSize) {
+        if ((u32Addr - 0x800000) >= stCPU.u32RAMSize) {
             sprintf(ppcResponse_, "E01");
             return false;
         }
 
         if (((u32Addr - 0x800000) + u32Count) > stCPU.u32RAMSize) {
-            u32Count = ((u32Addr - 0x800000) + u32Count) - stCPU.u32RAMSize;
+            u32Count = stCPU.u32RAMSize - (u32Addr - 0x800000);
         }
 
         r = (char*)&stCPU.pstRAM->au8RAM[u32Addr & 0xFFFF];
+        CPU_DirtyRAMRange( u32Addr & 0xFFFF, u32Count );
 
         while (u32Count--)
         {
@@ -741,10 +762,11 @@ static bool GDB_Handler_WriteMem( const char *pcCmd_, char *ppcResponse_ )
             u32Count = ((u32Addr - 0x810000) + u32Count) - stCPU.u32EEPROMSize;
         }
 
-        r = (char*)&stCPU.pu8EEPROM[ u32Addr & 0xFFFFF ];
+        r = (char*)&stCPU.pu8EEPROM[ u32Addr - 0x810000 ];
 
         while (u32Count--)
         {
+            CPU_DirtyEEPROM( (uint32_t)((uint8_t*)r - stCPU.pu8EEPROM) );
             READ_HEX_BYTE(data, r);
             r++;
         }
@@ -1115,12 +1137,12 @@ static bool GDB_Handler_PokeThread( const char *pcCmd_, char *ppcResponse_ )
 //---------------------------------------------------------------------------
 static void GDB_SendStatus( char *ppcResponse_, uint8_t signo_ )
 {
-    uint16_t PC = stCPU.u32PC << 1;
-    sprintf(ppcResponse_, "T%02x20:%02x;21:%02x%02x;22:%02x%02x0000;",
+    uint32_t PC = stCPU.u32PC << 1;
+    sprintf(ppcResponse_, "T%02x20:%02x;21:%02x%02x;22:%02x%02x%02x00;",
         signo_, stCPU.pstRAM->stRegisters.SREG.r,
         stCPU.pstRAM->stRegisters.SPL.r,
         stCPU.pstRAM->stRegisters.SPH.r,
-        PC & 0xff, (PC >> 8) & 0xff);
+        PC & 0xff, (PC >> 8) & 0xff, (PC >> 16) & 0xff);
 }
 
 //---------------------------------------------------------------------------
@@ -1186,7 +1208,7 @@ void GDB_Init( void )
         BreakPoint_Insert(0);
     }
 
-    WriteCallout_Add( GDB_WatchpointCallback, 0 );
+    WriteCallout_AddWatch( GDB_WatchpointCallback );
     GDB_ServerCreate();
     GDB_InstallBreakHandler();
 }
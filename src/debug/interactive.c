@@ -385,9 +385,9 @@ void Interactive_Init( TraceBuffer_t *pstTrace_ )
     bIsInteractive = false;
     bRetrigger = false;
 
-    // Add the watchpoint handler as a wildcard callout (i.e. every write
-    // triggers is, it's up to the callout to handle filtering on its own).
-    WriteCallout_Add( Interactive_WatchpointCallback, 0 );
+    // Add the watchpoint handler - it's only called for writes to addresses
+    // with a watchpoint set.
+    WriteCallout_AddWatch( Interactive_WatchpointCallback );
 
 }
 
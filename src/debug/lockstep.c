@@ -0,0 +1,753 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   lockstep.c
+
+    \brief  Differential testing of execution engines - runs the CPU on two
+            engines side-by-side, and reports the first instruction at which
+            their results differ.
+
+    The emulator has no way of copying the complete state of the CPU and
+    its peripherals, so every comparison is made between forked copies of the
+    emulator process instead.  At the start of each interval, the emulator
+    forks a "keeper" process, which holds on to the state at that checkpoint
+    and forks a probe process to run the interval on the reference engine.
+    Meanwhile, the emulator itself runs the interval on its own engine, and
+    sends the resulting state to the keeper for comparison.
+
+    If the states match, the keeper exits and the next interval begins.  If
+    not, the keeper bisects the interval from its checkpoint - forking a pair
+    of probes for each step - until it finds the first instruction cycle after
+    which the two engines disagree.
+
+    Probes run the same code as the emulator, peripherals and plugins
+    included, so they cannot be given any connection to the host: a probe
+    would read from the UART's socket or the kernel-aware plugin's files in
+    the emulator's place.  --lockstep is refused alongside --uart and --mark3
+    for this reason.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#if FEATURE_USE_LOCKSTEP
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "avr_cpu.h"
+#include "avr_opcodes.h"
+#include "avr_op_decode.h"
+#include "avr_jit.h"
+#include "avr_disasm.h"
+#include "lockstep.h"
+
+//---------------------------------------------------------------------------
+/*!
+    CPU state compared between engines.  RAM (including the register file and
+    IO space) is compared byte-for-byte, and EEPROM by hash.
+*/
+typedef struct
+{
+    uint32_t u32PC;
+    uint16_t u16SP;
+    uint8_t  u8SREG;
+    bool     bAsleep;
+    uint64_t u64CycleCount;
+    uint64_t u64InstructionCount;
+    uint64_t u64IOTicks;
+    uint64_t u64EEPROMHash;
+} Lockstep_State_t;
+
+//---------------------------------------------------------------------------
+/*!
+    Forked process running a number of cycles on one engine, which reports
+    its state through a pipe when done.
+*/
+typedef struct
+{
+    pid_t   pid;            //!< Process ID of the probe
+    int     iFd;            //!< Read end of the pipe the state is sent on
+
+    Lockstep_State_t stState;   //!< State reported by the probe
+    uint8_t *pu8RAM;            //!< RAM contents reported by the probe
+} Lockstep_Probe_t;
+
+//---------------------------------------------------------------------------
+static const char *aszEngineNames[ CPU_ENGINE_COUNT ] =
+{
+    "interpreter",
+    "threaded",
+    "jit",
+    "aot"
+};
+
+//---------------------------------------------------------------------------
+#define LOCKSTEP_OPCODE_NAME(x)     #x,
+
+static const char *aszOpcodeNames[ AVR_OPCODE_INDEX_COUNT ] =
+{
+    AVR_OPCODE_LIST(LOCKSTEP_OPCODE_NAME)
+};
+
+//---------------------------------------------------------------------------
+#define LOCKSTEP_MAX_RAM_DIFFS      (16)    //!< RAM differences printed per report
+
+//---------------------------------------------------------------------------
+static EMU_INSTANCE CPU_Engine_t eReference;         //!< Engine the CPU's engine is checked against
+static EMU_INSTANCE uint32_t u32Interval;            //!< Instruction cycles between comparisons
+static EMU_INSTANCE uint32_t u32Done = 0;            //!< Cycles run since the last checkpoint
+static EMU_INSTANCE uint64_t u64Checkpoint = 0;      //!< Cycles run before the last checkpoint
+
+static EMU_INSTANCE pid_t pidKeeper = 0;             //!< Process holding the last checkpoint
+static EMU_INSTANCE int iKeeperIn = -1;              //!< Pipe to send the emulator's state to the keeper
+static EMU_INSTANCE int iKeeperOut = -1;             //!< Pipe to receive the keeper's verdict
+
+static EMU_INSTANCE uint32_t u32Random;              //!< Fuzz test random number generator state
+
+//---------------------------------------------------------------------------
+static bool Lockstep_Write( int iFd_, const void *pvData_, size_t szLen_ )
+{
+    const uint8_t *pu8Data = (const uint8_t*)pvData_;
+    while (szLen_)
+    {
+        ssize_t iWritten = write( iFd_, pu8Data, szLen_ );
+        if (iWritten <= 0)
+        {
+            return false;
+        }
+        pu8Data += iWritten;
+        szLen_ -= (size_t)iWritten;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool Lockstep_Read( int iFd_, void *pvData_, size_t szLen_ )
+{
+    uint8_t *pu8Data = (uint8_t*)pvData_;
+    while (szLen_)
+    {
+        ssize_t iRead = read( iFd_, pu8Data, szLen_ );
+        if (iRead <= 0)
+        {
+            return false;
+        }
+        pu8Data += iRead;
+        szLen_ -= (size_t)iRead;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t Lockstep_Hash( const uint8_t *pu8Data_, uint32_t u32Len_ )
+{
+    uint64_t u64Hash = 14695981039346656037ULL;
+    while (u32Len_--)
+    {
+        u64Hash ^= *pu8Data_++;
+        u64Hash *= 1099511628211ULL;
+    }
+    return u64Hash;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Send the CPU's current state, followed by the contents of its RAM.
+ */
+static bool Lockstep_SendState( int iFd_ )
+{
+    Lockstep_State_t stState;
+
+    memset( &stState, 0, sizeof(stState) );
+    AVR_Opcode_SyncFlags();
+
+    stState.u32PC = stCPU.u32PC;
+    stState.u16SP = ((uint16_t)stCPU.pstRAM->stRegisters.SPH.r << 8) |
+                    stCPU.pstRAM->stRegisters.SPL.r;
+    stState.u8SREG = stCPU.pstRAM->stRegisters.SREG.r;
+    stState.bAsleep = stCPU.bAsleep;
+    stState.u64CycleCount = stCPU.u64CycleCount;
+    stState.u64InstructionCount = stCPU.u64InstructionCount;
+    stState.u64IOTicks = stCPU.u64IOTicks;
+    stState.u64EEPROMHash = Lockstep_Hash( stCPU.pu8EEPROM, stCPU.u32EEPROMSize );
+
+    return Lockstep_Write( iFd_, &stState, sizeof(stState) ) &&
+           Lockstep_Write( iFd_, stCPU.pstRAM->au8RAM, stCPU.u32RAMSize );
+}
+
+//---------------------------------------------------------------------------
+static bool Lockstep_RecvState( int iFd_, Lockstep_State_t *pstState_, uint8_t *pu8RAM_ )
+{
+    return Lockstep_Read( iFd_, pstState_, sizeof(*pstState_) ) &&
+           Lockstep_Read( iFd_, pu8RAM_, stCPU.u32RAMSize );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Run a number of cycles on the given engine, in place of the CPU's own.
+ */
+static void Lockstep_Step( CPU_Engine_t eEngine_, uint32_t u32Count_ )
+{
+    CPU_Engine_t eEngine = stCPU.eEngine;
+
+    stCPU.eEngine = eEngine_;
+    if (u32Count_)
+    {
+        CPU_Run( u32Count_ );
+    }
+    stCPU.eEngine = eEngine;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Fork a probe that runs a number of cycles on the given engine from the
+ * current state, and reports the result.
+ */
+static void Lockstep_Start( Lockstep_Probe_t *pstProbe_, CPU_Engine_t eEngine_, uint32_t u32Count_ )
+{
+    int aiPipe[2];
+
+    // Anything left in the buffer would otherwise be printed by each process
+    fflush( stdout );
+
+    if (pipe( aiPipe ) != 0)
+    {
+        perror( "[Lockstep] pipe" );
+        exit(-1);
+    }
+
+    pstProbe_->pid = fork();
+    if (pstProbe_->pid < 0)
+    {
+        perror( "[Lockstep] fork" );
+        exit(-1);
+    }
+
+    if (!pstProbe_->pid)
+    {
+        int iNull = open( "/dev/null", O_WRONLY );
+
+        // The emulator's own process prints the program's output.
+        close( aiPipe[0] );
+        if (iNull >= 0)
+        {
+            dup2( iNull, STDOUT_FILENO );
+            close( iNull );
+        }
+
+        Lockstep_Step( eEngine_, u32Count_ );
+        Lockstep_SendState( aiPipe[1] );
+        _exit(0);
+    }
+
+    close( aiPipe[1] );
+    pstProbe_->iFd = aiPipe[0];
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Wait for a probe's result.  Returns false if the probe exited without
+ * reporting its state (i.e. the program caused the emulator to exit).
+ */
+static bool Lockstep_Finish( Lockstep_Probe_t *pstProbe_ )
+{
+    bool bOk;
+
+    if (!pstProbe_->pu8RAM)
+    {
+        pstProbe_->pu8RAM = (uint8_t*)malloc( stCPU.u32RAMSize );
+    }
+
+    bOk = Lockstep_RecvState( pstProbe_->iFd, &pstProbe_->stState, pstProbe_->pu8RAM );
+
+    close( pstProbe_->iFd );
+    waitpid( pstProbe_->pid, NULL, 0 );
+    return bOk;
+}
+
+//---------------------------------------------------------------------------
+static bool Lockstep_Match( const Lockstep_Probe_t *pstA_, const Lockstep_Probe_t *pstB_ )
+{
+    const Lockstep_State_t *pstA = &pstA_->stState;
+    const Lockstep_State_t *pstB = &pstB_->stState;
+
+    return (pstA->u32PC == pstB->u32PC)
+        && (pstA->u16SP == pstB->u16SP)
+        && (pstA->u8SREG == pstB->u8SREG)
+        && (pstA->bAsleep == pstB->bAsleep)
+        && (pstA->u64CycleCount == pstB->u64CycleCount)
+        && (pstA->u64InstructionCount == pstB->u64InstructionCount)
+        && (pstA->u64IOTicks == pstB->u64IOTicks)
+        && (pstA->u64EEPROMHash == pstB->u64EEPROMHash)
+        && (0 == memcmp( pstA_->pu8RAM, pstB_->pu8RAM, stCPU.u32RAMSize ));
+}
+
+//---------------------------------------------------------------------------
+static void Lockstep_PrintField( const char *szName_, uint64_t u64A_, uint64_t u64B_ )
+{
+    if (u64A_ != u64B_)
+    {
+        printf( "    %-12s %20llX %20llX\n", szName_,
+                (unsigned long long)u64A_, (unsigned long long)u64B_ );
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Print every field that differs between the results of two probes, run on
+ * the CPU's engine and the reference engine respectively.
+ */
+static void Lockstep_PrintDiff( const Lockstep_Probe_t *pstTest_, const Lockstep_Probe_t *pstRef_ )
+{
+    const Lockstep_State_t *pstA = &pstTest_->stState;
+    const Lockstep_State_t *pstB = &pstRef_->stState;
+    uint32_t u32Diffs = 0;
+    uint32_t i;
+
+    printf( "    %-12s %20s %20s\n", "",
+            aszEngineNames[ stCPU.eEngine ], aszEngineNames[ eReference ] );
+
+    Lockstep_PrintField( "PC", pstA->u32PC, pstB->u32PC );
+    Lockstep_PrintField( "SP", pstA->u16SP, pstB->u16SP );
+    Lockstep_PrintField( "SREG", pstA->u8SREG, pstB->u8SREG );
+    Lockstep_PrintField( "Asleep", pstA->bAsleep, pstB->bAsleep );
+    Lockstep_PrintField( "Cycles", pstA->u64CycleCount, pstB->u64CycleCount );
+    Lockstep_PrintField( "Instructions", pstA->u64InstructionCount, pstB->u64InstructionCount );
+    Lockstep_PrintField( "IO ticks", pstA->u64IOTicks, pstB->u64IOTicks );
+    Lockstep_PrintField( "EEPROM hash", pstA->u64EEPROMHash, pstB->u64EEPROMHash );
+
+    for (i = 0; i < stCPU.u32RAMSize; i++)
+    {
+        char szName[16];
+
+        if (pstTest_->pu8RAM[i] == pstRef_->pu8RAM[i])
+        {
+            continue;
+        }
+        if (++u32Diffs > LOCKSTEP_MAX_RAM_DIFFS)
+        {
+            printf( "    ...\n" );
+            break;
+        }
+
+        if (i < 32)
+        {
+            sprintf( szName, "r%u", i );
+        }
+        else
+        {
+            sprintf( szName, "[0x%04X]", i );
+        }
+        Lockstep_PrintField( szName, pstTest_->pu8RAM[i], pstRef_->pu8RAM[i] );
+    }
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Print the instruction at the PC, in the same format as --disasm.  Decoding
+ * modifies the CPU's intermediate registers (and may clock the peripherals),
+ * so the CPU's state can't be relied upon afterwards.
+ */
+static void Lockstep_PrintInstruction( void )
+{
+    char szBuf[256];
+    uint16_t OP = stCPU.pu16ROM[ stCPU.u32PC ];
+
+    printf( "0x%04X: [0x%04X] ", stCPU.u32PC, OP );
+    AVR_Decode( OP );
+    AVR_Disasm_Function( OP )( szBuf );
+    printf( "%s", szBuf );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Narrow down an interval, known to end with the engines disagreeing, to the
+ * first instruction cycle after which they differ, and print the differences.
+ * Runs in the keeper process, from the checkpoint at the start of the
+ * interval.
+ */
+static void Lockstep_Bisect( void )
+{
+    Lockstep_Probe_t stTest = { 0 };
+    Lockstep_Probe_t stRef = { 0 };
+    uint32_t u32Lo = 0;
+    uint32_t u32Hi = u32Interval;
+    bool bTestOk;
+    bool bRefOk;
+
+    while ((u32Hi - u32Lo) > 1)
+    {
+        uint32_t u32Mid = u32Lo + ((u32Hi - u32Lo) / 2);
+
+        Lockstep_Start( &stTest, stCPU.eEngine, u32Mid );
+        Lockstep_Start( &stRef, eReference, u32Mid );
+        bTestOk = Lockstep_Finish( &stTest );
+        bRefOk = Lockstep_Finish( &stRef );
+
+        if (bTestOk && bRefOk && Lockstep_Match( &stTest, &stRef ))
+        {
+            u32Lo = u32Mid;
+        }
+        else
+        {
+            u32Hi = u32Mid;
+        }
+    }
+
+    Lockstep_Start( &stTest, stCPU.eEngine, u32Hi );
+    Lockstep_Start( &stRef, eReference, u32Hi );
+    bTestOk = Lockstep_Finish( &stTest );
+    bRefOk = Lockstep_Finish( &stRef );
+
+    // The keeper has no further use for its checkpoint - bring it up to the
+    // last state both engines agree on, to show what was run next.
+    Lockstep_Step( stCPU.eEngine, u32Lo );
+
+    printf( "[Lockstep] %s and %s engines diverge at instruction cycle %llu\n",
+            aszEngineNames[ stCPU.eEngine ], aszEngineNames[ eReference ],
+            (unsigned long long)(u64Checkpoint + u32Hi) );
+    printf( "[Lockstep] Last matching state: %llu instructions, %llu cycles\n",
+            (unsigned long long)stCPU.u64InstructionCount,
+            (unsigned long long)stCPU.u64CycleCount );
+    Lockstep_PrintInstruction();
+
+    if (!bTestOk || !bRefOk)
+    {
+        printf( "[Lockstep] %s engine exited the emulator\n",
+                aszEngineNames[ bTestOk ? eReference : stCPU.eEngine ] );
+    }
+    else
+    {
+        Lockstep_PrintDiff( &stTest, &stRef );
+    }
+    fflush( stdout );
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Body of the keeper process, forked at each checkpoint.  Never returns.
+ */
+static void Lockstep_Keeper( int iIn_, int iOut_ )
+{
+    Lockstep_Probe_t stRef = { 0 };
+    Lockstep_Probe_t stTest = { 0 };
+    bool bRefOk;
+    char cVerdict = 'Y';
+
+    Lockstep_Start( &stRef, eReference, u32Interval );
+    bRefOk = Lockstep_Finish( &stRef );
+
+    stTest.pu8RAM = (uint8_t*)malloc( stCPU.u32RAMSize );
+    if (!Lockstep_RecvState( iIn_, &stTest.stState, stTest.pu8RAM ))
+    {
+        // The emulator exited before the end of the interval
+        _exit(0);
+    }
+
+    if (!bRefOk || !Lockstep_Match( &stTest, &stRef ))
+    {
+        Lockstep_Bisect();
+        cVerdict = 'N';
+    }
+
+    Lockstep_Write( iOut_, &cVerdict, 1 );
+    _exit(0);
+}
+
+//---------------------------------------------------------------------------
+static void Lockstep_Checkpoint( void )
+{
+    int aiIn[2];
+    int aiOut[2];
+
+    fflush( stdout );
+
+    if ((pipe( aiIn ) != 0) || (pipe( aiOut ) != 0))
+    {
+        perror( "[Lockstep] pipe" );
+        exit(-1);
+    }
+
+    pidKeeper = fork();
+    if (pidKeeper < 0)
+    {
+        perror( "[Lockstep] fork" );
+        exit(-1);
+    }
+
+    if (!pidKeeper)
+    {
+        close( aiIn[1] );
+        close( aiOut[0] );
+        Lockstep_Keeper( aiIn[0], aiOut[1] );
+    }
+
+    close( aiIn[0] );
+    close( aiOut[1] );
+    iKeeperIn = aiIn[1];
+    iKeeperOut = aiOut[0];
+}
+
+//---------------------------------------------------------------------------
+static void Lockstep_Check( void )
+{
+    char cVerdict = 'N';
+
+    if (!Lockstep_SendState( iKeeperIn ) || !Lockstep_Read( iKeeperOut, &cVerdict, 1 ))
+    {
+        cVerdict = 'N';
+    }
+
+    close( iKeeperIn );
+    close( iKeeperOut );
+    waitpid( pidKeeper, NULL, 0 );
+    pidKeeper = 0;
+
+    if (cVerdict != 'Y')
+    {
+        exit(-1);
+    }
+
+    u64Checkpoint += u32Done;
+    u32Done = 0;
+}
+
+//---------------------------------------------------------------------------
+void Lockstep_Init( CPU_Engine_t eReference_, uint32_t u32Interval_ )
+{
+    eReference = eReference_;
+    u32Interval = u32Interval_ ? u32Interval_ : 1;
+
+#if FEATURE_USE_JIT
+    // The JIT is only set up by CPU_Init() when it's the CPU's own engine
+    if ((eReference == CPU_ENGINE_JIT) && (stCPU.eEngine != CPU_ENGINE_JIT))
+    {
+        AVR_JIT_Init( stCPU.u32ROMSize );
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+void Lockstep_Run( uint32_t u32Count_ )
+{
+    while (u32Count_)
+    {
+        uint32_t u32Run = u32Interval - u32Done;
+        if (u32Run > u32Count_)
+        {
+            u32Run = u32Count_;
+        }
+
+        if (!pidKeeper)
+        {
+            Lockstep_Checkpoint();
+        }
+
+        CPU_Run( u32Run );
+        u32Done += u32Run;
+        u32Count_ -= u32Run;
+
+        if (u32Done == u32Interval)
+        {
+            Lockstep_Check();
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static uint32_t Lockstep_Random( void )
+{
+    // xorshift32
+    u32Random ^= u32Random << 13;
+    u32Random ^= u32Random >> 17;
+    u32Random ^= u32Random << 5;
+    return u32Random;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * Randomize the CPU's registers and RAM for a fuzz test.  Pointer registers
+ * and SP are kept far enough inside of RAM that any instruction using them
+ * stays inside of it.
+ */
+static void Lockstep_FuzzState( void )
+{
+    uint32_t u32Pointers = stCPU.u32RAMSize - 64;
+    uint32_t u32Stack = stCPU.u32RAMSize - 256 - 6;
+    uint16_t u16SP;
+    uint32_t i;
+
+    // Drop any outstanding flag update, since SREG is about to be replaced
+    AVR_Opcode_SyncFlags();
+
+    for (i = 0; i < stCPU.u32RAMSize; i++)
+    {
+        stCPU.pstRAM->au8RAM[i] = (uint8_t)Lockstep_Random();
+    }
+
+    stCPU.pstRAM->stRegisters.CORE_REGISTERS.X = (uint16_t)(1 + (Lockstep_Random() % u32Pointers));
+    stCPU.pstRAM->stRegisters.CORE_REGISTERS.Y = (uint16_t)(1 + (Lockstep_Random() % u32Pointers));
+    stCPU.pstRAM->stRegisters.CORE_REGISTERS.Z = (uint16_t)(1 + (Lockstep_Random() % u32Pointers));
+    stCPU.pstRAM->stRegisters.RAMPZ = 0;
+
+    u16SP = (uint16_t)(256 + 3 + (Lockstep_Random() % u32Stack));
+    stCPU.pstRAM->stRegisters.SPH.r = (uint8_t)(u16SP >> 8);
+    stCPU.pstRAM->stRegisters.SPL.r = (uint8_t)(u16SP & 0xFF);
+
+    stCPU.bAsleep = false;
+    stCPU.u64IntFlags = 0;
+    stCPU.u8IntPriority = 255;
+}
+
+//---------------------------------------------------------------------------
+uint32_t Lockstep_Fuzz( uint32_t u32Tests_, uint32_t u32Seed_ )
+{
+    static uint16_t au16Ops[65536];
+    uint32_t au32First[ AVR_OPCODE_INDEX_COUNT + 1 ] = { 0 };
+    uint32_t au32Next[ AVR_OPCODE_INDEX_COUNT ];
+    uint32_t u32ROMWords = stCPU.u32ROMSize / sizeof(uint16_t);
+    uint32_t u32Addr = 0;
+    uint32_t u32Failed = 0;
+    uint32_t u32Covered = 0;
+    uint32_t u32Test;
+    uint8_t u8Index = 0;
+    bool bTestOk;
+    bool bRefOk;
+    uint32_t i;
+
+    Lockstep_Probe_t stTest = { 0 };
+    Lockstep_Probe_t stRef = { 0 };
+
+    u32Random = u32Seed_ ? u32Seed_ : 1;
+
+    // Sort every opcode by the opcode function it decodes to, so that tests
+    // can cycle through the functions, rather than being dominated by the
+    // handful of functions that cover most of the opcode space.
+    for (i = 0; i < 65536; i++)
+    {
+        au32First[ AVR_Opcode_Index( AVR_Opcode_Function( (uint16_t)i ) ) + 1 ]++;
+    }
+    for (i = 0; i < AVR_OPCODE_INDEX_COUNT; i++)
+    {
+        au32First[ i + 1 ] += au32First[ i ];
+        au32Next[ i ] = au32First[ i ];
+    }
+    for (i = 0; i < 65536; i++)
+    {
+        au16Ops[ au32Next[ AVR_Opcode_Index( AVR_Opcode_Function( (uint16_t)i ) ) ]++ ] = (uint16_t)i;
+    }
+
+    for (i = 0; i < AVR_OPCODE_INDEX_COUNT; i++)
+    {
+        if (au32First[ i + 1 ] != au32First[ i ])
+        {
+            u32Covered++;
+        }
+        else
+        {
+            printf( "[Fuzz] %s is never generated by the decoder\n", aszOpcodeNames[i] );
+        }
+    }
+
+    for (u32Test = 0; u32Test < u32Tests_; u32Test++)
+    {
+        uint16_t OP;
+        uint16_t u16Arg;
+
+        // Next opcode function with any opcodes decoding to it
+        do
+        {
+            u8Index = (uint8_t)((u8Index + 1) % AVR_OPCODE_INDEX_COUNT);
+        } while (au32First[ u8Index + 1 ] == au32First[ u8Index ]);
+
+        OP = au16Ops[ au32First[ u8Index ] +
+                      (Lockstep_Random() % (au32First[ u8Index + 1 ] - au32First[ u8Index ])) ];
+
+        // Second word of 2-word instructions - LDS/STS addresses are kept
+        // inside of RAM.
+        u16Arg = (uint16_t)Lockstep_Random();
+        if ((u8Index == AVR_OPCODE_INDEX_LDS) || (u8Index == AVR_OPCODE_INDEX_STS))
+        {
+            u16Arg = (uint16_t)(u16Arg % stCPU.u32RAMSize);
+        }
+
+        // Clear out the last test's instruction, and place this one somewhere
+        // else in ROM.
+        stCPU.pu16ROM[ u32Addr ] = 0;
+        stCPU.pu16ROM[ u32Addr + 1 ] = 0;
+        CPU_InvalidateROM( u32Addr, 2 );
+
+        u32Addr = Lockstep_Random() % (u32ROMWords - 1);
+        stCPU.pu16ROM[ u32Addr ] = OP;
+        stCPU.pu16ROM[ u32Addr + 1 ] = u16Arg;
+        CPU_InvalidateROM( u32Addr, 2 );
+
+#if FEATURE_USE_JIT
+        // The JIT only translates code the interpreter has run often enough -
+        // run the instruction that many times first, from throwaway states.
+        if ((stCPU.eEngine == CPU_ENGINE_JIT) || (eReference == CPU_ENGINE_JIT))
+        {
+            for (i = 0; i <= CONFIG_JIT_HOT_THRESHOLD; i++)
+            {
+                Lockstep_FuzzState();
+                stCPU.u32PC = u32Addr;
+                Lockstep_Step( CPU_ENGINE_JIT, 1 );
+            }
+        }
+#endif
+
+        Lockstep_FuzzState();
+        stCPU.u32PC = u32Addr;
+
+        Lockstep_Start( &stTest, stCPU.eEngine, 1 );
+        Lockstep_Start( &stRef, eReference, 1 );
+        bTestOk = Lockstep_Finish( &stTest );
+        bRefOk = Lockstep_Finish( &stRef );
+        if (bTestOk && bRefOk && Lockstep_Match( &stTest, &stRef ))
+        {
+            continue;
+        }
+
+        u32Failed++;
+        printf( "[Fuzz] Test %u (seed %u) - %s: ", u32Test, u32Seed_, aszOpcodeNames[ u8Index ] );
+        Lockstep_PrintInstruction();
+        if (!bTestOk || !bRefOk)
+        {
+            printf( "[Fuzz] %s engine exited the emulator\n",
+                    aszEngineNames[ bTestOk ? eReference : stCPU.eEngine ] );
+        }
+        else
+        {
+            Lockstep_PrintDiff( &stTest, &stRef );
+        }
+    }
+
+    printf( "[Fuzz] %u tests, %u failed, %u of %u opcode functions covered\n",
+            u32Tests_, u32Failed, u32Covered, (uint32_t)AVR_OPCODE_INDEX_COUNT );
+
+    free( stTest.pu8RAM );
+    free( stRef.pu8RAM );
+    return u32Failed;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   lockstep.h
+
+    \brief  Differential testing of execution engines - runs the CPU on two
+            engines side-by-side, and reports the first instruction at which
+            their results differ.
+*/
+
+#ifndef __LOCKSTEP_H__
+#define __LOCKSTEP_H__
+
+#include <stdint.h>
+
+#include "avr_cpu.h"
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Lockstep_Init
+ *
+ * Set up lockstep execution against a reference engine.  The CPU must have
+ * been initialized beforehand, with the engine under test selected.
+ *
+ * \param eReference_  Engine the CPU's own engine is checked against
+ * \param u32Interval_ Number of instruction cycles run between comparisons
+ */
+void Lockstep_Init( CPU_Engine_t eReference_, uint32_t u32Interval_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Lockstep_Run
+ *
+ * Run a number of CPU instruction cycles, as with CPU_Run(), while running
+ * the same cycles on the reference engine in a separate process.  The
+ * register file, SREG, PC, SP, counters and RAM are compared every interval;
+ * if they don't match, the interval is bisected down to the first instruction
+ * cycle at which the engines diverge, the differences are printed, and the
+ * emulator exits.
+ *
+ * Each comparison forks the emulator, so the reference engine sees the exact
+ * same CPU and peripheral state.  Console output from the forked processes is
+ * discarded.
+ *
+ * \param u32Count_ Number of instruction cycles to run
+ */
+void Lockstep_Run( uint32_t u32Count_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Lockstep_Fuzz
+ *
+ * Run randomized single-instruction tests on the CPU's engine and on the
+ * reference engine, and print any whose results differ.  Tests cycle through
+ * every opcode function in avr_opcodes.c reachable from the decoder, with
+ * random operands, registers, SREG and RAM contents.  Pointer registers, SP
+ * and LDS/STS addresses are kept within RAM.
+ *
+ * The CPU should have no peripherals attached, and its ROM contents are
+ * overwritten.
+ *
+ * \param u32Tests_ Number of tests to run
+ * \param u32Seed_  Random seed (the same seed generates the same tests)
+ *
+ * \return Number of tests that failed
+ */
+uint32_t Lockstep_Fuzz( uint32_t u32Tests_, uint32_t u32Seed_ );
+
+#endif
@@ -0,0 +1,309 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   replay.c
+
+    \brief  Record and replay of external inputs - logs everything the
+            emulated program receives from the host, so that a run can be
+            repeated exactly without the host.
+
+    The log starts with an 8-byte magic number and a version, followed by
+    one record per input:
+
+        <source> <stamp delta> <size> <data>
+
+    where the source is a byte, and the stamp delta (from the previous input
+    from the same source) and size are unsigned LEB128 varints - so a UART
+    byte typically takes 4-5 bytes of log.
+
+    A log being replayed is read into memory up front, and indexed by source,
+    so that each source keeps its own place in it.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu_config.h"
+
+#if FEATURE_USE_REPLAY
+
+#include "replay.h"
+
+//---------------------------------------------------------------------------
+#define REPLAY_MAGIC        "FLAVRLOG"  //!< First 8 bytes of a log
+#define REPLAY_VERSION      (1)         //!< Bumped on any change to the format
+
+//---------------------------------------------------------------------------
+/*!
+    An input in a log being replayed.
+*/
+typedef struct
+{
+    uint64_t        u64Stamp;       //!< Time the input was delivered
+    const uint8_t  *pu8Data;        //!< Input data, within the loaded log
+    uint32_t        u32Size;        //!< Size of the input data
+} Replay_Input_t;
+
+//---------------------------------------------------------------------------
+static bool bRecording = false;
+static bool bPlaying = false;
+
+static FILE *fpRecord = NULL;                           //!< Log being recorded
+static uint64_t au64LastStamp[REPLAY_SOURCE_COUNT];     //!< Last stamp recorded, per source
+
+static uint8_t *pu8Log = NULL;                          //!< Log being replayed
+static Replay_Input_t *apstInputs[REPLAY_SOURCE_COUNT]; //!< Its inputs, per source
+static uint32_t au32InputCount[REPLAY_SOURCE_COUNT];
+static uint32_t au32NextInput[REPLAY_SOURCE_COUNT];     //!< Next input to replay, per source
+
+//---------------------------------------------------------------------------
+static void Replay_PutVarint( uint64_t u64Value_ )
+{
+    do
+    {
+        uint8_t u8Byte = (uint8_t)(u64Value_ & 0x7F);
+        u64Value_ >>= 7;
+        if (u64Value_)
+        {
+            u8Byte |= 0x80;
+        }
+        fputc( u8Byte, fpRecord );
+    } while (u64Value_);
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_GetVarint
+ *
+ * \param ppu8Read_ [in/out] Position in the log
+ * \param pu8End_   End of the log
+ * \param pu64Value_ [out] Value read
+ * \return true on success, false if the log ends part-way through
+ */
+static bool Replay_GetVarint( const uint8_t **ppu8Read_, const uint8_t *pu8End_, uint64_t *pu64Value_ )
+{
+    uint32_t u32Shift = 0;
+
+    *pu64Value_ = 0;
+    while ((*ppu8Read_ < pu8End_) && (u32Shift < 64))
+    {
+        uint8_t u8Byte = *(*ppu8Read_)++;
+        *pu64Value_ |= ((uint64_t)(u8Byte & 0x7F) << u32Shift);
+        if (!(u8Byte & 0x80))
+        {
+            return true;
+        }
+        u32Shift += 7;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+static bool Replay_Create( const char *szPath_ )
+{
+    uint32_t u32Version = REPLAY_VERSION;
+
+    fpRecord = fopen( szPath_, "wb" );
+    if (!fpRecord)
+    {
+        fprintf( stderr, "Unable to create input log %s\n", szPath_ );
+        return false;
+    }
+    fwrite( REPLAY_MAGIC, 1, strlen(REPLAY_MAGIC), fpRecord );
+    fwrite( &u32Version, sizeof(u32Version), 1, fpRecord );
+    fflush( fpRecord );
+
+    bRecording = true;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_Scan
+ *
+ * Walk the inputs in a loaded log, counting them by source - and, once the
+ * indexes have been allocated, filling them in.  A log cut short (i.e. by
+ * killing the recording) ends at the last complete input.
+ *
+ * \param pu8Read_ First input in the log
+ * \param pu8End_  End of the log
+ * \param bIndex_  true to fill in the indexes
+ * \return true on success, false if the log contains an unknown source
+ */
+static bool Replay_Scan( const uint8_t *pu8Read_, const uint8_t *pu8End_, bool bIndex_ )
+{
+    uint64_t au64Stamp[REPLAY_SOURCE_COUNT];
+
+    memset( au64Stamp, 0, sizeof(au64Stamp) );
+    memset( au32InputCount, 0, sizeof(au32InputCount) );
+
+    while (pu8Read_ < pu8End_)
+    {
+        uint8_t u8Source = *pu8Read_++;
+        uint64_t u64Delta;
+        uint64_t u64Size;
+
+        if (u8Source >= REPLAY_SOURCE_COUNT)
+        {
+            return false;
+        }
+        if (!Replay_GetVarint( &pu8Read_, pu8End_, &u64Delta ) ||
+            !Replay_GetVarint( &pu8Read_, pu8End_, &u64Size ) ||
+            (u64Size > (uint64_t)(pu8End_ - pu8Read_)))
+        {
+            break;
+        }
+
+        au64Stamp[u8Source] += u64Delta;
+        if (bIndex_)
+        {
+            Replay_Input_t *pstInput = &apstInputs[u8Source][ au32InputCount[u8Source] ];
+            pstInput->u64Stamp = au64Stamp[u8Source];
+            pstInput->pu8Data = pu8Read_;
+            pstInput->u32Size = (uint32_t)u64Size;
+        }
+        au32InputCount[u8Source]++;
+        pu8Read_ += u64Size;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool Replay_Load( const char *szPath_ )
+{
+    const uint8_t *pu8Start;
+    const uint8_t *pu8End;
+    uint32_t u32Version;
+    long lSize;
+    FILE *fp;
+    int i;
+
+    fp = fopen( szPath_, "rb" );
+    if (!fp)
+    {
+        fprintf( stderr, "Unable to open input log %s\n", szPath_ );
+        return false;
+    }
+    fseek( fp, 0, SEEK_END );
+    lSize = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    pu8Log = (uint8_t*)malloc( (size_t)lSize + 1 );
+    if (!pu8Log || (lSize < (long)(strlen(REPLAY_MAGIC) + sizeof(u32Version))) ||
+        ((size_t)lSize != fread( pu8Log, 1, (size_t)lSize, fp )))
+    {
+        fprintf( stderr, "%s is not an input log\n", szPath_ );
+        fclose( fp );
+        return false;
+    }
+    fclose( fp );
+
+    memcpy( &u32Version, pu8Log + strlen(REPLAY_MAGIC), sizeof(u32Version) );
+    if (memcmp( pu8Log, REPLAY_MAGIC, strlen(REPLAY_MAGIC) ) || (u32Version != REPLAY_VERSION))
+    {
+        fprintf( stderr, "%s is not a compatible input log\n", szPath_ );
+        return false;
+    }
+
+    // Count the inputs from each source, then index them
+    pu8Start = pu8Log + strlen(REPLAY_MAGIC) + sizeof(u32Version);
+    pu8End = pu8Log + lSize;
+    if (!Replay_Scan( pu8Start, pu8End, false ))
+    {
+        fprintf( stderr, "%s contains inputs from an unknown source\n", szPath_ );
+        return false;
+    }
+    for (i = 0; i < REPLAY_SOURCE_COUNT; i++)
+    {
+        apstInputs[i] = (Replay_Input_t*)malloc( sizeof(Replay_Input_t) * (au32InputCount[i] + 1) );
+        au32NextInput[i] = 0;
+    }
+    Replay_Scan( pu8Start, pu8End, true );
+
+    bPlaying = true;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool Replay_Init( const char *szPath_, bool bRecord_ )
+{
+    if (bRecord_)
+    {
+        return Replay_Create( szPath_ );
+    }
+    return Replay_Load( szPath_ );
+}
+
+//---------------------------------------------------------------------------
+bool Replay_IsRecording( void )
+{
+    return bRecording;
+}
+
+//---------------------------------------------------------------------------
+bool Replay_IsPlaying( void )
+{
+    return bPlaying;
+}
+
+//---------------------------------------------------------------------------
+void Replay_Record( Replay_Source_t eSource_, uint64_t u64Stamp_, const void *pvData_, uint32_t u32Size_ )
+{
+    if (!bRecording)
+    {
+        return;
+    }
+
+    fputc( (uint8_t)eSource_, fpRecord );
+    Replay_PutVarint( u64Stamp_ - au64LastStamp[eSource_] );
+    Replay_PutVarint( u32Size_ );
+    fwrite( pvData_, 1, u32Size_, fpRecord );
+    fflush( fpRecord );
+
+    au64LastStamp[eSource_] = u64Stamp_;
+}
+
+//---------------------------------------------------------------------------
+int32_t Replay_Play( Replay_Source_t eSource_, uint64_t u64Stamp_, void *pvData_, uint32_t u32Size_ )
+{
+    const Replay_Input_t *pstInput;
+
+    if (!bPlaying || (au32NextInput[eSource_] == au32InputCount[eSource_]))
+    {
+        return -1;
+    }
+
+    pstInput = &apstInputs[eSource_][ au32NextInput[eSource_] ];
+    if (pstInput->u64Stamp > u64Stamp_)
+    {
+        return -1;
+    }
+    au32NextInput[eSource_]++;
+
+    if (u32Size_ > pstInput->u32Size)
+    {
+        u32Size_ = pstInput->u32Size;
+    }
+    if (u32Size_)
+    {
+        memcpy( pvData_, pstInput->pu8Data, u32Size_ );
+    }
+    return (int32_t)pstInput->u32Size;
+}
+
+#endif
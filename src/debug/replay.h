@@ -0,0 +1,120 @@
+/****************************************************************************
+ *     (     (                      (     |
+ *    )\ )  )\ )    (              )\ )   |
+ *   (()/( (()/(    )\     (   (  (()/(   | -- [ Funkenstein ] -------------
+ *    /(_)) /(_))((((_)()\  )\  /(_))     | -- [ Litle ] -------------------
+ *   (_))_|(_))   )\ _ )\ ((_)((_)(_))    | -- [ AVR ] ---------------------
+ *   | |_  | |    (_)_\(_)\ \ / / | _ \   | -- [ Virtual ] -----------------
+ *   | __| | |__   / _ \   \ V /  |   /   | -- [ Runtime ] -----------------
+ *   |_|   |____| /_/ \_\   \_/   |_|_\   |
+ *                                        | "Yeah, it does Arduino..."
+ * ---------------------------------------+----------------------------------
+ * (c) Copyright 2014-17, Funkenstein Software Consulting, All rights reserved
+ *     See license.txt for details
+ ****************************************************************************/
+/*!
+    \file   replay.h
+
+    \brief  Record and replay of external inputs - logs everything the
+            emulated program receives from the host, so that a run can be
+            repeated exactly without the host.
+
+    The inputs logged are bytes received on the UART socket, breaks sent by
+    the GDB client, the results of kernel-aware file operations (with the data
+    read), and kernel-aware joystick state.  Each is stamped with the time it
+    was delivered to the program - the peripheral clock tick for the UART,
+    and the CPU cycle count for everything else.
+
+    When replaying, each input is delivered at the first point its source is
+    checked at or after its stamp - which, running the same program with the
+    same options, is exactly where it was recorded.  Sources are replayed
+    independently of each other, and neither the sockets nor the host files
+    are touched.  Changes made to the program's state from the debugger
+    (other than stopping it) aren't recorded.
+*/
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emu_config.h"
+
+//---------------------------------------------------------------------------
+/*!
+    Sources of external input.  The values are stored in the log, so new
+    sources must be added at the end.
+*/
+typedef enum
+{
+    REPLAY_UART_RX,         //!< Byte received on the UART socket
+    REPLAY_GDB_BREAK,       //!< Break sent by the GDB client (no data)
+    REPLAY_KA_OPEN,         //!< Kernel-aware file open - host file descriptor (int32_t)
+    REPLAY_KA_READ,         //!< Kernel-aware file read - result (int32_t), then the data read
+    REPLAY_KA_WRITE,        //!< Kernel-aware file write - result (int32_t)
+    REPLAY_JOYSTICK,        //!< Kernel-aware joystick state (uint8_t), on each change
+//---
+    REPLAY_SOURCE_COUNT
+} Replay_Source_t;
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_Init
+ *
+ * Start recording inputs to a log file, or replaying them from one.
+ *
+ * \param szPath_   Path of the log file
+ * \param bRecord_  true to create the log and record to it, false to replay
+ *                  an existing log
+ * \return true on success, false if the log couldn't be created or read
+ */
+bool Replay_Init( const char *szPath_, bool bRecord_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_IsRecording
+ *
+ * \return true if inputs are being recorded
+ */
+bool Replay_IsRecording( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_IsPlaying
+ *
+ * \return true if inputs are being replayed, and so mustn't be read from the
+ *         host
+ */
+bool Replay_IsPlaying( void );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_Record
+ *
+ * Log an input, if recording.  The log is flushed after each input, so that
+ * nothing is lost if the emulator is killed.
+ *
+ * \param eSource_  Source of the input
+ * \param u64Stamp_ Time the input was delivered
+ * \param pvData_   Input data
+ * \param u32Size_  Size of the input data, in bytes
+ */
+void Replay_Record( Replay_Source_t eSource_, uint64_t u64Stamp_, const void *pvData_, uint32_t u32Size_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief Replay_Play
+ *
+ * Take the next input from a source, if replaying and it's due.
+ *
+ * \param eSource_  Source of the input
+ * \param u64Stamp_ Current time, on the same clock as the input was recorded
+ * \param pvData_   [out] Input data - the first u32Size_ bytes are copied
+ * \param u32Size_  Size of pvData_, in bytes
+ * \return Size of the input taken, or -1 if there's no input from the source
+ *         due by u64Stamp_
+ */
+int32_t Replay_Play( Replay_Source_t eSource_, uint64_t u64Stamp_, void *pvData_, uint32_t u32Size_ );
+
+#endif
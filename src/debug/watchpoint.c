@@ -26,6 +26,7 @@
 #include <stdlib.h>
 
 #include "watchpoint.h"
+#include "write_callout.h"
 
 //---------------------------------------------------------------------------
 void WatchPoint_Insert( uint16_t u16Addr_ )
@@ -51,6 +52,8 @@ void WatchPoint_Insert( uint16_t u16Addr_ )
         pstTemp->prev = pstNewWatch;
     }
     stCPU.pstWatchPoints = pstNewWatch;
+
+    WriteCallout_Watch( u16Addr_, true );
 }
 
 //---------------------------------------------------------------------------
@@ -85,6 +88,8 @@ void WatchPoint_Delete( uint16_t u16Addr_ )
             pstPrev = pstTemp;
             pstTemp = pstTemp->next;
             free(pstPrev);
+
+            WriteCallout_Watch( u16Addr_, false );
         }
         else
         {
@@ -36,6 +36,11 @@
 #include "avr_cpu_print.h"
 #include "avr_cpu.h"
 #include "avr_loader.h"
+#include "avr_aot.h"
+#include "avr_op_fusion.h"
+#include "avr_idle_loop.h"
+#include "avr_hle.h"
+#include "avr_snapshot.h"
 
 //---------------------------------------------------------------------------
 #include "mega_uart.h"
@@ -55,6 +60,10 @@
 #include "code_profile.h"
 #include "tlv_file.h"
 #include "gdb_rsp.h"
+#include "lockstep.h"
+#include "batch.h"
+#include "prefork.h"
+#include "replay.h"
 
 //---------------------------------------------------------------------------
 typedef enum
@@ -65,7 +74,12 @@ typedef enum
     ROM_TOO_BIG,
     INVALID_HEX_FILE,
     INVALID_VARIANT,
-    INVALID_DEBUG_OPTIONS
+    INVALID_DEBUG_OPTIONS,
+    INVALID_ENGINE,
+    INVALID_AOT_MODULE,
+    INVALID_STATE_FILE,
+    INVALID_REPLAY_LOG,
+    INVALID_LOCKSTEP_OPTIONS
 } ErrorReason_t;
 
 //---------------------------------------------------------------------------
@@ -116,6 +130,22 @@ void error_out( ErrorReason_t eReason_ )
             break;
         case INVALID_DEBUG_OPTIONS:
             printf( "GDB and built-in interactive debugger are mutually exclusive\n");
+            break;
+        case INVALID_ENGINE:
+            printf( "Unknown execution engine not supported\n");
+            break;
+        case INVALID_AOT_MODULE:
+            printf( "AOT module cannot be generated or loaded\n");
+            break;
+        case INVALID_STATE_FILE:
+            printf( "Machine state file cannot be saved or loaded\n");
+            break;
+        case INVALID_REPLAY_LOG:
+            printf( "Input log cannot be recorded or replayed\n");
+            break;
+        case INVALID_LOCKSTEP_OPTIONS:
+            printf( "Lockstep checking cannot be combined with --uart or --mark3\n");
+            break;
         default:
             printf( "Some other reason\n" );
     }
@@ -131,6 +161,8 @@ void emulator_loop(void)
     bool bUseTrace = false;
     bool bProfile = false;
     bool bUseGDB = false;
+    bool bLockstep = false;
+    uint32_t u32Batch = 1;
 
     if ( Options_GetByName("--trace") && Options_GetByName("--debug") )
     {
@@ -147,6 +179,20 @@ void emulator_loop(void)
         bUseGDB = true;
     }
 
+#if FEATURE_USE_LOCKSTEP
+    if ( Options_GetByName("--lockstep"))
+    {
+        bLockstep = true;
+    }
+#endif
+
+    // If there's nothing that needs to inspect the CPU between instructions,
+    // hand the CPU over to the execution engine in large batches.
+    if (!bUseGDB && !bProfile && !Options_GetByName("--debug"))
+    {
+        u32Batch = CONFIG_EXECUTION_BATCH_SIZE;
+    }
+
     while (1)
     {
         // Check to see if we've hit a breakpoint
@@ -184,8 +230,15 @@ void emulator_loop(void)
             Profile_Hit(stCPU.u32PC);
         }
 
-        // Execute a machine cycle
-        CPU_RunCycle();
+        // Execute machine cycle(s)
+#if FEATURE_USE_LOCKSTEP
+        if (bLockstep)
+        {
+            Lockstep_Run( u32Batch );
+            continue;
+        }
+#endif
+        CPU_Run( u32Batch );
     }
     // doesn't return, except by quitting from debugger, or by signal.
 }
@@ -227,6 +280,32 @@ void flavr_disasm(void)
     exit(0);
 }
 
+//---------------------------------------------------------------------------
+bool engine_by_name( const char *szName_, CPU_Engine_t *peEngine_ )
+{
+    if (0 == strcmp(szName_, "interpreter"))
+    {
+        *peEngine_ = CPU_ENGINE_INTERPRETER;
+    }
+#if FEATURE_USE_THREADED_ENGINE
+    else if (0 == strcmp(szName_, "threaded"))
+    {
+        *peEngine_ = CPU_ENGINE_THREADED;
+    }
+#endif
+#if FEATURE_USE_JIT
+    else if (0 == strcmp(szName_, "jit"))
+    {
+        *peEngine_ = CPU_ENGINE_JIT;
+    }
+#endif
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
 //---------------------------------------------------------------------------
 void emulator_init(void)
 {
@@ -250,12 +329,28 @@ void emulator_init(void)
         stConfig.bExitOnReset = false;
     }
 
+    stConfig.bIdleSkip = !Options_GetByName("--no-idle-skip");
+    stConfig.bHLE = (Options_GetByName("--hle") != NULL);
+    stConfig.bFastIO = (Options_GetByName("--fast") != NULL);
+
     stConfig.u32EESize  = pstVariant->u32EESize;
     stConfig.u32RAMSize = pstVariant->u32RAMSize;
     stConfig.u32ROMSize = pstVariant->u32ROMSize;
     stConfig.pstFeatureMap = pstVariant->pstFeatures;
     stConfig.pstVectorMap = pstVariant->pstVectors;
 
+    if (!engine_by_name( Options_GetByName("--engine"), &stConfig.eEngine ))
+    {
+        error_out( INVALID_ENGINE );
+    }
+
+#if FEATURE_USE_AOT
+    if (Options_GetByName("--aot-load"))
+    {
+        stConfig.eEngine = CPU_ENGINE_AOT;
+    }
+#endif
+
     if (stConfig.u32EESize >= 32768)
     {
         error_out( EEPROM_TOO_BIG );
@@ -270,13 +365,42 @@ void emulator_init(void)
         error_out( RAM_TOO_SMALL );
     }
 
-    if (stConfig.u32ROMSize >= (256*1024))
+    if (stConfig.u32ROMSize > (256*1024))
     {
         error_out( ROM_TOO_BIG );
     }
 
     CPU_Init(&stConfig);
 
+#if FEATURE_USE_LOCKSTEP
+    if (Options_GetByName("--lockstep") || Options_GetByName("--fuzz"))
+    {
+        CPU_Engine_t eReference = CPU_ENGINE_INTERPRETER;
+
+        if (Options_GetByName("--lockstep") &&
+            !engine_by_name( Options_GetByName("--lockstep"), &eReference ))
+        {
+            error_out( INVALID_ENGINE );
+        }
+
+        // Every forked probe would share the UART socket and the kernel-aware
+        // plugin's host files with the emulator, and consume their input.
+        if (Options_GetByName("--lockstep") &&
+            (Options_GetByName("--uart") || Options_GetByName("--mark3")))
+        {
+            error_out( INVALID_LOCKSTEP_OPTIONS );
+        }
+        Lockstep_Init( eReference, (uint32_t)strtoul( Options_GetByName("--lockstep-interval"), NULL, 10 ) );
+    }
+
+    if (Options_GetByName("--fuzz"))
+    {
+        // Tests run on the bare CPU, without a program or peripherals
+        exit( Lockstep_Fuzz( (uint32_t)strtoul( Options_GetByName("--fuzz"), NULL, 10 ),
+                             (uint32_t)strtoul( Options_GetByName("--fuzz-seed"), NULL, 10 ) ) ? -1 : 0 );
+    }
+#endif
+
     TraceBuffer_Init( &stTraceBuffer );
 
     if (Options_GetByName("--hexfile"))
@@ -292,6 +416,9 @@ void emulator_init(void)
         {
             error_out( INVALID_HEX_FILE );
         }
+#if FEATURE_USE_HLE
+        AVR_HLE_Bind();
+#endif
     }
     else
     {
@@ -304,6 +431,43 @@ void emulator_init(void)
         flavr_disasm();
     }
 
+#if FEATURE_USE_AOT
+    if (Options_GetByName("--aot-emit"))
+    {
+        // terminates after the translated program is written out
+        if (!AVR_AOT_Emit( Options_GetByName("--aot-emit") ))
+        {
+            error_out( INVALID_AOT_MODULE );
+        }
+        exit(0);
+    }
+
+    if (Options_GetByName("--aot-load"))
+    {
+        if (!AVR_AOT_Load( Options_GetByName("--aot-load") ))
+        {
+            error_out( INVALID_AOT_MODULE );
+        }
+    }
+#endif
+
+#if FEATURE_USE_REPLAY
+    // Must be set up before the peripherals and debugger, which check whether
+    // to connect to the host at all
+    if (Options_GetByName("--record") && Options_GetByName("--replay"))
+    {
+        error_out( INVALID_REPLAY_LOG );
+    }
+    if (Options_GetByName("--record") && !Replay_Init( Options_GetByName("--record"), true ))
+    {
+        error_out( INVALID_REPLAY_LOG );
+    }
+    if (Options_GetByName("--replay") && !Replay_Init( Options_GetByName("--replay"), false ))
+    {
+        error_out( INVALID_REPLAY_LOG );
+    }
+#endif
+
     if (Options_GetByName("--debug"))
     {
         Interactive_Init( &stTraceBuffer );
@@ -346,8 +510,156 @@ void emulator_init(void)
         Profile_Init( stConfig.u32ROMSize );
         atexit( Profile_Print );
     }
+
+#if FEATURE_USE_FUSION
+    if (Options_GetByName("--fusion-report"))
+    {
+        atexit( AVR_Fusion_Report );
+    }
+#endif
+
+#if FEATURE_USE_SLEEP_SKIP
+    if (Options_GetByName("--sleep-report"))
+    {
+        atexit( CPU_SleepReport );
+    }
+#endif
+
+#if FEATURE_USE_IDLE_LOOPS
+    if (Options_GetByName("--idle-report"))
+    {
+        atexit( AVR_IdleLoop_Report );
+    }
+#endif
+
+#if FEATURE_USE_HLE
+    if (Options_GetByName("--hle-report"))
+    {
+        atexit( AVR_HLE_Report );
+    }
+#endif
+}
+
+#if FEATURE_USE_STATE_FILE
+//---------------------------------------------------------------------------
+uint64_t state_hash( uint64_t u64Hash_, const void *pvData_, size_t szLen_ )
+{
+    // 64-bit FNV-1a
+    const uint8_t *pu8Data = (const uint8_t*)pvData_;
+
+    while (szLen_--)
+    {
+        u64Hash_ ^= *pu8Data++;
+        u64Hash_ *= 1099511628211ULL;
+    }
+    return u64Hash_;
+}
+
+//---------------------------------------------------------------------------
+uint64_t state_key(void)
+{
+    // A state file only applies to the programming file, variant and options
+    // that determine the machine it was saved from.
+    static const char *aszOptions[] = { "--variant", "--hle", "--fast" };
+    const char *szProgram;
+    uint64_t u64Hash = 14695981039346656037ULL;
+    uint8_t au8Buf[4096];
+    size_t szRead;
+    uint32_t i;
+    FILE *fp;
+
+    szProgram = Options_GetByName("--hexfile");
+    if (!szProgram)
+    {
+        szProgram = Options_GetByName("--elffile");
+    }
+
+    fp = fopen( szProgram, "rb" );
+    if (!fp)
+    {
+        error_out( INVALID_HEX_FILE );
+    }
+    while ((szRead = fread( au8Buf, 1, sizeof(au8Buf), fp )) > 0)
+    {
+        u64Hash = state_hash( u64Hash, au8Buf, szRead );
+    }
+    fclose( fp );
+
+    for (i = 0; i < sizeof(aszOptions) / sizeof(aszOptions[0]); i++)
+    {
+        const char *szValue = Options_GetByName( aszOptions[i] );
+
+        // Include the terminator, so that an unset option hashes differently
+        // from an empty one
+        u64Hash = state_hash( u64Hash, aszOptions[i], strlen(aszOptions[i]) + 1 );
+        if (szValue)
+        {
+            u64Hash = state_hash( u64Hash, szValue, strlen(szValue) + 1 );
+        }
+    }
+    return u64Hash;
+}
+
+//---------------------------------------------------------------------------
+void flavr_save_state(void)
+{
+    CPU_Snapshot_t *pstSnapshot;
+    const char *szAt = Options_GetByName("--at");
+    Batch_Exit_t eExit;
+    bool bOk;
+
+    if (szAt)
+    {
+        eExit = Batch_RunTo( szAt );
+        if (eExit == BATCH_EXIT_ERROR)
+        {
+            error_out( INVALID_STATE_FILE );
+        }
+        if (eExit != BATCH_EXIT_LIMIT)
+        {
+            fprintf( stderr, "Program exited before reaching %s\n", szAt );
+            error_out( INVALID_STATE_FILE );
+        }
+    }
+
+    pstSnapshot = CPU_SnapshotAlloc();
+    if (!pstSnapshot)
+    {
+        error_out( INVALID_STATE_FILE );
+    }
+    CPU_SnapshotSave( pstSnapshot );
+    bOk = CPU_SnapshotWrite( pstSnapshot, Options_GetByName("--save-state"), state_key() );
+    CPU_SnapshotFree( pstSnapshot );
+
+    if (!bOk)
+    {
+        error_out( INVALID_STATE_FILE );
+    }
+    exit(0);
 }
 
+//---------------------------------------------------------------------------
+void flavr_load_state(void)
+{
+    CPU_Snapshot_t *pstSnapshot;
+    bool bOk;
+
+    pstSnapshot = CPU_SnapshotMap( Options_GetByName("--load-state"), state_key() );
+    if (!pstSnapshot)
+    {
+        error_out( INVALID_STATE_FILE );
+    }
+    bOk = CPU_SnapshotRestore( pstSnapshot );
+    CPU_SnapshotFree( pstSnapshot );
+
+    if (!bOk)
+    {
+        fprintf( stderr, "%s was saved with different peripherals\n", Options_GetByName("--load-state") );
+        error_out( INVALID_STATE_FILE );
+    }
+}
+#endif
+
 //---------------------------------------------------------------------------
 int main( int argc, char **argv )
 {    
@@ -360,8 +672,46 @@ int main( int argc, char **argv )
         splash();
     }
 
+#if FEATURE_USE_BATCH
+    if (Options_GetByName("--batch"))
+    {
+        Batch_Config_t stBatch;
+
+        stBatch.szManifest = Options_GetByName("--batch");
+        stBatch.szResults = Options_GetByName("--batch-out");
+        stBatch.u32Threads = (uint32_t)strtoul( Options_GetByName("--threads"), NULL, 10 );
+        stBatch.pfAddPlugins = add_plugins;
+        stBatch.pfEngineByName = engine_by_name;
+
+        // Each job runs in its own emulator instance - nothing else to set up
+        return Batch_Run( &stBatch ) ? -1 : 0;
+    }
+#endif
+
     emulator_init();
 
+#if FEATURE_USE_STATE_FILE
+    // Loading first allows a state to be saved from a later point, starting
+    // from an earlier one
+    if (Options_GetByName("--load-state"))
+    {
+        flavr_load_state();
+    }
+    if (Options_GetByName("--save-state"))
+    {
+        // terminates after the state is saved
+        flavr_save_state();
+    }
+#endif
+
+#if FEATURE_USE_PREFORK
+    if (Options_GetByName("--prefork"))
+    {
+        // Only returns on error
+        return Prefork_Run( Options_GetByName("--prefork"), Options_GetByName("--prefork-ready") );
+    }
+#endif
+
     // Run the emulator/debugger loop.
     emulator_loop();
 
@@ -1,5 +1,6 @@
 #include "kernel_aware.h"
 #include "debug_sym.h"
+#include "replay.h"
 
 #include "ka_file.h"
 
@@ -55,6 +56,7 @@ void KA_Command_Open(void)
     {
         OpenReturn_t *pstReturn = (OpenReturn_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
         pstReturn->iHostFd = -1;
+        CPU_DirtyRAMRange( pstSymbol->u32StartAddr, sizeof(OpenReturn_t) );
         return;
     }
 
@@ -71,10 +73,26 @@ void KA_Command_Open(void)
         flags |= O_TRUNC;
     }
 
-    int fd = open(path, flags, 0660);
+    int32_t fd;
+#if FEATURE_USE_REPLAY
+    if (Replay_IsPlaying())
+    {
+        // Replaying - the host files aren't touched, results come from the log
+        fd = -1;
+        Replay_Play( REPLAY_KA_OPEN, stCPU.u64CycleCount, &fd, sizeof(fd) );
+    }
+    else
+    {
+        fd = open(path, flags, 0660);
+        Replay_Record( REPLAY_KA_OPEN, stCPU.u64CycleCount, &fd, sizeof(fd) );
+    }
+#else
+    fd = open(path, flags, 0660);
+#endif
 
     OpenReturn_t *pstReturn = (OpenReturn_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     pstReturn->iHostFd = fd;
+    CPU_DirtyRAMRange( pstSymbol->u32StartAddr, sizeof(OpenReturn_t) );
 }
 
 //---------------------------------------------------------------------------
@@ -89,6 +107,12 @@ void KA_Command_Close(void)
     {
         return;
     }
+#if FEATURE_USE_REPLAY
+    if (Replay_IsPlaying())
+    {
+        return;
+    }
+#endif
     CloseRequest_t *pstClose = (CloseRequest_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     close(pstClose->iHostFd);
 }
@@ -104,6 +128,11 @@ typedef struct {
     int32_t iBytesRead;
 } KernelAwareReadReturn_t;
 
+#if FEATURE_USE_REPLAY
+// Logged reads - the result, followed by the data read
+static uint8_t au8ReadLog[ sizeof(int32_t) + UINT16_MAX ];
+#endif
+
 void KA_Command_Read(void)
 {
     Debug_Symbol_t *pstSymbol = Symbol_Find_Obj_By_Name( "g_stKAData" );
@@ -114,10 +143,44 @@ void KA_Command_Read(void)
 
     KernelAwareRead_t *pstRead = (KernelAwareRead_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     void* pvReadPtr = (void*)&stCPU.pstRAM->au8RAM[ pstRead->u16ReadBufAddress ];
-    size_t iBytesRead = read(pstRead->iHostFd, pvReadPtr, pstRead->u16BytesToRead);
+    ssize_t iBytesRead;
+#if FEATURE_USE_REPLAY
+    if (Replay_IsPlaying())
+    {
+        int32_t iLogSize = Replay_Play( REPLAY_KA_READ, stCPU.u64CycleCount, au8ReadLog, sizeof(au8ReadLog) );
+        int32_t iResult = -1;
+        if (iLogSize >= (int32_t)sizeof(int32_t))
+        {
+            memcpy( &iResult, au8ReadLog, sizeof(iResult) );
+            iLogSize -= sizeof(int32_t);
+            if (iLogSize > pstRead->u16BytesToRead)
+            {
+                iLogSize = pstRead->u16BytesToRead;
+            }
+            memcpy( pvReadPtr, &au8ReadLog[ sizeof(int32_t) ], iLogSize );
+        }
+        iBytesRead = iResult;
+    }
+    else
+    {
+        iBytesRead = read(pstRead->iHostFd, pvReadPtr, pstRead->u16BytesToRead);
+        if (Replay_IsRecording())
+        {
+            int32_t iResult = (int32_t)iBytesRead;
+            uint32_t u32DataSize = (iResult > 0) ? (uint32_t)iResult : 0;
+            memcpy( au8ReadLog, &iResult, sizeof(iResult) );
+            memcpy( &au8ReadLog[ sizeof(int32_t) ], pvReadPtr, u32DataSize );
+            Replay_Record( REPLAY_KA_READ, stCPU.u64CycleCount, au8ReadLog, sizeof(int32_t) + u32DataSize );
+        }
+    }
+#else
+    iBytesRead = read(pstRead->iHostFd, pvReadPtr, pstRead->u16BytesToRead);
+#endif
+    CPU_DirtyRAMRange( pstRead->u16ReadBufAddress, pstRead->u16BytesToRead );
 
     KernelAwareReadReturn_t *pstReadResult = (KernelAwareReadReturn_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     pstReadResult->iBytesRead = iBytesRead;
+    CPU_DirtyRAMRange( pstSymbol->u32StartAddr, sizeof(KernelAwareReadReturn_t) );
 }
 
 //---------------------------------------------------------------------------
@@ -141,10 +204,25 @@ void KA_Command_Write(void)
 
     KernelAwareWrite_t *pstWrite = (KernelAwareWrite_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     void* pvWritePtr = (void*)&stCPU.pstRAM->au8RAM[ pstWrite->u16WriteBufAddress ];
-    size_t iBytesWritten = write(pstWrite->iHostFd, pvWritePtr, pstWrite->u16BytesToWrite );
+    int32_t iBytesWritten;
+#if FEATURE_USE_REPLAY
+    if (Replay_IsPlaying())
+    {
+        iBytesWritten = -1;
+        Replay_Play( REPLAY_KA_WRITE, stCPU.u64CycleCount, &iBytesWritten, sizeof(iBytesWritten) );
+    }
+    else
+    {
+        iBytesWritten = write(pstWrite->iHostFd, pvWritePtr, pstWrite->u16BytesToWrite );
+        Replay_Record( REPLAY_KA_WRITE, stCPU.u64CycleCount, &iBytesWritten, sizeof(iBytesWritten) );
+    }
+#else
+    iBytesWritten = write(pstWrite->iHostFd, pvWritePtr, pstWrite->u16BytesToWrite );
+#endif
 
     KernelAwareWriteReturn_t *pstWriteReturn = (KernelAwareWriteReturn_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     pstWriteReturn->iBytesWritten = iBytesWritten;
+    CPU_DirtyRAMRange( pstSymbol->u32StartAddr, sizeof(KernelAwareWriteReturn_t) );
 }
 
 //---------------------------------------------------------------------------
@@ -161,6 +239,12 @@ void KA_Command_Blocking(void)
         return;
     }
 
+#if FEATURE_USE_REPLAY
+    if (Replay_IsPlaying())
+    {
+        return;
+    }
+#endif
     KernelAwareBlocking_t *pstBlocking = (KernelAwareBlocking_t*)&stCPU.pstRAM->au8RAM[ pstSymbol->u32StartAddr ];
     int flags = fcntl(pstBlocking->iHostFd, F_GETFL);
     if (!pstBlocking->bBlocking)
@@ -32,7 +32,7 @@
 #include "tlv_file.h"
 
 //---------------------------------------------------------------------------
-static TLV_t *pstTLV = NULL;
+static EMU_INSTANCE TLV_t *pstTLV = NULL;
 
 //---------------------------------------------------------------------------
 typedef struct
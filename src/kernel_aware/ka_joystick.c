@@ -30,6 +30,7 @@
 #include "write_callout.h"
 #include "debug_sym.h"
 #include "avr_cpu.h"
+#include "replay.h"
 
 //---------------------------------------------------------------------------
 #define FLAVR_JOY_UP		0x01
@@ -55,6 +56,20 @@ static bool KA_Scan_Joystick( uint16_t u16Addr_, uint8_t u8Data_ )
 
     uint16_t u16Addr = (uint16_t)(pstSymbol->u32StartAddr & 0x0000FFFF);
 
+#if FEATURE_USE_REPLAY
+    uint8_t u8LastVal = u8Val;
+    if (Replay_IsPlaying())
+    {
+        // Take every change logged up to now, instead of polling the keyboard
+        while (Replay_Play( REPLAY_JOYSTICK, stCPU.u64CycleCount, &u8Val, sizeof(u8Val) ) >= 0)
+        {
+        }
+        stCPU.pstRAM->au8RAM[ u16Addr ] = u8Val;
+        CPU_DirtyRAM( u16Addr );
+        return true;
+    }
+#endif
+
     SDL_Event stEvent;
 
     while (SDL_PollEvent(&stEvent))
@@ -117,7 +132,15 @@ static bool KA_Scan_Joystick( uint16_t u16Addr_, uint8_t u8Data_ )
         }
     }
 
+#if FEATURE_USE_REPLAY
+    if (u8Val != u8LastVal)
+    {
+        Replay_Record( REPLAY_JOYSTICK, stCPU.u64CycleCount, &u8Val, sizeof(u8Val) );
+    }
+#endif
+
     stCPU.pstRAM->au8RAM[ u16Addr ] = u8Val;
+    CPU_DirtyRAM( u16Addr );
 
     return true;
 }
@@ -34,11 +34,11 @@
 //---------------------------------------------------------------------------
 //!! This is all singleton data... could be better hosted in a struct...
 //!! Especially if Mark3 ever supports multiple concurrent Profilers
-static uint64_t u64ProfileEpochStart = 0;
-static uint64_t u64ProfileTotal = 0;
-static uint64_t u64ProfileCount = 0;
-static char szNameBuffer[32] = {};
-static TLV_t *pstTLV = NULL;
+static EMU_INSTANCE uint64_t u64ProfileEpochStart = 0;
+static EMU_INSTANCE uint64_t u64ProfileTotal = 0;
+static EMU_INSTANCE uint64_t u64ProfileCount = 0;
+static EMU_INSTANCE char szNameBuffer[32] = {};
+static EMU_INSTANCE TLV_t *pstTLV = NULL;
 
 //---------------------------------------------------------------------------
 typedef struct
@@ -112,17 +112,17 @@ typedef struct
 } Mark3ContextSwitch_TLV_t;
 
 //---------------------------------------------------------------------------
-static uint64_t u64IdleTime = 0;
-static FILE *fKernelState = NULL;
-static FILE *fInterrupts = NULL;
-static Mark3_Thread_Info_t *pstThreadInfo = NULL;
-static uint16_t u16NumThreads = 0;
-
-static Mark3_Thread_t *pstLastThread = NULL;
-static uint64_t u64LastTime = 0;
-static uint8_t u8LastPri = 255;
+static EMU_INSTANCE uint64_t u64IdleTime = 0;
+static EMU_INSTANCE FILE *fKernelState = NULL;
+static EMU_INSTANCE FILE *fInterrupts = NULL;
+static EMU_INSTANCE Mark3_Thread_Info_t *pstThreadInfo = NULL;
+static EMU_INSTANCE uint16_t u16NumThreads = 0;
+
+static EMU_INSTANCE Mark3_Thread_t *pstLastThread = NULL;
+static EMU_INSTANCE uint64_t u64LastTime = 0;
+static EMU_INSTANCE uint8_t u8LastPri = 255;
 //---------------------------------------------------------------------------
-static TLV_t *pstTLV = NULL;
+static EMU_INSTANCE TLV_t *pstTLV = NULL;
 
 //---------------------------------------------------------------------------
 static void Mark3KA_AddKnownThread( Mark3_Thread_t *pstThread_ )
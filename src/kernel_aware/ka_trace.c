@@ -41,7 +41,7 @@ typedef struct
 } KernelAwareTrace_t;
 
 //---------------------------------------------------------------------------
-static TLV_t *pstTLV = NULL;
+static EMU_INSTANCE TLV_t *pstTLV = NULL;
 
 //---------------------------------------------------------------------------
 void KA_EmitTrace( KernelAwareCommand_t eCmd_ )
@@ -69,6 +69,7 @@ static bool KA_Set( uint16_t u16Addr_, uint8_t u8Data_ )
 {
     fprintf(stderr, "ADDR: [%04X], Data: [%02X]\n", u16Addr_, u8Data_ );
     stCPU.pstRAM->au8RAM[ u16Addr_ & 0xFFFF ] = 1;
+    CPU_DirtyRAM( u16Addr_ & 0xFFFF );
     return false;
 }
 
@@ -27,10 +27,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "emu_config.h"
 #include "tlv_file.h"
 
 //---------------------------------------------------------------------------
-static FILE *fMyFile = NULL;
+static EMU_INSTANCE FILE *fMyFile = NULL;
 
 //---------------------------------------------------------------------------
 void TLV_WriteInit( const char *szPath_ )
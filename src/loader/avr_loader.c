@@ -36,18 +36,29 @@
 #include "debug_sym.h"
 
 //---------------------------------------------------------------------------
-static void AVR_Copy_Record( HEX_Record_t *pstHex_)
+static bool AVR_Copy_Record( HEX_Record_t *pstHex_, uint32_t u32Base_ )
 {
+    uint32_t u32Addr = u32Base_ + pstHex_->u16Address;
     uint16_t u16Data;
     uint16_t i;
+
+    if ((u32Addr + pstHex_->u8ByteCount) > stCPU.u32ROMSize)
+    {
+        fprintf(stderr, "Record at 0x%06X (line %d) is outside of ROM\n", u32Addr, pstHex_->u32Line);
+        return false;
+    }
+
     for (i = 0; i < pstHex_->u8ByteCount; i += 2)
     {
         u16Data = pstHex_->u8Data[i+1];
         u16Data <<= 8;
         u16Data |= pstHex_->u8Data[i];
 
-        stCPU.pu16ROM[(pstHex_->u16Address + i) >> 1] = u16Data;
+        stCPU.pu16ROM[(u32Addr + i) >> 1] = u16Data;
     }
+
+    CPU_InvalidateROM( u32Addr >> 1, (pstHex_->u8ByteCount + 1) >> 1 );
+    return true;
 }
 
 //---------------------------------------------------------------------------
@@ -82,7 +93,16 @@ bool AVR_Load_HEX( const char *szFilePath_)
         }
         if (RECORD_DATA == stRecord.u8RecordType)
         {
-            AVR_Copy_Record(&stRecord);
+            rc = AVR_Copy_Record(&stRecord, u32Addr);
+        }
+        // Parts with more than 64KB of ROM need the upper address bits
+        else if (RECORD_EXTENDED_SEGMENT == stRecord.u8RecordType)
+        {
+            u32Addr = (((uint32_t)stRecord.u8Data[0] << 8) | stRecord.u8Data[1]) << 4;
+        }
+        else if (RECORD_EXTENDED_LINEAR == stRecord.u8RecordType)
+        {
+            u32Addr = (((uint32_t)stRecord.u8Data[0] << 8) | stRecord.u8Data[1]) << 16;
         }
     }
 
@@ -172,6 +192,12 @@ bool AVR_Load_ELF( const char *szFilePath_)
                     &pu8Buffer[pstPHeader->u32Offset],
                     pstPHeader->u32FileSize );
         }
+        else if ((pstPHeader->u32PhysicalAddress + pstPHeader->u32MemSize) > stCPU.u32ROMSize)
+        {
+            fprintf(stderr, "Segment at 0x%06X is outside of ROM\n", pstPHeader->u32PhysicalAddress);
+            free( pu8Buffer );
+            return false;
+        }
         else
         {
             // Clear range in segment
@@ -183,6 +209,9 @@ bool AVR_Load_ELF( const char *szFilePath_)
             memcpy( &(stCPU.pu16ROM[pstPHeader->u32PhysicalAddress >> 1]),
                     &pu8Buffer[pstPHeader->u32Offset],
                     pstPHeader->u32FileSize );
+
+            CPU_InvalidateROM( pstPHeader->u32PhysicalAddress >> 1,
+                               (pstPHeader->u32MemSize + 1) >> 1 );
         }
 
         // Next Section...
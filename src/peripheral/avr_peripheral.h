@@ -33,11 +33,58 @@ typedef void (*PeriphInit) (void *context_ );
 typedef void (*PeriphRead) (void *context_, uint8_t ucAddr_, uint8_t *pucValue_ );
 typedef void (*PeriphWrite)(void *context_, uint8_t ucAddr_, uint8_t ucValue_ );
 typedef void (*PeriphClock)(void *context_ );
+typedef uint64_t (*PeriphNextEvent)(void *context_ );
+typedef void (*PeriphAdvance)(void *context_, uint64_t u64Ticks_ );
+typedef void (*PeriphSave)(void *context_, void *pvState_ );
+typedef void (*PeriphRestore)(void *context_, const void *pvState_ );
+
+//---------------------------------------------------------------------------
+//! Returned from a PeriphNextEvent callback when the peripheral is idle
+#define PERIPH_NO_EVENT     (UINT64_MAX)
 
 //---------------------------------------------------------------------------
 typedef void (*InterruptAck)( uint8_t ucVector_);
 
 //---------------------------------------------------------------------------
+/*!
+    Peripheral descriptor.
+
+    Peripherals that only provide pfClock are clocked on every CPU cycle.
+    Peripherals that also provide pfNextEvent are event-driven: pfNextEvent
+    returns the absolute peripheral tick (stCPU.u64IOTicks) at which pfClock
+    next has to run, or PERIPH_NO_EVENT, and pfClock is only called on those
+    ticks.  The ticks in between are skipped, so the peripheral must account
+    for them itself - when its clock next runs, and before any register write
+    that depends on them.  pfNextEvent is re-evaluated after the peripheral's
+    clock runs and after each write to its registers; use IO_Reschedule() if
+    its timing can change any other way.
+
+    While the CPU is idle (asleep, or in a loop that reads nothing in the IO
+    range - see CPU_IsIdle()), nothing can observe the peripheral's registers,
+    so pfNextEvent may look past updates that can't raise an interrupt (i.e.
+    timer counts between overflows) and return the next tick that can.  It's
+    re-evaluated when the CPU stops being idle, and whenever the CPU state is
+    about to be inspected, so pfNextEvent must also bring any state it advances lazily up
+    to date with the current tick before returning.
+
+    Event-driven peripherals may also provide pfAdvance, used in place of
+    pfClock in fast IO mode (see AVR_CPU_Config_t::bFastIO).  Peripherals are
+    then only serviced once per instruction: pfAdvance is passed the number of
+    ticks elapsed since (and including) the peripheral's scheduled event, the
+    last of which is the current tick, and must leave the peripheral as if its
+    clock had run on each of them.  In fast IO mode the CPU is also treated as
+    idle for the purpose of looking ahead (see IO_CanLookAhead()), so any
+    register a peripheral lets fall behind must be brought up to date by its
+    pfRead handler.
+
+    Peripherals with private state (anything not held in their I/O registers)
+    provide pfSave and pfRestore, which copy that state to and from a buffer
+    of u32StateSize bytes when the CPU is snapshotted (see avr_snapshot.h).
+    Lazily-advanced state is brought up to date (through pfNextEvent) before
+    pfSave is called, and the scheduler re-evaluates pfNextEvent after
+    pfRestore.  Where several descriptors share the same state, only one of
+    them provides the hooks.
+*/
 typedef struct AVRPeripheral
 {
     PeriphInit          pfInit;
@@ -49,6 +96,29 @@ typedef struct AVRPeripheral
 
     uint8_t             u8AddrStart;
     uint8_t             u8AddrEnd;
+
+    PeriphNextEvent     pfNextEvent;
+    PeriphAdvance       pfAdvance;
+
+    uint32_t            u32StateSize;
+    PeriphSave          pfSave;
+    PeriphRestore       pfRestore;
 } AVRPeripheral;
 
+//---------------------------------------------------------------------------
+/*!
+    Helpers for implementing pfSave/pfRestore over a list of private state
+    variables, given as an X-macro:
+
+        #define TIMER_STATE(x)  x(u16DivRemain) x(u64LastTick) ...
+
+        typedef struct { TIMER_STATE(PERIPH_STATE_FIELD) } Timer_State_t;
+
+    The save and restore expansions copy each variable to and from the
+    matching field of a local named pstState.
+*/
+#define PERIPH_STATE_FIELD(x)       __typeof__(x) x;
+#define PERIPH_STATE_SAVE(x)        pstState->x = x;
+#define PERIPH_STATE_RESTORE(x)     x = pstState->x;
+
 #endif //__AVR_PERIPHERAL_H__
@@ -57,8 +57,9 @@ typedef enum
 } EEPROM_Mode_t;
 
 //---------------------------------------------------------------------------
-static EEPROM_State_t eState = EEPROM_STATE_IDLE;
-static uint32_t       u32CountDown = 0;
+static EMU_INSTANCE EEPROM_State_t eState = EEPROM_STATE_IDLE;
+static EMU_INSTANCE uint32_t       u32CountDown = 0;
+static EMU_INSTANCE uint64_t       u64LastTick = 0;  // Peripheral tick the countdown is current as of
 
 //---------------------------------------------------------------------------
 static void EEARH_Write( uint8_t u8Addr_ )
@@ -165,11 +166,32 @@ static uint8_t EEDR_Read(void)
     return stCPU.pstRAM->stRegisters.EEDR;
 }
 
+//---------------------------------------------------------------------------
+static void EEPROM_Sync( uint64_t u64Tick_ )
+{
+    if (u32CountDown)
+    {
+        u32CountDown -= (uint32_t)(u64Tick_ - u64LastTick);
+    }
+    u64LastTick = u64Tick_;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t EEPROM_NextEvent(void *context_ )
+{
+    if (!u32CountDown)
+    {
+        return PERIPH_NO_EVENT;
+    }
+    return u64LastTick + u32CountDown;
+}
+
 //---------------------------------------------------------------------------
 static void EEPROM_Init(void *context_ )
 {
     eState = EEPROM_STATE_IDLE;
     u32CountDown = 0;
+    u64LastTick = 0;
 }
 
 //---------------------------------------------------------------------------
@@ -189,6 +211,8 @@ static void EEPROM_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
     // libc implementation, which is very much "sunny case" code.  In short,
     // this will handle incorrectly-implemented code incorrectly.
 
+    EEPROM_Sync( stCPU.u64IOTicks );
+
     stCPU.pstRAM->stRegisters.EECR.r |= (ucValue_ & 0x3F);
 
     switch (eState)
@@ -252,6 +276,7 @@ static void EEPROM_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
                     default:
                         break;
                 }
+                CPU_DirtyEEPROM( EEAR_Read() );
             }
         }
             break;
@@ -260,9 +285,48 @@ static void EEPROM_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
     }
 }
 
+//---------------------------------------------------------------------------
+static void EEPROM_Complete(void)
+{
+    // We're only interested in the EECR register.
+    switch (eState)
+    {
+        case EEPROM_STATE_WRITE:
+        {
+            EEPE_Clear();
+            EERE_Clear();
+            EEMPE_Clear();
+
+            eState = EEPROM_STATE_IDLE;
+        }
+            break;
+        case EEPROM_STATE_READ:
+        {
+            EEPE_Clear();
+            EERE_Clear();
+            EEMPE_Clear();
+
+            eState = EEPROM_STATE_IDLE;
+        }
+            break;
+        case EEPROM_STATE_WRITE_ENABLE:
+        {
+            EEMPE_Clear();
+            EERE_Clear();
+            eState = EEPROM_STATE_IDLE;
+        }
+            break;
+        default:
+            break;
+    }
+}
+
 //---------------------------------------------------------------------------
 static void EEPROM_Clock(void *context_)
 {
+    // Catch up on the ticks skipped since the last event, then run this one
+    EEPROM_Sync( stCPU.u64IOTicks - 1 );
+    u64LastTick = stCPU.u64IOTicks;
 
     if (u32CountDown)
     {
@@ -271,41 +335,59 @@ static void EEPROM_Clock(void *context_)
         u32CountDown--;
         if (!u32CountDown)
         {
-            // We're only interested in the EECR register.
-            switch (eState)
-            {
-                case EEPROM_STATE_WRITE:
-                {
-                    EEPE_Clear();
-                    EERE_Clear();
-                    EEMPE_Clear();
+            EEPROM_Complete();
+        }
+    }
+}
 
-                    eState = EEPROM_STATE_IDLE;
-                }
-                    break;
-                case EEPROM_STATE_READ:
-                {
-                    EEPE_Clear();
-                    EERE_Clear();
-                    EEMPE_Clear();
+//---------------------------------------------------------------------------
+static void EEPROM_Advance(void *context_, uint64_t u64Ticks_)
+{
+    // There's only ever one operation in progress, so the countdown can't
+    // expire more than once.
+    EEPROM_Sync( stCPU.u64IOTicks - u64Ticks_ );
+    u64LastTick = stCPU.u64IOTicks;
 
-                    eState = EEPROM_STATE_IDLE;
-                }
-                    break;
-                case EEPROM_STATE_WRITE_ENABLE:
-                {
-                    EEMPE_Clear();
-                    EERE_Clear();
-                    eState = EEPROM_STATE_IDLE;
-                }
-                    break;
-                default:
-                    break;
-            }
+    if (u32CountDown)
+    {
+        if (u32CountDown <= u64Ticks_)
+        {
+            u32CountDown = 0;
+            EEPROM_Complete();
+        }
+        else
+        {
+            u32CountDown -= (uint32_t)u64Ticks_;
         }
     }
 }
 
+//---------------------------------------------------------------------------
+// Private state kept in CPU snapshots
+#define EEPROM_STATE(x) \
+    x(eState) \
+    x(u32CountDown) \
+    x(u64LastTick)
+
+typedef struct
+{
+    EEPROM_STATE(PERIPH_STATE_FIELD)
+} EEPROM_Snapshot_t;
+
+//---------------------------------------------------------------------------
+static void EEPROM_Save(void *context_, void *pvState_ )
+{
+    EEPROM_Snapshot_t *pstState = (EEPROM_Snapshot_t*)pvState_;
+    EEPROM_STATE(PERIPH_STATE_SAVE)
+}
+
+//---------------------------------------------------------------------------
+static void EEPROM_Restore(void *context_, const void *pvState_ )
+{
+    const EEPROM_Snapshot_t *pstState = (const EEPROM_Snapshot_t*)pvState_;
+    EEPROM_STATE(PERIPH_STATE_RESTORE)
+}
+
 //---------------------------------------------------------------------------
 AVRPeripheral stEEPROM =
 {
@@ -315,6 +397,11 @@ AVRPeripheral stEEPROM =
     EEPROM_Clock,
     0,
     0x3F,
-    0x3F
+    0x3F,
+    EEPROM_NextEvent,
+    EEPROM_Advance,
+    sizeof(EEPROM_Snapshot_t),
+    EEPROM_Save,
+    EEPROM_Restore
 };
 
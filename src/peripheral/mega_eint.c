@@ -42,17 +42,23 @@ typedef enum
 } InterruptSense_t;
 
 //---------------------------------------------------------------------------
-static InterruptSense_t eINT0Sense;
-static InterruptSense_t eINT1Sense;
-static InterruptSense_t eINT2Sense;
+static EMU_INSTANCE InterruptSense_t eINT0Sense;
+static EMU_INSTANCE InterruptSense_t eINT1Sense;
+static EMU_INSTANCE InterruptSense_t eINT2Sense;
 
-static uint8_t ucLastINT0;
-static uint8_t ucLastINT1;
-static uint8_t ucLastINT2;
+static EMU_INSTANCE uint8_t ucLastINT0;
+static EMU_INSTANCE uint8_t ucLastINT1;
+static EMU_INSTANCE uint8_t ucLastINT2;
+
+static EMU_INSTANCE uint64_t u64LastTick;    // Peripheral tick the pin history is current as of
+static EMU_INSTANCE bool     bSampled;       // Whether the pins have been sampled since the last register write/ack
 
 //---------------------------------------------------------------------------
 static void EINT_AckInt(  uint8_t ucVector_);
 
+//---------------------------------------------------------------------------
+extern AVRPeripheral stEINT_a;
+
 //---------------------------------------------------------------------------
 static void EINT_Init(void *context_ )
 {
@@ -65,6 +71,9 @@ static void EINT_Init(void *context_ )
     ucLastINT1 = 0;
     ucLastINT2 = 0;
 
+    u64LastTick = 0;
+    bSampled = false;
+
     // Register interrupt callback functions
     CPU_RegisterInterruptCallback(EINT_AckInt, stCPU.pstVectorMap->INT0);
     CPU_RegisterInterruptCallback(EINT_AckInt, stCPU.pstVectorMap->INT1);
@@ -177,10 +186,58 @@ static void EIMSK_Write( uint8_t ucValue_ )
     stCPU.pstRAM->stRegisters.EIMSK.r = ucValue_;
 }
 
+//---------------------------------------------------------------------------
+static bool EINT_IsEnabled( void )
+{
+    return ((stCPU.pstRAM->stRegisters.EIMSK.INT0 == 1) ||
+            (stCPU.pstRAM->stRegisters.EIMSK.INT1 == 1) ||
+            (stCPU.pstRAM->stRegisters.EIMSK.INT2 == 1));
+}
+
+//---------------------------------------------------------------------------
+static void EINT_Sync( uint64_t u64Tick_ )
+{
+    // While all external interrupts are masked, the pins are still sampled on
+    // every clock for edge detection - bring the samples up to date.
+    if (!EINT_IsEnabled() && (u64Tick_ != u64LastTick))
+    {
+        ucLastINT0 = stCPU.pstRAM->stRegisters.PORTD.PORT2;
+        ucLastINT1 = stCPU.pstRAM->stRegisters.PORTD.PORT3;
+        ucLastINT2 = stCPU.pstRAM->stRegisters.PORTB.PORT2;
+    }
+    u64LastTick = u64Tick_;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t EINT_NextEvent(void *context_ )
+{
+    // Pin changes aren't visible to the scheduler, so the pins have to be
+    // polled on every clock while any external interrupt is unmasked.
+    if (!EINT_IsEnabled())
+    {
+        return PERIPH_NO_EVENT;
+    }
+
+    // ... unless the CPU is idle, in which case nothing can change the pins.
+    // Once they've been sampled as they are now, later samples can't raise
+    // anything new.
+    if (CPU_IsIdle() && bSampled &&
+        (ucLastINT0 == stCPU.pstRAM->stRegisters.PORTD.PORT2) &&
+        (ucLastINT1 == stCPU.pstRAM->stRegisters.PORTD.PORT3) &&
+        (ucLastINT2 == stCPU.pstRAM->stRegisters.PORTB.PORT2))
+    {
+        return PERIPH_NO_EVENT;
+    }
+    return u64LastTick + 1;
+}
+
 //---------------------------------------------------------------------------
 static void EINT_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 {
     DEBUG_PRINT("EINT Write\n");
+    EINT_Sync( stCPU.u64IOTicks );
+    bSampled = false;
+
     switch (ucAddr_)
     {
     case 0x69:  // EICRA        
@@ -195,6 +252,9 @@ static void EINT_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
     default:
         break;
     }
+
+    // EIMSK belongs to stEINT_b, which shares stEINT_a's clock
+    IO_Reschedule( &stEINT_a );
 }
 
 //---------------------------------------------------------------------------
@@ -207,6 +267,10 @@ static void EINT_Clock(void *context_ )
     bool bSetINT1 = false;
     bool bSetINT2 = false;
 
+    // Catch up on the ticks skipped since the last event, then run this one
+    EINT_Sync( stCPU.u64IOTicks - 1 );
+    u64LastTick = stCPU.u64IOTicks;
+
     //!! ToDo - Consider adding support for external stimulus (which would
     //!! Invoke inputs on PIND as opposed to PORTD)...  This will only work
     //!! as software interrupts in its current state    
@@ -334,12 +398,14 @@ static void EINT_Clock(void *context_ )
     ucLastINT0 = stCPU.pstRAM->stRegisters.PORTD.PORT2;
     ucLastINT1 = stCPU.pstRAM->stRegisters.PORTD.PORT3;
     ucLastINT2 = stCPU.pstRAM->stRegisters.PORTB.PORT2;
+    bSampled = true;
 }
 
 //---------------------------------------------------------------------------
 static void EINT_AckInt(  uint8_t ucVector_)
 {
     DEBUG_PRINT("EINT ACK INT\n");
+    bSampled = false;
     // We automatically clear the INTx flag as soon as the interrupt
     // is acknowledged.
     if (ucVector_ == stCPU.pstVectorMap->INT0)
@@ -359,6 +425,37 @@ static void EINT_AckInt(  uint8_t ucVector_)
     }
 }
 
+//---------------------------------------------------------------------------
+// Private state kept in CPU snapshots
+#define EINT_STATE(x) \
+    x(eINT0Sense) \
+    x(eINT1Sense) \
+    x(eINT2Sense) \
+    x(ucLastINT0) \
+    x(ucLastINT1) \
+    x(ucLastINT2) \
+    x(u64LastTick) \
+    x(bSampled)
+
+typedef struct
+{
+    EINT_STATE(PERIPH_STATE_FIELD)
+} EINT_State_t;
+
+//---------------------------------------------------------------------------
+static void EINT_Save(void *context_, void *pvState_ )
+{
+    EINT_State_t *pstState = (EINT_State_t*)pvState_;
+    EINT_STATE(PERIPH_STATE_SAVE)
+}
+
+//---------------------------------------------------------------------------
+static void EINT_Restore(void *context_, const void *pvState_ )
+{
+    const EINT_State_t *pstState = (const EINT_State_t*)pvState_;
+    EINT_STATE(PERIPH_STATE_RESTORE)
+}
+
 //---------------------------------------------------------------------------
 AVRPeripheral stEINT_a =
 {
@@ -368,7 +465,12 @@ AVRPeripheral stEINT_a =
     EINT_Clock,
     NULL,
     0x69,
-    0x69
+    0x69,
+    EINT_NextEvent,
+    NULL,
+    sizeof(EINT_State_t),
+    EINT_Save,
+    EINT_Restore
 };
 
 //---------------------------------------------------------------------------
@@ -82,16 +82,17 @@ typedef enum
 } CompareOutputMode_t;
 
 //---------------------------------------------------------------------------
-static uint16_t u16DivCycles = 0;
-static uint16_t u16DivRemain = 0;
-static ClockSource_t eClockSource   = CLK_SRC_OFF;
-static WaveformGeneratorMode_t eWGM = WGM_NORMAL;
-static CompareOutputMode_t eCOM1A = COM_NORMAL;
-static CompareOutputMode_t eCOM1B = COM_NORMAL;
+static EMU_INSTANCE uint16_t u16DivCycles = 0;
+static EMU_INSTANCE uint16_t u16DivRemain = 0;
+static EMU_INSTANCE uint64_t u64LastTick  = 0; // Peripheral tick the timer state is current as of
+static EMU_INSTANCE ClockSource_t eClockSource   = CLK_SRC_OFF;
+static EMU_INSTANCE WaveformGeneratorMode_t eWGM = WGM_NORMAL;
+static EMU_INSTANCE CompareOutputMode_t eCOM1A = COM_NORMAL;
+static EMU_INSTANCE CompareOutputMode_t eCOM1B = COM_NORMAL;
 
 //---------------------------------------------------------------------------
-static uint8_t  u8Temp;  // The 8-bit temporary register used in 16-bit register accesses
-static uint16_t u8Count; // Internal 16-bit count register
+static EMU_INSTANCE uint8_t  u8Temp;  // The 8-bit temporary register used in 16-bit register accesses
+static EMU_INSTANCE uint16_t u8Count; // Internal 16-bit count register
 
 //---------------------------------------------------------------------------
 static void TCNT1_Increment()
@@ -192,7 +193,7 @@ static void IC1_Ack(  uint8_t ucVector_)
 //---------------------------------------------------------------------------
 static void COMP1A_Ack(  uint8_t ucVector_)
 {
-    static uint64_t lastcycles = 0;
+    static EMU_INSTANCE uint64_t lastcycles = 0;
    // printf("COMP1A - Ack'd: %d delta\n", stCPU.u64CycleCount - lastcycles);
     lastcycles = stCPU.u64CycleCount;
 
@@ -210,19 +211,23 @@ static void Timer16_Init(void *context_ )
 {
     DEBUG_PRINT(stderr, "Timer16 Init\n");    
 
+    u16DivCycles = 0;
+    u16DivRemain = 0;
+    u64LastTick  = 0;
+    eClockSource = CLK_SRC_OFF;
+    eWGM   = WGM_NORMAL;
+    eCOM1A = COM_NORMAL;
+    eCOM1B = COM_NORMAL;
+    u8Temp  = 0;
+    u8Count = 0;
+
+
     CPU_RegisterInterruptCallback( OV1_Ack, stCPU.pstVectorMap->TIMER1_OVF);
     CPU_RegisterInterruptCallback( IC1_Ack, stCPU.pstVectorMap->TIMER1_CAPT);
     CPU_RegisterInterruptCallback( COMP1A_Ack, stCPU.pstVectorMap->TIMER1_COMPA);
     CPU_RegisterInterruptCallback( COMP1B_Ack, stCPU.pstVectorMap->TIMER1_COMPB);
 }
 
-//---------------------------------------------------------------------------
-static void Timer16_Read(void *context_, uint8_t ucAddr_, uint8_t *pucValue_ )
-{
-    DEBUG_PRINT(stderr, "Timer16 Read: 0x%02x\n", ucAddr_);
-    *pucValue_ = stCPU.pstRAM->au8RAM[ ucAddr_ ];
-}
-
 //---------------------------------------------------------------------------
 static void TCCR1A_Write( uint8_t ucAddr_, uint8_t ucValue_)
 {
@@ -395,6 +400,123 @@ static void Timer16_IntFlagUpdate(void)
     }
 }
 
+//---------------------------------------------------------------------------
+static uint32_t Timer16_UpdatesToEvent( void )
+{
+    // Number of timer updates until TCNT1 reaches a value that sets a flag
+    // (or clears the count), or 0 if no update ever will.
+    uint16_t u16Count = TCNT1_Read();
+    uint32_t u32Updates;
+    uint32_t u32Match;
+
+    switch (eWGM)
+    {
+    case WGM_NORMAL:
+        return 65536 - u16Count;
+    case WGM_CTC_OCR:
+        u32Updates = 65536 - u16Count;
+        u32Match = (uint16_t)(OCR1A_Read() - u16Count - 1) + 1;
+        if (u32Match < u32Updates)
+        {
+            u32Updates = u32Match;
+        }
+        u32Match = (uint16_t)(ICR1_Read() - u16Count - 1) + 1;
+        if (u32Match < u32Updates)
+        {
+            u32Updates = u32Match;
+        }
+        return u32Updates;
+    default:
+        return 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void Timer16_Sync( uint64_t u64Tick_ )
+{
+    uint64_t u64Ticks = u64Tick_ - u64LastTick;
+    uint64_t u64First;
+    uint64_t u64Updates;
+    uint16_t u16Count;
+
+    u64LastTick = u64Tick_;
+    if (!u16DivCycles || !u64Ticks)
+    {
+        return;
+    }
+
+    // Between events, the clock-divide count runs down...
+    u64First = u16DivRemain ? u16DivRemain : 1;
+    if (u64Ticks < u64First)
+    {
+        u16DivRemain -= (uint16_t)u64Ticks;
+        return;
+    }
+
+    // ... and while the CPU is idle, the timer may also have been updated
+    // any number of times short of the next flag-setting count.
+    u64Ticks -= u64First;
+    u64Updates = 1 + (u64Ticks / u16DivCycles);
+    u16DivRemain = u16DivCycles - (uint16_t)(u64Ticks % u16DivCycles);
+
+    switch (eWGM)
+    {
+    case WGM_NORMAL:
+    case WGM_CTC_OCR:
+        u16Count = TCNT1_Read() + (uint16_t)u64Updates;
+        stCPU.pstRAM->stRegisters.TCNT1L = (u16Count & 0x00FF);
+        stCPU.pstRAM->stRegisters.TCNT1H = (u16Count >> 8);
+        break;
+    default:
+        break;
+    }
+}
+
+//---------------------------------------------------------------------------
+static uint64_t Timer16_UpdateTick( uint32_t u32Updates_ )
+{
+    // Tick on which the given number of timer updates will have run, counting
+    // from the current state - the first is when the clock-divide count expires.
+    return u64LastTick + (u16DivRemain ? u16DivRemain : 1) +
+           ((uint64_t)(u32Updates_ - 1) * u16DivCycles);
+}
+
+//---------------------------------------------------------------------------
+static uint64_t Timer16_NextEvent(void *context_ )
+{
+    uint32_t u32Updates;
+
+    Timer16_Sync( stCPU.u64IOTicks );
+    if (!u16DivCycles)
+    {
+        return PERIPH_NO_EVENT;
+    }
+
+    // Next timer update is when the clock-divide count expires.  While the
+    // CPU is idle (or TCNT1 is brought up to date on reads), it can't be
+    // observed, so skip ahead to the update that next sets a flag.
+    u32Updates = 1;
+    if (IO_CanLookAhead())
+    {
+        u32Updates = Timer16_UpdatesToEvent();
+        if (!u32Updates)
+        {
+            return PERIPH_NO_EVENT;
+        }
+    }
+    return Timer16_UpdateTick( u32Updates );
+}
+
+//---------------------------------------------------------------------------
+static void Timer16_Read(void *context_, uint8_t ucAddr_, uint8_t *pucValue_ )
+{
+    DEBUG_PRINT(stderr, "Timer16 Read: 0x%02x\n", ucAddr_);
+
+    // TCNT1 may have fallen behind, if the timer is looking ahead
+    Timer16_Sync( stCPU.u64IOTicks );
+    *pucValue_ = stCPU.pstRAM->au8RAM[ ucAddr_ ];
+}
+
 //---------------------------------------------------------------------------
 // TIFR & TMSK
 static void Timer16b_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
@@ -406,6 +528,9 @@ static void Timer16b_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 //---------------------------------------------------------------------------
 static void Timer16_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 {
+    // Bring the prescaler up to date before the clock source can change
+    Timer16_Sync( stCPU.u64IOTicks );
+
     switch (ucAddr_)
     {
     case 0x80:  //TCCR1A
@@ -449,8 +574,12 @@ static void Timer16_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 }
 
 //---------------------------------------------------------------------------
-static void Timer16_Clock(void *context_ )
+static void Timer16_Tick( uint64_t u64Tick_ )
 {
+    // Catch up on the ticks skipped since the last event, then run this one
+    Timer16_Sync( u64Tick_ - 1 );
+    u64LastTick = u64Tick_;
+
     if (eClockSource == CLK_SRC_OFF)
     {        
         return;
@@ -580,6 +709,71 @@ static void Timer16_Clock(void *context_ )
     }
 }
 
+//---------------------------------------------------------------------------
+static void Timer16_Clock(void *context_ )
+{
+    Timer16_Tick( stCPU.u64IOTicks );
+}
+
+//---------------------------------------------------------------------------
+static void Timer16_Advance(void *context_, uint64_t u64Ticks_ )
+{
+    uint64_t u64Now = stCPU.u64IOTicks;
+    uint64_t u64Update;
+    uint32_t u32Updates;
+
+    // Only the updates which set a flag (or clear the count) need running one
+    // at a time - the ones in between are counted in closed form by the sync.
+    Timer16_Sync( u64Now - u64Ticks_ );
+    while (u16DivCycles)
+    {
+        u32Updates = Timer16_UpdatesToEvent();
+        if (!u32Updates)
+        {
+            break;
+        }
+        u64Update = Timer16_UpdateTick( u32Updates );
+        if (u64Update > u64Now)
+        {
+            break;
+        }
+        Timer16_Tick( u64Update );
+    }
+    Timer16_Sync( u64Now );
+}
+
+//---------------------------------------------------------------------------
+// Private state kept in CPU snapshots
+#define TIMER16_STATE(x) \
+    x(u16DivCycles) \
+    x(u16DivRemain) \
+    x(u64LastTick) \
+    x(eClockSource) \
+    x(eWGM) \
+    x(eCOM1A) \
+    x(eCOM1B) \
+    x(u8Temp) \
+    x(u8Count)
+
+typedef struct
+{
+    TIMER16_STATE(PERIPH_STATE_FIELD)
+} Timer16_State_t;
+
+//---------------------------------------------------------------------------
+static void Timer16_Save(void *context_, void *pvState_ )
+{
+    Timer16_State_t *pstState = (Timer16_State_t*)pvState_;
+    TIMER16_STATE(PERIPH_STATE_SAVE)
+}
+
+//---------------------------------------------------------------------------
+static void Timer16_Restore(void *context_, const void *pvState_ )
+{
+    const Timer16_State_t *pstState = (const Timer16_State_t*)pvState_;
+    TIMER16_STATE(PERIPH_STATE_RESTORE)
+}
+
 //---------------------------------------------------------------------------
 AVRPeripheral stTimer16 =
 {
@@ -589,7 +783,12 @@ AVRPeripheral stTimer16 =
     Timer16_Clock,
     0,
     0x80,
-    0x8B
+    0x8B,
+    Timer16_NextEvent,
+    Timer16_Advance,
+    sizeof(Timer16_State_t),
+    Timer16_Save,
+    Timer16_Restore
 };
 
 //---------------------------------------------------------------------------
@@ -74,16 +74,17 @@ typedef enum
 } CompareOutputMode_t;
 
 //---------------------------------------------------------------------------
-static uint16_t u16DivCycles = 0;
-static uint16_t u16DivRemain = 0;
-static ClockSource_t eClockSource   = CLK_SRC_OFF;
-static WaveformGeneratorMode_t eWGM = WGM_NORMAL;
-static CompareOutputMode_t eCOM1A = COM_NORMAL;
-static CompareOutputMode_t eCOM1B = COM_NORMAL;
+static EMU_INSTANCE uint16_t u16DivCycles = 0;
+static EMU_INSTANCE uint16_t u16DivRemain = 0;
+static EMU_INSTANCE uint64_t u64LastTick  = 0; // Peripheral tick the timer state is current as of
+static EMU_INSTANCE ClockSource_t eClockSource   = CLK_SRC_OFF;
+static EMU_INSTANCE WaveformGeneratorMode_t eWGM = WGM_NORMAL;
+static EMU_INSTANCE CompareOutputMode_t eCOM1A = COM_NORMAL;
+static EMU_INSTANCE CompareOutputMode_t eCOM1B = COM_NORMAL;
 
 //---------------------------------------------------------------------------
-static uint8_t  u8Temp;  // The 8-bit temporary register used in 16-bit register accesses
-static uint16_t u8Count; // Internal 16-bit count register
+static EMU_INSTANCE uint8_t  u8Temp;  // The 8-bit temporary register used in 16-bit register accesses
+static EMU_INSTANCE uint16_t u8Count; // Internal 16-bit count register
 
 //---------------------------------------------------------------------------
 static void TCNT0_Increment()
@@ -136,7 +137,7 @@ static bool Timer8_Is_OCIE1B_Enabled()
 //---------------------------------------------------------------------------
 static void OV0_Ack(  uint8_t ucVector_)
 {
-    static uint64_t lastcycles = 0;
+    static EMU_INSTANCE uint64_t lastcycles = 0;
     stCPU.pstRAM->stRegisters.TIFR0.TOV0 = 0;
    // printf("OV0 - Ack'd: %d delta\n", stCPU.u64CycleCount - lastcycles);
     lastcycles = stCPU.u64CycleCount;
@@ -158,18 +159,22 @@ static void COMP0B_Ack(  uint8_t ucVector_)
 static void Timer8_Init(void *context_ )
 {
     DEBUG_PRINT( "Timer8 Init\n");
+
+    u16DivCycles = 0;
+    u16DivRemain = 0;
+    u64LastTick  = 0;
+    eClockSource = CLK_SRC_OFF;
+    eWGM   = WGM_NORMAL;
+    eCOM1A = COM_NORMAL;
+    eCOM1B = COM_NORMAL;
+    u8Temp  = 0;
+    u8Count = 0;
+
     CPU_RegisterInterruptCallback( OV0_Ack, stCPU.pstVectorMap->TIMER0_OVF);
     CPU_RegisterInterruptCallback( COMP0A_Ack, stCPU.pstVectorMap->TIMER0_COMPA);
     CPU_RegisterInterruptCallback( COMP0B_Ack, stCPU.pstVectorMap->TIMER0_COMPB);
 }
 
-//---------------------------------------------------------------------------
-static void Timer8_Read(void *context_, uint8_t ucAddr_, uint8_t *pucValue_ )
-{
-    DEBUG_PRINT( "Timer8 Read: 0x%02x\n", ucAddr_);
-    *pucValue_ = stCPU.pstRAM->au8RAM[ ucAddr_ ];
-}
-
 //---------------------------------------------------------------------------
 static void TCCR0A_Write( uint8_t ucAddr_, uint8_t ucValue_)
 {
@@ -282,6 +287,114 @@ static void Timer8_IntFlagUpdate(void)
     }
 }
 
+//---------------------------------------------------------------------------
+static uint32_t Timer8_UpdatesToEvent( void )
+{
+    // Number of timer updates until TCNT0 reaches a value that sets a flag
+    // (or clears the count), or 0 if no update ever will.
+    uint8_t u8Count = TCNT0_Read();
+    uint32_t u32Ovf;
+    uint32_t u32Match;
+
+    switch (eWGM)
+    {
+    case WGM_NORMAL:
+        return 256 - u8Count;
+    case WGM_CTC_OCR:
+        u32Ovf = 256 - u8Count;
+        u32Match = (uint8_t)(OCR0A_Read() - u8Count - 1) + 1;
+        return (u32Match < u32Ovf) ? u32Match : u32Ovf;
+    case WGM_FAST_PWM_FF:
+        return (uint8_t)(0xFE - u8Count) + 1;
+    default:
+        return 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void Timer8_Sync( uint64_t u64Tick_ )
+{
+    uint64_t u64Ticks = u64Tick_ - u64LastTick;
+    uint64_t u64First;
+    uint64_t u64Updates;
+
+    u64LastTick = u64Tick_;
+    if (!u16DivCycles || !u64Ticks)
+    {
+        return;
+    }
+
+    // Between events, the clock-divide count runs down...
+    u64First = u16DivRemain ? u16DivRemain : 1;
+    if (u64Ticks < u64First)
+    {
+        u16DivRemain -= (uint16_t)u64Ticks;
+        return;
+    }
+
+    // ... and while the CPU is idle, the timer may also have been updated
+    // any number of times short of the next flag-setting count.
+    u64Ticks -= u64First;
+    u64Updates = 1 + (u64Ticks / u16DivCycles);
+    u16DivRemain = u16DivCycles - (uint16_t)(u64Ticks % u16DivCycles);
+
+    switch (eWGM)
+    {
+    case WGM_NORMAL:
+    case WGM_CTC_OCR:
+    case WGM_FAST_PWM_FF:
+        stCPU.pstRAM->stRegisters.TCNT0 += (uint8_t)u64Updates;
+        break;
+    default:
+        break;
+    }
+}
+
+//---------------------------------------------------------------------------
+static uint64_t Timer8_UpdateTick( uint32_t u32Updates_ )
+{
+    // Tick on which the given number of timer updates will have run, counting
+    // from the current state - the first is when the clock-divide count expires.
+    return u64LastTick + (u16DivRemain ? u16DivRemain : 1) +
+           ((uint64_t)(u32Updates_ - 1) * u16DivCycles);
+}
+
+//---------------------------------------------------------------------------
+static uint64_t Timer8_NextEvent(void *context_ )
+{
+    uint32_t u32Updates;
+
+    Timer8_Sync( stCPU.u64IOTicks );
+    if (!u16DivCycles)
+    {
+        return PERIPH_NO_EVENT;
+    }
+
+    // Next timer update is when the clock-divide count expires.  While the
+    // CPU is idle (or TCNT0 is brought up to date on reads), it can't be
+    // observed, so skip ahead to the update that next sets a flag.
+    u32Updates = 1;
+    if (IO_CanLookAhead())
+    {
+        u32Updates = Timer8_UpdatesToEvent();
+        if (!u32Updates)
+        {
+            return PERIPH_NO_EVENT;
+        }
+    }
+    return Timer8_UpdateTick( u32Updates );
+}
+
+//---------------------------------------------------------------------------
+static void Timer8_Read(void *context_, uint8_t ucAddr_, uint8_t *pucValue_ )
+{
+    DEBUG_PRINT( "Timer8 Read: 0x%02x\n", ucAddr_);
+
+    // TCNT0 may have fallen behind, if the timer is looking ahead
+    Timer8_Sync( stCPU.u64IOTicks );
+    *pucValue_ = stCPU.pstRAM->au8RAM[ ucAddr_ ];
+}
+
 //--------------------------------------------------------------------------
 static void Timer8b_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 {
@@ -293,6 +406,9 @@ static void Timer8b_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 static void Timer8_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 {
     DEBUG_PRINT("Timer8_Write: %d=%d\n", ucAddr_, ucValue_);
+
+    // Bring the prescaler up to date before the clock source can change
+    Timer8_Sync( stCPU.u64IOTicks );
     switch (ucAddr_)
     {
     case 0x44:  //TCCR1A
@@ -316,8 +432,12 @@ static void Timer8_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 }
 
 //---------------------------------------------------------------------------
-static void Timer8_Clock(void *context_ )
+static void Timer8_Tick( uint64_t u64Tick_ )
 {
+    // Catch up on the ticks skipped since the last event, then run this one
+    Timer8_Sync( u64Tick_ - 1 );
+    u64LastTick = u64Tick_;
+
     if (eClockSource == CLK_SRC_OFF)
     {        
         return;
@@ -438,6 +558,71 @@ static void Timer8_Clock(void *context_ )
     }
 }
 
+//---------------------------------------------------------------------------
+static void Timer8_Clock(void *context_ )
+{
+    Timer8_Tick( stCPU.u64IOTicks );
+}
+
+//---------------------------------------------------------------------------
+static void Timer8_Advance(void *context_, uint64_t u64Ticks_ )
+{
+    uint64_t u64Now = stCPU.u64IOTicks;
+    uint64_t u64Update;
+    uint32_t u32Updates;
+
+    // Only the updates which set a flag (or clear the count) need running one
+    // at a time - the ones in between are counted in closed form by the sync.
+    Timer8_Sync( u64Now - u64Ticks_ );
+    while (u16DivCycles)
+    {
+        u32Updates = Timer8_UpdatesToEvent();
+        if (!u32Updates)
+        {
+            break;
+        }
+        u64Update = Timer8_UpdateTick( u32Updates );
+        if (u64Update > u64Now)
+        {
+            break;
+        }
+        Timer8_Tick( u64Update );
+    }
+    Timer8_Sync( u64Now );
+}
+
+//---------------------------------------------------------------------------
+// Private state kept in CPU snapshots
+#define TIMER8_STATE(x) \
+    x(u16DivCycles) \
+    x(u16DivRemain) \
+    x(u64LastTick) \
+    x(eClockSource) \
+    x(eWGM) \
+    x(eCOM1A) \
+    x(eCOM1B) \
+    x(u8Temp) \
+    x(u8Count)
+
+typedef struct
+{
+    TIMER8_STATE(PERIPH_STATE_FIELD)
+} Timer8_State_t;
+
+//---------------------------------------------------------------------------
+static void Timer8_Save(void *context_, void *pvState_ )
+{
+    Timer8_State_t *pstState = (Timer8_State_t*)pvState_;
+    TIMER8_STATE(PERIPH_STATE_SAVE)
+}
+
+//---------------------------------------------------------------------------
+static void Timer8_Restore(void *context_, const void *pvState_ )
+{
+    const Timer8_State_t *pstState = (const Timer8_State_t*)pvState_;
+    TIMER8_STATE(PERIPH_STATE_RESTORE)
+}
+
 //---------------------------------------------------------------------------
 AVRPeripheral stTimer8 =
 {
@@ -447,7 +632,12 @@ AVRPeripheral stTimer8 =
     Timer8_Clock,
     0,
     0x44,
-    0x48
+    0x48,
+    Timer8_NextEvent,
+    Timer8_Advance,
+    sizeof(Timer8_State_t),
+    Timer8_Save,
+    Timer8_Restore
 };
 
 
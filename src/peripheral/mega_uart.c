@@ -38,7 +38,9 @@
 #include "avr_peripheral.h"
 #include "avr_periphregs.h"
 #include "avr_interrupt.h"
+#include "mega_uart.h"
 #include "options.h"
+#include "replay.h"
 
 #if 1
 #define DEBUG_PRINT(...)
@@ -47,15 +49,16 @@
 #endif
 
 //---------------------------------------------------------------------------
-static bool    use_uart_socket = false;
+static EMU_INSTANCE bool    use_uart_socket = false;
+static EMU_INSTANCE bool    use_uart_replay = false;    // Socket input is replayed from the --replay log
 
 #if _WIN32
 #include <io.h>
 #include <WinSock2.h>
 #include <WS2tcpip.h>
 
-static SOCKET  listener_socket = INVALID_SOCKET;
-static SOCKET  uart_socket     = INVALID_SOCKET;
+static EMU_INSTANCE SOCKET  listener_socket = INVALID_SOCKET;
+static EMU_INSTANCE SOCKET  uart_socket     = INVALID_SOCKET;
 
 #pragma comment(lib, "Ws2_32.lib")
 static WSADATA ws;
@@ -167,8 +170,8 @@ static void UART_BeginServer(void)
 #include <sys/socket.h>
 #include <netinet/in.h>
 
-static int  listener_socket = 0;
-static int  uart_socket     = 0;
+static EMU_INSTANCE int  listener_socket = 0;
+static EMU_INSTANCE int  uart_socket     = 0;
 
 //---------------------------------------------------------------------------
 static void UART_BeginServer(void)
@@ -225,22 +228,32 @@ static void UART_BeginServer(void)
 
 #endif
 //---------------------------------------------------------------------------
-static bool bUDR_Empty = true;
-static bool bTSR_Empty = true;
+static EMU_INSTANCE bool bUDR_Empty = true;
+static EMU_INSTANCE bool bTSR_Empty = true;
 
-static uint8_t RXB = 0; // receive buffer
-static uint8_t TXB = 0; // transmit buffer
-static uint8_t TSR = 0; // transmit shift register.
-static uint8_t RSR = 0; // receive shift register.
+#define UART_POLL_TICKS     (200)    // Ticks between polls of the UART socket
 
-static uint32_t u32BaudTicks = 0;
-static uint32_t u32TxTicksRemaining = 0;
-static uint32_t u32RxTicksRemaining = 0;
+static EMU_INSTANCE uint8_t RXB = 0; // receive buffer
+static EMU_INSTANCE uint8_t TXB = 0; // transmit buffer
+static EMU_INSTANCE uint8_t TSR = 0; // transmit shift register.
+static EMU_INSTANCE uint8_t RSR = 0; // receive shift register.
+
+static EMU_INSTANCE uint32_t u32BaudTicks = 0;
+static EMU_INSTANCE uint32_t u32TxTicksRemaining = 0;
+static EMU_INSTANCE uint32_t u32RxTicksRemaining = 0;
+static EMU_INSTANCE uint32_t u32RxPollTicks = 0;     // Ticks since the UART socket was last polled
+static EMU_INSTANCE uint64_t u64LastTick = 0;        // Peripheral tick the counters are current as of
+
+static EMU_INSTANCE const uint8_t *pu8RxInput = NULL;   // Input supplied by UART_SetInput()
+static EMU_INSTANCE uint32_t u32RxInputLeft = 0;        // ... and the number of bytes yet to be received
+static EMU_INSTANCE UART_TxCallout pfTxCallout = NULL;  // Replaces the TX echo (see UART_SetTxCallout())
 
 //---------------------------------------------------------------------------
 static void Echo_Tx()
 {
-    if (use_uart_socket) {
+    if (pfTxCallout) {
+        pfTxCallout(TSR);
+    } else if (use_uart_socket) {
         if (send(uart_socket, &TSR, 1, 0) <= 0) {
             exit(-1);
         }
@@ -347,6 +360,63 @@ static void UART_RxComplete( void )
     stCPU.pstRAM->stRegisters.UCSR0A.RXC0 = 1;
 }
 
+//---------------------------------------------------------------------------
+static bool UART_IsTxActive( void )
+{
+    return (UART_IsTxEnabled() && u32TxTicksRemaining);
+}
+
+//---------------------------------------------------------------------------
+static bool UART_IsRxPolling( void )
+{
+    return (UART_IsRxEnabled() && !u32RxTicksRemaining && (use_uart_socket || use_uart_replay || u32RxInputLeft));
+}
+
+//---------------------------------------------------------------------------
+static void UART_Sync( uint64_t u64Tick_ )
+{
+    // Between events, only the baud and polling counters move
+    uint32_t u32Ticks = (uint32_t)(u64Tick_ - u64LastTick);
+    if (UART_IsTxActive())
+    {
+        u32TxTicksRemaining -= u32Ticks;
+    }
+    if (UART_IsRxEnabled() && u32RxTicksRemaining)
+    {
+        u32RxTicksRemaining -= u32Ticks;
+    }
+    else if (UART_IsRxPolling())
+    {
+        u32RxPollTicks += u32Ticks;
+    }
+    u64LastTick = u64Tick_;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t UART_NextEvent(void *context_ )
+{
+    uint64_t u64Next = PERIPH_NO_EVENT;
+    uint64_t u64Rx = PERIPH_NO_EVENT;
+
+    if (UART_IsTxActive())
+    {
+        u64Next = u64LastTick + u32TxTicksRemaining;
+    }
+    if (UART_IsRxEnabled() && u32RxTicksRemaining)
+    {
+        u64Rx = u64LastTick + u32RxTicksRemaining;
+    }
+    else if (UART_IsRxPolling())
+    {
+        u64Rx = u64LastTick + (UART_POLL_TICKS - u32RxPollTicks);
+    }
+    if (u64Rx < u64Next)
+    {
+        u64Next = u64Rx;
+    }
+    return u64Next;
+}
+
 //---------------------------------------------------------------------------
 static void TXC0_Callback(  uint8_t ucVector_ )
 {
@@ -360,9 +430,32 @@ static void UART_Init(void *context_ )
     DEBUG_PRINT("UART Init\n");
     stCPU.pstRAM->stRegisters.UCSR0A.UDRE0 = 1;
 
+    bUDR_Empty = true;
+    bTSR_Empty = true;
+    RXB = 0;
+    TXB = 0;
+    TSR = 0;
+    RSR = 0;
+    u32BaudTicks = 0;
+    u32TxTicksRemaining = 0;
+    u32RxTicksRemaining = 0;
+    u32RxPollTicks = 0;
+    u64LastTick = 0;
+    pu8RxInput = NULL;
+    u32RxInputLeft = 0;
+    pfTxCallout = NULL;
+
     CPU_RegisterInterruptCallback(TXC0_Callback, stCPU.pstVectorMap->USART0_TX); // TX Complete
 
-    if (Options_GetByName("--uart")) {
+    // The socket server is kept open for later instances on the same thread
+    if (Options_GetByName("--uart") && !use_uart_socket && !use_uart_replay) {
+#if FEATURE_USE_REPLAY
+        // Replay the socket's input without opening it - output goes to stdout
+        if (Replay_IsPlaying()) {
+            use_uart_replay = true;
+            return;
+        }
+#endif
         use_uart_socket = true;
         UART_BeginServer();
     }
@@ -520,6 +613,10 @@ static void UART_Write(void *context_, uint8_t ucAddr_, uint8_t ucValue_ )
 {    
     DEBUG_PRINT("UART Write: %2X=%2X\n", ucAddr_, ucValue_ );
     DEBUG_PRINT("ADDR=%08X\n", stCPU.u32PC);
+
+    // Bring the baud counters up to date before enables/data can change
+    UART_Sync( stCPU.u64IOTicks );
+
     switch (ucAddr_)
     {
     case 0xC0:  //UCSR0A
@@ -622,13 +719,30 @@ static void UART_RxClock(void *context_ )
                 }
             }
         } else {
-            if (use_uart_socket) {
-                static int interval = 0;
-                interval++;
-                if (interval == 200) { // poll for input every X cycles
-                    interval = 0;
+            if (use_uart_socket || use_uart_replay || u32RxInputLeft) {
+                u32RxPollTicks++;
+                if (u32RxPollTicks == UART_POLL_TICKS) { // poll for input every X cycles
+                    u32RxPollTicks = 0;
                     uint8_t rx_byte;
-                    int bytes_read = recv(uart_socket, &rx_byte, 1, 0);
+                    int bytes_read;
+                    if (u32RxInputLeft) {
+                        rx_byte = *pu8RxInput++;
+                        u32RxInputLeft--;
+                        bytes_read = 1;
+#if FEATURE_USE_REPLAY
+                    } else if (use_uart_replay) {
+                        // Stamped with the poll's peripheral tick, which is
+                        // the same however the UART was clocked up to it
+                        bytes_read = Replay_Play(REPLAY_UART_RX, u64LastTick, &rx_byte, 1);
+#endif
+                    } else {
+                        bytes_read = recv(uart_socket, &rx_byte, 1, 0);
+#if FEATURE_USE_REPLAY
+                        if (bytes_read == 1) {
+                            Replay_Record(REPLAY_UART_RX, u64LastTick, &rx_byte, 1);
+                        }
+#endif
+                    }
                     if (bytes_read == 1) {
                         RSR = rx_byte;
                         u32RxTicksRemaining = u32BaudTicks;
@@ -639,13 +753,91 @@ static void UART_RxClock(void *context_ )
     }
 }
 //---------------------------------------------------------------------------
-static void UART_Clock(void *context_ )
-{    
+static void UART_Tick(void *context_, uint64_t u64Tick_ )
+{
+    // Catch up on the ticks skipped since the last event, then run this one
+    UART_Sync( u64Tick_ - 1 );
+    u64LastTick = u64Tick_;
+
     // Handle Rx and TX clocks.
     UART_TxClock(context_);
     UART_RxClock(context_);
 }
 
+//---------------------------------------------------------------------------
+static void UART_Clock(void *context_ )
+{    
+    UART_Tick( context_, stCPU.u64IOTicks );
+}
+
+//---------------------------------------------------------------------------
+static void UART_Advance(void *context_, uint64_t u64Ticks_ )
+{
+    uint64_t u64Now = stCPU.u64IOTicks;
+    uint64_t u64Event;
+
+    // The baud counters only do anything on the tick they expire - run the
+    // clock on each of those, and count down the rest in closed form.
+    UART_Sync( u64Now - u64Ticks_ );
+    u64Event = UART_NextEvent( context_ );
+    while (u64Event <= u64Now)
+    {
+        UART_Tick( context_, u64Event );
+        u64Event = UART_NextEvent( context_ );
+    }
+    UART_Sync( u64Now );
+}
+
+//---------------------------------------------------------------------------
+void UART_SetInput( const uint8_t *pu8Data_, uint32_t u32Size_ )
+{
+    UART_Sync( stCPU.u64IOTicks );
+    pu8RxInput = pu8Data_;
+    u32RxInputLeft = u32Size_;
+    IO_Reschedule( &stUART );
+}
+
+//---------------------------------------------------------------------------
+void UART_SetTxCallout( UART_TxCallout pfCallout_ )
+{
+    pfTxCallout = pfCallout_;
+}
+
+//---------------------------------------------------------------------------
+// Private state kept in CPU snapshots.  Input from UART_SetInput() belongs to
+// the host rather than the machine, so it's left as it is on restore.
+#define UART_STATE(x) \
+    x(bUDR_Empty) \
+    x(bTSR_Empty) \
+    x(RXB) \
+    x(TXB) \
+    x(TSR) \
+    x(RSR) \
+    x(u32BaudTicks) \
+    x(u32TxTicksRemaining) \
+    x(u32RxTicksRemaining) \
+    x(u32RxPollTicks) \
+    x(u64LastTick)
+
+typedef struct
+{
+    UART_STATE(PERIPH_STATE_FIELD)
+} UART_State_t;
+
+//---------------------------------------------------------------------------
+static void UART_Save(void *context_, void *pvState_ )
+{
+    UART_State_t *pstState = (UART_State_t*)pvState_;
+    UART_STATE(PERIPH_STATE_SAVE)
+}
+
+//---------------------------------------------------------------------------
+static void UART_Restore(void *context_, const void *pvState_ )
+{
+    const UART_State_t *pstState = (const UART_State_t*)pvState_;
+    UART_STATE(PERIPH_STATE_RESTORE)
+}
+
 //---------------------------------------------------------------------------
 AVRPeripheral stUART =
 {
@@ -655,5 +847,10 @@ AVRPeripheral stUART =
     UART_Clock,
     0,
     0xC0,
-    0xC6
+    0xC6,
+    UART_NextEvent,
+    UART_Advance,
+    sizeof(UART_State_t),
+    UART_Save,
+    UART_Restore
 };
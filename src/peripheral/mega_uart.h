@@ -25,4 +25,37 @@
 
 extern AVRPeripheral stUART;
 
+//---------------------------------------------------------------------------
+/*!
+    Function called with each byte shifted out of the UART, in place of
+    echoing it to the terminal (see UART_SetTxCallout())
+*/
+typedef void (*UART_TxCallout)( uint8_t u8Byte_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief UART_SetInput
+ *
+ * Supply a buffer of bytes to be received by the UART, in place of the UART
+ * socket.  Bytes are received at the same rate they would be polled from the
+ * socket.  The buffer must remain valid until it has been consumed, or the
+ * UART is re-initialized (which discards any remaining input).  Must be
+ * called after the UART has been added to the CPU.
+ *
+ * \param pu8Data_  Bytes to receive
+ * \param u32Size_  Number of bytes in the buffer
+ */
+void UART_SetInput( const uint8_t *pu8Data_, uint32_t u32Size_ );
+
+//---------------------------------------------------------------------------
+/*!
+ * \brief UART_SetTxCallout
+ *
+ * Install a function to be called with each byte transmitted by the UART, in
+ * place of the terminal/socket echo.  Cleared when the UART is initialized.
+ *
+ * \param pfCallout_ Function to call, or NULL to restore the default echo
+ */
+void UART_SetTxCallout( UART_TxCallout pfCallout_ );
+
 #endif //__MEGA_UART_H__